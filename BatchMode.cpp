@@ -0,0 +1,305 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "BatchMode.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+
+#include "PresentMonTraceConsumer.hpp"
+#include "TraceSession.hpp"
+
+namespace {
+
+struct WorkQueue {
+    std::mutex mMutex;
+    std::deque<size_t> mItems;
+};
+
+// Counting semaphore limiting the number of files being processed at once.
+struct InFlightLimit {
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    uint32_t mAvailable = 0;
+
+    void Acquire()
+    {
+        auto lock = scoped_lock(mMutex);
+        mCondition.wait(lock, [this]() { return mAvailable > 0; });
+        mAvailable -= 1;
+    }
+
+    void Release()
+    {
+        {
+            auto lock = scoped_lock(mMutex);
+            mAvailable += 1;
+        }
+        mCondition.notify_one();
+    }
+};
+
+double QpcToSecondsDelta(LARGE_INTEGER const& start, LARGE_INTEGER const& end, LARGE_INTEGER const& frequency)
+{
+    return (double) (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+void ProcessFile(char const* path, BatchFileSummary* summary)
+{
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    summary->mPath = path;
+
+    {
+        PMTraceConsumer pmConsumer(false, false);
+        TraceSession session;
+        summary->mStatus = session.Start(&pmConsumer, nullptr, path, nullptr);
+        if (summary->mStatus == ERROR_SUCCESS) {
+            ProcessTrace(&session.mTraceHandle, 1, NULL, NULL);
+            session.Stop();
+
+            summary->mPresentCount = pmConsumer.mCompletedPresents.size();
+            summary->mScreenTimes.reserve(pmConsumer.mFrames.size());
+            for (auto const& f : pmConsumer.mFrames) {
+                if (f.present && f.present->FinalState != PresentResult::Lost) {
+                    auto screenTime = session.mClock.ToMilliseconds((int64_t) (f.present->ScreenTime - f.StartTime));
+                    if (screenTime > 33.) {
+                        summary->mLateFrameCount += 1;
+                    }
+                    summary->mScreenTimes.push_back((float) screenTime);
+                }
+            }
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+    summary->mProcessSeconds = QpcToSecondsDelta(start, end, frequency);
+}
+
+bool PopWork(std::vector<WorkQueue>* queues, size_t self, size_t* item)
+{
+    // Own queue first, from the front...
+    {
+        auto& q = (*queues)[self];
+        auto lock = scoped_lock(q.mMutex);
+        if (!q.mItems.empty()) {
+            *item = q.mItems.front();
+            q.mItems.pop_front();
+            return true;
+        }
+    }
+
+    // ... then steal from the back of the others.
+    for (size_t i = 1, n = queues->size(); i < n; ++i) {
+        auto& q = (*queues)[(self + i) % n];
+        auto lock = scoped_lock(q.mMutex);
+        if (!q.mItems.empty()) {
+            *item = q.mItems.back();
+            q.mItems.pop_back();
+            return true;
+        }
+    }
+
+    // No work is added once the batch starts, so empty queues mean we're done.
+    return false;
+}
+
+float Percentile(std::vector<float> const& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0.f;
+    }
+    auto index = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void PrintSummaryLine(char const* name, std::vector<float>* screenTimes, uint64_t presentCount, uint64_t lateFrameCount, double seconds)
+{
+    std::sort(screenTimes->begin(), screenTimes->end());
+    printf("%s, %llu, %zu, %llu, %.2f, %.2f, %.2f, %.2f, %.3f\n",
+        name,
+        presentCount,
+        screenTimes->size(),
+        lateFrameCount,
+        Percentile(*screenTimes, 0.50),
+        Percentile(*screenTimes, 0.90),
+        Percentile(*screenTimes, 0.99),
+        screenTimes->empty() ? 0.f : screenTimes->back(),
+        seconds);
+}
+
+}
+
+bool GetBatchFileList(char const* path, std::vector<std::string>* files)
+{
+    auto attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "error: batch path not found: %s\n", path);
+        return false;
+    }
+
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        std::string dir(path);
+        if (!dir.empty() && dir.back() != '\\' && dir.back() != '/') {
+            dir += '\\';
+        }
+
+        WIN32_FIND_DATAA findData = {};
+        auto h = FindFirstFileA((dir + "*.etl").c_str(), &findData);
+        if (h != INVALID_HANDLE_VALUE) {
+            do {
+                if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+                    files->emplace_back(dir + findData.cFileName);
+                }
+            } while (FindNextFileA(h, &findData));
+            FindClose(h);
+        }
+    } else {
+        FILE* fp = nullptr;
+        if (fopen_s(&fp, path, "r") != 0) {
+            fprintf(stderr, "error: failed to open batch list: %s\n", path);
+            return false;
+        }
+        char line[MAX_PATH + 2];
+        while (fgets(line, sizeof(line), fp) != nullptr) {
+            auto len = strcspn(line, "\r\n");
+            line[len] = '\0';
+            if (len > 0) {
+                files->emplace_back(line);
+            }
+        }
+        fclose(fp);
+    }
+
+    if (files->empty()) {
+        fprintf(stderr, "error: no ETL files found in %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+double RunBatch(std::vector<std::string> const& files, BatchOptions const& options, std::vector<BatchFileSummary>* summaries)
+{
+    auto threadCount = options.mThreadCount;
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto maxFilesInFlight = options.mMaxFilesInFlight == 0 ? threadCount : options.mMaxFilesInFlight;
+
+    summaries->clear();
+    summaries->resize(files.size());
+
+    // Deal the files out round-robin.
+    std::vector<WorkQueue> queues(threadCount);
+    for (size_t i = 0, n = files.size(); i < n; ++i) {
+        queues[i % threadCount].mItems.push_back(i);
+    }
+
+    InFlightLimit inFlight;
+    inFlight.mAvailable = maxFilesInFlight;
+
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (uint32_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            size_t item = 0;
+            while (PopWork(&queues, t, &item)) {
+                inFlight.Acquire();
+                ProcessFile(files[item].c_str(), &(*summaries)[item]);
+                inFlight.Release();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    QueryPerformanceCounter(&end);
+    return QpcToSecondsDelta(start, end, frequency);
+}
+
+void PrintBatchReport(std::vector<BatchFileSummary> const& summaries, double wallSeconds)
+{
+    printf("File, Presents, Frames, LateFrames, ScreenTimeP50, ScreenTimeP90, ScreenTimeP99, ScreenTimeMax, ProcessSeconds\n");
+
+    std::vector<float> allScreenTimes;
+    std::vector<float> screenTimes;
+    uint64_t presentCount = 0;
+    uint64_t lateFrameCount = 0;
+    double cpuSeconds = 0.;
+    uint32_t failedCount = 0;
+    for (auto const& s : summaries) {
+        if (s.mStatus != ERROR_SUCCESS) {
+            fprintf(stderr, "error: failed to process %s (error=%lu).\n", s.mPath.c_str(), s.mStatus);
+            failedCount += 1;
+            continue;
+        }
+
+        screenTimes = s.mScreenTimes;
+        PrintSummaryLine(s.mPath.c_str(), &screenTimes, s.mPresentCount, s.mLateFrameCount, s.mProcessSeconds);
+
+        allScreenTimes.insert(allScreenTimes.end(), s.mScreenTimes.begin(), s.mScreenTimes.end());
+        presentCount += s.mPresentCount;
+        lateFrameCount += s.mLateFrameCount;
+        cpuSeconds += s.mProcessSeconds;
+    }
+
+    PrintSummaryLine("(all)", &allScreenTimes, presentCount, lateFrameCount, cpuSeconds);
+    printf("files: %zu (%u failed), wall time: %.3f s\n", summaries.size(), failedCount, wallSeconds);
+}
+
+void PrintBatchScaling(std::vector<std::string> const& files, uint32_t maxFilesInFlight)
+{
+    printf("Threads, WallSeconds, Speedup\n");
+
+    std::vector<BatchFileSummary> summaries;
+    double baseSeconds = 0.;
+    for (uint32_t threadCount = 1; threadCount <= 32; threadCount *= 2) {
+        BatchOptions options;
+        options.mThreadCount = threadCount;
+        options.mMaxFilesInFlight = maxFilesInFlight == 0 ? threadCount : std::min(threadCount, maxFilesInFlight);
+
+        auto seconds = RunBatch(files, options, &summaries);
+        if (threadCount == 1) {
+            baseSeconds = seconds;
+        }
+        printf("%u, %.3f, %.2f\n", threadCount, seconds, seconds == 0. ? 0. : baseSeconds / seconds);
+    }
+}
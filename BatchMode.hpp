@@ -0,0 +1,67 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Batch mode processes many ETL files in parallel, each with its own
+// TraceSession and PMTraceConsumer, and merges the per-file results into a
+// single report.
+//
+// Files are distributed across per-thread work queues; a thread that runs out
+// of work steals from the back of another thread's queue, so a few very long
+// captures don't leave the other threads idle.  At most mMaxFilesInFlight
+// files are processed at once, which bounds peak memory independently of the
+// number of threads.
+
+struct BatchFileSummary {
+    std::string mPath;
+    unsigned long mStatus = 0;      // ERROR_SUCCESS or the TraceSession::Start() error
+    double mProcessSeconds = 0.;
+    uint64_t mPresentCount = 0;
+    uint64_t mLateFrameCount = 0;
+    std::vector<float> mScreenTimes; // ms from frame start to screen, per frame
+};
+
+struct BatchOptions {
+    uint32_t mThreadCount = 0;      // 0 = one per logical processor
+    uint32_t mMaxFilesInFlight = 0; // 0 = same as thread count
+};
+
+// Expand path into a list of ETL files: a directory is searched for *.etl
+// files, anything else is read as a text file with one path per line.
+bool GetBatchFileList(char const* path, std::vector<std::string>* files);
+
+// Process all files and return one summary per file (in the same order as
+// files).  Returns the wall time taken in seconds.
+double RunBatch(std::vector<std::string> const& files, BatchOptions const& options, std::vector<BatchFileSummary>* summaries);
+
+// Print the per-file and aggregate report.
+void PrintBatchReport(std::vector<BatchFileSummary> const& summaries, double wallSeconds);
+
+// Run the batch with 1, 2, 4, ..., 32 threads and print the wall-time speedup
+// relative to a single thread.
+void PrintBatchScaling(std::vector<std::string> const& files, uint32_t maxFilesInFlight);
@@ -0,0 +1,138 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+
+#include "BufferController.hpp"
+#include "TraceSession.hpp"
+
+namespace {
+
+ULONG const MAX_BUFFER_SIZE_KB = 1024;
+
+}
+
+void BufferController::Initialize(TraceSession* session, uint32_t memoryCapKB)
+{
+    mSession = session;
+    mMemoryCapKB = memoryCapKB;
+    mLastEventsLost = 0;
+    mLastBuffersLost = 0;
+    mInitialMaximumBuffers = 0;
+    mPollsWithoutLoss = 0;
+    mCapReported = false;
+}
+
+void BufferController::OnRestart()
+{
+    mLastEventsLost = 0;
+    mLastBuffersLost = 0;
+    mPollsWithoutLoss = 0;
+}
+
+BufferController::Action BufferController::Poll()
+{
+    ULONG eventsLost = 0;
+    ULONG buffersLost = 0;
+    if (mSession->CheckLostReports(&eventsLost, &buffersLost) != ERROR_SUCCESS) {
+        return Action::None;
+    }
+
+    ULONG bufferSizeKB = 0;
+    ULONG minimumBuffers = 0;
+    ULONG maximumBuffers = 0;
+    ULONG numberOfBuffers = 0;
+    ULONG freeBuffers = 0;
+    if (mSession->QueryBuffers(&bufferSizeKB, &minimumBuffers, &maximumBuffers, &numberOfBuffers, &freeBuffers) != ERROR_SUCCESS) {
+        return Action::None;
+    }
+    if (mInitialMaximumBuffers == 0) {
+        mInitialMaximumBuffers = maximumBuffers;
+    }
+
+    auto newEventsLost = eventsLost - mLastEventsLost;
+    auto newBuffersLost = buffersLost - mLastBuffersLost;
+    mLastEventsLost = eventsLost;
+    mLastBuffersLost = buffersLost;
+
+    if (newEventsLost == 0 && newBuffersLost == 0) {
+        // Shrink back towards the initial pool size after a long period
+        // without loss, if the session allows it to be done in place.
+        mPollsWithoutLoss += 1;
+        if (mPollsWithoutLoss >= SHRINK_AFTER_POLLS && maximumBuffers > mInitialMaximumBuffers) {
+            mPollsWithoutLoss = 0;
+            auto newMaximumBuffers = maximumBuffers / 2;
+            if (newMaximumBuffers < mInitialMaximumBuffers) newMaximumBuffers = mInitialMaximumBuffers;
+            if (newMaximumBuffers < minimumBuffers) newMaximumBuffers = minimumBuffers;
+            if (newMaximumBuffers < maximumBuffers) {
+                mSession->mMaximumBuffers = newMaximumBuffers;
+                if (mSession->UpdateBuffers() == ERROR_SUCCESS) {
+                    fprintf(stderr, "buffers: no loss, MaximumBuffers %lu -> %lu (%lu KB buffers)\n",
+                        maximumBuffers, newMaximumBuffers, bufferSizeKB);
+                    mCapReported = false;
+                    return Action::Updated;
+                }
+                mSession->mMaximumBuffers = maximumBuffers;
+            }
+        }
+        return Action::None;
+    }
+
+    mPollsWithoutLoss = 0;
+
+    // First choice: more buffers, which can be changed without a restart.
+    if ((uint64_t) bufferSizeKB * maximumBuffers * 2 <= mMemoryCapKB) {
+        mSession->mMaximumBuffers = maximumBuffers * 2;
+        if (mSession->UpdateBuffers() == ERROR_SUCCESS) {
+            fprintf(stderr, "buffers: lost %lu events/%lu buffers, MaximumBuffers %lu -> %lu (%lu KB buffers)\n",
+                newEventsLost, newBuffersLost, maximumBuffers, mSession->mMaximumBuffers, bufferSizeKB);
+            return Action::Updated;
+        }
+
+        // The update was refused; apply it with a restart instead.
+        mSession->mBufferSizeKB = bufferSizeKB;
+        mSession->mMinimumBuffers = minimumBuffers;
+        fprintf(stderr, "buffers: lost %lu events/%lu buffers, restarting with MaximumBuffers %lu -> %lu (%lu KB buffers)\n",
+            newEventsLost, newBuffersLost, maximumBuffers, mSession->mMaximumBuffers, bufferSizeKB);
+        return Action::RestartRequired;
+    }
+
+    // Second choice: larger buffers, which requires a restart.
+    if (bufferSizeKB < MAX_BUFFER_SIZE_KB && (uint64_t) bufferSizeKB * 2 * maximumBuffers <= mMemoryCapKB) {
+        mSession->mBufferSizeKB = bufferSizeKB * 2;
+        mSession->mMinimumBuffers = minimumBuffers;
+        mSession->mMaximumBuffers = maximumBuffers;
+        fprintf(stderr, "buffers: lost %lu events/%lu buffers, restarting with BufferSize %lu -> %lu KB (%lu buffers max)\n",
+            newEventsLost, newBuffersLost, bufferSizeKB, mSession->mBufferSizeKB, maximumBuffers);
+        return Action::RestartRequired;
+    }
+
+    if (!mCapReported) {
+        mCapReported = true;
+        fprintf(stderr, "buffers: lost %lu events/%lu buffers, but the %lu KB x %lu buffer pool is at the %u KB cap\n",
+            newEventsLost, newBuffersLost, bufferSizeKB, maximumBuffers, mMemoryCapKB);
+    }
+    return Action::None;
+}
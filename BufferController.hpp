@@ -0,0 +1,68 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+
+struct TraceSession;
+
+// BufferController adapts a realtime session's ETW buffer pool to the load.
+// Poll() is called periodically and checks TraceSession::CheckLostReports():
+//
+//   - If events or buffers were lost since the last poll, the pool is grown:
+//     MaximumBuffers is doubled on the running session if possible; otherwise
+//     (or once MaximumBuffers can't grow within the memory cap) BufferSize is
+//     doubled, which requires restarting the session.
+//
+//   - After a long loss-free period, MaximumBuffers is stepped back down
+//     towards its starting value so that idle sessions don't keep a large
+//     pool.
+//
+// The pool (BufferSize * MaximumBuffers) never exceeds mMemoryCapKB.  Every
+// adjustment is logged to stderr.
+struct BufferController {
+    enum class Action {
+        None,
+        Updated,            // The running session was updated
+        RestartRequired,    // Stop, wait for ProcessTrace() to return, then TraceSession::Restart()
+    };
+
+    static uint32_t const SHRINK_AFTER_POLLS = 300;
+
+    TraceSession* mSession = nullptr;
+    uint32_t mMemoryCapKB = 0;
+
+    ULONG mLastEventsLost = 0;
+    ULONG mLastBuffersLost = 0;
+    ULONG mInitialMaximumBuffers = 0;
+    uint32_t mPollsWithoutLoss = 0;
+    bool mCapReported = false;
+
+    void Initialize(TraceSession* session, uint32_t memoryCapKB);
+    Action Poll();
+
+    // Call after the session was restarted; ETW's lost counts start over.
+    void OnRestart();
+};
@@ -0,0 +1,738 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "Checkpoint.hpp"
+#include "MixedRealityTraceConsumer.hpp"
+#include "PresentMonTraceConsumer.hpp"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace {
+
+char const CHECKPOINT_FILE_MAGIC[4] = { 'P', 'M', 'C', 'K' };
+uint32_t const CHECKPOINT_FILE_VERSION = 3;
+
+// Presents and holographic frames are shared between several maps, so each
+// one is written once to a table and maps refer to it by its table index.
+uint32_t const NULL_ID = UINT32_MAX;
+
+// Upper bound on any element count, so that a corrupt file fails to load
+// instead of trying to allocate an enormous container.
+uint32_t const MAX_COUNT = 1 << 24;
+
+// LateStageReprojectionEvent's timing floats are written as one block.
+static_assert(offsetof(LateStageReprojectionEvent, TimeUntilPhotonsMiddleMs) -
+              offsetof(LateStageReprojectionEvent, ThreadWakeupStartLatchToCpuRenderFrameStartInMs) == 15 * sizeof(float),
+              "unexpected LateStageReprojectionEvent layout");
+size_t const LSR_TIMING_SIZE = 16 * sizeof(float);
+
+struct CheckpointWriter {
+    FILE* mFile = nullptr;
+    bool mOk = true;
+    std::unordered_map<void const*, uint32_t> mIds;
+
+    template<typename T> void Write(T const& value)
+    {
+        mOk = mOk && fwrite(&value, sizeof(T), 1, mFile) == 1;
+    }
+
+    void WriteBytes(void const* data, size_t size)
+    {
+        mOk = mOk && (size == 0 || fwrite(data, size, 1, mFile) == 1);
+    }
+
+    void WriteCount(size_t count)
+    {
+        assert(count <= MAX_COUNT);
+        Write((uint32_t) count);
+    }
+
+    template<typename T> void WriteId(std::shared_ptr<T> const& p)
+    {
+        if (p == nullptr) {
+            Write(NULL_ID);
+            return;
+        }
+
+        auto ii = mIds.find(p.get());
+        assert(ii != mIds.end());
+        Write(ii->second);
+    }
+
+    // Assign the next table index to p, returning false if it already has one.
+    template<typename T> bool AddId(std::shared_ptr<T> const& p, std::vector<T*>* table)
+    {
+        if (p == nullptr || !mIds.emplace(p.get(), (uint32_t) table->size()).second) {
+            return false;
+        }
+        table->push_back(p.get());
+        return true;
+    }
+};
+
+struct CheckpointReader {
+    FILE* mFile = nullptr;
+    bool mOk = true;
+
+    template<typename T> T Read()
+    {
+        T value {};
+        mOk = mOk && fread(&value, sizeof(T), 1, mFile) == 1;
+        return value;
+    }
+
+    void ReadBytes(void* data, size_t size)
+    {
+        mOk = mOk && (size == 0 || fread(data, size, 1, mFile) == 1);
+    }
+
+    uint32_t ReadCount()
+    {
+        auto count = Read<uint32_t>();
+        if (count > MAX_COUNT) {
+            mOk = false;
+        }
+        return mOk ? count : 0;
+    }
+
+    template<typename T> std::shared_ptr<T> ReadId(std::vector<std::shared_ptr<T>> const& table)
+    {
+        auto id = Read<uint32_t>();
+        if (!mOk || id == NULL_ID) {
+            return nullptr;
+        }
+        if (id >= table.size()) {
+            mOk = false;
+            return nullptr;
+        }
+        return table[id];
+    }
+
+    // Like ReadId(), but for references that can't be null.
+    template<typename T> std::shared_ptr<T> ReadRequiredId(std::vector<std::shared_ptr<T>> const& table)
+    {
+        auto p = ReadId(table);
+        if (p == nullptr) {
+            mOk = false;
+        }
+        return p;
+    }
+};
+
+void WriteMetadata(CheckpointWriter* w, EventMetadata const& metadata)
+{
+    w->WriteCount(metadata.metadata_.size());
+    for (auto const& pair : metadata.metadata_) {
+        w->Write(pair.first);
+        w->WriteCount(pair.second.size());
+        w->WriteBytes(pair.second.data(), pair.second.size());
+    }
+}
+
+void ReadMetadata(CheckpointReader* r, EventMetadata* metadata)
+{
+    metadata->metadata_.clear();
+    auto count = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < count; ++i) {
+        auto key = r->Read<EventMetadataKey>();
+        std::vector<uint8_t> data(r->ReadCount());
+        r->ReadBytes(data.data(), data.size());
+        metadata->metadata_.emplace(key, std::move(data));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// PMTraceConsumer state
+
+void AddPresent(CheckpointWriter* w, std::vector<PresentEvent*>* presents, std::shared_ptr<PresentEvent> const& p)
+{
+    if (w->AddId(p, presents)) {
+        for (auto const& dependent : p->DependentPresents) {
+            AddPresent(w, presents, dependent);
+        }
+    }
+}
+
+void WritePresent(CheckpointWriter* w, PresentEvent const& p)
+{
+    w->Write(p.QpcTime);
+    w->Write(p.ProcessId);
+    w->Write(p.ThreadId);
+    w->Write(p.TimeTaken);
+    w->Write(p.ReadyTime);
+    w->Write(p.ScreenTime);
+    w->Write(p.SwapChainAddress);
+    w->Write(p.SyncInterval);
+    w->Write(p.PresentFlags);
+    w->Write(p.Hwnd);
+    w->Write(p.TokenPtr);
+    w->Write(p.QueueSubmitSequence);
+    w->Write(p.Runtime);
+    w->Write(p.PresentMode);
+    w->Write(p.FinalState);
+    w->Write(p.DestWidth);
+    w->Write(p.DestHeight);
+    w->Write(p.CompositionSurfaceLuid);
+    w->Write(p.SupportsTearing);
+    w->Write(p.MMIO);
+    w->Write(p.SeenDxgkPresent);
+    w->Write(p.SeenWin32KEvents);
+    w->Write(p.WasBatched);
+    w->Write(p.DwmNotified);
+    w->Write(p.Completed);
+    w->Write(p.Win32KPresentCount);
+    w->Write(p.Win32KBindId);
+    w->Write(p.DxgContext);
+    w->Write(p.LegacyBlitTokenData);
+    w->Write(p.StageTimes);
+
+    w->WriteCount(p.DependentPresents.size());
+    for (auto const& dependent : p.DependentPresents) {
+        w->WriteId(dependent);
+    }
+}
+
+void ReadPresent(CheckpointReader* r, std::vector<std::shared_ptr<PresentEvent>> const& presents, PresentEvent* p)
+{
+    p->QpcTime                = r->Read<uint64_t>();
+    p->ProcessId              = r->Read<uint32_t>();
+    p->ThreadId               = r->Read<uint32_t>();
+    p->TimeTaken              = r->Read<uint64_t>();
+    p->ReadyTime              = r->Read<uint64_t>();
+    p->ScreenTime             = r->Read<uint64_t>();
+    p->SwapChainAddress       = r->Read<uint64_t>();
+    p->SyncInterval           = r->Read<int32_t>();
+    p->PresentFlags           = r->Read<uint32_t>();
+    p->Hwnd                   = r->Read<uint64_t>();
+    p->TokenPtr               = r->Read<uint64_t>();
+    p->QueueSubmitSequence    = r->Read<uint32_t>();
+    p->Runtime                = r->Read<::Runtime>();
+    p->PresentMode            = r->Read<::PresentMode>();
+    p->FinalState             = r->Read<PresentResult>();
+    p->DestWidth              = r->Read<uint32_t>();
+    p->DestHeight             = r->Read<uint32_t>();
+    p->CompositionSurfaceLuid = r->Read<uint64_t>();
+    p->SupportsTearing        = r->Read<bool>();
+    p->MMIO                   = r->Read<bool>();
+    p->SeenDxgkPresent        = r->Read<bool>();
+    p->SeenWin32KEvents       = r->Read<bool>();
+    p->WasBatched             = r->Read<bool>();
+    p->DwmNotified            = r->Read<bool>();
+    p->Completed              = r->Read<bool>();
+    p->Win32KPresentCount     = r->Read<uint64_t>();
+    p->Win32KBindId           = r->Read<uint64_t>();
+    p->DxgContext             = r->Read<uint64_t>();
+    p->LegacyBlitTokenData    = r->Read<uint64_t>();
+    for (auto& stageTime : p->StageTimes) {
+        stageTime = r->Read<uint32_t>();
+    }
+
+    auto count = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < count; ++i) {
+        p->DependentPresents.push_back(r->ReadRequiredId(presents));
+    }
+}
+
+void WritePresentList(CheckpointWriter* w, std::deque<std::shared_ptr<PresentEvent>> const& list)
+{
+    w->WriteCount(list.size());
+    for (auto const& p : list) {
+        w->WriteId(p);
+    }
+}
+
+void ReadPresentList(CheckpointReader* r, std::vector<std::shared_ptr<PresentEvent>> const& presents, std::deque<std::shared_ptr<PresentEvent>>* list)
+{
+    list->clear();
+    auto count = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < count; ++i) {
+        list->push_back(r->ReadRequiredId(presents));
+    }
+}
+
+template<typename Key>
+void WritePresentMap(CheckpointWriter* w, std::map<Key, std::shared_ptr<PresentEvent>> const& map)
+{
+    w->WriteCount(map.size());
+    for (auto const& pair : map) {
+        w->Write(pair.first);
+        w->WriteId(pair.second);
+    }
+}
+
+template<typename Key>
+void ReadPresentMap(CheckpointReader* r, std::vector<std::shared_ptr<PresentEvent>> const& presents, std::map<Key, std::shared_ptr<PresentEvent>>* map)
+{
+    map->clear();
+    auto count = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < count; ++i) {
+        auto key = r->Read<Key>();
+        auto p = r->ReadRequiredId(presents);
+        map->emplace(key, p);
+    }
+}
+
+void WriteFrame(CheckpointWriter* w, Frame const& f)
+{
+    w->Write(f.StartTime);
+    w->Write(f.EndTime);
+    w->WriteId(f.present);
+}
+
+Frame ReadFrame(CheckpointReader* r, std::vector<std::shared_ptr<PresentEvent>> const& presents)
+{
+    Frame f;
+    f.StartTime = r->Read<uint64_t>();
+    f.EndTime   = r->Read<uint64_t>();
+    f.present   = r->ReadId(presents);
+    return f;
+}
+
+bool IsPendingFrame(Frame const& f)
+{
+    return f.present != nullptr && !f.present->Completed;
+}
+
+void WritePMState(CheckpointWriter* w, PMTraceConsumer* pm)
+{
+    // Frames already in mFrames are output, but the ones whose present has not
+    // completed yet belong to the resumed run.
+    std::vector<Frame> pendingFrames;
+    {
+        auto lock = scoped_lock(pm->mMutex);
+        for (auto const& f : pm->mFrames) {
+            if (IsPendingFrame(f)) {
+                pendingFrames.push_back(f);
+            }
+        }
+    }
+
+    // Build the present table from everything that references a present.
+    std::vector<PresentEvent*> presents;
+    for (auto const& pair : pm->mPresentsByProcess) {
+        for (auto const& pair2 : pair.second) {
+            AddPresent(w, &presents, pair2.second);
+        }
+    }
+    for (auto const& pair : pm->mPresentsByProcessAndSwapChain) {
+        for (auto const& p : pair.second) {
+            AddPresent(w, &presents, p);
+        }
+    }
+    for (auto const& pair : pm->mPresentByThreadId)            AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mPresentsBySubmitSequence)     AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mWin32KPresentHistoryTokens)   AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mDxgKrnlPresentHistoryTokens)  AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mBltsByDxgContext)             AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mLastWindowPresent)            AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mPresentsByLegacyBlitToken)    AddPresent(w, &presents, pair.second);
+    for (auto const& pair : pm->mCurrentFramesByThreadId)      AddPresent(w, &presents, pair.second.present);
+    for (auto const& p : pm->mPresentsWaitingForDWM)           AddPresent(w, &presents, p);
+    for (auto const& f : pendingFrames)                        AddPresent(w, &presents, f.present);
+
+    WriteMetadata(w, pm->mMetadata);
+
+    w->WriteCount(presents.size());
+    for (auto p : presents) {
+        WritePresent(w, *p);
+    }
+
+    w->WriteCount(pm->mPresentsByProcess.size());
+    for (auto const& pair : pm->mPresentsByProcess) {
+        w->Write(pair.first);
+        WritePresentMap(w, pair.second);
+    }
+
+    w->WriteCount(pm->mPresentsByProcessAndSwapChain.size());
+    for (auto const& pair : pm->mPresentsByProcessAndSwapChain) {
+        w->Write(std::get<0>(pair.first));
+        w->Write(std::get<1>(pair.first));
+        WritePresentList(w, pair.second);
+    }
+
+    WritePresentMap(w, pm->mPresentByThreadId);
+    WritePresentMap(w, pm->mPresentsBySubmitSequence);
+
+    w->WriteCount(pm->mWin32KPresentHistoryTokens.size());
+    for (auto const& pair : pm->mWin32KPresentHistoryTokens) {
+        w->Write(std::get<0>(pair.first));
+        w->Write(std::get<1>(pair.first));
+        w->Write(std::get<2>(pair.first));
+        w->WriteId(pair.second);
+    }
+
+    WritePresentMap(w, pm->mDxgKrnlPresentHistoryTokens);
+    WritePresentMap(w, pm->mBltsByDxgContext);
+    WritePresentMap(w, pm->mLastWindowPresent);
+    WritePresentList(w, pm->mPresentsWaitingForDWM);
+    w->Write(pm->DwmPresentThreadId);
+    WritePresentMap(w, pm->mPresentsByLegacyBlitToken);
+
+    w->WriteCount(pm->mCurrentFramesByThreadId.size());
+    for (auto const& pair : pm->mCurrentFramesByThreadId) {
+        w->Write(pair.first);
+        WriteFrame(w, pair.second);
+    }
+
+    w->WriteCount(pm->mFrameThreadsByProcess.size());
+    for (auto const& pair : pm->mFrameThreadsByProcess) {
+        w->Write(pair.first);
+        w->WriteCount(pair.second.size());
+        w->WriteBytes(pair.second.data(), pair.second.size() * sizeof(uint32_t));
+    }
+
+    w->WriteCount(pendingFrames.size());
+    for (auto const& f : pendingFrames) {
+        WriteFrame(w, f);
+    }
+}
+
+void ReadPMState(CheckpointReader* r, PMTraceConsumer* pm, std::vector<std::shared_ptr<PresentEvent>>* presents)
+{
+    ReadMetadata(r, &pm->mMetadata);
+
+    // Create every present first, since dependents can refer forward.
+    EVENT_HEADER hdr = {};
+    presents->resize(r->ReadCount());
+    for (auto& p : *presents) {
+        p = std::make_shared<PresentEvent>(hdr, Runtime::Other);
+    }
+    for (size_t i = 0, n = presents->size(); r->mOk && i < n; ++i) {
+        ReadPresent(r, *presents, (*presents)[i].get());
+    }
+
+    auto processCount = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < processCount; ++i) {
+        auto processId = r->Read<uint32_t>();
+        ReadPresentMap(r, *presents, &pm->mPresentsByProcess[processId]);
+    }
+
+    auto swapChainCount = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < swapChainCount; ++i) {
+        auto processId = r->Read<uint32_t>();
+        auto swapChainAddress = r->Read<uint64_t>();
+        ReadPresentList(r, *presents, &pm->mPresentsByProcessAndSwapChain[std::make_tuple(processId, swapChainAddress)]);
+    }
+
+    ReadPresentMap(r, *presents, &pm->mPresentByThreadId);
+    ReadPresentMap(r, *presents, &pm->mPresentsBySubmitSequence);
+
+    auto tokenCount = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < tokenCount; ++i) {
+        auto compositionSurfaceLuid = r->Read<uint64_t>();
+        auto presentCount = r->Read<uint64_t>();
+        auto bindId = r->Read<uint64_t>();
+        auto p = r->ReadRequiredId(*presents);
+        pm->mWin32KPresentHistoryTokens.emplace(std::make_tuple(compositionSurfaceLuid, presentCount, bindId), p);
+    }
+
+    ReadPresentMap(r, *presents, &pm->mDxgKrnlPresentHistoryTokens);
+    ReadPresentMap(r, *presents, &pm->mBltsByDxgContext);
+    ReadPresentMap(r, *presents, &pm->mLastWindowPresent);
+    ReadPresentList(r, *presents, &pm->mPresentsWaitingForDWM);
+    pm->DwmPresentThreadId = r->Read<uint32_t>();
+    ReadPresentMap(r, *presents, &pm->mPresentsByLegacyBlitToken);
+
+    auto currentFrameCount = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < currentFrameCount; ++i) {
+        auto threadId = r->Read<uint32_t>();
+        pm->mCurrentFramesByThreadId.emplace(threadId, ReadFrame(r, *presents));
+    }
+
+    auto frameProcessCount = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < frameProcessCount; ++i) {
+        auto processId = r->Read<uint32_t>();
+        auto& threads = pm->mFrameThreadsByProcess[processId];
+        threads.resize(r->ReadCount());
+        r->ReadBytes(threads.data(), threads.size() * sizeof(uint32_t));
+    }
+
+    auto pendingFrameCount = r->ReadCount();
+    auto lock = scoped_lock(pm->mMutex);
+    for (uint32_t i = 0; r->mOk && i < pendingFrameCount; ++i) {
+        pm->mFrames.push_back(ReadFrame(r, *presents));
+    }
+}
+
+void ClearPMState(PMTraceConsumer* pm)
+{
+    pm->mMetadata.metadata_.clear();
+    pm->mPresentsByProcess.clear();
+    pm->mPresentsByProcessAndSwapChain.clear();
+    pm->mPresentByThreadId.clear();
+    pm->mPresentsBySubmitSequence.clear();
+    pm->mWin32KPresentHistoryTokens.clear();
+    pm->mDxgKrnlPresentHistoryTokens.clear();
+    pm->mBltsByDxgContext.clear();
+    pm->mLastWindowPresent.clear();
+    pm->mPresentsWaitingForDWM.clear();
+    pm->DwmPresentThreadId = 0;
+    pm->mPresentsByLegacyBlitToken.clear();
+    pm->mCurrentFramesByThreadId.clear();
+    pm->mFrameThreadsByProcess.clear();
+
+    auto lock = scoped_lock(pm->mMutex);
+    pm->mFrames.clear();
+}
+
+// -----------------------------------------------------------------------------
+// MRTraceConsumer state
+
+void WriteHolographicFrame(CheckpointWriter* w, HolographicFrame const& f)
+{
+    w->Write(f.PresentId);
+    w->Write(f.FrameId);
+    w->Write(f.StartTime);
+    w->Write(f.StopTime);
+    w->Write(f.ProcessId);
+    w->Write(f.Completed);
+    w->Write(f.FinalState);
+}
+
+void ReadHolographicFrame(CheckpointReader* r, HolographicFrame* f)
+{
+    f->PresentId  = r->Read<uint32_t>();
+    f->FrameId    = r->Read<uint32_t>();
+    f->StartTime  = r->Read<uint64_t>();
+    f->StopTime   = r->Read<uint64_t>();
+    f->ProcessId  = r->Read<uint32_t>();
+    f->Completed  = r->Read<bool>();
+    f->FinalState = r->Read<HolographicFrameResult>();
+}
+
+void WritePresentationSource(CheckpointWriter* w, PresentationSource const& s)
+{
+    w->Write(s.Ptr);
+    w->Write(s.AcquireForRenderingTime);
+    w->Write(s.ReleaseFromRenderingTime);
+    w->Write(s.AcquireForPresentationTime);
+    w->Write(s.ReleaseFromPresentationTime);
+    w->WriteId(s.pHolographicFrame);
+}
+
+void ReadPresentationSource(CheckpointReader* r, std::vector<std::shared_ptr<HolographicFrame>> const& frames, PresentationSource* s)
+{
+    s->Ptr                         = r->Read<uint64_t>();
+    s->AcquireForRenderingTime     = r->Read<uint64_t>();
+    s->ReleaseFromRenderingTime    = r->Read<uint64_t>();
+    s->AcquireForPresentationTime  = r->Read<uint64_t>();
+    s->ReleaseFromPresentationTime = r->Read<uint64_t>();
+    s->pHolographicFrame           = r->ReadId(frames);
+}
+
+void WriteHolographicFrameMap(CheckpointWriter* w, std::map<uint32_t, std::shared_ptr<HolographicFrame>> const& map)
+{
+    w->WriteCount(map.size());
+    for (auto const& pair : map) {
+        w->Write(pair.first);
+        w->WriteId(pair.second);
+    }
+}
+
+void ReadHolographicFrameMap(CheckpointReader* r, std::vector<std::shared_ptr<HolographicFrame>> const& frames, std::map<uint32_t, std::shared_ptr<HolographicFrame>>* map)
+{
+    map->clear();
+    auto count = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < count; ++i) {
+        auto key = r->Read<uint32_t>();
+        auto f = r->ReadRequiredId(frames);
+        map->emplace(key, f);
+    }
+}
+
+void WriteMRState(CheckpointWriter* w, MRTraceConsumer* mr)
+{
+    std::vector<HolographicFrame*> frames;
+    for (auto const& pair : mr->mHolographicFramesByFrameId)   w->AddId(pair.second, &frames);
+    for (auto const& pair : mr->mHolographicFramesByPresentId) w->AddId(pair.second, &frames);
+    for (auto const& pair : mr->mPresentationSourceByPtr)      w->AddId(pair.second->pHolographicFrame, &frames);
+    if (mr->mActiveLSR != nullptr) {
+        w->AddId(mr->mActiveLSR->Source.pHolographicFrame, &frames);
+    }
+
+    WriteMetadata(w, mr->mMetadata);
+
+    w->WriteCount(frames.size());
+    for (auto f : frames) {
+        WriteHolographicFrame(w, *f);
+    }
+
+    w->WriteCount(mr->mPresentationSourceByPtr.size());
+    for (auto const& pair : mr->mPresentationSourceByPtr) {
+        w->Write(pair.first);
+        WritePresentationSource(w, *pair.second);
+    }
+
+    WriteHolographicFrameMap(w, mr->mHolographicFramesByFrameId);
+    WriteHolographicFrameMap(w, mr->mHolographicFramesByPresentId);
+
+    auto const& lsr = mr->mActiveLSR;
+    w->Write(lsr != nullptr);
+    if (lsr != nullptr) {
+        w->Write(lsr->QpcTime);
+        WritePresentationSource(w, lsr->Source);
+        w->Write(lsr->NewSourceLatched);
+        w->WriteBytes(&lsr->ThreadWakeupStartLatchToCpuRenderFrameStartInMs, LSR_TIMING_SIZE);
+        w->Write(lsr->ProcessId);
+        w->Write(lsr->FinalState);
+        w->Write(lsr->MissedVsyncCount);
+        w->Write(lsr->Completed);
+    }
+}
+
+void ReadMRState(CheckpointReader* r, MRTraceConsumer* mr, std::vector<std::shared_ptr<HolographicFrame>>* frames)
+{
+    ReadMetadata(r, &mr->mMetadata);
+
+    EVENT_HEADER hdr = {};
+    frames->resize(r->ReadCount());
+    for (auto& f : *frames) {
+        f = std::make_shared<HolographicFrame>(hdr);
+        ReadHolographicFrame(r, f.get());
+    }
+
+    auto sourceCount = r->ReadCount();
+    for (uint32_t i = 0; r->mOk && i < sourceCount; ++i) {
+        auto ptr = r->Read<uint64_t>();
+        auto source = std::make_shared<PresentationSource>();
+        ReadPresentationSource(r, *frames, source.get());
+        mr->mPresentationSourceByPtr.emplace(ptr, source);
+    }
+
+    ReadHolographicFrameMap(r, *frames, &mr->mHolographicFramesByFrameId);
+    ReadHolographicFrameMap(r, *frames, &mr->mHolographicFramesByPresentId);
+
+    if (r->Read<bool>()) {
+        auto lsr = std::make_shared<LateStageReprojectionEvent>(hdr);
+        lsr->QpcTime = r->Read<uint64_t>();
+        ReadPresentationSource(r, *frames, &lsr->Source);
+        lsr->NewSourceLatched = r->Read<bool>();
+        r->ReadBytes(&lsr->ThreadWakeupStartLatchToCpuRenderFrameStartInMs, LSR_TIMING_SIZE);
+        lsr->ProcessId        = r->Read<uint32_t>();
+        lsr->FinalState       = r->Read<LateStageReprojectionResult>();
+        lsr->MissedVsyncCount = r->Read<uint32_t>();
+        lsr->Completed        = r->Read<bool>();
+        mr->mActiveLSR = lsr;
+    }
+}
+
+void ClearMRState(MRTraceConsumer* mr)
+{
+    mr->mMetadata.metadata_.clear();
+    mr->mPresentationSourceByPtr.clear();
+    mr->mHolographicFramesByFrameId.clear();
+    mr->mHolographicFramesByPresentId.clear();
+    if (mr->mActiveLSR != nullptr) {
+        mr->mActiveLSR->Completed = true;
+        mr->mActiveLSR.reset();
+    }
+}
+
+}
+
+bool WriteCheckpoint(char const* path, CheckpointInfo const& info, PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer)
+{
+    CheckpointWriter w;
+    if (fopen_s(&w.mFile, path, "wb") != 0) {
+        fprintf(stderr, "error: failed to open checkpoint file for writing: %s\n", path);
+        return false;
+    }
+
+    w.WriteBytes(CHECKPOINT_FILE_MAGIC, sizeof(CHECKPOINT_FILE_MAGIC));
+    w.Write(CHECKPOINT_FILE_VERSION);
+    w.Write(info.mEventIndex);
+    w.Write(info.mTimestamp);
+    w.Write(info.mStartQpc);
+    w.Write(info.mQpcFrequency);
+
+    WritePMState(&w, pmConsumer);
+
+    w.Write(mrConsumer != nullptr);
+    if (mrConsumer != nullptr) {
+        WriteMRState(&w, mrConsumer);
+    }
+
+    auto ok = fclose(w.mFile) == 0 && w.mOk;
+    if (!ok) {
+        fprintf(stderr, "error: failed to write checkpoint file: %s\n", path);
+    }
+    return ok;
+}
+
+bool ReadCheckpoint(char const* path, CheckpointInfo* info, PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer)
+{
+    CheckpointReader r;
+    if (fopen_s(&r.mFile, path, "rb") != 0) {
+        fprintf(stderr, "error: failed to open checkpoint file: %s\n", path);
+        return false;
+    }
+
+    char magic[4] = {};
+    r.ReadBytes(magic, sizeof(magic));
+    r.mOk = r.mOk &&
+        memcmp(magic, CHECKPOINT_FILE_MAGIC, sizeof(magic)) == 0 &&
+        r.Read<uint32_t>() == CHECKPOINT_FILE_VERSION;
+    info->mEventIndex   = r.Read<uint64_t>();
+    info->mTimestamp    = r.Read<uint64_t>();
+    info->mStartQpc     = r.Read<uint64_t>();
+    info->mQpcFrequency = r.Read<uint64_t>();
+
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    std::vector<std::shared_ptr<HolographicFrame>> frames;
+    if (r.mOk) {
+        ReadPMState(&r, pmConsumer, &presents);
+    }
+
+    auto hasMR = r.Read<bool>();
+    if (hasMR != (mrConsumer != nullptr)) {
+        r.mOk = false;
+    }
+    if (r.mOk && hasMR) {
+        ReadMRState(&r, mrConsumer, &frames);
+    }
+
+    fclose(r.mFile);
+    if (!r.mOk) {
+        fprintf(stderr, "error: invalid or corrupt checkpoint file: %s\n", path);
+
+        // Drop any partially-restored state.  The tracked objects were never
+        // completed, so mark them as such to keep the destructors' asserts
+        // quiet.
+        for (auto const& p : presents) {
+            p->Completed = true;
+            p->DependentPresents.clear();
+        }
+        for (auto const& f : frames) {
+            f->Completed = true;
+        }
+        ClearPMState(pmConsumer);
+        if (mrConsumer != nullptr) {
+            ClearMRState(mrConsumer);
+        }
+    }
+    return r.mOk;
+}
@@ -0,0 +1,62 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+struct PMTraceConsumer;
+struct MRTraceConsumer;
+
+// A checkpoint is a snapshot of the consumers' tracking state taken just
+// before a given event is handled.  Processing of the same ETL file can be
+// resumed from a checkpoint by loading it into fresh consumers and skipping
+// the first mEventIndex events (see TraceSession::mResumeEventIndex), which
+// makes it possible to split a long capture into time segments that are each
+// seeded from a checkpoint and processed independently.
+//
+// Saved state includes every in-flight present and the maps that reference
+// them, frames whose present has not completed yet, DwmPresentThreadId, the
+// event metadata cache, and the MRTraceConsumer's in-flight state.  Completed
+// presents/LSRs and already-completed frames are output, not state, and are
+// not saved.
+struct CheckpointInfo {
+    uint64_t mEventIndex = 0;   // Index of the first event not yet handled
+    uint64_t mTimestamp = 0;    // QPC of that event
+    uint64_t mStartQpc = 0;     // TraceSession::mStartQpc of the run that wrote it
+    uint64_t mQpcFrequency = 0;
+};
+
+// A checkpoint to write once processing reaches mTime seconds after the
+// start of the trace.
+struct CheckpointRequest {
+    double mTime;
+    std::string mPath;
+};
+
+bool WriteCheckpoint(char const* path, CheckpointInfo const& info, PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer);
+
+// Restore a checkpoint into newly-constructed consumers.  mrConsumer must be
+// non-null if, and only if, the checkpoint was written with one.
+bool ReadCheckpoint(char const* path, CheckpointInfo* info, PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer);
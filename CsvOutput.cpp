@@ -0,0 +1,232 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "CsvOutput.hpp"
+#include "PresentMonTraceConsumer.hpp"
+
+#include <assert.h>
+#include <charconv>
+#include <string.h>
+
+namespace {
+
+// Upper bound on the formatted size of one field plus its separator.
+size_t const MAX_FIELD_SIZE = 32;
+
+struct {
+    char const* mName;
+    CsvColumn mColumn;
+} const COLUMN_NAMES[] = {
+    { "StartTime",    CsvColumn::StartTime },
+    { "RendererTime", CsvColumn::RendererTime },
+    { "GpuTime",      CsvColumn::GpuTime },
+    { "CombinedTime", CsvColumn::CombinedTime },
+    { "ScreenTime",   CsvColumn::ScreenTime },
+    { "RuntimeOnly",  CsvColumn::RuntimeOnly },
+};
+
+char* FormatU64(char* p, char* end, uint64_t value)
+{
+    auto r = std::to_chars(p, end, value);
+    assert(r.ec == std::errc());
+    return r.ptr;
+}
+
+char* FormatDouble(char* p, char* end, double value)
+{
+    auto r = std::to_chars(p, end, value, std::chars_format::general, 6);
+    assert(r.ec == std::errc());
+    return r.ptr;
+}
+
+}
+
+bool ParseCsvColumns(char const* list, std::vector<CsvColumn>* columns)
+{
+    columns->clear();
+    for (auto p = list; *p != '\0'; ) {
+        auto end = strchr(p, ',');
+        auto len = end == nullptr ? strlen(p) : (size_t) (end - p);
+
+        auto found = false;
+        for (auto const& c : COLUMN_NAMES) {
+            if (strlen(c.mName) == len && _strnicmp(c.mName, p, len) == 0) {
+                columns->push_back(c.mColumn);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "error: unrecognized CSV column: %.*s\n", (int) len, p);
+            return false;
+        }
+
+        p += len;
+        if (*p == ',') {
+            p += 1;
+        }
+    }
+    return !columns->empty();
+}
+
+std::vector<CsvColumn> DefaultCsvColumns()
+{
+    return {
+        CsvColumn::StartTime,
+        CsvColumn::RendererTime,
+        CsvColumn::GpuTime,
+        CsvColumn::CombinedTime,
+        CsvColumn::ScreenTime,
+    };
+}
+
+bool CsvOutput::Start(FILE* fp, std::vector<CsvColumn> const& columns, uint64_t startQpc, QpcClock const& clock)
+{
+    assert(mFile == nullptr);
+    assert(!columns.empty());
+
+    mFile = fp;
+    mColumns = columns;
+    mStartQpc = startQpc;
+    mClock = clock;
+
+    mBuffers[0].resize(BUFFER_SIZE);
+    mBuffers[1].resize(BUFFER_SIZE);
+    mFillIndex = 0;
+    mFillSize = 0;
+    mWritePending = false;
+    mQuit = false;
+
+    mWriterThread = std::thread(&CsvOutput::WriterThread, this);
+    return true;
+}
+
+void CsvOutput::Stop()
+{
+    if (mFile == nullptr) {
+        return;
+    }
+
+    SubmitBuffer();
+
+    {
+        auto lock = scoped_lock(mMutex);
+        mQuit = true;
+    }
+    mCondition.notify_all();
+    mWriterThread.join();
+
+    fflush(mFile);
+    mFile = nullptr;
+}
+
+void CsvOutput::WriteFrame(Frame const& f)
+{
+    auto const& p = *f.present;
+
+    if (mFillSize + mColumns.size() * MAX_FIELD_SIZE + 1 > BUFFER_SIZE) {
+        SubmitBuffer();
+    }
+
+    auto begin = mBuffers[mFillIndex].data();
+    auto out   = begin + mFillSize;
+    auto end   = begin + BUFFER_SIZE;
+
+    // Convert all of the row's intervals at once.
+    int64_t const ticks[] = {
+        (int64_t) (p.QpcTime - f.StartTime),
+        (int64_t) (p.ReadyTime - p.QpcTime),
+        (int64_t) (p.ReadyTime - f.StartTime),
+        (int64_t) (p.ScreenTime - f.StartTime),
+    };
+    double ms[_countof(ticks)];
+    mClock.ToMilliseconds(ticks, ms, _countof(ticks));
+
+    for (size_t i = 0, n = mColumns.size(); i < n; ++i) {
+        // Rows have always been written as "start,renderer, gpu, ...", with
+        // no space after StartTime.
+        if (i > 0) {
+            *out++ = ',';
+            if (mColumns[i - 1] != CsvColumn::StartTime) {
+                *out++ = ' ';
+            }
+        }
+
+        switch (mColumns[i]) {
+        case CsvColumn::StartTime:    out = FormatU64(out, end, f.StartTime - mStartQpc); break;
+        case CsvColumn::RendererTime: out = FormatDouble(out, end, ms[0]); break;
+        case CsvColumn::GpuTime:      if (!p.RuntimeOnly) out = FormatDouble(out, end, ms[1]); break;
+        case CsvColumn::CombinedTime: if (!p.RuntimeOnly) out = FormatDouble(out, end, ms[2]); break;
+        case CsvColumn::ScreenTime:   if (!p.RuntimeOnly && p.FinalState == PresentResult::Presented) out = FormatDouble(out, end, ms[3]); break;
+        case CsvColumn::RuntimeOnly:  *out++ = p.RuntimeOnly ? '1' : '0'; break;
+        }
+    }
+    *out++ = '\n';
+
+    mFillSize = out - begin;
+}
+
+// Hand the fill buffer to the writer thread, waiting for it to finish the
+// previous buffer first, and start filling the other one.
+void CsvOutput::SubmitBuffer()
+{
+    if (mFillSize == 0) {
+        return;
+    }
+
+    {
+        auto lock = scoped_lock(mMutex);
+        mCondition.wait(lock, [this]() { return !mWritePending; });
+        mWriteIndex = mFillIndex;
+        mWriteSize = mFillSize;
+        mWritePending = true;
+    }
+    mCondition.notify_all();
+
+    mFillIndex ^= 1;
+    mFillSize = 0;
+}
+
+void CsvOutput::WriterThread()
+{
+    for (;;) {
+        size_t index = 0;
+        size_t size = 0;
+        {
+            auto lock = scoped_lock(mMutex);
+            mCondition.wait(lock, [this]() { return mWritePending || mQuit; });
+            if (!mWritePending) {
+                return;
+            }
+            index = mWriteIndex;
+            size = mWriteSize;
+        }
+
+        fwrite(mBuffers[index].data(), 1, size, mFile);
+
+        {
+            auto lock = scoped_lock(mMutex);
+            mWritePending = false;
+        }
+        mCondition.notify_all();
+    }
+}
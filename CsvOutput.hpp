@@ -0,0 +1,95 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "QpcClock.hpp"
+
+struct Frame;
+
+enum class CsvColumn
+{
+    StartTime,      // QPC ticks since the start of the trace
+    RendererTime,   // ms from frame start to runtime present
+    GpuTime,        // ms from runtime present to GPU ready
+    CombinedTime,   // ms from frame start to GPU ready
+    ScreenTime,     // ms from frame start to screen
+    RuntimeOnly,    // 1 if the present was tracked without kernel events (see SimpleTraceConsumer)
+};
+
+// Parse a comma-separated list of column names (e.g., "StartTime,ScreenTime").
+// Returns false if any name is unrecognized.
+bool ParseCsvColumns(char const* list, std::vector<CsvColumn>* columns);
+std::vector<CsvColumn> DefaultCsvColumns();
+
+// CsvOutput formats frame rows into large buffers on the calling thread and
+// hands full buffers to a dedicated writer thread, which writes them out with
+// a single fwrite() each.  Two buffers are used, so formatting only blocks if
+// the writer falls a full buffer behind.
+//
+// Runtime-only presents have no ready or screen time, so GpuTime,
+// CombinedTime, and ScreenTime are left empty in their rows.  Presents that
+// were not displayed (e.g., discarded) have no screen time, so their
+// ScreenTime is left empty.
+//
+// Numbers are formatted with std::to_chars(), which produces the same text as
+// the default std::ostream formatting (%g with 6 significant digits) without
+// the locale and stream overhead.
+struct CsvOutput {
+    static size_t const BUFFER_SIZE = 1024 * 1024;
+
+    FILE* mFile = nullptr;
+    std::vector<CsvColumn> mColumns;
+    uint64_t mStartQpc = 0;
+    QpcClock mClock;
+
+    // mBuffers[mFillIndex] is being formatted into by the caller, and
+    // mBuffers[mWriteIndex] is owned by the writer thread while mWritePending
+    // is true.
+    std::vector<char> mBuffers[2];
+    size_t mFillIndex = 0;
+    size_t mFillSize = 0;
+
+    std::thread mWriterThread;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    size_t mWriteIndex = 0;
+    size_t mWriteSize = 0;
+    bool mWritePending = false;
+    bool mQuit = false;
+
+    bool Start(FILE* fp, std::vector<CsvColumn> const& columns, uint64_t startQpc, QpcClock const& clock);
+    void Stop();
+
+    void WriteFrame(Frame const& f);
+
+private:
+    void SubmitBuffer();
+    void WriterThread();
+};
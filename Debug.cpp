@@ -28,54 +28,112 @@ SOFTWARE.
 #include "DxgkrnlEventStructs.hpp"
 #include "Win32kEventStructs.hpp"
 
+#include <algorithm>
 #include <assert.h>
+#include <string.h>
 
-#if DEBUG_VERBOSE
+DebugJournal* gDebugJournal = nullptr;
 
 namespace {
 
-PresentEvent const* gModifiedPresent = nullptr;
-struct {
-    uint64_t TimeTaken;
-    uint64_t ReadyTime;
-    uint64_t ScreenTime;
-    
-    uint64_t SwapChainAddress;
-    int32_t SyncInterval;
-    uint32_t PresentFlags;
-    
-    uint64_t Hwnd;
-    uint64_t TokenPtr;
-    uint32_t QueueSubmitSequence;
-    PresentMode PresentMode;
-    PresentResult FinalState;
-    bool SupportsTearing;
-    bool MMIO;
-    bool SeenDxgkPresent;
-    bool SeenWin32KEvents;
-    bool WasBatched;
-    bool DwmNotified;
-    bool Completed;
-} gOriginalPresentValues;
-
-bool gDebugDone = false;
-bool gDebugTrace = false;
-LARGE_INTEGER* gFirstTimestamp = nullptr;
-LARGE_INTEGER gTimestampFrequency = {};
-
-uint64_t ConvertTimestampDeltaToNs(uint64_t timestampDelta)
+char const JOURNAL_FILE_MAGIC[4] = { 'P', 'M', 'D', 'J' };
+uint32_t const JOURNAL_FILE_VERSION = 1;
+
+// Records are written to disk as-is, so make sure the layout has no padding.
+static_assert(sizeof(DebugRecord) == 40, "unexpected DebugRecord layout");
+
+uint32_t const FIRST_IN_GROUP = 1;  // DebugRecord::mFlags for ModifyPresent
+
+template<typename T>
+bool WriteValue(FILE* fp, T const& value)
+{
+    return fwrite(&value, sizeof(T), 1, fp) == 1;
+}
+
+template<typename T>
+bool ReadValue(FILE* fp, T* value)
+{
+    return fread(value, sizeof(T), 1, fp) == 1;
+}
+
+DebugProvider GetProvider(GUID const& providerId)
+{
+    if (providerId == Microsoft_Windows_D3D9::GUID)                         return DebugProvider::D3D9;
+    if (providerId == Microsoft_Windows_DXGI::GUID)                         return DebugProvider::DXGI;
+    if (providerId == Microsoft_Windows_DxgKrnl::GUID)                      return DebugProvider::DxgKrnl;
+    if (providerId == Microsoft_Windows_DxgKrnl::Win7::BLT_GUID)            return DebugProvider::DxgKrnl_Win7_Blt;
+    if (providerId == Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID)           return DebugProvider::DxgKrnl_Win7_Flip;
+    if (providerId == Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID) return DebugProvider::DxgKrnl_Win7_PresentHistory;
+    if (providerId == Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID)    return DebugProvider::DxgKrnl_Win7_QueuePacket;
+    if (providerId == Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID)       return DebugProvider::DxgKrnl_Win7_VSyncDPC;
+    if (providerId == Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID)       return DebugProvider::DxgKrnl_Win7_MMIOFlip;
+    if (providerId == Microsoft_Windows_Dwm_Core::GUID)                     return DebugProvider::Dwm;
+    if (providerId == Microsoft_Windows_Dwm_Core::Win7::GUID)               return DebugProvider::Dwm;
+    if (providerId == Microsoft_Windows_Win32k::GUID)                       return DebugProvider::Win32k;
+    return DebugProvider::Other;
+}
+
+void GetPresentValues(PresentEvent const& p, uint64_t* values)
 {
-    return 1000000000ull * timestampDelta / gTimestampFrequency.QuadPart;
+#define GET_MEMBER(_Name) values[(size_t) DebugPresentMember::_Name] = (uint64_t) p._Name;
+    GET_MEMBER(TimeTaken)
+    GET_MEMBER(ReadyTime)
+    GET_MEMBER(ScreenTime)
+    GET_MEMBER(SwapChainAddress)
+    GET_MEMBER(SyncInterval)
+    GET_MEMBER(PresentFlags)
+    GET_MEMBER(Hwnd)
+    GET_MEMBER(TokenPtr)
+    GET_MEMBER(QueueSubmitSequence)
+    GET_MEMBER(PresentMode)
+    GET_MEMBER(FinalState)
+    GET_MEMBER(SupportsTearing)
+    GET_MEMBER(MMIO)
+    GET_MEMBER(SeenDxgkPresent)
+    GET_MEMBER(SeenWin32KEvents)
+    GET_MEMBER(WasBatched)
+    GET_MEMBER(DwmNotified)
+    GET_MEMBER(Completed)
+#undef GET_MEMBER
 }
 
-uint64_t ConvertTimestampToNs(LARGE_INTEGER timestamp)
+// Record how the present passed to the last DebugModifyPresent() has
+// changed since then, one ModifyPresent record per changed member.
+void FlushModifiedPresent(DebugJournal* journal)
 {
-    return ConvertTimestampDeltaToNs(timestamp.QuadPart - gFirstTimestamp->QuadPart);
+    auto p = journal->mModifiedPresent;
+    if (p == nullptr) return;
+
+    uint64_t values[(size_t) DebugPresentMember::Count];
+    GetPresentValues(*p, values);
+
+    uint32_t changedCount = 0;
+    for (size_t i = 0; i < (size_t) DebugPresentMember::Count; ++i) {
+        if (values[i] != journal->mOriginalValues[i]) {
+            DebugRecord record = {};
+            record.mType = DebugRecordType::ModifyPresent;
+            record.mSubtype = (uint8_t) i;
+            record.mFlags = changedCount++ == 0 ? FIRST_IN_GROUP : 0;
+            record.mId = p->Id;
+            record.mValues[0] = journal->mOriginalValues[i];
+            record.mValues[1] = values[i];
+            journal->Append(record);
+        }
+    }
+
+    journal->mModifiedPresent = nullptr;
 }
 
-char* AddCommas(uint64_t t)
+// Decoding
+
+struct DecodeContext {
+    FILE* mFile;
+    uint64_t mFirstTimestamp;
+    QpcClock mClock;
+};
+
+char const* AddCommas(uint64_t t, char (&buf)[32])
 {
-    static char buf[128];
     auto r = sprintf_s(buf, "%llu", t);
 
     auto commaCount = r == 0 ? 0 : ((r - 1) / 3);
@@ -93,295 +151,448 @@ char* AddCommas(uint64_t t)
     return buf;
 }
 
-void PrintEventHeader(EVENT_HEADER const& hdr)
+void PrintEventHeader(DecodeContext const& ctx, DebugRecord const& r)
 {
-    printf("%16s %5u %5u ", AddCommas(ConvertTimestampToNs(hdr.TimeStamp)), hdr.ProcessId, hdr.ThreadId);
+    char buf[32];
+    fprintf(ctx.mFile, "%16s %5u %5u ",
+        AddCommas(ctx.mClock.ToNs(r.mId - ctx.mFirstTimestamp), buf),
+        r.mProcessId, r.mThreadId);
 }
 
-void PrintUpdateHeader(uint64_t id, int indent=0)
+void PrintUpdateHeader(DecodeContext const& ctx, uint64_t id, int indent=0)
 {
-    printf("%*sp%llu", 17 + 6 + 6 + indent*4, "", id);
+    fprintf(ctx.mFile, "%*sp%llu", 17 + 6 + 6 + indent*4, "", id);
 }
 
-void PrintU32(uint32_t value) { printf("%u", value); }
-void PrintU64(uint64_t value) { printf("%llu", value); }
-void PrintU64Ptr(uint64_t value) { printf("%llx", value); }
-void PrintTimeDelta(uint64_t value) { printf("%s", AddCommas(ConvertTimestampDeltaToNs(value))); }
-void PrintBool(bool value) { printf("%s", value ? "true" : "false"); }
-void PrintRuntime(Runtime value)
+void PrintU32(DecodeContext const& ctx, uint64_t value) { fprintf(ctx.mFile, "%u", (uint32_t) value); }
+void PrintU64Ptr(DecodeContext const& ctx, uint64_t value) { fprintf(ctx.mFile, "%llx", value); }
+void PrintTimeDelta(DecodeContext const& ctx, uint64_t value)
+{
+    char buf[32];
+    fprintf(ctx.mFile, "%s", AddCommas(ctx.mClock.ToNs(value), buf));
+}
+void PrintBool(DecodeContext const& ctx, uint64_t value) { fprintf(ctx.mFile, "%s", value ? "true" : "false"); }
+void PrintRuntime(DecodeContext const& ctx, uint64_t value)
 {
-    switch (value) {
-    case Runtime::DXGI:  printf("DXGI");  break;
-    case Runtime::D3D9:  printf("D3D9");  break;
-    case Runtime::Other: printf("Other"); break;
-    default:             printf("ERROR"); break;
+    switch ((Runtime) value) {
+    case Runtime::DXGI:  fprintf(ctx.mFile, "DXGI");  break;
+    case Runtime::D3D9:  fprintf(ctx.mFile, "D3D9");  break;
+    case Runtime::Other: fprintf(ctx.mFile, "Other"); break;
+    default:             fprintf(ctx.mFile, "ERROR"); break;
     }
 }
-void PrintPresentMode(PresentMode value)
+void PrintPresentMode(DecodeContext const& ctx, uint64_t value)
 {
-    switch (value) {
-    case PresentMode::Unknown:                              printf("Unknown"); break;
-    case PresentMode::Hardware_Legacy_Flip:                 printf("Hardware_Legacy_Flip"); break;
-    case PresentMode::Hardware_Legacy_Copy_To_Front_Buffer: printf("Hardware_Legacy_Copy_To_Front_Buffer"); break;
-    case PresentMode::Hardware_Independent_Flip:            printf("Hardware_Independent_Flip"); break;
-    case PresentMode::Composed_Flip:                        printf("Composed_Flip"); break;
-    case PresentMode::Composed_Copy_GPU_GDI:                printf("Composed_Copy_GPU_GDI"); break;
-    case PresentMode::Composed_Copy_CPU_GDI:                printf("Composed_Copy_CPU_GDI"); break;
-    case PresentMode::Composed_Composition_Atlas:           printf("Composed_Composition_Atlas"); break;
-    case PresentMode::Hardware_Composed_Independent_Flip:   printf("Hardware_Composed_Independent_Flip"); break;
-    default:                                                printf("ERROR"); break;
+    switch ((PresentMode) value) {
+    case PresentMode::Unknown:                              fprintf(ctx.mFile, "Unknown"); break;
+    case PresentMode::Hardware_Legacy_Flip:                 fprintf(ctx.mFile, "Hardware_Legacy_Flip"); break;
+    case PresentMode::Hardware_Legacy_Copy_To_Front_Buffer: fprintf(ctx.mFile, "Hardware_Legacy_Copy_To_Front_Buffer"); break;
+    case PresentMode::Hardware_Independent_Flip:            fprintf(ctx.mFile, "Hardware_Independent_Flip"); break;
+    case PresentMode::Composed_Flip:                        fprintf(ctx.mFile, "Composed_Flip"); break;
+    case PresentMode::Composed_Copy_GPU_GDI:                fprintf(ctx.mFile, "Composed_Copy_GPU_GDI"); break;
+    case PresentMode::Composed_Copy_CPU_GDI:                fprintf(ctx.mFile, "Composed_Copy_CPU_GDI"); break;
+    case PresentMode::Composed_Composition_Atlas:           fprintf(ctx.mFile, "Composed_Composition_Atlas"); break;
+    case PresentMode::Hardware_Composed_Independent_Flip:   fprintf(ctx.mFile, "Hardware_Composed_Independent_Flip"); break;
+    default:                                                fprintf(ctx.mFile, "ERROR"); break;
     }
 }
-void PrintPresentResult(PresentResult value)
+void PrintPresentResult(DecodeContext const& ctx, uint64_t value)
 {
-    switch (value) {
-    case PresentResult::Unknown:   printf("Unknown");   break;
-    case PresentResult::Presented: printf("Presented"); break;
-    case PresentResult::Discarded: printf("Discarded"); break;
-    case PresentResult::Error:     printf("Error");     break;
-    default:                       printf("ERROR");     break;
+    switch ((PresentResult) value) {
+    case PresentResult::Unknown:   fprintf(ctx.mFile, "Unknown");   break;
+    case PresentResult::Presented: fprintf(ctx.mFile, "Presented"); break;
+    case PresentResult::Discarded: fprintf(ctx.mFile, "Discarded"); break;
+    case PresentResult::Error:     fprintf(ctx.mFile, "Error");     break;
+    case PresentResult::Lost:      fprintf(ctx.mFile, "Lost");      break;
+    default:                       fprintf(ctx.mFile, "ERROR");     break;
     }
 }
 
-void FlushModifiedPresent()
+struct {
+    char const* mName;
+    void (*mPrint)(DecodeContext const& ctx, uint64_t value);
+} const PRESENT_MEMBERS[] = {
+    { "TimeTaken",           PrintTimeDelta },
+    { "ReadyTime",           PrintTimeDelta },
+    { "ScreenTime",          PrintTimeDelta },
+    { "SwapChainAddress",    PrintU64Ptr },
+    { "SyncInterval",        PrintU32 },
+    { "PresentFlags",        PrintU32 },
+    { "Hwnd",                PrintU64Ptr },
+    { "TokenPtr",            PrintU64Ptr },
+    { "QueueSubmitSequence", PrintU32 },
+    { "PresentMode",         PrintPresentMode },
+    { "FinalState",          PrintPresentResult },
+    { "SupportsTearing",     PrintBool },
+    { "MMIO",                PrintBool },
+    { "SeenDxgkPresent",     PrintBool },
+    { "SeenWin32KEvents",    PrintBool },
+    { "WasBatched",          PrintBool },
+    { "DwmNotified",         PrintBool },
+    { "Completed",           PrintBool },
+};
+static_assert(_countof(PRESENT_MEMBERS) == (size_t) DebugPresentMember::Count, "PRESENT_MEMBERS must match DebugPresentMember");
+
+void PrintEvent(DecodeContext const& ctx, DebugRecord const& r)
 {
-    if (gModifiedPresent == nullptr) return;
+    auto fp = ctx.mFile;
+    auto id = r.mEventId;
 
-    uint32_t changedCount = 0;
-#define FLUSH_MEMBER(_Fn, _Name) \
-    if (gModifiedPresent->_Name != gOriginalPresentValues._Name) { \
-        if (changedCount++ == 0) PrintUpdateHeader(gModifiedPresent->Id); \
-        printf(" " #_Name "="); \
-        _Fn(gOriginalPresentValues._Name); \
-        printf("->"); \
-        _Fn(gModifiedPresent->_Name); \
+    switch ((DebugProvider) r.mSubtype) {
+    case DebugProvider::D3D9:
+        switch (id) {
+        case Microsoft_Windows_D3D9::Present_Start::Id: PrintEventHeader(ctx, r); fprintf(fp, "D3D9PresentStart\n"); break;
+        case Microsoft_Windows_D3D9::Present_Stop::Id:  PrintEventHeader(ctx, r); fprintf(fp, "D3D9PresentStop\n"); break;
+        }
+        break;
+
+    case DebugProvider::DXGI:
+        switch (id) {
+        case Microsoft_Windows_DXGI::Present_Start::Id:                  PrintEventHeader(ctx, r); fprintf(fp, "DXGIPresent_Start\n"); break;
+        case Microsoft_Windows_DXGI::Present_Stop::Id:                   PrintEventHeader(ctx, r); fprintf(fp, "DXGIPresent_Stop\n"); break;
+        case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Start::Id: PrintEventHeader(ctx, r); fprintf(fp, "DXGIPresentMPO_Start\n"); break;
+        case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Stop::Id:  PrintEventHeader(ctx, r); fprintf(fp, "DXGIPresentMPO_Stop\n"); break;
+        }
+        break;
+
+    case DebugProvider::DxgKrnl_Win7_Blt:            PrintEventHeader(ctx, r); fprintf(fp, "Win7::BLT\n"); break;
+    case DebugProvider::DxgKrnl_Win7_Flip:           PrintEventHeader(ctx, r); fprintf(fp, "Win7::FLIP\n"); break;
+    case DebugProvider::DxgKrnl_Win7_PresentHistory: PrintEventHeader(ctx, r); fprintf(fp, "Win7::PRESENTHISTORY\n"); break;
+    case DebugProvider::DxgKrnl_Win7_QueuePacket:    PrintEventHeader(ctx, r); fprintf(fp, "Win7::QUEUEPACKET\n"); break;
+    case DebugProvider::DxgKrnl_Win7_VSyncDPC:       PrintEventHeader(ctx, r); fprintf(fp, "Win7::VSYNCDPC\n"); break;
+    case DebugProvider::DxgKrnl_Win7_MMIOFlip:       PrintEventHeader(ctx, r); fprintf(fp, "Win7::MMIOFLIP\n"); break;
+
+    case DebugProvider::DxgKrnl:
+        switch (id) {
+        case Microsoft_Windows_DxgKrnl::Flip_Info::Id:                      PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_Flip\n"); break;
+        case Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id:     PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_FlipMPO\n"); break;
+        case Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id:              PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_QueuePacket_Start"); break;
+        case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:               PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_QueuePacket_Stop"); break;
+        case Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id:                  PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_MMIOFlip\n"); break;
+        case Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id: PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_MMIOFlipMPO\n"); break;
+        case Microsoft_Windows_DxgKrnl::HSyncDPCMultiPlane_Info::Id:        PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_HSyncDPC\n"); break;
+        case Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id:                  PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_VSyncDPC\n"); break;
+        case Microsoft_Windows_DxgKrnl::Present_Info::Id:                   PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_Present\n"); break;
+        case Microsoft_Windows_DxgKrnl::Blit_Info::Id:                      PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_Blit\n"); break;
+        case Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id:           PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_PresentHistory_Start"); break;
+        case Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id:            PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_PresentHistory_Info"); break;
+        case Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id:   PrintEventHeader(ctx, r); fprintf(fp, "DxgKrnl_PresentHistoryDetailed_Start"); break;
+        }
+
+        switch (id) {
+        case Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id:
+        case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:
+            fprintf(fp, " SubmitSequence=%u\n", (uint32_t) r.mValues[0]);
+            break;
+        case Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id:
+        case Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id:
+        case Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id:
+            fprintf(fp, " Token=%llx, Model=", r.mValues[0]);
+            switch (r.mValues[1]) {
+            case D3DKMT_PM_UNINITIALIZED:          fprintf(fp, "UNINITIALIZED");          break;
+            case D3DKMT_PM_REDIRECTED_GDI:         fprintf(fp, "REDIRECTED_GDI");         break;
+            case D3DKMT_PM_REDIRECTED_FLIP:        fprintf(fp, "REDIRECTED_FLIP");        break;
+            case D3DKMT_PM_REDIRECTED_BLT:         fprintf(fp, "REDIRECTED_BLT");         break;
+            case D3DKMT_PM_REDIRECTED_VISTABLT:    fprintf(fp, "REDIRECTED_VISTABLT");    break;
+            case D3DKMT_PM_SCREENCAPTUREFENCE:     fprintf(fp, "SCREENCAPTUREFENCE");     break;
+            case D3DKMT_PM_REDIRECTED_GDI_SYSMEM:  fprintf(fp, "REDIRECTED_GDI_SYSMEM");  break;
+            case D3DKMT_PM_REDIRECTED_COMPOSITION: fprintf(fp, "REDIRECTED_COMPOSITION"); break;
+            default:                               fprintf(fp, "%llu", r.mValues[1]);     break;
+            }
+            fprintf(fp, "\n");
+            break;
+        }
+        break;
+
+    case DebugProvider::Dwm:
+        switch (id) {
+        case Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id:
+                                                                          PrintEventHeader(ctx, r); fprintf(fp, "DWM_GetPresentHistory\n"); break;
+        case Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start::Id:      PrintEventHeader(ctx, r); fprintf(fp, "DWM_SCHEDULE_PRESENT_Start\n"); break;
+        case Microsoft_Windows_Dwm_Core::FlipChain_Pending::Id:           PrintEventHeader(ctx, r); fprintf(fp, "DWM_FlipChain_Pending\n"); break;
+        case Microsoft_Windows_Dwm_Core::FlipChain_Complete::Id:          PrintEventHeader(ctx, r); fprintf(fp, "DWM_FlipChain_Complete\n"); break;
+        case Microsoft_Windows_Dwm_Core::FlipChain_Dirty::Id:             PrintEventHeader(ctx, r); fprintf(fp, "DWM_FlipChain_Dirty\n"); break;
+        case Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id: PrintEventHeader(ctx, r); fprintf(fp, "DWM_Schedule_SurfaceUpdate\n"); break;
+        }
+        break;
+
+    case DebugProvider::Win32k:
+        switch (id) {
+        case Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info::Id:
+            PrintEventHeader(ctx, r);
+            fprintf(fp, "Win32K_TokenCompositionSurfaceObject\n");
+            break;
+        case Microsoft_Windows_Win32k::TokenStateChanged_Info::Id:
+            PrintEventHeader(ctx, r);
+            fprintf(fp, "Win32K_TokenStateChanged Unknown (%u)\n", (uint32_t) r.mValues[0]);
+            break;
+        }
+        break;
+
+    default:
+        break;
     }
-    FLUSH_MEMBER(PrintTimeDelta,     TimeTaken)
-    FLUSH_MEMBER(PrintTimeDelta,     ReadyTime)
-    FLUSH_MEMBER(PrintTimeDelta,     ScreenTime)
-    FLUSH_MEMBER(PrintU64Ptr,        SwapChainAddress)
-    FLUSH_MEMBER(PrintU32,           SyncInterval)
-    FLUSH_MEMBER(PrintU32,           PresentFlags)
-    FLUSH_MEMBER(PrintU64Ptr,        Hwnd)
-    FLUSH_MEMBER(PrintU64Ptr,        TokenPtr)
-    FLUSH_MEMBER(PrintU32,           QueueSubmitSequence)
-    FLUSH_MEMBER(PrintPresentMode,   PresentMode)
-    FLUSH_MEMBER(PrintPresentResult, FinalState)
-    FLUSH_MEMBER(PrintBool,          SupportsTearing)
-    FLUSH_MEMBER(PrintBool,          MMIO)
-    FLUSH_MEMBER(PrintBool,          SeenDxgkPresent)
-    FLUSH_MEMBER(PrintBool,          SeenWin32KEvents)
-    FLUSH_MEMBER(PrintBool,          WasBatched)
-    FLUSH_MEMBER(PrintBool,          DwmNotified)
-    FLUSH_MEMBER(PrintBool,          Completed)
-#undef FLUSH_MEMBER
-    if (changedCount > 0) {
-        printf("\n");
+}
+
+}
+
+void DebugJournal::Initialize(size_t recordCapacity)
+{
+    assert(recordCapacity > 0);
+
+    mRecords.clear();
+    mRecords.resize(recordCapacity);
+    mRecordCount = 0;
+    mPresentCount = 0;
+    mTrace = false;
+    mDone = false;
+    mModifiedPresent = nullptr;
+}
+
+// File layout:
+//     char[4]     "PMDJ"
+//     uint32_t    version
+//     uint64_t    first event QPC
+//     uint64_t    QPC frequency
+//     uint64_t    record count
+//     DebugRecord records[record count], oldest first
+bool DebugJournal::Write(char const* path) const
+{
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path, "wb") != 0) {
+        fprintf(stderr, "error: failed to open debug journal for writing: %s\n", path);
+        return false;
     }
 
-    gModifiedPresent = nullptr;
+    auto capacity = (uint64_t) mRecords.size();
+    auto count = std::min(mRecordCount, capacity);
+    auto first = mRecordCount - count;
+    auto ok =
+        fwrite(JOURNAL_FILE_MAGIC, sizeof(JOURNAL_FILE_MAGIC), 1, fp) == 1 &&
+        WriteValue(fp, JOURNAL_FILE_VERSION) &&
+        WriteValue(fp, (uint64_t) (mFirstTimestamp == nullptr ? 0 : mFirstTimestamp->QuadPart)) &&
+        WriteValue(fp, mClock.mFrequency) &&
+        WriteValue(fp, count);
+
+    // The ring may wrap, in which case the oldest records are at the end.
+    auto begin = (size_t) (first % capacity);
+    auto tailCount = std::min((size_t) count, (size_t) capacity - begin);
+    ok = ok &&
+        fwrite(mRecords.data() + begin, sizeof(DebugRecord), tailCount, fp) == tailCount &&
+        fwrite(mRecords.data(), sizeof(DebugRecord), (size_t) count - tailCount, fp) == (size_t) count - tailCount;
+
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "error: failed to write debug journal: %s\n", path);
+    }
+    return ok;
 }
 
+bool DecodeDebugJournal(char const* path, FILE* out)
+{
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path, "rb") != 0) {
+        fprintf(stderr, "error: failed to open debug journal: %s\n", path);
+        return false;
+    }
+
+    char magic[4] = {};
+    uint32_t version = 0;
+    uint64_t frequency = 0;
+    uint64_t recordCount = 0;
+    DecodeContext ctx = { out, 0 };
+    auto ok =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, JOURNAL_FILE_MAGIC, sizeof(magic)) == 0 &&
+        ReadValue(fp, &version) &&
+        version == JOURNAL_FILE_VERSION &&
+        ReadValue(fp, &ctx.mFirstTimestamp) &&
+        ReadValue(fp, &frequency) &&
+        frequency != 0 &&
+        ReadValue(fp, &recordCount);
+
+    if (ok) {
+        ctx.mClock.Initialize(frequency);
+        fprintf(out, "       Time (ns)   PID   TID EVENT\n");
+    }
+
+    // Each group of ModifyPresent records is printed on one line, which is
+    // ended by the next record that isn't part of the group.
+    auto modifyLine = false;
+    for (uint64_t i = 0; ok && i < recordCount; ++i) {
+        DebugRecord r;
+        ok = ReadValue(fp, &r);
+        if (!ok) {
+            break;
+        }
+
+        if (modifyLine && (r.mType != DebugRecordType::ModifyPresent || (r.mFlags & FIRST_IN_GROUP))) {
+            fprintf(out, "\n");
+            modifyLine = false;
+        }
+
+        switch (r.mType) {
+        case DebugRecordType::Event:
+            PrintEvent(ctx, r);
+            break;
+
+        case DebugRecordType::CreatePresent:
+            PrintUpdateHeader(ctx, r.mId);
+            fprintf(out, " CreatePresent");
+            fprintf(out, " SwapChainAddress=%llx", r.mValues[0]);
+            fprintf(out, " PresentFlags=%x", (uint32_t) r.mValues[1]);
+            fprintf(out, " SyncInterval=%u", (uint32_t) (r.mValues[1] >> 32));
+            fprintf(out, " Runtime=");
+            PrintRuntime(ctx, r.mSubtype);
+            fprintf(out, "\n");
+            break;
+
+        case DebugRecordType::ModifyPresent:
+            if (r.mSubtype >= (uint8_t) DebugPresentMember::Count) {
+                ok = false;
+                break;
+            }
+            if (!modifyLine) {
+                PrintUpdateHeader(ctx, r.mId);
+                modifyLine = true;
+            }
+            fprintf(out, " %s=", PRESENT_MEMBERS[r.mSubtype].mName);
+            PRESENT_MEMBERS[r.mSubtype].mPrint(ctx, r.mValues[0]);
+            fprintf(out, "->");
+            PRESENT_MEMBERS[r.mSubtype].mPrint(ctx, r.mValues[1]);
+            break;
+
+        case DebugRecordType::CompletePresent:
+            PrintUpdateHeader(ctx, r.mId, r.mSubtype);
+            fprintf(out, " Completed=");
+            PrintBool(ctx, false);
+            fprintf(out, "->");
+            PrintBool(ctx, true);
+            fprintf(out, "\n");
+            break;
+
+        default:
+            ok = false;
+            break;
+        }
+    }
+    if (modifyLine) {
+        fprintf(out, "\n");
+    }
+
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "error: invalid or corrupt debug journal: %s\n", path);
+    }
+    return ok;
 }
 
 void DebugInitialize(LARGE_INTEGER* firstTimestamp, LARGE_INTEGER timestampFrequency)
 {
-    gDebugDone = false;
-    gFirstTimestamp = firstTimestamp;
-    gTimestampFrequency = timestampFrequency;
-
-    printf("       Time (ns)   PID   TID EVENT\n");
+    if (gDebugJournal != nullptr) {
+        gDebugJournal->mFirstTimestamp = firstTimestamp;
+        gDebugJournal->mClock.Initialize(timestampFrequency.QuadPart);
+        gDebugJournal->mTrace = false;
+        gDebugJournal->mDone = false;
+    }
 }
 
 bool DebugDone()
 {
-    return gDebugDone;
+    return gDebugJournal != nullptr && gDebugJournal->mDone;
 }
 
-void DebugEvent(EVENT_RECORD* eventRecord, EventMetadata* metadata)
+void DebugJournalEvent(EVENT_RECORD* eventRecord, EventMetadata* metadata)
 {
+    auto journal = gDebugJournal;
     auto const& hdr = eventRecord->EventHeader;
     auto id = hdr.EventDescriptor.Id;
 
-    FlushModifiedPresent();
+    FlushModifiedPresent(journal);
 
-    auto t = ConvertTimestampToNs(hdr.TimeStamp);
-    if (t >= DEBUG_START_TIME_NS) {
-        gDebugTrace = true;
+    // Times are relative to the first event, as the window is.
+    auto first = journal->mFirstTimestamp == nullptr ? 0 : (uint64_t) journal->mFirstTimestamp->QuadPart;
+    auto t = journal->mClock.ToNs(hdr.TimeStamp.QuadPart - first);
+    if (t >= journal->mStartNs) {
+        journal->mTrace = true;
     }
 
-    if (t >= DEBUG_STOP_TIME_NS) {
-        gDebugTrace = false;
-        gDebugDone = true;
+    if (t >= journal->mStopNs) {
+        journal->mTrace = false;
+        journal->mDone = true;
     }
 
-    if (!gDebugTrace) {
+    if (!journal->mTrace) {
         return;
     }
 
-    if (hdr.ProviderId == Microsoft_Windows_D3D9::GUID) {
-        switch (id) {
-        case Microsoft_Windows_D3D9::Present_Start::Id: PrintEventHeader(hdr); printf("D3D9PresentStart\n"); break;
-        case Microsoft_Windows_D3D9::Present_Stop::Id:  PrintEventHeader(hdr); printf("D3D9PresentStop\n"); break;
-        }
-        return;
-    }
-
-    if (hdr.ProviderId == Microsoft_Windows_DXGI::GUID) {
-        switch (id) {
-        case Microsoft_Windows_DXGI::Present_Start::Id:                  PrintEventHeader(hdr); printf("DXGIPresent_Start\n"); break;
-        case Microsoft_Windows_DXGI::Present_Stop::Id:                   PrintEventHeader(hdr); printf("DXGIPresent_Stop\n"); break;
-        case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Start::Id: PrintEventHeader(hdr); printf("DXGIPresentMPO_Start\n"); break;
-        case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Stop::Id:  PrintEventHeader(hdr); printf("DXGIPresentMPO_Stop\n"); break;
-        }
-        return;
-    }
-
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::BLT_GUID)            { PrintEventHeader(hdr); printf("Win7::BLT\n"); return; }
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID)           { PrintEventHeader(hdr); printf("Win7::FLIP\n"); return; }
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID) { PrintEventHeader(hdr); printf("Win7::PRESENTHISTORY\n"); return; }
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID)    { PrintEventHeader(hdr); printf("Win7::QUEUEPACKET\n"); return; }
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID)       { PrintEventHeader(hdr); printf("Win7::VSYNCDPC\n"); return; }
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID)       { PrintEventHeader(hdr); printf("Win7::MMIOFLIP\n"); return; }
-
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::GUID) {
-        switch (id) {
-        case Microsoft_Windows_DxgKrnl::Flip_Info::Id:                      PrintEventHeader(hdr); printf("DxgKrnl_Flip\n"); break;
-        case Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id:     PrintEventHeader(hdr); printf("DxgKrnl_FlipMPO\n"); break;
-        case Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id:              PrintEventHeader(hdr); printf("DxgKrnl_QueuePacket_Start"); break;
-        case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:               PrintEventHeader(hdr); printf("DxgKrnl_QueuePacket_Stop"); break;
-        case Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id:                  PrintEventHeader(hdr); printf("DxgKrnl_MMIOFlip\n"); break;
-        case Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id: PrintEventHeader(hdr); printf("DxgKrnl_MMIOFlipMPO\n"); break;
-        case Microsoft_Windows_DxgKrnl::HSyncDPCMultiPlane_Info::Id:        PrintEventHeader(hdr); printf("DxgKrnl_HSyncDPC\n"); break;
-        case Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id:                  PrintEventHeader(hdr); printf("DxgKrnl_VSyncDPC\n"); break;
-        case Microsoft_Windows_DxgKrnl::Present_Info::Id:                   PrintEventHeader(hdr); printf("DxgKrnl_Present\n"); break;
-        case Microsoft_Windows_DxgKrnl::Blit_Info::Id:                      PrintEventHeader(hdr); printf("DxgKrnl_Blit\n"); break;
-        case Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id:           PrintEventHeader(hdr); printf("DxgKrnl_PresentHistory_Start"); break;
-        case Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id:            PrintEventHeader(hdr); printf("DxgKrnl_PresentHistory_Info"); break;
-        case Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id:   PrintEventHeader(hdr); printf("DxgKrnl_PresentHistoryDetailed_Start"); break;
-        }
+    DebugRecord record = {};
+    record.mType = DebugRecordType::Event;
+    record.mSubtype = (uint8_t) GetProvider(hdr.ProviderId);
+    record.mEventId = id;
+    record.mProcessId = hdr.ProcessId;
+    record.mThreadId = hdr.ThreadId;
+    record.mId = hdr.TimeStamp.QuadPart;
 
+    // Decode the properties that the text output includes.
+    if ((DebugProvider) record.mSubtype == DebugProvider::DxgKrnl) {
         switch (id) {
         case Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id:
         case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:
-            printf(" SubmitSequence=%u\n", metadata->GetEventData<uint32_t>(eventRecord, L"SubmitSequence"));
+            record.mValues[0] = metadata->GetEventData<uint32_t>(eventRecord, L"SubmitSequence");
             break;
         // The first part of the event data is the same for all these (detailed
         // has other members after).
         case Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id:
         case Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id:
         case Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id:
-            printf(" Token=%llx, Model=", metadata->GetEventData<uint64_t>(eventRecord, L"Token"));
-            switch (metadata->GetEventData<uint32_t>(eventRecord, L"Model")) {
-            case D3DKMT_PM_UNINITIALIZED:          printf("UNINITIALIZED");          break;
-            case D3DKMT_PM_REDIRECTED_GDI:         printf("REDIRECTED_GDI");         break;
-            case D3DKMT_PM_REDIRECTED_FLIP:        printf("REDIRECTED_FLIP");        break;
-            case D3DKMT_PM_REDIRECTED_BLT:         printf("REDIRECTED_BLT");         break;
-            case D3DKMT_PM_REDIRECTED_VISTABLT:    printf("REDIRECTED_VISTABLT");    break;
-            case D3DKMT_PM_SCREENCAPTUREFENCE:     printf("SCREENCAPTUREFENCE");     break;
-            case D3DKMT_PM_REDIRECTED_GDI_SYSMEM:  printf("REDIRECTED_GDI_SYSMEM");  break;
-            case D3DKMT_PM_REDIRECTED_COMPOSITION: printf("REDIRECTED_COMPOSITION"); break;
-            default:                               assert(false);                    break;
-            }
-            printf("\n");
-        }
-        return;
-    }
-
-    if (hdr.ProviderId == Microsoft_Windows_Dwm_Core::GUID ||
-        hdr.ProviderId == Microsoft_Windows_Dwm_Core::Win7::GUID) {
-        switch (id) {
-        case Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id:
-                                                                          PrintEventHeader(hdr); printf("DWM_GetPresentHistory\n"); break;
-        case Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start::Id:      PrintEventHeader(hdr); printf("DWM_SCHEDULE_PRESENT_Start\n"); break;
-        case Microsoft_Windows_Dwm_Core::FlipChain_Pending::Id:           PrintEventHeader(hdr); printf("DWM_FlipChain_Pending\n"); break;
-        case Microsoft_Windows_Dwm_Core::FlipChain_Complete::Id:          PrintEventHeader(hdr); printf("DWM_FlipChain_Complete\n"); break;
-        case Microsoft_Windows_Dwm_Core::FlipChain_Dirty::Id:             PrintEventHeader(hdr); printf("DWM_FlipChain_Dirty\n"); break;
-        case Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id: PrintEventHeader(hdr); printf("DWM_Schedule_SurfaceUpdate\n"); break;
-        }
-        return;
-    }
-
-    if (hdr.ProviderId == Microsoft_Windows_Win32k::GUID) {
-        switch (id) {
-        case Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info::Id:
-            PrintEventHeader(hdr);
-            printf("Win32K_TokenCompositionSurfaceObject\n");
-            break;
-        case Microsoft_Windows_Win32k::TokenStateChanged_Info::Id:
-            PrintEventHeader(hdr);
-            printf("Win32K_TokenStateChanged ");
-
-            switch (metadata->GetEventData<uint32_t>(eventRecord, L"NewState")) {
-                /*
-            case Microsoft_Windows_Win32k::TokenState::Completed: printf("Completed\n"); break;
-            case Microsoft_Windows_Win32k::TokenState::InFrame:   printf("InFrame\n");   break;
-            case Microsoft_Windows_Win32k::TokenState::Confirmed: printf("Confirmed\n"); break;
-            case Microsoft_Windows_Win32k::TokenState::Retired:   printf("Retired\n");   break;
-            case Microsoft_Windows_Win32k::TokenState::Discarded: printf("Discarded\n"); break;*/
-            default:                                              printf("Unknown (%u)\n", metadata->GetEventData<uint32_t>(eventRecord, L"NewState")); break;
-            }
+            record.mValues[0] = metadata->GetEventData<uint64_t>(eventRecord, L"Token");
+            record.mValues[1] = metadata->GetEventData<uint32_t>(eventRecord, L"Model");
             break;
         }
-        return;
+    } else if ((DebugProvider) record.mSubtype == DebugProvider::Win32k &&
+               id == Microsoft_Windows_Win32k::TokenStateChanged_Info::Id) {
+        record.mValues[0] = metadata->GetEventData<uint32_t>(eventRecord, L"NewState");
     }
 
-    assert(false);
+    journal->Append(record);
 }
 
-void DebugModifyPresent(PresentEvent const& p)
+void DebugJournalModifyPresent(PresentEvent const& p)
 {
-    if (!gDebugTrace) return;
-    if (gModifiedPresent != &p) {
-        FlushModifiedPresent();
-
-        gModifiedPresent = &p;
-
-        gOriginalPresentValues.TimeTaken           = p.TimeTaken;
-        gOriginalPresentValues.ReadyTime           = p.ReadyTime;
-        gOriginalPresentValues.ScreenTime          = p.ScreenTime;
-        gOriginalPresentValues.SwapChainAddress    = p.SwapChainAddress;
-        gOriginalPresentValues.SyncInterval        = p.SyncInterval;
-        gOriginalPresentValues.PresentFlags        = p.PresentFlags;
-        gOriginalPresentValues.Hwnd                = p.Hwnd;
-        gOriginalPresentValues.TokenPtr            = p.TokenPtr;
-        gOriginalPresentValues.QueueSubmitSequence = p.QueueSubmitSequence;
-        gOriginalPresentValues.PresentMode         = p.PresentMode;
-        gOriginalPresentValues.FinalState          = p.FinalState;
-        gOriginalPresentValues.SupportsTearing     = p.SupportsTearing;
-        gOriginalPresentValues.MMIO                = p.MMIO;
-        gOriginalPresentValues.SeenDxgkPresent     = p.SeenDxgkPresent;
-        gOriginalPresentValues.SeenWin32KEvents    = p.SeenWin32KEvents;
-        gOriginalPresentValues.WasBatched          = p.WasBatched;
-        gOriginalPresentValues.DwmNotified         = p.DwmNotified;
-        gOriginalPresentValues.Completed           = p.Completed;
+    auto journal = gDebugJournal;
+    if (!journal->mTrace) return;
+    if (journal->mModifiedPresent != &p) {
+        FlushModifiedPresent(journal);
+        journal->mModifiedPresent = &p;
+        GetPresentValues(p, journal->mOriginalValues);
     }
 }
 
-void DebugCreatePresent(PresentEvent const& p)
+void DebugJournalCreatePresent(PresentEvent const& p)
 {
-    if (!gDebugTrace) return;
-    FlushModifiedPresent();
-    PrintUpdateHeader(p.Id);
-    printf(" CreatePresent");
-    printf(" SwapChainAddress=%llx", p.SwapChainAddress);
-    printf(" PresentFlags=%x", p.PresentFlags);
-    printf(" SyncInterval=%u", p.SyncInterval);
-    printf(" Runtime=");
-    PrintRuntime(p.Runtime);
-    printf("\n");
+    auto journal = gDebugJournal;
+    if (!journal->mTrace) return;
+    FlushModifiedPresent(journal);
+
+    DebugRecord record = {};
+    record.mType = DebugRecordType::CreatePresent;
+    record.mSubtype = (uint8_t) p.Runtime;
+    record.mId = p.Id;
+    record.mValues[0] = p.SwapChainAddress;
+    record.mValues[1] = (uint64_t) p.PresentFlags | ((uint64_t) (uint32_t) p.SyncInterval << 32);
+    journal->Append(record);
 }
 
-void DebugCompletePresent(PresentEvent const& p, int indent)
+void DebugJournalCompletePresent(PresentEvent const& p, int indent)
 {
-    if (!gDebugTrace) return;
-    FlushModifiedPresent();
-    PrintUpdateHeader(p.Id, indent);
-    printf(" Completed=");
-    PrintBool(p.Completed);
-    printf("->");
-    PrintBool(true);
-    printf("\n");
+    auto journal = gDebugJournal;
+    if (!journal->mTrace) return;
+    FlushModifiedPresent(journal);
+
+    DebugRecord record = {};
+    record.mType = DebugRecordType::CompletePresent;
+    record.mSubtype = (uint8_t) indent;
+    record.mId = p.Id;
+    journal->Append(record);
 }
-
-#endif // if DEBUG_VERBOSE
@@ -22,33 +22,164 @@ SOFTWARE.
 
 #pragma once
 
-#define DEBUG_VERBOSE 0
-#if DEBUG_VERBOSE
-
-// Time relative to first event
-#define DEBUG_START_TIME_NS     0ull
-#define DEBUG_STOP_TIME_NS      UINT64_MAX
-
 #include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "QpcClock.hpp"
 
 struct PresentEvent; // Can't include PresentMonTraceConsumer.hpp because it includes Debug.hpp (before defining PresentEvent)
 struct EventMetadata;
 struct _EVENT_RECORD;
 
+enum class DebugRecordType : uint8_t {
+    Event,
+    CreatePresent,
+    ModifyPresent,
+    CompletePresent,
+};
+
+// The providers whose events DecodeDebugJournal() knows how to name.
+enum class DebugProvider : uint8_t {
+    Other,
+    D3D9,
+    DXGI,
+    DxgKrnl,
+    DxgKrnl_Win7_Blt,
+    DxgKrnl_Win7_Flip,
+    DxgKrnl_Win7_PresentHistory,
+    DxgKrnl_Win7_QueuePacket,
+    DxgKrnl_Win7_VSyncDPC,
+    DxgKrnl_Win7_MMIOFlip,
+    Dwm,
+    Win32k,
+};
+
+// The PresentEvent members whose changes are recorded.
+enum class DebugPresentMember : uint8_t {
+    TimeTaken,
+    ReadyTime,
+    ScreenTime,
+    SwapChainAddress,
+    SyncInterval,
+    PresentFlags,
+    Hwnd,
+    TokenPtr,
+    QueueSubmitSequence,
+    PresentMode,
+    FinalState,
+    SupportsTearing,
+    MMIO,
+    SeenDxgkPresent,
+    SeenWin32KEvents,
+    WasBatched,
+    DwmNotified,
+    Completed,
+    Count
+};
+
+// One journal entry.  The meaning of the fields depends on mType:
+//
+//                  mSubtype            mFlags          mId         mValues
+//  Event           DebugProvider       -               QPC time    event-specific decoded properties
+//  CreatePresent   Runtime             -               present id  SwapChainAddress, PresentFlags | SyncInterval << 32
+//  ModifyPresent   DebugPresentMember  first in group  present id  old value, new value
+//  CompletePresent recursion depth     -               present id  -
+//
+// mEventId, mProcessId and mThreadId are only used by Event records.
+struct DebugRecord {
+    DebugRecordType mType;
+    uint8_t mSubtype;
+    uint16_t mEventId;
+    uint32_t mFlags;
+    uint32_t mProcessId;
+    uint32_t mThreadId;
+    uint64_t mId;
+    uint64_t mValues[2];
+};
+
+// DebugJournal records the events PMTraceConsumer handles and the changes
+// it makes to each PresentEvent as fixed-size binary records in a ring, so
+// that the last mRecords.size() records can be written out with Write() and
+// rendered as text later by DecodeDebugJournal().
+//
+// Journaling is enabled by pointing gDebugJournal at an initialized
+// DebugJournal before the session starts.  When gDebugJournal is nullptr
+// each Debug*() hook is a single pointer test.  Only events within
+// [mStartNs, mStopNs) of the first event are recorded.
+//
+// The journal is written to by the event handling thread only, so it can't
+// be shared by several consumers running at once (e.g., batch mode).
+struct DebugJournal {
+    std::vector<DebugRecord> mRecords;
+    uint64_t mRecordCount = 0;          // Total records appended; the ring holds the last min(mRecordCount, mRecords.size())
+    uint64_t mPresentCount = 0;         // Used to assign PresentEvent::Id
+    uint64_t mStartNs = 0;
+    uint64_t mStopNs = UINT64_MAX;
+
+    LARGE_INTEGER* mFirstTimestamp = nullptr;
+    QpcClock mClock;                    // Initialized by DebugInitialize()
+    bool mTrace = false;
+    bool mDone = false;
+
+    // The present being modified since the last record, and the values it
+    // had before; the differences are recorded once another hook is called.
+    PresentEvent const* mModifiedPresent = nullptr;
+    uint64_t mOriginalValues[(size_t) DebugPresentMember::Count] = {};
+
+    void Initialize(size_t recordCapacity);
+    bool Write(char const* path) const;
+
+    void Append(DebugRecord const& record)
+    {
+        mRecords[mRecordCount % mRecords.size()] = record;
+        mRecordCount += 1;
+    }
+};
+
+extern DebugJournal* gDebugJournal;
+
+// Render a journal written by DebugJournal::Write() as text, one line per
+// event, created or completed present, or group of present modifications.
+bool DecodeDebugJournal(char const* path, FILE* fp);
+
 void DebugInitialize(LARGE_INTEGER* firstTimestamp, LARGE_INTEGER timestampFrequency);
 bool DebugDone();
-void DebugEvent(_EVENT_RECORD* eventRecord, EventMetadata* metadata);
-void DebugCreatePresent(PresentEvent const& p);
-void DebugModifyPresent(PresentEvent const& p);
-void DebugCompletePresent(PresentEvent const& p, int indent);
 
-#else
+void DebugJournalEvent(_EVENT_RECORD* eventRecord, EventMetadata* metadata);
+void DebugJournalCreatePresent(PresentEvent const& p);
+void DebugJournalModifyPresent(PresentEvent const& p);
+void DebugJournalCompletePresent(PresentEvent const& p, int indent);
+
+inline uint64_t DebugNextPresentId()
+{
+    return gDebugJournal == nullptr ? 0 : ++gDebugJournal->mPresentCount;
+}
+
+inline void DebugEvent(_EVENT_RECORD* eventRecord, EventMetadata* metadata)
+{
+    if (gDebugJournal != nullptr) {
+        DebugJournalEvent(eventRecord, metadata);
+    }
+}
+
+inline void DebugCreatePresent(PresentEvent const& p)
+{
+    if (gDebugJournal != nullptr) {
+        DebugJournalCreatePresent(p);
+    }
+}
 
-#define DebugInitialize(firstTimestamp, timestampFrequency) (void) firstTimestamp, timestampFrequency
-#define DebugDone()                                         false
-#define DebugEvent(eventRecord, metadata)                   (void) eventRecord, metadata
-#define DebugCreatePresent(p)                               (void) p
-#define DebugModifyPresent(p)                               (void) p
-#define DebugCompletePresent(p, indent)                     (void) p, indent
+inline void DebugModifyPresent(PresentEvent const& p)
+{
+    if (gDebugJournal != nullptr) {
+        DebugJournalModifyPresent(p);
+    }
+}
 
-#endif
+inline void DebugCompletePresent(PresentEvent const& p, int indent)
+{
+    if (gDebugJournal != nullptr) {
+        DebugJournalCompletePresent(p, indent);
+    }
+}
@@ -0,0 +1,340 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "DecodeBenchmark.hpp"
+#include "SyntheticEventInfo.hpp"
+#include "TraceConsumer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <wchar.h>
+
+namespace {
+
+// Not a real provider; only used to key the synthetic metadata.
+GUID const BENCHMARK_PROVIDER_GUID = { 0x6a1c7e52, 0x3d4b, 0x4f0e, { 0x9b, 0x27, 0x58, 0xc1, 0x0e, 0x7d, 0x2a, 0x93 } };
+
+uint32_t const CALLS_PER_RUN = 1000000;
+uint32_t const RUN_COUNT = 5;
+
+// Decoded pointers are accumulated here so the calls aren't optimized away.
+volatile uintptr_t gSink = 0;
+
+struct BenchmarkLookup {
+    wchar_t const* mName;
+    uint32_t mArrayIndex;
+    uint32_t mExpectedSize;
+};
+
+struct BenchmarkCase {
+    char const* mName;
+    bool m64BitHeader;
+    uint32_t mTopLevelPropertyCount;
+    std::vector<SyntheticProperty> mProperties;  // Top-level properties followed by struct members
+    std::vector<uint8_t> mUserData;
+    std::vector<BenchmarkLookup> mLookups;       // Descriptors passed to each GetEventData() call
+};
+
+SyntheticProperty Scalar(wchar_t const* name, USHORT inType, USHORT length)
+{
+    return SyntheticProperty{ name, inType, 0, length, 1, 0, 0 };
+}
+
+SyntheticProperty String(wchar_t const* name, USHORT inType)
+{
+    return SyntheticProperty{ name, inType, 0, 0, 1, 0, 0 };
+}
+
+SyntheticProperty ParamCountArray(wchar_t const* name, USHORT inType, USHORT length, USHORT countPropertyIndex)
+{
+    return SyntheticProperty{ name, inType, PropertyParamCount, length, countPropertyIndex, 0, 0 };
+}
+
+SyntheticProperty Struct(wchar_t const* name, USHORT count, USHORT structStartIndex, USHORT structMemberCount)
+{
+    return SyntheticProperty{ name, 0, PropertyStruct, 0, count, structStartIndex, structMemberCount };
+}
+
+template<typename T>
+void Append(std::vector<uint8_t>* data, T value)
+{
+    auto p = (uint8_t const*) &value;
+    data->insert(data->end(), p, p + sizeof(T));
+}
+
+template<typename T>
+void AppendString(std::vector<uint8_t>* data, T const* s, bool terminate)
+{
+    for (; *s != (T) 0; ++s) {
+        Append(data, *s);
+    }
+    if (terminate) {
+        Append(data, (T) 0);
+    }
+}
+
+std::vector<BenchmarkCase> GetBenchmarkCases()
+{
+    std::vector<BenchmarkCase> cases;
+
+    // Fixed-size scalars, looking up the first, the last, and all of them.
+    {
+        BenchmarkCase c = {};
+        c.mName = "scalars/first";
+        c.m64BitHeader = true;
+        c.mProperties = {
+            Scalar(L"hContext",     TDH_INTYPE_POINTER, 8),
+            Scalar(L"PacketType",   TDH_INTYPE_UINT32,  4),
+            Scalar(L"SubmitSequence", TDH_INTYPE_UINT32, 4),
+            Scalar(L"DmaBuffer",    TDH_INTYPE_UINT64,  8),
+            Scalar(L"FenceId",      TDH_INTYPE_UINT64,  8),
+            Scalar(L"Flags",        TDH_INTYPE_UINT32,  4),
+            Scalar(L"Interval",     TDH_INTYPE_INT32,   4),
+            Scalar(L"bPresent",     TDH_INTYPE_UINT8,   1),
+        };
+        c.mTopLevelPropertyCount = (uint32_t) c.mProperties.size();
+        Append<uint64_t>(&c.mUserData, 0xffffc0012345a000ull);
+        Append<uint32_t>(&c.mUserData, 1);
+        Append<uint32_t>(&c.mUserData, 1234);
+        Append<uint64_t>(&c.mUserData, 0x12345678ull);
+        Append<uint64_t>(&c.mUserData, 42);
+        Append<uint32_t>(&c.mUserData, 0);
+        Append<int32_t>(&c.mUserData, 1);
+        Append<uint8_t>(&c.mUserData, 1);
+        c.mLookups = { { L"hContext", 0, 8 } };
+        cases.push_back(c);
+
+        c.mName = "scalars/last";
+        c.mLookups = { { L"bPresent", 0, 1 } };
+        cases.push_back(c);
+
+        c.mName = "scalars/all";
+        c.mLookups = {
+            { L"hContext", 0, 8 }, { L"PacketType", 0, 4 }, { L"SubmitSequence", 0, 4 }, { L"DmaBuffer", 0, 8 },
+            { L"FenceId",  0, 8 }, { L"Flags",      0, 4 }, { L"Interval",       0, 4 }, { L"bPresent",  0, 1 },
+        };
+        cases.push_back(c);
+    }
+
+    // Pointer and SIZET sizes come from the event header rather than the
+    // metadata.
+    for (auto is64Bit : { false, true }) {
+        BenchmarkCase c = {};
+        c.mName = is64Bit ? "pointer/64-bit header" : "pointer/32-bit header";
+        c.m64BitHeader = is64Bit;
+        c.mProperties = {
+            Scalar(L"pSwapChain", TDH_INTYPE_POINTER, 0),
+            Scalar(L"Size",       TDH_INTYPE_SIZET,   0),
+            Scalar(L"Flags",      TDH_INTYPE_UINT32,  4),
+        };
+        c.mTopLevelPropertyCount = (uint32_t) c.mProperties.size();
+        uint32_t pointerSize = is64Bit ? 8 : 4;
+        if (is64Bit) {
+            Append<uint64_t>(&c.mUserData, 0x000001d2c0a81230ull);
+            Append<uint64_t>(&c.mUserData, 4096);
+        } else {
+            Append<uint32_t>(&c.mUserData, 0x0c0a8123);
+            Append<uint32_t>(&c.mUserData, 4096);
+        }
+        Append<uint32_t>(&c.mUserData, 0);
+        c.mLookups = { { L"pSwapChain", 0, pointerSize }, { L"Size", 0, pointerSize }, { L"Flags", 0, 4 } };
+        cases.push_back(c);
+    }
+
+    // Strings followed by another property, so the string has to be scanned
+    // to find the next offset.
+    {
+        char const* ansi = "C:\\Program Files\\Game\\bin\\game.exe";
+        wchar_t const* unicode = L"C:\\Program Files\\Game\\bin\\game.exe";
+        auto ansiSize = (uint32_t) (strlen(ansi) + 1);
+        auto unicodeSize = (uint32_t) ((wcslen(unicode) + 1) * sizeof(wchar_t));
+
+        BenchmarkCase c = {};
+        c.mName = "ansi string/terminated";
+        c.m64BitHeader = true;
+        c.mProperties = {
+            String(L"ImageName", TDH_INTYPE_ANSISTRING),
+            Scalar(L"ProcessId", TDH_INTYPE_UINT32, 4),
+        };
+        c.mTopLevelPropertyCount = (uint32_t) c.mProperties.size();
+        AppendString(&c.mUserData, ansi, true);
+        Append<uint32_t>(&c.mUserData, 1234);
+        c.mLookups = { { L"ImageName", 0, ansiSize }, { L"ProcessId", 0, 4 } };
+        cases.push_back(c);
+
+        c.mName = "unicode string/terminated";
+        c.mProperties[0].mInType = TDH_INTYPE_UNICODESTRING;
+        c.mUserData.clear();
+        AppendString(&c.mUserData, unicode, true);
+        Append<uint32_t>(&c.mUserData, 1234);
+        c.mLookups = { { L"ImageName", 0, unicodeSize }, { L"ProcessId", 0, 4 } };
+        cases.push_back(c);
+
+        // Some providers don't terminate a trailing string; it then runs to
+        // the end of UserData.
+        c.mName = "ansi string/unterminated";
+        c.mProperties = {
+            Scalar(L"ProcessId", TDH_INTYPE_UINT32, 4),
+            String(L"ImageName", TDH_INTYPE_ANSISTRING),
+        };
+        c.mTopLevelPropertyCount = (uint32_t) c.mProperties.size();
+        c.mUserData.clear();
+        Append<uint32_t>(&c.mUserData, 1234);
+        AppendString(&c.mUserData, ansi, false);
+        c.mLookups = { { L"ProcessId", 0, 4 }, { L"ImageName", 0, ansiSize - 1 } };
+        cases.push_back(c);
+
+        c.mName = "unicode string/unterminated";
+        c.mProperties[1].mInType = TDH_INTYPE_UNICODESTRING;
+        c.mUserData.clear();
+        Append<uint32_t>(&c.mUserData, 1234);
+        AppendString(&c.mUserData, unicode, false);
+        c.mLookups = { { L"ProcessId", 0, 4 }, { L"ImageName", 0, unicodeSize - (uint32_t) sizeof(wchar_t) } };
+        cases.push_back(c);
+    }
+
+    // An array whose length is given by an earlier property.
+    {
+        uint32_t const count = 16;
+
+        BenchmarkCase c = {};
+        c.mName = "array/param count";
+        c.m64BitHeader = true;
+        c.mProperties = {
+            Scalar(L"AllocationCount", TDH_INTYPE_UINT32, 4),
+            ParamCountArray(L"Allocations", TDH_INTYPE_UINT64, 8, 0),
+            Scalar(L"Flags", TDH_INTYPE_UINT32, 4),
+        };
+        c.mTopLevelPropertyCount = (uint32_t) c.mProperties.size();
+        Append<uint32_t>(&c.mUserData, count);
+        for (uint32_t i = 0; i < count; ++i) {
+            Append<uint64_t>(&c.mUserData, 0xffffc00100000000ull + i * 0x1000);
+        }
+        Append<uint32_t>(&c.mUserData, 0);
+        c.mLookups = { { L"Allocations", count - 1, 8 }, { L"Flags", 0, 4 } };
+        cases.push_back(c);
+    }
+
+    // An array of structs; members are stored after the top-level properties.
+    {
+        uint32_t const count = 2;
+
+        BenchmarkCase c = {};
+        c.mName = "struct/nested";
+        c.m64BitHeader = true;
+        c.mProperties = {
+            Scalar(L"RectCount", TDH_INTYPE_UINT32, 4),
+            Struct(L"DirtyRects", (USHORT) count, 3, 4),
+            Scalar(L"Flags", TDH_INTYPE_UINT32, 4),
+            Scalar(L"left",   TDH_INTYPE_INT32, 4),
+            Scalar(L"top",    TDH_INTYPE_INT32, 4),
+            Scalar(L"right",  TDH_INTYPE_INT32, 4),
+            Scalar(L"bottom", TDH_INTYPE_INT32, 4),
+        };
+        c.mTopLevelPropertyCount = 3;
+        Append<uint32_t>(&c.mUserData, count);
+        for (uint32_t i = 0; i < count; ++i) {
+            Append<int32_t>(&c.mUserData, 0);
+            Append<int32_t>(&c.mUserData, 0);
+            Append<int32_t>(&c.mUserData, 1920);
+            Append<int32_t>(&c.mUserData, 1080);
+        }
+        Append<uint32_t>(&c.mUserData, 0);
+        c.mLookups = { { L"DirtyRects", count - 1, 16 }, { L"Flags", 0, 4 } };
+        cases.push_back(c);
+    }
+
+    return cases;
+}
+
+void ResetDescriptors(BenchmarkCase const& c, EventDataDesc* desc)
+{
+    for (size_t i = 0, n = c.mLookups.size(); i < n; ++i) {
+        desc[i] = EventDataDesc{ c.mLookups[i].mName, c.mLookups[i].mArrayIndex, };
+    }
+}
+
+}
+
+bool RunDecodeBenchmark()
+{
+    auto cases = GetBenchmarkCases();
+
+    printf("Case, Descriptors, NsPerCall\n");
+
+    EventMetadata metadata;
+    for (size_t ci = 0, cn = cases.size(); ci < cn; ++ci) {
+        auto const& c = cases[ci];
+
+        EVENT_RECORD eventRecord = {};
+        eventRecord.EventHeader.ProviderId = BENCHMARK_PROVIDER_GUID;
+        eventRecord.EventHeader.EventDescriptor.Id = (USHORT) ci;
+        eventRecord.EventHeader.Flags = c.m64BitHeader ? EVENT_HEADER_FLAG_64_BIT_HEADER : EVENT_HEADER_FLAG_32_BIT_HEADER;
+        eventRecord.UserData = (void*) c.mUserData.data();
+        eventRecord.UserDataLength = (USHORT) c.mUserData.size();
+
+        EventMetadataKey key;
+        memset(&key, 0, sizeof(key));
+        key.guid_ = eventRecord.EventHeader.ProviderId;
+        key.desc_ = eventRecord.EventHeader.EventDescriptor;
+        metadata.metadata_[key] = BuildTraceEventInfo(key.guid_, key.desc_, c.mProperties.data(), (uint32_t) c.mProperties.size(),
+                                                      c.mTopLevelPropertyCount);
+
+        // Check that every descriptor decodes to the expected size before
+        // timing anything.
+        auto descCount = (uint32_t) c.mLookups.size();
+        std::vector<EventDataDesc> desc(descCount);
+        ResetDescriptors(c, desc.data());
+        metadata.GetEventData(&eventRecord, desc.data(), descCount, descCount);
+        for (uint32_t i = 0; i < descCount; ++i) {
+            if (desc[i].status_ == PROP_STATUS_NOT_FOUND || desc[i].size_ != c.mLookups[i].mExpectedSize) {
+                fprintf(stderr, "error: decode benchmark case '%s' failed to decode %ls (size %u, expected %u).\n",
+                    c.mName, c.mLookups[i].mName, desc[i].size_, c.mLookups[i].mExpectedSize);
+                return false;
+            }
+        }
+
+        // Report the best of several runs, which is more stable than the mean
+        // when the machine is busy.
+        double bestNs = 0.;
+        uintptr_t sink = 0;
+        for (uint32_t run = 0; run < RUN_COUNT; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t call = 0; call < CALLS_PER_RUN; ++call) {
+                ResetDescriptors(c, desc.data());
+                metadata.GetEventData(&eventRecord, desc.data(), descCount);
+                sink += (uintptr_t) desc[descCount - 1].data_;
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            auto ns = std::chrono::duration<double, std::nano>(end - start).count() / CALLS_PER_RUN;
+            bestNs = run == 0 ? ns : std::min(bestNs, ns);
+        }
+        gSink = sink;
+
+        printf("%s, %u, %.1f\n", c.mName, descCount, bestNs);
+    }
+
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+// Measure the cost of EventMetadata::GetEventData() on synthetic events.
+//
+// Each case builds a TRACE_EVENT_INFO blob and matching UserData covering one
+// of the property layouts the decoder handles (fixed scalars, pointer/SIZET
+// with 32- and 64-bit headers, terminated and unterminated ANSI and Unicode
+// strings, PropertyParamCount arrays, and nested PropertyStruct members).
+// The metadata is stored in the EventMetadata before timing, so neither TDH
+// nor a trace session is involved while timing.  It runs from the Windows
+// build with -decode_benchmark, or standalone from decode-benchmark/, which
+// also builds on Linux with a small Windows SDK shim.  There wchar_t is 4
+// bytes, so the Unicode string cases scan 4-byte characters.
+//
+// The table is printed to stdout as CSV, one row per case, with the best
+// ns/call over several runs.  Returns false if a case fails to decode.
+bool RunDecodeBenchmark();
@@ -0,0 +1,164 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "EventRing.hpp"
+
+#include <assert.h>
+#include <intrin.h>
+#include <malloc.h>
+#include <string.h>
+
+namespace {
+
+uint32_t AlignEntrySize(uint32_t size)
+{
+    return (size + 7) & ~7u;
+}
+
+static_assert((sizeof(EventRing::EntryHeader) & 7) == 0, "extended data items must follow EntryHeader 8-byte aligned");
+
+}
+
+EventRing::~EventRing()
+{
+    _aligned_free(mBuffer);
+}
+
+bool EventRing::Initialize(uint64_t capacity)
+{
+    assert(mBuffer == nullptr);
+
+    // Round up to a power of two, and make sure the largest possible event
+    // (64KB of UserData) fits.
+    uint64_t size = 1024 * 1024;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    mBuffer = (uint8_t*) _aligned_malloc((size_t) size, 64);
+    if (mBuffer == nullptr) {
+        return false;
+    }
+    mCapacity = size;
+    return true;
+}
+
+void EventRing::Push(EVENT_RECORD const* eventRecord)
+{
+    auto startCycles = __rdtsc();
+
+    auto itemCount = (uint32_t) eventRecord->ExtendedDataCount;
+    auto dataOffset = AlignEntrySize((uint32_t) (sizeof(EntryHeader) + itemCount * sizeof(EVENT_HEADER_EXTENDED_DATA_ITEM)) +
+                                     eventRecord->UserDataLength);
+    auto entrySize = dataOffset;
+    for (uint32_t i = 0; i < itemCount; ++i) {
+        entrySize += AlignEntrySize(eventRecord->ExtendedData[i].DataSize);
+    }
+
+    auto writePos = mWritePos.load(std::memory_order_relaxed);
+    auto offset = writePos & (mCapacity - 1);
+    auto contiguous = mCapacity - offset;
+
+    // If the entry doesn't fit before the end of the buffer, it is preceded by
+    // a padding entry that covers the rest of the buffer.
+    auto required = contiguous < entrySize ? contiguous + entrySize : entrySize;
+    if (mCapacity - (writePos - mReadPos.load(std::memory_order_acquire)) < required) {
+        mFullStallCount += 1;
+        do {
+            YieldProcessor();
+        } while (mCapacity - (writePos - mReadPos.load(std::memory_order_acquire)) < required);
+    }
+
+    if (contiguous < entrySize) {
+        ((EntryHeader*) (mBuffer + offset))->mSize = 0;
+        writePos += contiguous;
+        offset = 0;
+    }
+
+    auto entry = (EntryHeader*) (mBuffer + offset);
+    entry->mSize = entrySize;
+    entry->mUserDataLength = eventRecord->UserDataLength;
+    entry->mExtendedDataCount = itemCount;
+    entry->mEventHeader = eventRecord->EventHeader;
+    entry->mBufferContext = eventRecord->BufferContext;
+
+    auto items = (EVENT_HEADER_EXTENDED_DATA_ITEM*) (entry + 1);
+    memcpy(items + itemCount, eventRecord->UserData, eventRecord->UserDataLength);
+
+    auto data = (uint8_t*) entry + dataOffset;
+    for (uint32_t i = 0; i < itemCount; ++i) {
+        auto const& item = eventRecord->ExtendedData[i];
+        memcpy(data, (void const*) item.DataPtr, item.DataSize);
+        items[i] = item;
+        items[i].DataPtr = (ULONGLONG) data;
+        data += AlignEntrySize(item.DataSize);
+    }
+
+    writePos += entrySize;
+    mWritePos.store(writePos, std::memory_order_release);
+
+    auto occupancy = writePos - mReadPos.load(std::memory_order_relaxed);
+    if (mHighWater < occupancy) {
+        mHighWater = occupancy;
+    }
+    mEventCount += 1;
+    mCopyCycles += __rdtsc() - startCycles;
+}
+
+EVENT_RECORD* EventRing::Peek()
+{
+    auto readPos = mReadPos.load(std::memory_order_relaxed);
+    auto writePos = mWritePos.load(std::memory_order_acquire);
+    if (readPos == writePos) {
+        return nullptr;
+    }
+
+    auto offset = readPos & (mCapacity - 1);
+    auto entry = (EntryHeader const*) (mBuffer + offset);
+
+    // Skip padding.  The padding and the entry after it are published
+    // together, so there is always an entry at the start of the buffer.
+    if (entry->mSize == 0) {
+        readPos += mCapacity - offset;
+        mReadPos.store(readPos, std::memory_order_release);
+        assert(readPos != writePos);
+        entry = (EntryHeader const*) mBuffer;
+    }
+
+    mPeekSize = entry->mSize;
+    mRecord.EventHeader = entry->mEventHeader;
+    mRecord.BufferContext = entry->mBufferContext;
+    auto items = (EVENT_HEADER_EXTENDED_DATA_ITEM*) (entry + 1);
+    mRecord.ExtendedDataCount = (USHORT) entry->mExtendedDataCount;
+    mRecord.UserDataLength = (USHORT) entry->mUserDataLength;
+    mRecord.ExtendedData = entry->mExtendedDataCount == 0 ? nullptr : items;
+    mRecord.UserData = (void*) (items + entry->mExtendedDataCount);
+    return &mRecord;
+}
+
+void EventRing::Pop()
+{
+    assert(mPeekSize != 0);
+    mReadPos.store(mReadPos.load(std::memory_order_relaxed) + mPeekSize, std::memory_order_release);
+    mPeekSize = 0;
+}
@@ -0,0 +1,87 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+
+// EventRing is a single-producer/single-consumer ring of raw event records.
+// The ETW callback copies each EVENT_HEADER, ETW_BUFFER_CONTEXT and UserData
+// into the ring (no allocation, no locks), and a handler thread reconstructs
+// the EVENT_RECORD in place and runs the consumers' handlers on it.  This
+// keeps the time spent inside the ETW callback to a copy.
+//
+// Extended data items (e.g., the related activity id or a stack trace) are
+// copied too, with each item's DataPtr pointing at its copy in the ring.
+//
+// If the ring is full the producer waits for the handler thread to catch up
+// (counted in mFullStallCount) rather than dropping the event.
+struct EventRing {
+    // Each entry is an EntryHeader followed by the extended data items,
+    // UserData, and each item's data, each padded to 8 bytes.  An entry with
+    // mSize == 0 marks unused space at the end of the buffer; the next entry
+    // starts at the beginning of the buffer.
+    struct EntryHeader {
+        uint32_t mSize;
+        uint32_t mUserDataLength;
+        uint32_t mExtendedDataCount;
+        EVENT_HEADER mEventHeader;
+        ETW_BUFFER_CONTEXT mBufferContext;
+    };
+
+    uint8_t* mBuffer = nullptr;
+    uint64_t mCapacity = 0; // Power of two
+
+    // Monotonically increasing byte positions; the buffer offset is the
+    // position modulo mCapacity.  mWritePos is only written by the producer
+    // and mReadPos only by the consumer.
+    alignas(64) std::atomic<uint64_t> mWritePos = 0;
+    alignas(64) std::atomic<uint64_t> mReadPos = 0;
+
+    // Producer-side statistics
+    alignas(64) uint64_t mEventCount = 0;
+    uint64_t mCopyCycles = 0;       // Total __rdtsc() cycles spent in Push()
+    uint64_t mFullStallCount = 0;   // Number of Push() calls that had to wait
+    uint64_t mHighWater = 0;        // Maximum occupancy in bytes
+
+    // Consumer-side state
+    EVENT_RECORD mRecord = {};
+    uint32_t mPeekSize = 0;
+
+    ~EventRing();
+
+    bool Initialize(uint64_t capacity);
+
+    // Producer: copy the event into the ring.
+    void Push(EVENT_RECORD const* eventRecord);
+
+    // Consumer: returns the oldest event, or nullptr if the ring is empty.
+    // The returned record (and its UserData) is valid until Pop().
+    EVENT_RECORD* Peek();
+    void Pop();
+
+    uint64_t GetOccupancy() const { return mWritePos.load(std::memory_order_relaxed) - mReadPos.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,408 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMonTraceConsumer.hpp"
+#include "FlightRecorder.hpp"
+#include "TraceSession.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+char const CAPTURE_FILE_MAGIC[4] = { 'P', 'M', 'F', 'R' };
+uint32_t const CAPTURE_FILE_VERSION = 1;
+
+// Entries are written to capture files as-is.
+static_assert(sizeof(FlightRecorder::Entry) == 32, "unexpected FlightRecorder::Entry layout");
+
+// Upper bound on the key count and metadata size read from a capture file,
+// so that a corrupt file fails to load instead of allocating too much.
+uint32_t const MAX_METADATA_SIZE = 1024 * 1024;
+
+uint32_t GetEntrySize(uint32_t userDataLength)
+{
+    return (uint32_t) ((sizeof(FlightRecorder::Entry) + userDataLength + 7) & ~7ull);
+}
+
+template<typename T>
+bool WriteValue(FILE* fp, T const& value)
+{
+    return fwrite(&value, sizeof(T), 1, fp) == 1;
+}
+
+template<typename T>
+bool ReadValue(FILE* fp, T* value)
+{
+    return fread(value, sizeof(T), 1, fp) == 1;
+}
+
+void PrintPresents(FILE* fp, std::vector<std::shared_ptr<PresentEvent>> const& presents, uint64_t startQpc, QpcClock const& clock)
+{
+    for (auto const& p : presents) {
+        fprintf(fp, "%.6f, %u, %u, %llx, %g, %g, %g, %d, %u, %u, %u\n",
+            clock.ToSeconds((int64_t) (p->QpcTime - startQpc)),
+            p->ProcessId,
+            p->ThreadId,
+            p->SwapChainAddress,
+            clock.ToMilliseconds((int64_t) p->TimeTaken),
+            p->ReadyTime == 0 ? 0. : clock.ToMilliseconds((int64_t) (p->ReadyTime - p->QpcTime)),
+            p->ScreenTime == 0 ? 0. : clock.ToMilliseconds((int64_t) (p->ScreenTime - p->QpcTime)),
+            p->SyncInterval,
+            p->PresentFlags,
+            (uint32_t) p->PresentMode,
+            (uint32_t) p->FinalState);
+    }
+}
+
+}
+
+bool FlightRecorder::Start(FlightRecorderOptions const& options, EventMetadata const* metadata, LARGE_INTEGER const* startQpc, QpcClock const& clock)
+{
+    assert(clock.mFrequency != 0);
+
+    // Every entry has to fit in the ring with room to spare, and positions
+    // are rounded to 8 bytes.
+    auto capacity = options.mCapacity & ~7ull;
+    if (capacity < 4 * GetEntrySize(UINT16_MAX)) {
+        fprintf(stderr, "error: flight recorder capacity must be at least %u bytes.\n", 4 * GetEntrySize(UINT16_MAX));
+        return false;
+    }
+
+    mOptions = options;
+    mMetadata = metadata;
+    mStartQpc = startQpc;
+    mClock = clock;
+    mWindowQpc = (uint64_t) clock.FromSeconds(options.mWindowSeconds);
+    mPostRollQpc = (uint64_t) clock.FromSeconds(options.mPostRollSeconds);
+
+    mBuffer.resize(capacity);
+    mBeginPos = 0;
+    mEndPos = 0;
+    return true;
+}
+
+void FlightRecorder::Record(EVENT_RECORD const* eventRecord)
+{
+    auto const& hdr = eventRecord->EventHeader;
+    auto timestamp = (uint64_t) hdr.TimeStamp.QuadPart;
+
+    if (mPendingCaptureQpc != 0 && timestamp >= mPendingCaptureQpc) {
+        Stop();
+    }
+
+    EventMetadataKey key;
+    key.guid_ = hdr.ProviderId;
+    key.desc_ = hdr.EventDescriptor;
+    auto ii = mKeyIndices.find(key);
+    if (ii == mKeyIndices.end()) {
+        if (mKeys.size() > UINT16_MAX) {
+            mDroppedEventCount += 1;
+            return;
+        }
+        ii = mKeyIndices.emplace(key, (uint16_t) mKeys.size()).first;
+        mKeys.push_back(key);
+    }
+
+    // Make room for the entry, and for the unused space at the end of the
+    // buffer if it doesn't fit there, by dropping the oldest entries.
+    uint64_t capacity = mBuffer.size();
+    auto size = GetEntrySize(eventRecord->UserDataLength);
+    auto offset = mEndPos % capacity;
+    auto padding = capacity - offset < size ? capacity - offset : 0;
+    while (mEndPos + padding + size - mBeginPos > capacity) {
+        auto beginOffset = mBeginPos % capacity;
+        auto beginSize = ((Entry const*) (mBuffer.data() + beginOffset))->mSize;
+        mBeginPos += beginSize == 0 ? capacity - beginOffset : beginSize;
+    }
+
+    if (padding != 0) {
+        ((Entry*) (mBuffer.data() + offset))->mSize = 0;
+        mEndPos += padding;
+        offset = 0;
+    }
+
+    auto entry = (Entry*) (mBuffer.data() + offset);
+    entry->mSize = size;
+    entry->mKeyIndex = ii->second;
+    entry->mUserDataLength = eventRecord->UserDataLength;
+    entry->mTimestamp = timestamp;
+    entry->mProcessId = hdr.ProcessId;
+    entry->mThreadId = hdr.ThreadId;
+    entry->mFlags = hdr.Flags;
+    entry->mEventProperty = hdr.EventProperty;
+    entry->mReserved = 0;
+    memcpy(entry + 1, eventRecord->UserData, eventRecord->UserDataLength);
+
+    mEndPos += size;
+    mEventCount += 1;
+}
+
+void FlightRecorder::CheckPresent(PresentEvent const& p)
+{
+    if (p.FinalState != PresentResult::Presented || p.ScreenTime == 0) {
+        return;
+    }
+
+    auto& lastScreenTime = mLastScreenTimes[std::make_tuple(p.ProcessId, p.SwapChainAddress)];
+    auto previous = lastScreenTime;
+    if (p.ScreenTime <= previous) {
+        return;
+    }
+    lastScreenTime = p.ScreenTime;
+    if (previous == 0) {
+        return;
+    }
+
+    auto ms = mClock.ToMilliseconds((int64_t) (p.ScreenTime - previous));
+    auto hitch = mOptions.mHitchMs > 0. && ms >= mOptions.mHitchMs;
+    if (mOptions.mHitchVBlanks > 0) {
+        auto vblanks = (uint32_t) (ms * mOptions.mRefreshRate / 1000. + 0.5);
+        auto expected = (uint32_t) std::max(p.SyncInterval, 1);
+        hitch = hitch || vblanks >= expected + mOptions.mHitchVBlanks;
+    }
+    if (!hitch) {
+        return;
+    }
+
+    mHitchCount += 1;
+    if (mPendingCaptureQpc != 0 || p.ScreenTime < mNextHitchQpc || mCaptureCount == mOptions.mMaxCaptures) {
+        return;
+    }
+
+    mHitchQpc = p.ScreenTime;
+    mHitchProcessId = p.ProcessId;
+    mHitchSwapChainAddress = p.SwapChainAddress;
+    mPendingCaptureQpc = p.ScreenTime + mPostRollQpc;
+}
+
+void FlightRecorder::RemoveProcess(uint32_t processId)
+{
+    EraseProcessSwapChains(&mLastScreenTimes, processId);
+}
+
+void FlightRecorder::Stop()
+{
+    if (mPendingCaptureQpc == 0) {
+        return;
+    }
+
+    char path[MAX_PATH];
+    _snprintf_s(path, _TRUNCATE, "%s_%u.pmfr", mOptions.mPathPrefix.c_str(), mCaptureCount + 1);
+    if (WriteCapture(path)) {
+        fprintf(stderr, "flight recorder: wrote %s (process %u swap chain %llx hitch at %.3f s)\n",
+            path, mHitchProcessId, mHitchSwapChainAddress,
+            mClock.ToSeconds((int64_t) (mHitchQpc - mStartQpc->QuadPart)));
+    }
+
+    mCaptureCount += 1;
+    mNextHitchQpc = mPendingCaptureQpc;
+    mPendingCaptureQpc = 0;
+}
+
+void FlightRecorder::PrintStats(FILE* fp) const
+{
+    fprintf(fp, "flight recorder: %llu events recorded, %llu hitches, %u captures written",
+        mEventCount, mHitchCount, mCaptureCount);
+    if (mDroppedEventCount > 0) {
+        fprintf(fp, ", %llu events dropped", mDroppedEventCount);
+    }
+    fprintf(fp, "\n");
+}
+
+// File layout:
+//     char[4]     "PMFR"
+//     uint32_t    version
+//     uint64_t    QPC frequency
+//     uint64_t    TraceSession::mStartQpc
+//     uint64_t    hitch QPC (the present's ScreenTime)
+//     uint32_t    hitch process id
+//     uint64_t    hitch swap chain address
+//     uint32_t    key count
+//     per key:    EventMetadataKey, uint32_t metadata size, metadata
+//     uint64_t    event count
+//     per event:  Entry and UserData (Entry::mSize bytes), oldest first
+//
+// The metadata is the consumer's cached TRACE_EVENT_INFO for the key, and
+// is empty if the consumer hasn't decoded any of those events.
+bool FlightRecorder::WriteCapture(char const* path)
+{
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path, "wb") != 0) {
+        fprintf(stderr, "error: failed to open flight recorder capture for writing: %s\n", path);
+        return false;
+    }
+
+    // Capture the entries from the start of the window, which may be
+    // earlier than the oldest entry still in the ring.
+    uint64_t capacity = mBuffer.size();
+    auto windowQpc = mHitchQpc > mWindowQpc ? mHitchQpc - mWindowQpc : 0;
+    auto forEachEntry = [&](auto fn) {
+        for (auto pos = mBeginPos; pos < mEndPos; ) {
+            auto offset = pos % capacity;
+            auto entry = (Entry const*) (mBuffer.data() + offset);
+            if (entry->mSize == 0) {
+                pos += capacity - offset;
+                continue;
+            }
+            if (entry->mTimestamp >= windowQpc) {
+                fn(entry);
+            }
+            pos += entry->mSize;
+        }
+    };
+
+    uint64_t eventCount = 0;
+    forEachEntry([&](Entry const*) { eventCount += 1; });
+
+    auto ok =
+        fwrite(CAPTURE_FILE_MAGIC, sizeof(CAPTURE_FILE_MAGIC), 1, fp) == 1 &&
+        WriteValue(fp, CAPTURE_FILE_VERSION) &&
+        WriteValue(fp, mClock.mFrequency) &&
+        WriteValue(fp, (uint64_t) mStartQpc->QuadPart) &&
+        WriteValue(fp, mHitchQpc) &&
+        WriteValue(fp, mHitchProcessId) &&
+        WriteValue(fp, mHitchSwapChainAddress) &&
+        WriteValue(fp, (uint32_t) mKeys.size());
+    for (size_t i = 0; ok && i < mKeys.size(); ++i) {
+        std::vector<uint8_t> const* metadata = nullptr;
+        if (mMetadata != nullptr) {
+            auto ii = mMetadata->metadata_.find(mKeys[i]);
+            if (ii != mMetadata->metadata_.end()) {
+                metadata = &ii->second;
+            }
+        }
+        auto size = metadata == nullptr ? 0u : (uint32_t) metadata->size();
+        ok = WriteValue(fp, mKeys[i]) &&
+             WriteValue(fp, size) &&
+             (size == 0 || fwrite(metadata->data(), size, 1, fp) == 1);
+    }
+    ok = ok && WriteValue(fp, eventCount);
+    forEachEntry([&](Entry const* entry) {
+        ok = ok && fwrite(entry, entry->mSize, 1, fp) == 1;
+    });
+
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "error: failed to write flight recorder capture: %s\n", path);
+    }
+    return ok;
+}
+
+bool ReplayFlightCapture(char const* path, FILE* out)
+{
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path, "rb") != 0) {
+        fprintf(stderr, "error: failed to open flight recorder capture: %s\n", path);
+        return false;
+    }
+
+    PMTraceConsumer consumer(false, false);
+    TraceSession session;
+    session.InitializeDispatch(&consumer, nullptr);
+
+    char magic[4] = {};
+    uint32_t version = 0;
+    uint64_t qpcFrequency = 0;
+    uint64_t startQpc = 0;
+    uint64_t hitchQpc = 0;
+    uint32_t hitchProcessId = 0;
+    uint64_t hitchSwapChainAddress = 0;
+    uint32_t keyCount = 0;
+    auto ok =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, CAPTURE_FILE_MAGIC, sizeof(magic)) == 0 &&
+        ReadValue(fp, &version) &&
+        version == CAPTURE_FILE_VERSION &&
+        ReadValue(fp, &qpcFrequency) &&
+        qpcFrequency != 0 &&
+        ReadValue(fp, &startQpc) &&
+        ReadValue(fp, &hitchQpc) &&
+        ReadValue(fp, &hitchProcessId) &&
+        ReadValue(fp, &hitchSwapChainAddress) &&
+        ReadValue(fp, &keyCount) &&
+        keyCount <= (uint32_t) UINT16_MAX + 1;
+
+    std::vector<EventMetadataKey> keys(ok ? keyCount : 0);
+    for (uint32_t i = 0; ok && i < keyCount; ++i) {
+        uint32_t size = 0;
+        ok = ReadValue(fp, &keys[i]) &&
+             ReadValue(fp, &size) &&
+             size <= MAX_METADATA_SIZE;
+        if (ok && size > 0) {
+            std::vector<uint8_t> metadata(size);
+            ok = fread(metadata.data(), size, 1, fp) == 1;
+            consumer.mMetadata.metadata_.emplace(keys[i], std::move(metadata));
+        }
+    }
+
+    uint64_t eventCount = 0;
+    ok = ok && ReadValue(fp, &eventCount);
+
+    if (ok) {
+        session.mStartQpc.QuadPart = startQpc;
+        session.mQpcFrequency.QuadPart = qpcFrequency;
+        session.mClock.Initialize(qpcFrequency);
+        fprintf(out, "Hitch: process %u swap chain %llx at %.6f s\n", hitchProcessId, hitchSwapChainAddress,
+            session.mClock.ToSeconds((int64_t) (hitchQpc - startQpc)));
+        fprintf(out, "Time, ProcessId, ThreadId, SwapChainAddress, TimeTaken, ReadyTime, ScreenTime, SyncInterval, PresentFlags, PresentMode, FinalState\n");
+    }
+
+    std::vector<uint8_t> userData(GetEntrySize(UINT16_MAX) - sizeof(FlightRecorder::Entry));
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    for (uint64_t i = 0; ok && i < eventCount; ++i) {
+        FlightRecorder::Entry entry;
+        ok = ReadValue(fp, &entry) &&
+             entry.mKeyIndex < keyCount &&
+             entry.mSize == GetEntrySize(entry.mUserDataLength) &&
+             (entry.mSize == sizeof(entry) || fread(userData.data(), entry.mSize - sizeof(entry), 1, fp) == 1);
+        if (!ok) {
+            break;
+        }
+
+        EVENT_RECORD eventRecord = {};
+        eventRecord.EventHeader.Size = sizeof(EVENT_HEADER);
+        eventRecord.EventHeader.Flags = entry.mFlags;
+        eventRecord.EventHeader.EventProperty = entry.mEventProperty;
+        eventRecord.EventHeader.ThreadId = entry.mThreadId;
+        eventRecord.EventHeader.ProcessId = entry.mProcessId;
+        eventRecord.EventHeader.TimeStamp.QuadPart = entry.mTimestamp;
+        eventRecord.EventHeader.ProviderId = keys[entry.mKeyIndex].guid_;
+        eventRecord.EventHeader.EventDescriptor = keys[entry.mKeyIndex].desc_;
+        eventRecord.UserDataLength = entry.mUserDataLength;
+        eventRecord.UserData = userData.data();
+        eventRecord.UserContext = &session;
+        session.mDispatchEvent(&session, &eventRecord);
+
+        if (consumer.DequeuePresents(presents)) {
+            PrintPresents(out, presents, startQpc, session.mClock);
+            presents.clear();
+        }
+    }
+
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "error: invalid or corrupt flight recorder capture: %s\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,141 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+
+#include "QpcClock.hpp"
+#include "TraceConsumer.hpp"
+
+struct PresentEvent;
+
+struct FlightRecorderOptions {
+    uint64_t mCapacity = 64 * 1024 * 1024;  // Ring size in bytes
+    double mWindowSeconds = 5.;             // Trace time before the hitch to capture
+    double mPostRollSeconds = 0.5;          // Trace time after the hitch to capture
+
+    // A displayed present is a hitch if the time since its swap chain's
+    // previous displayed present is at least mHitchMs, or if it missed at
+    // least mHitchVBlanks vblanks more than its SyncInterval asked for.
+    // Zero disables either test.
+    double mHitchMs = 0.;
+    uint32_t mHitchVBlanks = 0;
+    double mRefreshRate = 60.;              // Hz, used to count vblanks
+
+    uint32_t mMaxCaptures = 16;
+    std::string mPathPrefix = "hitch";      // Captures are written to <prefix>_<n>.pmfr
+};
+
+// FlightRecorder keeps the most recent raw events in a fixed-size ring and,
+// when a completed present is a hitch, writes the events from mWindowSeconds
+// before to mPostRollSeconds after it to a capture file that
+// ReplayFlightCapture() can run through a fresh consumer.
+//
+// Each event is stored as a 32-byte Entry (the EVENT_HEADER fields the
+// consumers use, with the provider and event descriptor replaced by an index
+// into mKeys) followed by its UserData, so recording costs one key lookup
+// and a copy.  The oldest entries are overwritten as the ring wraps, so
+// memory use is fixed; if the ring holds less than the window, the capture
+// is shorter.  Captures also include the consumer's cached event metadata
+// for the recorded keys, so replay doesn't depend on the providers'
+// manifests being installed.
+//
+// Recording is enabled by pointing TraceSession::mFlightRecorder at a
+// started FlightRecorder, and hitch detection by also setting
+// PMTraceConsumer::mFlightRecorder.  Both are called on the event handling
+// thread (the EventRing thread if there is one, otherwise the ETW callback).
+// A capture is written from Record() once the post-roll has passed.
+struct FlightRecorder {
+    struct Entry {
+        uint32_t mSize;             // Entry size including UserData, padded to 8; 0 marks the end of the buffer
+        uint16_t mKeyIndex;         // Index into mKeys
+        uint16_t mUserDataLength;
+        uint64_t mTimestamp;
+        uint32_t mProcessId;
+        uint32_t mThreadId;
+        uint16_t mFlags;            // EVENT_HEADER::Flags
+        uint16_t mEventProperty;    // EVENT_HEADER::EventProperty
+        uint32_t mReserved;
+    };
+
+    typedef std::tuple<uint32_t, uint64_t> ProcessAndSwapChainKey;
+
+    FlightRecorderOptions mOptions;
+    EventMetadata const* mMetadata = nullptr;
+    LARGE_INTEGER const* mStartQpc = nullptr;
+    QpcClock mClock;
+    uint64_t mWindowQpc = 0;
+    uint64_t mPostRollQpc = 0;
+
+    std::vector<uint8_t> mBuffer;
+    uint64_t mBeginPos = 0;     // Monotonically increasing byte positions of the oldest entry
+    uint64_t mEndPos = 0;       // and of the next one; the buffer offset is the position modulo mBuffer.size()
+
+    std::vector<EventMetadataKey> mKeys;
+    std::unordered_map<EventMetadataKey, uint16_t, EventMetadataKeyHash, EventMetadataKeyEqual> mKeyIndices;
+
+    std::map<ProcessAndSwapChainKey, uint64_t> mLastScreenTimes;
+
+    // The hitch waiting for its post-roll.  mPendingCaptureQpc is 0 if there
+    // is none.
+    uint64_t mPendingCaptureQpc = 0;
+    uint64_t mHitchQpc = 0;
+    uint32_t mHitchProcessId = 0;
+    uint64_t mHitchSwapChainAddress = 0;
+    uint64_t mNextHitchQpc = 0;     // Hitches within a written window are part of that capture
+
+    // Statistics
+    uint64_t mEventCount = 0;
+    uint64_t mDroppedEventCount = 0;    // Events with more distinct keys than an Entry can index
+    uint64_t mHitchCount = 0;
+    uint32_t mCaptureCount = 0;
+
+    bool Start(FlightRecorderOptions const& options, EventMetadata const* metadata, LARGE_INTEGER const* startQpc, QpcClock const& clock);
+
+    void Record(EVENT_RECORD const* eventRecord);
+    void CheckPresent(PresentEvent const& p);
+
+    // Forget the process's last screen times once it has exited.
+    void RemoveProcess(uint32_t processId);
+
+    // Write the pending capture, if any, without waiting for the rest of its
+    // post-roll (e.g., at the end of the trace).
+    void Stop();
+
+    void PrintStats(FILE* fp) const;
+
+private:
+    bool WriteCapture(char const* path);
+};
+
+// Handle the events in a capture written by FlightRecorder with a new
+// PMTraceConsumer, printing each completed present to fp.
+bool ReplayFlightCapture(char const* path, FILE* fp);
@@ -0,0 +1,298 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMonTraceConsumer.hpp"
+#include "GpuBusy.hpp"
+
+#include <algorithm>
+#include <assert.h>
+
+void GpuBusyTracker::Start(FILE* fp, FILE* frameFp, LARGE_INTEGER const* startQpc, QpcClock const& clock)
+{
+    assert(clock.mFrequency != 0);
+
+    mFile = fp;
+    mFrameFile = frameFp;
+    mStartQpc = startQpc;
+    mClock = clock;
+    mContexts.clear();
+    mProcesses.clear();
+
+    if (mFile != nullptr) {
+        fprintf(mFile, "StartTime, EndTime, Context, ProcessId\n");
+    }
+    if (mFrameFile != nullptr) {
+        fprintf(mFrameFile, "Time, ProcessId, FrameTime, GpuBusy, Packets\n");
+    }
+}
+
+void GpuBusyTracker::SubmitPacket(uint64_t qpc, uint32_t processId, uint64_t hContext, uint32_t submitSequence)
+{
+    if (mFirstQpc == 0) {
+        mFirstQpc = qpc;
+    }
+    mLatestQpc = std::max(mLatestQpc, qpc);
+    mPacketCount += 1;
+
+    auto& context = mContexts[hContext];
+    if (context.mProcess == nullptr) {
+        auto& process = mProcesses[processId];
+        process.mProcessId = processId;
+        context.mProcess = &process;
+    }
+
+    if (context.mPendingEnd - context.mPendingBegin == MAX_PENDING_PACKETS) {
+        mUntrackedPacketCount += 1;
+        return;
+    }
+
+    // An idle context becomes busy.
+    if (context.mPendingBegin == context.mPendingEnd) {
+        context.mBusyStartQpc = qpc;
+        if (mBusyContextCount == 0) {
+            mBusyStartQpc = qpc;
+        }
+        mBusyContextCount += 1;
+    }
+
+    auto process = context.mProcess;
+    process->mFrames[process->mFrameIndex % MAX_PENDING_FRAMES].mPendingPacketCount += 1;
+
+    auto& packet = context.mPending[context.mPendingEnd % MAX_PENDING_PACKETS];
+    packet.mSubmitQpc = qpc;
+    packet.mSubmitSequence = submitSequence;
+    packet.mFrameIndex = process->mFrameIndex;
+    context.mPendingEnd += 1;
+}
+
+void GpuBusyTracker::CompletePacket(uint64_t qpc, uint64_t hContext, uint32_t submitSequence)
+{
+    auto ii = mContexts.find(hContext);
+    if (ii == mContexts.end()) {
+        mUntrackedPacketCount += 1;
+        return;
+    }
+    auto& context = ii->second;
+    auto process = context.mProcess;
+
+    // Packets complete in order, so this is normally the oldest pending
+    // packet.  Any older ones whose completion was missed are dropped.
+    auto i = context.mPendingBegin;
+    while (i != context.mPendingEnd && context.mPending[i % MAX_PENDING_PACKETS].mSubmitSequence != submitSequence) {
+        ++i;
+    }
+    if (i == context.mPendingEnd) {
+        mUntrackedPacketCount += 1;
+        return;
+    }
+    for (; context.mPendingBegin != i; ++context.mPendingBegin) {
+        ReleasePacket(process, context.mPending[context.mPendingBegin % MAX_PENDING_PACKETS], 0, false);
+        mUntrackedPacketCount += 1;
+    }
+
+    mLatestQpc = std::max(mLatestQpc, qpc);
+    qpc = std::max(qpc, context.mBusyStartQpc);
+
+    auto const& packet = context.mPending[i % MAX_PENDING_PACKETS];
+    auto executeStartQpc = std::min(qpc, std::max(packet.mSubmitQpc, context.mLastCompleteQpc));
+    ReleasePacket(process, packet, qpc - executeStartQpc, true);
+    context.mLastCompleteQpc = qpc;
+    context.mPacketCount += 1;
+    context.mPendingBegin += 1;
+
+    // The context's queue has drained.
+    if (context.mPendingBegin == context.mPendingEnd) {
+        context.mBusyTicks += qpc - context.mBusyStartQpc;
+        WriteInterval(context.mBusyStartQpc, qpc, hContext, process->mProcessId);
+
+        assert(mBusyContextCount > 0);
+        mBusyContextCount -= 1;
+        if (mBusyContextCount == 0) {
+            qpc = std::max(qpc, mBusyStartQpc);
+            mBusyTicks += qpc - mBusyStartQpc;
+            WriteInterval(mBusyStartQpc, qpc, 0, 0);
+        }
+    }
+
+    ReportFrames(process, false);
+}
+
+// Attribute a packet to the frame that submitted it, unless that frame has
+// already been reported.
+void GpuBusyTracker::ReleasePacket(Process* process, PendingPacket const& packet, uint64_t ticks, bool completed)
+{
+    if ((int32_t) (packet.mFrameIndex - process->mFirstFrameIndex) < 0) {
+        return;
+    }
+
+    auto& frame = process->mFrames[packet.mFrameIndex % MAX_PENDING_FRAMES];
+    assert(frame.mPendingPacketCount > 0);
+    frame.mPendingPacketCount -= 1;
+    if (completed) {
+        frame.mGpuTicks += ticks;
+        frame.mPacketCount += 1;
+    }
+}
+
+void GpuBusyTracker::Present(uint32_t processId, uint64_t qpc)
+{
+    auto& process = mProcesses[processId];
+    process.mProcessId = processId;
+
+    process.mFrames[process.mFrameIndex % MAX_PENDING_FRAMES].mEndQpc = qpc;
+    process.mFrameIndex += 1;
+    ReportFrames(&process, process.mFrameIndex - process.mFirstFrameIndex == MAX_PENDING_FRAMES);
+
+    auto& frame = process.mFrames[process.mFrameIndex % MAX_PENDING_FRAMES];
+    frame.mStartQpc = qpc;
+    frame.mEndQpc = 0;
+    frame.mGpuTicks = 0;
+    frame.mPacketCount = 0;
+    frame.mPendingPacketCount = 0;
+}
+
+// Report the process's ended frames whose packets have all completed, in
+// order.  If forceOldest is set, the oldest frame is reported (and its
+// outstanding packets ignored) even if it is still waiting on packets, to
+// make room in the ring.
+void GpuBusyTracker::ReportFrames(Process* process, bool forceOldest)
+{
+    for (; process->mFirstFrameIndex != process->mFrameIndex; ++process->mFirstFrameIndex, forceOldest = false) {
+        auto const& frame = process->mFrames[process->mFirstFrameIndex % MAX_PENDING_FRAMES];
+        if (frame.mPendingPacketCount != 0) {
+            if (!forceOldest) {
+                break;
+            }
+            mDroppedFrameCount += 1;
+        }
+
+        // The frame before the process's first present has no start.
+        if (frame.mStartQpc == 0) {
+            continue;
+        }
+
+        process->mFrameCount += 1;
+        process->mFrameGpuTicks += frame.mGpuTicks;
+        process->mMaxFrameGpuTicks = std::max(process->mMaxFrameGpuTicks, frame.mGpuTicks);
+
+        if (mFrameFile != nullptr) {
+            fprintf(mFrameFile, "%.6f, %u, %.6f, %.6f, %u\n",
+                QpcToSeconds(frame.mEndQpc),
+                process->mProcessId,
+                mClock.ToMilliseconds((int64_t) (frame.mEndQpc - frame.mStartQpc)),
+                mClock.ToMilliseconds((int64_t) frame.mGpuTicks),
+                frame.mPacketCount);
+        }
+    }
+}
+
+void GpuBusyTracker::RemoveProcess(uint32_t processId)
+{
+    for (auto ii = mContexts.begin(); ii != mContexts.end(); ) {
+        auto const& context = ii->second;
+        if (context.mProcess->mProcessId != processId) {
+            ++ii;
+            continue;
+        }
+
+        // A context exiting with work pending is treated as idle from now on.
+        if (context.mPendingBegin != context.mPendingEnd) {
+            assert(mBusyContextCount > 0);
+            mBusyContextCount -= 1;
+            if (mBusyContextCount == 0) {
+                mBusyTicks += mLatestQpc - std::min(mLatestQpc, mBusyStartQpc);
+                WriteInterval(mBusyStartQpc, mLatestQpc, 0, 0);
+            }
+        }
+
+        mExitedBusyTicks += context.mBusyTicks;
+        mExitedPacketCount += context.mPacketCount;
+        ii = mContexts.erase(ii);
+    }
+
+    auto ii = mProcesses.find(processId);
+    if (ii != mProcesses.end()) {
+        mExitedFrameCount += ii->second.mFrameCount;
+        mExitedFrameGpuTicks += ii->second.mFrameGpuTicks;
+        mProcesses.erase(ii);
+    }
+}
+
+void GpuBusyTracker::WriteInterval(uint64_t startQpc, uint64_t endQpc, uint64_t hContext, uint32_t processId)
+{
+    if (mFile == nullptr) {
+        return;
+    }
+
+    if (hContext == 0) {
+        fprintf(mFile, "%.6f, %.6f, all,\n", QpcToSeconds(startQpc), QpcToSeconds(endQpc));
+    } else {
+        fprintf(mFile, "%.6f, %.6f, %llx, %u\n", QpcToSeconds(startQpc), QpcToSeconds(endQpc), hContext, processId);
+    }
+}
+
+double GpuBusyTracker::QpcToSeconds(uint64_t qpc) const
+{
+    return mClock.ToSeconds((int64_t) (qpc - mStartQpc->QuadPart));
+}
+
+void GpuBusyTracker::PrintSummary(FILE* fp) const
+{
+    auto spanTicks = mLatestQpc - mFirstQpc;
+    auto toMs = [this](uint64_t ticks) { return mClock.ToMilliseconds((int64_t) ticks); };
+    auto toPercent = [spanTicks](uint64_t ticks) { return spanTicks == 0 ? 0. : 100. * ticks / spanTicks; };
+
+    fprintf(fp, "%-16s %-10s %10s %12s %8s\n", "Context", "ProcessId", "Packets", "Busy (ms)", "Util (%)");
+    for (auto const& pair : mContexts) {
+        auto const& context = pair.second;
+        fprintf(fp, "%-16llx %-10u %10llu %12.3f %8.1f\n",
+            pair.first,
+            context.mProcess->mProcessId,
+            context.mPacketCount,
+            toMs(context.mBusyTicks),
+            toPercent(context.mBusyTicks));
+    }
+    if (mExitedPacketCount != 0) {
+        fprintf(fp, "%-16s %-10s %10llu %12.3f %8.1f\n", "(exited)", "", mExitedPacketCount, toMs(mExitedBusyTicks), toPercent(mExitedBusyTicks));
+    }
+    fprintf(fp, "%-16s %-10s %10llu %12.3f %8.1f\n", "all", "", mPacketCount, toMs(mBusyTicks), toPercent(mBusyTicks));
+
+    fprintf(fp, "\n%-10s %10s %18s %18s\n", "ProcessId", "Frames", "GPU ms/frame", "Max GPU ms/frame");
+    for (auto const& pair : mProcesses) {
+        auto const& process = pair.second;
+        if (process.mFrameCount == 0) {
+            continue;
+        }
+        fprintf(fp, "%-10u %10llu %18.3f %18.3f\n",
+            process.mProcessId,
+            process.mFrameCount,
+            toMs(process.mFrameGpuTicks) / process.mFrameCount,
+            toMs(process.mMaxFrameGpuTicks));
+    }
+    if (mExitedFrameCount != 0) {
+        fprintf(fp, "%-10s %10llu %18.3f %18s\n", "(exited)", mExitedFrameCount, toMs(mExitedFrameGpuTicks) / mExitedFrameCount, "");
+    }
+
+    if (mUntrackedPacketCount != 0 || mDroppedFrameCount != 0) {
+        fprintf(fp, "%llu packets untracked, %llu frames reported with packets outstanding\n", mUntrackedPacketCount, mDroppedFrameCount);
+    }
+}
@@ -0,0 +1,145 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <windows.h>
+
+#include "QpcClock.hpp"
+
+// GpuBusyTracker follows every DMA packet the kernel queues to a GPU context
+// (DxgKrnl QueuePacket_Start) until it completes (QueuePacket_Stop), to
+// measure how busy each context, and the GPU as a whole, is.
+//
+// A context's packets execute in submission order, so the context is busy
+// from the time a packet is queued to an idle context until its queue drains
+// again, and each packet's execution time is its completion time less the
+// later of its submission and the previous packet's completion.  These busy
+// intervals are merged across contexts, by counting how many contexts are
+// busy, into the intervals where any context is busy.  Without the context
+// and adapter creation events, contexts can't be grouped by adapter, so this
+// merged view stands in for the adapter's, and is exact on single-GPU
+// systems.  Each merged interval is optionally written to mFile as a row of
+// (start, end, context, process), with "all" for the merged view.
+//
+// Each packet's execution time is also attributed to the frame the
+// context's process was working on when the packet was submitted, i.e., the
+// frame between two consecutive presents.  A frame is reported once the
+// process has presented again and all of the frame's packets have
+// completed; each is optionally written to mFrameFile as a row of (time,
+// process, frame ms, GPU busy ms, packet count).
+//
+// The packets in flight on a context are kept in a fixed-size ring inside
+// the context, and the unreported frames in a fixed-size ring inside the
+// process, so nothing is allocated per packet or per present.  A packet
+// submitted to a full ring isn't tracked, and a frame pushed out of a full
+// ring is reported without its outstanding packets; both are counted.
+//
+// All functions are called from the event handling thread.
+struct GpuBusyTracker {
+    static uint32_t const MAX_PENDING_PACKETS = 256;    // Per context
+    static uint32_t const MAX_PENDING_FRAMES = 16;      // Per process
+
+    struct PendingPacket {
+        uint64_t mSubmitQpc;
+        uint32_t mSubmitSequence;
+        uint32_t mFrameIndex;       // Index of the owning process's frame that submitted it
+    };
+
+    struct Frame {
+        uint64_t mStartQpc;         // The QpcTime of the present that started the frame, or 0
+        uint64_t mEndQpc;           // The QpcTime of the present that ended the frame, or 0
+        uint64_t mGpuTicks;         // Sum of the frame's packets' execution times
+        uint32_t mPacketCount;
+        uint32_t mPendingPacketCount;
+    };
+
+    struct Process {
+        uint32_t mProcessId = 0;
+        uint32_t mFrameIndex = 0;           // The frame packets are currently attributed to
+        uint32_t mFirstFrameIndex = 0;      // The oldest unreported frame
+        Frame mFrames[MAX_PENDING_FRAMES] = {};
+        uint64_t mFrameCount = 0;
+        uint64_t mFrameGpuTicks = 0;
+        uint64_t mMaxFrameGpuTicks = 0;
+    };
+
+    struct Context {
+        Process* mProcess = nullptr;        // The process that first submitted to the context
+        uint64_t mBusyStartQpc = 0;         // Valid while packets are pending
+        uint64_t mLastCompleteQpc = 0;
+        uint64_t mBusyTicks = 0;
+        uint64_t mPacketCount = 0;
+        uint32_t mPendingBegin = 0;         // mPending[mPendingBegin % MAX_PENDING_PACKETS] is the oldest
+        uint32_t mPendingEnd = 0;
+        PendingPacket mPending[MAX_PENDING_PACKETS];
+    };
+
+    FILE* mFile = nullptr;                  // If non-null, each busy interval is written here
+    FILE* mFrameFile = nullptr;             // If non-null, each frame is written here
+    LARGE_INTEGER const* mStartQpc = nullptr;  // Set by the session once the first event is seen
+    QpcClock mClock;
+    std::unordered_map<uint64_t, Context> mContexts;
+    std::unordered_map<uint32_t, Process> mProcesses;
+
+    // The merged view of all contexts.
+    uint32_t mBusyContextCount = 0;
+    uint64_t mBusyStartQpc = 0;
+    uint64_t mBusyTicks = 0;
+    uint64_t mFirstQpc = 0;
+    uint64_t mLatestQpc = 0;
+
+    // Totals of the contexts and processes that have exited.
+    uint64_t mExitedBusyTicks = 0;
+    uint64_t mExitedPacketCount = 0;
+    uint64_t mExitedFrameCount = 0;
+    uint64_t mExitedFrameGpuTicks = 0;
+
+    uint64_t mPacketCount = 0;
+    uint64_t mUntrackedPacketCount = 0;     // Submitted to a full ring, or completed without being seen to start
+    uint64_t mDroppedFrameCount = 0;        // Reported before all of their packets completed
+
+    void Start(FILE* fp, FILE* frameFp, LARGE_INTEGER const* startQpc, QpcClock const& clock);
+
+    // Called by PMTraceConsumer for each QueuePacket_Start/Stop event.
+    void SubmitPacket(uint64_t qpc, uint32_t processId, uint64_t hContext, uint32_t submitSequence);
+    void CompletePacket(uint64_t qpc, uint64_t hContext, uint32_t submitSequence);
+
+    // Called by PMTraceConsumer as presents are created, to start the
+    // process's next frame.
+    void Present(uint32_t processId, uint64_t qpc);
+
+    // Called by PMTraceConsumer when a process exits.
+    void RemoveProcess(uint32_t processId);
+
+    // Print each context's and process's GPU busy time and utilization.
+    void PrintSummary(FILE* fp) const;
+
+private:
+    void ReleasePacket(Process* process, PendingPacket const& packet, uint64_t ticks, bool completed);
+    void ReportFrames(Process* process, bool forceOldest);
+    void WriteInterval(uint64_t startQpc, uint64_t endQpc, uint64_t hContext, uint32_t processId);
+    double QpcToSeconds(uint64_t qpc) const;
+};
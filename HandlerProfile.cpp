@@ -0,0 +1,104 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <windows.h>
+
+#include "HandlerProfile.hpp"
+
+namespace {
+
+char const* const COUNTER_NAMES[] = {
+    "HandleDXGKEvent",
+    "HandleWin32kEvent",
+    "HandleDWMEvent",
+    "HandleDXGIEvent",
+    "HandleD3D9Event",
+    "HandleD3D11Event",
+    "HandleWin7Dxgk*",
+    "HandleNTProcessEvent",
+    "HandleMetadataEvent",
+    "HandleLostEvent",
+    "HandleDHDEvent",
+    "HandleSpectrumContinuousEvent",
+    "GetEventData",
+    "CompletePresent",
+};
+
+static_assert(_countof(COUNTER_NAMES) == (size_t) ProfileCounter::Count, "COUNTER_NAMES out of date");
+
+}
+
+void HandlerProfile::Start()
+{
+    LARGE_INTEGER qpc = {};
+    QueryPerformanceCounter(&qpc);
+    mStartCycles = __rdtsc();
+    mStartQpc = qpc.QuadPart;
+}
+
+void HandlerProfile::Print(FILE* fp) const
+{
+    // Estimate the TSC frequency from the run itself.
+    LARGE_INTEGER qpc = {};
+    LARGE_INTEGER qpcFrequency = {};
+    QueryPerformanceCounter(&qpc);
+    QueryPerformanceFrequency(&qpcFrequency);
+    auto elapsedCycles = __rdtsc() - mStartCycles;
+    auto elapsedQpc = (uint64_t) qpc.QuadPart - mStartQpc;
+    auto cyclesPerMs = elapsedQpc == 0 ? 0. : (double) elapsedCycles / ((double) elapsedQpc / qpcFrequency.QuadPart * 1000.);
+
+    // Percentages are of the total time spent in the handlers, which doesn't
+    // include the nested GetEventData and CompletePresent counters.
+    uint64_t handlerCycles = 0;
+    for (size_t i = 0; i < (size_t) ProfileCounter::GetEventData; ++i) {
+        handlerCycles += mCounters[i].mCycles;
+    }
+
+    auto printRow = [=](char const* name, uint32_t id, Counter const& c) {
+        if (c.mCount == 0) {
+            return;
+        }
+        char idName[32] = {};
+        if (id != NO_EVENT_ID) {
+            _snprintf_s(idName, _TRUNCATE, id < MAX_DXGK_EVENT_ID ? "  id %u" : "  id >= %u", id);
+            name = idName;
+        }
+        fprintf(fp, "%-30s %12llu %14.1f %10.0f %10.2f %6.1f%%\n",
+            name,
+            c.mCount,
+            c.mCycles / 1e6,
+            (double) c.mCycles / c.mCount,
+            cyclesPerMs == 0. ? 0. : c.mCycles / cyclesPerMs,
+            handlerCycles == 0 ? 0. : 100. * c.mCycles / handlerCycles);
+    };
+
+    fprintf(fp, "%-30s %12s %14s %10s %10s %7s\n", "Handler", "Calls", "Mcycles", "cyc/call", "ms", "%");
+    for (size_t i = 0; i < (size_t) ProfileCounter::Count; ++i) {
+        printRow(COUNTER_NAMES[i], NO_EVENT_ID, mCounters[i]);
+        if (i == (size_t) ProfileCounter::DXGKEvent) {
+            for (uint32_t id = 0; id <= MAX_DXGK_EVENT_ID; ++id) {
+                printRow(nullptr, id, mDxgkEventCounters[id]);
+            }
+        }
+    }
+}
@@ -0,0 +1,117 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <intrin.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Counters for HandlerProfile.  Handler times are inclusive, so GetEventData
+// and CompletePresent time is also counted in the handlers that call them.
+enum class ProfileCounter : uint32_t {
+    DXGKEvent,
+    Win32kEvent,
+    DWMEvent,
+    DXGIEvent,
+    D3D9Event,
+    D3D11Event,
+    Win7DxgkEvent,
+    NTProcessEvent,
+    MetadataEvent,
+    LostEvent,
+    DHDEvent,
+    SpectrumContinuousEvent,
+    GetEventData,
+    CompletePresent,
+    Count
+};
+
+// HandlerProfile accumulates the number of calls and __rdtsc() cycles spent
+// in each event handler (and per event id for DxgKrnl events), in
+// EventMetadata::GetEventData(), and in PMTraceConsumer::CompletePresent().
+//
+// Profiling is enabled by pointing PMTraceConsumer::mProfile,
+// MRTraceConsumer::mProfile, and EventMetadata::profile_ at a HandlerProfile;
+// when they are nullptr each instrumented function only pays for a pointer
+// test.  A HandlerProfile must only be used by one event handling thread.
+struct HandlerProfile {
+    static uint32_t const MAX_DXGK_EVENT_ID = 512;  // Larger ids share the last bucket
+    static uint32_t const NO_EVENT_ID = UINT32_MAX;
+
+    struct Counter {
+        uint64_t mCount = 0;
+        uint64_t mCycles = 0;
+    };
+
+    Counter mCounters[(size_t) ProfileCounter::Count];
+    Counter mDxgkEventCounters[MAX_DXGK_EVENT_ID + 1];
+
+    // Used to convert cycles into time.
+    uint64_t mStartCycles = 0;
+    uint64_t mStartQpc = 0;
+
+    void Start();
+
+    void Add(ProfileCounter counter, uint32_t eventId, uint64_t cycles)
+    {
+        auto& c = mCounters[(size_t) counter];
+        c.mCount += 1;
+        c.mCycles += cycles;
+
+        if (eventId != NO_EVENT_ID) {
+            auto& e = mDxgkEventCounters[eventId < MAX_DXGK_EVENT_ID ? eventId : MAX_DXGK_EVENT_ID];
+            e.mCount += 1;
+            e.mCycles += cycles;
+        }
+    }
+
+    void Print(FILE* fp) const;
+};
+
+// Adds the cycles from construction to destruction to a HandlerProfile
+// counter, if profile is not nullptr.
+struct ProfileScope {
+    HandlerProfile* mProfile;
+    ProfileCounter mCounter;
+    uint32_t mEventId;
+    uint64_t mStartCycles;
+
+    ProfileScope(HandlerProfile* profile, ProfileCounter counter, uint32_t eventId = HandlerProfile::NO_EVENT_ID)
+        : mProfile(profile)
+        , mCounter(counter)
+        , mEventId(eventId)
+        , mStartCycles(profile == nullptr ? 0 : __rdtsc())
+    {
+    }
+
+    ~ProfileScope()
+    {
+        if (mProfile != nullptr) {
+            mProfile->Add(mCounter, mEventId, __rdtsc() - mStartCycles);
+        }
+    }
+
+private:
+    ProfileScope(ProfileScope const&); // dne
+};
@@ -0,0 +1,41 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+// Microsoft-Windows-Kernel-Process process start/stop events.  Unlike the NT
+// kernel logger's process events, these can be enabled on a regular realtime
+// session.
+namespace Microsoft_Windows_Kernel_Process {
+
+struct __declspec(uuid("{22fb2cd6-0e7b-422b-a0c7-2fad1fd0e716}")) GUID_STRUCT;
+static const auto GUID = __uuidof(GUID_STRUCT);
+
+enum class Keyword : uint64_t {
+    WINEVENT_KEYWORD_PROCESS = 0x10,
+};
+
+// Event descriptors:
+struct ProcessStart_Start { static uint16_t const Id = 1; };   // ProcessID, ImageName (full path)
+struct ProcessStop_Stop   { static uint16_t const Id = 2; };   // ProcessID
+
+}
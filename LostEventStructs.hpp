@@ -0,0 +1,38 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+// Events generated by ETW itself when a realtime consumer falls behind.
+// The event timestamp is when the loss was detected.
+namespace RT_LostEvent {
+
+struct __declspec(uuid("{6a399ae0-4bc6-4de9-870b-3657f8947e7e}")) GUID_STRUCT;
+static const auto GUID = __uuidof(GUID_STRUCT);
+
+enum Opcode : uint8_t {
+    LostEvent   = 32,   // One or more events were lost
+    LostBuffer  = 33,   // One or more buffers were lost
+    LostRundown = 34,   // Rundown events were lost
+};
+
+}
@@ -1,5 +1,9 @@
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <thread>
+#include <unordered_set>
 #include <windows.h>
 #include <tdh.h>
 
@@ -7,57 +11,881 @@
 
 #include "TraceSession.hpp"
 #include "PresentMonTraceConsumer.hpp"
+#include "BatchMode.hpp"
+#include "BufferController.hpp"
+#include "Checkpoint.hpp"
+#include "CsvOutput.hpp"
+#include "DecodeBenchmark.hpp"
+#include "EventRing.hpp"
+#include "FlightRecorder.hpp"
+#include "GpuBusy.hpp"
+#include "OccupancyGauges.hpp"
+#include "PipelineBenchmark.hpp"
+#include "PresentIndex.hpp"
+#include "HandlerProfile.hpp"
+#include "ProcessFilter.hpp"
+#include "QpcClock.hpp"
+#include "QueueDepth.hpp"
+#include "SimpleTraceConsumer.hpp"
+#include "StageLatency.hpp"
+#include "StressTest.hpp"
+#include "TimelineOutput.hpp"
+#include "TrackingController.hpp"
 
 namespace {
     TraceSession gSession;
     static PMTraceConsumer* gPMConsumer = nullptr;
 
+    char const* const REALTIME_SESSION_NAME = "frame-timing";
+    size_t const DEBUG_JOURNAL_RECORD_COUNT = 1024 * 1024; // 40 MB
+
+    std::atomic<bool> gQuit = false;          // Set by Ctrl+C or when ProcessTrace() returns
+    std::atomic<bool> gConsumerQuit = false;  // Set once ProcessTrace() has returned
+    std::atomic<bool> gRestarting = false;    // Set while the session is restarted with new buffer settings
+}
+
+// Print the presents in [t0, t1] (seconds since the start of the trace) for
+// one swap chain from a previously saved index.
+int QueryIndex(char const* path, uint32_t processId, uint64_t swapChainAddress, double t0, double t1)
+{
+    PresentIndex index;
+    if (!index.Load(path)) {
+        return 1;
+    }
+
+    QpcClock clock;
+    clock.Initialize(index.mQpcFrequency);
+    auto qpc0 = index.mStartQpc + (uint64_t) clock.FromSeconds(t0);
+    auto qpc1 = index.mStartQpc + (uint64_t) clock.FromSeconds(t1);
+
+    std::vector<PresentRecord> records;
+    index.Query(processId, swapChainAddress, qpc0, qpc1, &records);
+
+    std::cout << "Time, ThreadId, TimeTaken, ReadyTime, ScreenTime, SyncInterval, PresentFlags, PresentMode, FinalState\n";
+    for (auto const& r : records) {
+        std::cout << clock.ToSeconds((int64_t) (r.QpcTime - index.mStartQpc)) << ", "
+                  << r.ThreadId << ", "
+                  << clock.ToMilliseconds((int64_t) r.TimeTaken) << ", "
+                  << (r.ReadyTime == 0 ? 0. : clock.ToMilliseconds((int64_t) (r.ReadyTime - r.QpcTime))) << ", "
+                  << (r.ScreenTime == 0 ? 0. : clock.ToMilliseconds((int64_t) (r.ScreenTime - r.QpcTime))) << ", "
+                  << r.SyncInterval << ", "
+                  << r.PresentFlags << ", "
+                  << (uint32_t) r.PresentMode << ", "
+                  << (uint32_t) r.FinalState << "\n";
+    }
+    return 0;
+}
+
+void PrintEventRingStats(EventRing const& ring)
+{
+    fprintf(stderr, "event ring: %llu events, %.0f cycles/event in callback, high water %llu/%llu KB, %llu full stalls\n",
+        ring.mEventCount,
+        ring.mEventCount == 0 ? 0. : (double) ring.mCopyCycles / ring.mEventCount,
+        ring.mHighWater / 1024,
+        ring.mCapacity / 1024,
+        ring.mFullStallCount);
 }
 
-double QpcDeltaToSeconds(uint64_t qpcDelta)
+void PrintProcessFilterStats(ProcessFilter const& filter)
 {
-    return (double)qpcDelta / gSession.mQpcFrequency.QuadPart;
+    fprintf(stderr, "process filter: skipped %llu of %llu runtime events (%.1f%%)\n",
+        filter.mFilteredEventCount,
+        filter.mRuntimeEventCount,
+        filter.mRuntimeEventCount == 0 ? 0. : 100. * filter.mFilteredEventCount / filter.mRuntimeEventCount);
+}
+
+BOOL WINAPI HandleCtrlEvent(DWORD ctrlType)
+{
+    (void) ctrlType;
+    gQuit = true;
+    return TRUE;
+}
+
+// Realtime consumer: every intervalMs, drain the frames and completed presents
+// queued by the ETW thread and print statistics for the frames that became
+// ready during the interval.
+//
+// Frames and presents are dequeued together.  A frame is queued on EndFrame,
+// before its present can complete, so once a present has been dequeued any
+// frame that refers to it has been dequeued as well.  Frames wait in
+// pendingFrames until their present is seen completed.
+//
+// Latency is the QPC time at which the statistics are emitted minus the
+// timestamp of the last event that contributed to the frame.  It includes
+// the ETW buffer flush delay as well as the reporting interval.
+void ConsumerThread(CsvOutput* csv, uint32_t intervalMs)
+{
+    // Frames whose present hasn't completed after this long are dropped (e.g.,
+    // because some of its events were lost).
+    auto const pendingTimeout = (uint64_t) gSession.mClock.FromSeconds(10.);
+
+    std::vector<Frame> pendingFrames;
+    std::vector<Frame> frames;
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    std::vector<NTProcessEvent> processEvents;
+    std::unordered_set<PresentEvent const*> completed;
+
+    for (;;) {
+        // Read the quit flag before draining, so the last pass sees everything
+        // queued before ProcessTrace() returned.
+        auto quit = gConsumerQuit.load();
+
+        frames.clear();
+        presents.clear();
+        gPMConsumer->DequeueFramesAndPresents(frames, presents);
+
+        // Process events aren't reported, but are still queued by
+        // HandleNTProcessEvent() so they must be drained.
+        processEvents.clear();
+        gPMConsumer->DequeueProcessEvents(processEvents);
+
+        for (auto const& f : frames) {
+            if (f.present) {
+                pendingFrames.push_back(f);
+            }
+        }
+
+        completed.clear();
+        for (auto const& p : presents) {
+            completed.insert(p.get());
+        }
+
+        LARGE_INTEGER now = {};
+        QueryPerformanceCounter(&now);
+
+        uint32_t frameCount = 0;
+        uint32_t runtimeOnlyCount = 0;
+        uint32_t discardedCount = 0;
+        uint32_t lateFrameCount = 0;
+        double screenTimeSum = 0.;
+        double screenTimeMax = 0.;
+        double latencySum = 0.;
+        double latencyMax = 0.;
+
+        size_t pendingCount = 0;
+        for (auto const& f : pendingFrames) {
+            auto const& p = *f.present;
+            if (completed.find(&p) == completed.end()) {
+                if ((uint64_t) now.QuadPart - f.EndTime < pendingTimeout) {
+                    pendingFrames[pendingCount++] = f;
+                }
+                continue;
+            }
+
+            // The present's timing is unknown if its events were lost.
+            if (p.FinalState == PresentResult::Lost) {
+                continue;
+            }
+
+            if (csv != nullptr) {
+                csv->WriteFrame(f);
+            }
+
+            // Runtime-only presents (see SimpleTraceConsumer) have no screen
+            // time, so they are only counted.
+            if (p.RuntimeOnly) {
+                runtimeOnlyCount += 1;
+                continue;
+            }
+
+            // Presents that never reached the screen have no screen time
+            // either, so they are also only counted.
+            if (p.FinalState != PresentResult::Presented) {
+                discardedCount += 1;
+                continue;
+            }
+
+            auto screenTime = gSession.mClock.ToMilliseconds((int64_t) (p.ScreenTime - f.StartTime));
+            auto lastEventTime = std::max(f.EndTime, std::max(p.ReadyTime, p.ScreenTime));
+            auto latency = gSession.mClock.ToMilliseconds((int64_t) (now.QuadPart - lastEventTime));
+
+            frameCount += 1;
+            lateFrameCount += screenTime > 33. ? 1 : 0;
+            screenTimeSum += screenTime;
+            screenTimeMax = std::max(screenTimeMax, screenTime);
+            latencySum += latency;
+            latencyMax = std::max(latencyMax, latency);
+        }
+        pendingFrames.resize(pendingCount);
+
+        auto time = gSession.mClock.ToSeconds((int64_t) (now.QuadPart - gSession.mStartQpc.QuadPart));
+        if (frameCount > 0) {
+            printf("%.3f: frames=%u late=%u screen_ms(avg=%.2f max=%.2f) latency_ms(avg=%.2f max=%.2f)",
+                time,
+                frameCount,
+                lateFrameCount,
+                screenTimeSum / frameCount,
+                screenTimeMax,
+                latencySum / frameCount,
+                latencyMax);
+            if (runtimeOnlyCount > 0) {
+                printf(" runtime_only=%u", runtimeOnlyCount);
+            }
+            if (discardedCount > 0) {
+                printf(" discarded=%u", discardedCount);
+            }
+            printf("\n");
+            fflush(stdout);
+        } else if (runtimeOnlyCount > 0 || discardedCount > 0) {
+            printf("%.3f: frames=0 runtime_only=%u discarded=%u\n", time, runtimeOnlyCount, discardedCount);
+            fflush(stdout);
+        }
+
+        if (quit) {
+            break;
+        }
+
+        Sleep(intervalMs);
+    }
 }
 
-uint64_t SecondsDeltaToQpc(double secondsDelta)
+void TraceThread()
 {
-    return (uint64_t)(secondsDelta * gSession.mQpcFrequency.QuadPart);
+    ProcessTrace(&gSession.mTraceHandle, 1, NULL, NULL);
+    gSession.WaitForEventRing();
+    if (!gRestarting) {
+        gQuit = true;
+    }
 }
 
-double QpcToSeconds(uint64_t qpc)
+// Report an event gap at the last event handled, if any.
+void ReportLastEventGap()
 {
-    return QpcDeltaToSeconds(qpc - gSession.mStartQpc.QuadPart);
+    auto lastEventQpc = gSession.mLastEventQpc.load(std::memory_order_relaxed);
+    if (lastEventQpc != 0) {
+        gPMConsumer->ReportEventGap(lastEventQpc);
+    }
 }
 
-double QpcDeltaToMilliSeconds(uint64_t qpc)
+int RunRealtime(FILE* fp, uint32_t intervalMs, uint32_t bufferCapMB, bool adaptive)
 {
-    return QpcDeltaToSeconds(qpc) * 1000.;
+    SetConsoleCtrlHandler(HandleCtrlEvent, TRUE);
+
+    // CSV rows are only written in realtime mode if an output file was
+    // specified, since the statistics are printed to stdout.  If presents
+    // can be tracked without kernel events, each row says whether it was.
+    CsvOutput csv;
+    if (fp != stdout) {
+        auto columns = DefaultCsvColumns();
+        if (gPMConsumer->mSimpleConsumer != nullptr) {
+            columns.push_back(CsvColumn::RuntimeOnly);
+        }
+        csv.Start(fp, columns, gSession.mStartQpc.QuadPart, gSession.mClock);
+    }
+
+    BufferController bufferController;
+    bufferController.Initialize(&gSession, bufferCapMB * 1024);
+
+    // Switch to runtime-only tracking while the session can't keep up, with
+    // each switch reported alongside the statistics.
+    TrackingController trackingController;
+    if (adaptive) {
+        trackingController.Initialize(&gSession, stdout);
+    }
+
+    std::thread traceThread(TraceThread);
+    std::thread consumerThread(ConsumerThread, fp != stdout ? &csv : nullptr, intervalMs);
+
+    ULONG lastEventsLost = 0;
+    ULONG lastBuffersLost = 0;
+    for (uint32_t pollCount = 1; !gQuit; ++pollCount) {
+        Sleep(100);
+
+        if (gSession.mOccupancyGauges != nullptr) {
+            gSession.mOccupancyGauges->Poll(gSession.mStartQpc.QuadPart, gSession.mClock);
+        }
+
+        if (pollCount % 10 != 0) {
+            continue;
+        }
+
+        // Check for lost events once a second.  The exact time of the loss
+        // isn't known, so report a gap at the last event handled: every
+        // event up to it was seen, and presents in flight before it are
+        // treated as lost.  (Reporting the current time would also lose the
+        // presents that started in events still waiting to be handled.)
+        ULONG eventsLost = 0;
+        ULONG buffersLost = 0;
+        if (gSession.CheckLostReports(&eventsLost, &buffersLost) == ERROR_SUCCESS &&
+            (eventsLost != lastEventsLost || buffersLost != lastBuffersLost)) {
+            lastEventsLost = eventsLost;
+            lastBuffersLost = buffersLost;
+            ReportLastEventGap();
+        }
+
+        if (adaptive) {
+            trackingController.Poll();
+        }
+
+        // Grow the ETW buffer pool if needed.  Growing BufferSize requires
+        // restarting the session, during which events are not collected.
+        if (bufferCapMB == 0) {
+            continue;
+        }
+        if (bufferController.Poll() == BufferController::Action::RestartRequired) {
+            gRestarting = true;
+            gSession.Stop();
+            traceThread.join();
+
+            auto status = gSession.Restart();
+            gRestarting = false;
+            if (status != ERROR_SUCCESS) {
+                fprintf(stderr, "error: failed to restart trace session (error=%lu).\n", status);
+                break;
+            }
+
+            bufferController.OnRestart();
+            if (adaptive) {
+                trackingController.OnRestart();
+            }
+            lastEventsLost = 0;
+            lastBuffersLost = 0;
+            ReportLastEventGap();
+            traceThread = std::thread(TraceThread);
+        }
+    }
+
+    gSession.Stop();
+    if (traceThread.joinable()) {
+        traceThread.join();
+    }
+
+    gConsumerQuit = true;
+    consumerThread.join();
+
+    csv.Stop();
+
+    if (gPMConsumer->mEventGapCount > 0) {
+        fprintf(stderr, "lost events: %llu gaps, %llu presents lost\n",
+            gPMConsumer->mEventGapCount,
+            gPMConsumer->mLostPresentCount);
+    }
+    if (adaptive) {
+        trackingController.PrintSummary(stderr);
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    bool expectFilteredEvents = false;
+    char const* etlPath = nullptr;
+    char const* outputPath = nullptr;
+    char const* indexPath = nullptr;
+    char const* journalPath = nullptr;
+    char const* timelinePath = nullptr;
+    uint32_t flightRecorderMB = 0;
+    bool queueDepth = false;
+    char const* queueDepthPath = nullptr;
+    bool gpuBusy = false;
+    char const* gpuBusyPath = nullptr;
+    char const* gpuFramePath = nullptr;
+    bool stageLatency = false;
     bool simple = false;
+    bool adaptive = false;
+    FlightRecorderOptions flightOptions;
+    uint32_t intervalMs = 1000;
+    uint32_t eventRingMB = 64;
+    uint32_t bufferCapMB = 256;
+    char const* batchPath = nullptr;
+    char const* resumePath = nullptr;
+    bool batchScaling = false;
+    bool profile = false;
+    double occupancyMs = 0.;
+    bool stressTest = false;
+    StressTestOptions stressOptions;
+    DebugJournal journal;
+    BatchOptions batchOptions;
+    ProcessFilter processFilter;
+    auto columns = DefaultCsvColumns();
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-columns") == 0 && i + 1 < argc) {
+            if (!ParseCsvColumns(argv[++i], &columns)) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-output_file") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "-interval_ms") == 0 && i + 1 < argc) {
+            intervalMs = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-event_ring_mb") == 0 && i + 1 < argc) {
+            eventRingMB = strtoul(argv[++i], nullptr, 0); // 0 disables the ring; realtime sessions only
+        } else if (strcmp(argv[i], "-buffer_size_kb") == 0 && i + 1 < argc) {
+            gSession.mBufferSizeKB = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-min_buffers") == 0 && i + 1 < argc) {
+            gSession.mMinimumBuffers = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-max_buffers") == 0 && i + 1 < argc) {
+            gSession.mMaximumBuffers = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-flush_timer") == 0 && i + 1 < argc) {
+            gSession.mFlushTimer = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-buffer_cap_mb") == 0 && i + 1 < argc) {
+            bufferCapMB = strtoul(argv[++i], nullptr, 0); // 0 disables adaptive buffer sizing
+        } else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if (strcmp(argv[i], "-batch_scaling") == 0) {
+            batchScaling = true;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            batchOptions.mThreadCount = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-max_in_flight") == 0 && i + 1 < argc) {
+            batchOptions.mMaxFilesInFlight = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-decode_benchmark") == 0) {
+            return RunDecodeBenchmark() ? 0 : 1;
+        } else if (strcmp(argv[i], "-pipeline_benchmark") == 0) {
+            return RunPipelineBenchmark() ? 0 : 1;
+        } else if (strcmp(argv[i], "-scaling_benchmark") == 0) {
+            return RunScalingBenchmark() ? 0 : 1;
+        } else if (strcmp(argv[i], "-stress_test") == 0 && i + 1 < argc) {
+            stressTest = true;
+            stressOptions.mSeed = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-stress_events") == 0 && i + 1 < argc) {
+            stressOptions.mEventCount = strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[i], "-occupancy_ms") == 0 && i + 1 < argc) {
+            occupancyMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-timeline_file") == 0 && i + 1 < argc) {
+            timelinePath = argv[++i];
+        } else if (strcmp(argv[i], "-flight_recorder_mb") == 0 && i + 1 < argc) {
+            flightRecorderMB = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-flight_window") == 0 && i + 2 < argc) {
+            // -flight_window before after (seconds around the hitch)
+            flightOptions.mWindowSeconds = atof(argv[i + 1]);
+            flightOptions.mPostRollSeconds = atof(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "-flight_prefix") == 0 && i + 1 < argc) {
+            flightOptions.mPathPrefix = argv[++i];
+        } else if (strcmp(argv[i], "-hitch_ms") == 0 && i + 1 < argc) {
+            flightOptions.mHitchMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-hitch_vblanks") == 0 && i + 1 < argc) {
+            flightOptions.mHitchVBlanks = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-refresh_rate") == 0 && i + 1 < argc) {
+            flightOptions.mRefreshRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-replay_capture") == 0 && i + 1 < argc) {
+            return ReplayFlightCapture(argv[i + 1], stdout) ? 0 : 1;
+        } else if (strcmp(argv[i], "-queue_depth") == 0) {
+            queueDepth = true;
+        } else if (strcmp(argv[i], "-queue_depth_file") == 0 && i + 1 < argc) {
+            queueDepth = true;
+            queueDepthPath = argv[++i];
+        } else if (strcmp(argv[i], "-gpu_busy") == 0) {
+            gpuBusy = true;
+        } else if (strcmp(argv[i], "-gpu_busy_file") == 0 && i + 1 < argc) {
+            gpuBusy = true;
+            gpuBusyPath = argv[++i];
+        } else if (strcmp(argv[i], "-gpu_frame_file") == 0 && i + 1 < argc) {
+            gpuBusy = true;
+            gpuFramePath = argv[++i];
+        } else if (strcmp(argv[i], "-stage_latency") == 0) {
+            stageLatency = true;
+        } else if (strcmp(argv[i], "-simple") == 0) {
+            simple = true;
+        } else if (strcmp(argv[i], "-adaptive") == 0) {
+            adaptive = true;
+        } else if (strcmp(argv[i], "-save_index") == 0 && i + 1 < argc) {
+            indexPath = argv[++i];
+        } else if (strcmp(argv[i], "-debug_journal") == 0 && i + 1 < argc) {
+            journalPath = argv[++i];
+        } else if (strcmp(argv[i], "-debug_window") == 0 && i + 2 < argc) {
+            // -debug_window start stop (seconds from the first event)
+            journal.mStartNs = (uint64_t) (atof(argv[i + 1]) * 1000000000.);
+            journal.mStopNs  = (uint64_t) (atof(argv[i + 2]) * 1000000000.);
+            i += 2;
+        } else if (strcmp(argv[i], "-decode_journal") == 0 && i + 1 < argc) {
+            return DecodeDebugJournal(argv[i + 1], stdout) ? 0 : 1;
+        } else if (strcmp(argv[i], "-process_id") == 0 && i + 1 < argc) {
+            processFilter.mProcessIds.push_back(strtoul(argv[++i], nullptr, 0));
+        } else if (strcmp(argv[i], "-process_name") == 0 && i + 1 < argc) {
+            processFilter.mImageNames.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "-checkpoint") == 0 && i + 2 < argc) {
+            // -checkpoint seconds path; may be repeated
+            CheckpointRequest request;
+            request.mTime = atof(argv[i + 1]);
+            request.mPath = argv[i + 2];
+            gSession.mCheckpoints.push_back(request);
+            i += 2;
+        } else if (strcmp(argv[i], "-resume") == 0 && i + 1 < argc) {
+            resumePath = argv[++i];
+        } else if (strcmp(argv[i], "-stop_at") == 0 && i + 1 < argc) {
+            gSession.mStopTime = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-query_index") == 0 && i + 5 < argc) {
+            // -query_index path processId swapChainAddress t0 t1
+            return QueryIndex(argv[i + 1],
+                              strtoul(argv[i + 2], nullptr, 0),
+                              strtoull(argv[i + 3], nullptr, 0),
+                              atof(argv[i + 4]),
+                              atof(argv[i + 5]));
+        } else {
+            etlPath = argv[i];
+        }
+    }
+
+    // Run the consumer on mutated synthetic traces, checking tracking bounds.
+    if (stressTest) {
+        return RunStressTest(stressOptions) ? 0 : 1;
+    }
+
+    // Batch mode: process a directory or list of ETL files in parallel.
+    if (batchPath != nullptr) {
+        std::vector<std::string> files;
+        if (!GetBatchFileList(batchPath, &files)) {
+            return 1;
+        }
+        if (batchScaling) {
+            PrintBatchScaling(files, batchOptions.mMaxFilesInFlight);
+        } else {
+            std::vector<BatchFileSummary> summaries;
+            auto wallSeconds = RunBatch(files, batchOptions, &summaries);
+            PrintBatchReport(summaries, wallSeconds);
+        }
+        return 0;
+    }
+
+    // Checkpoints are only meaningful for log files, and are written from the
+    // ETW callback, so they are used without the EventRing.
+    auto eventControl = !gSession.mCheckpoints.empty() || resumePath != nullptr || gSession.mStopTime > 0.;
+    if (eventControl) {
+        if (etlPath == nullptr) {
+            fprintf(stderr, "error: -checkpoint, -resume, and -stop_at require an ETL file.\n");
+            return 1;
+        }
+        eventRingMB = 0;
+        std::sort(gSession.mCheckpoints.begin(), gSession.mCheckpoints.end(),
+                  [](CheckpointRequest const& a, CheckpointRequest const& b) { return a.mTime < b.mTime; });
+    }
+
+    // Simple mode doesn't see the kernel events, and its per-thread state
+    // isn't saved in checkpoints.
+    if (simple && (gpuBusy || stageLatency || !gSession.mCheckpoints.empty() || resumePath != nullptr)) {
+        fprintf(stderr, "error: -simple can't be used with -gpu_busy, -stage_latency, -checkpoint, or -resume.\n");
+        return 1;
+    }
+    // Adaptive tracking switches to simple mode when events are lost, so it
+    // has the same restrictions.
+    if (adaptive && (etlPath != nullptr || simple || gpuBusy || stageLatency || !gSession.mCheckpoints.empty())) {
+        fprintf(stderr, "error: -adaptive requires a realtime session, and can't be used with -simple, -gpu_busy, -stage_latency, or -checkpoint.\n");
+        return 1;
+    }
+
+    FILE* fp = stdout;
+    if (outputPath != nullptr) {
+        // Text mode, so rows have the same line endings as on stdout.
+        if (fopen_s(&fp, outputPath, "w") != 0) {
+            fprintf(stderr, "error: failed to open output file: %s\n", outputPath);
+            return 1;
+        }
+    }
+
+    FILE* timelineFile = nullptr;
+    if (timelinePath != nullptr) {
+        if (fopen_s(&timelineFile, timelinePath, "wb") != 0) {
+            fprintf(stderr, "error: failed to open timeline file: %s\n", timelinePath);
+            return 1;
+        }
+    }
+
+    FILE* queueDepthFile = nullptr;
+    if (queueDepthPath != nullptr) {
+        if (fopen_s(&queueDepthFile, queueDepthPath, "wb") != 0) {
+            fprintf(stderr, "error: failed to open queue depth file: %s\n", queueDepthPath);
+            return 1;
+        }
+    }
+
+    FILE* gpuBusyFile = nullptr;
+    if (gpuBusyPath != nullptr) {
+        if (fopen_s(&gpuBusyFile, gpuBusyPath, "wb") != 0) {
+            fprintf(stderr, "error: failed to open GPU busy file: %s\n", gpuBusyPath);
+            return 1;
+        }
+    }
+
+    FILE* gpuFrameFile = nullptr;
+    if (gpuFramePath != nullptr) {
+        if (fopen_s(&gpuFrameFile, gpuFramePath, "wb") != 0) {
+            fprintf(stderr, "error: failed to open GPU frame file: %s\n", gpuFramePath);
+            return 1;
+        }
+    }
+
+    bool expectFilteredEvents = false;
     gPMConsumer = new PMTraceConsumer(expectFilteredEvents, simple);
-    auto status = gSession.Start(gPMConsumer, nullptr, argv[1], nullptr);
+
+    // In simple mode only the runtime events are traced, and they are handled
+    // without any kernel tracking state.  Adaptive tracking switches to it
+    // under load.  Like gPMConsumer, it outlives the session, so presents
+    // still in flight at exit are never destroyed.
+    if (simple || adaptive) {
+        gPMConsumer->mSimpleConsumer = new SimpleTraceConsumer(gPMConsumer);
+    }
+    gSession.mAdaptiveTracking = adaptive;
+
+    PresentIndex index;
+    if (indexPath != nullptr) {
+        gPMConsumer->mPresentIndex = &index;
+    }
+
+    // Binary journal of handled events and present changes, written out at
+    // the end of the run and rendered with -decode_journal.
+    if (journalPath != nullptr) {
+        journal.Initialize(DEBUG_JOURNAL_RECORD_COUNT);
+        gDebugJournal = &journal;
+    }
+
+    // Only handle runtime events from the requested processes.  Realtime
+    // sessions see Kernel-Process start events but no rundown of processes
+    // that were already running, so those processes' image names are looked
+    // up when their process ids are first seen.
+    if (!processFilter.IsEmpty()) {
+        processFilter.mQueryProcesses = etlPath == nullptr;
+        gPMConsumer->mProcessFilter = &processFilter;
+    }
+
+    // Per-handler counts and cycles, reported at the end of the run.
+    HandlerProfile handlerProfile;
+    if (profile) {
+        handlerProfile.Start();
+        gPMConsumer->mProfile = &handlerProfile;
+        gPMConsumer->mMetadata.profile_ = &handlerProfile;
+    }
+
+    // Tracking map occupancy, printed to stderr every occupancyMs.  Log files
+    // are sampled by trace time as their events are handled; realtime
+    // sessions are polled by RunRealtime() so that event handling isn't
+    // paused for a full scan.
+    OccupancyGauges occupancyGauges;
+    if (occupancyMs > 0.) {
+        occupancyGauges.Start(stderr, occupancyMs, etlPath == nullptr);
+        gSession.mOccupancyGauges = &occupancyGauges;
+    }
+
+    CheckpointInfo resumeInfo;
+    if (resumePath != nullptr) {
+        if (!ReadCheckpoint(resumePath, &resumeInfo, gPMConsumer, nullptr)) {
+            return 1;
+        }
+        gSession.mResumeEventIndex = resumeInfo.mEventIndex;
+    }
+
+    // The ring keeps the ETW callback short so that realtime buffers aren't
+    // lost; log files are read at the consumer's pace, so their events are
+    // handled directly.
+    if (etlPath != nullptr) {
+        eventRingMB = 0;
+    }
+
+    EventRing eventRing;
+    if (eventRingMB != 0) {
+        if (!eventRing.Initialize((uint64_t) eventRingMB * 1024 * 1024)) {
+            fprintf(stderr, "error: failed to allocate %u MB event ring.\n", eventRingMB);
+            return 1;
+        }
+        gSession.mEventRing = &eventRing;
+    }
+
+    // Without an ETL path, start a realtime session.  If a session with the
+    // same name was left running (e.g., by a previous run that crashed), stop
+    // it and try again.
+    auto sessionName = etlPath == nullptr ? REALTIME_SESSION_NAME : nullptr;
+    auto status = gSession.Start(gPMConsumer, nullptr, etlPath, sessionName);
+    if (status == ERROR_ALREADY_EXISTS && sessionName != nullptr) {
+        TraceSession::StopNamedSession(sessionName);
+        status = gSession.Start(gPMConsumer, nullptr, etlPath, sessionName);
+    }
+    if (status != ERROR_SUCCESS) {
+        fprintf(stderr, "error: failed to start trace session (error=%lu).\n", status);
+        if (status == ERROR_ACCESS_DENIED) {
+            fprintf(stderr, "       Realtime tracing requires administrator privileges.\n");
+        }
+        return 1;
+    }
+
+    // Keep the resumed run's times relative to the original start of the
+    // trace (Start() resets mStartQpc).
+    if (resumePath != nullptr) {
+        gSession.mStartQpc.QuadPart = resumeInfo.mStartQpc;
+    }
+
+    // Presents and frames are streamed to the timeline as they complete.
+    // The QPC frequency is only known once the session has started, and the
+    // start time of an ETL session once its first event is seen.
+    TimelineOutput timeline;
+    if (timelineFile != nullptr) {
+        timeline.Start(timelineFile, &gSession.mStartQpc, gSession.mClock);
+        gPMConsumer->mTimeline = &timeline;
+    }
+
+    // Per-swap chain queue depth, with each change written to queueDepthFile
+    // and a summary reported at the end of the run.
+    QueueDepthTracker queueDepthTracker;
+    if (queueDepth) {
+        queueDepthTracker.Start(queueDepthFile, &gSession.mStartQpc, gSession.mClock);
+        gPMConsumer->mQueueDepth = &queueDepthTracker;
+    }
+
+    // Per-context and overall GPU busy time, with the merged busy intervals
+    // written to gpuBusyFile, each frame's GPU work to gpuFrameFile, and a
+    // summary reported at the end of the run.
+    GpuBusyTracker gpuBusyTracker;
+    if (gpuBusy) {
+        gpuBusyTracker.Start(gpuBusyFile, gpuFrameFile, &gSession.mStartQpc, gSession.mClock);
+        gPMConsumer->mGpuBusy = &gpuBusyTracker;
+    }
+
+    // Histograms of the time between each present's pipeline stages,
+    // reported at the end of the run.
+    StageLatencyHistograms stageLatencyHistograms;
+    if (stageLatency) {
+        stageLatencyHistograms.Start(gSession.mClock);
+        gPMConsumer->mStageLatency = &stageLatencyHistograms;
+    }
+
+    // Keep the most recent events, and write out the ones around each
+    // hitch.  Events are recorded on the handling thread, after the
+    // EventRing if there is one.
+    FlightRecorder flightRecorder;
+    if (flightRecorderMB != 0) {
+        if (flightOptions.mHitchMs == 0. && flightOptions.mHitchVBlanks == 0) {
+            fprintf(stderr, "warning: -flight_recorder_mb without -hitch_ms or -hitch_vblanks never writes a capture.\n");
+        }
+        flightOptions.mCapacity = (uint64_t) flightRecorderMB * 1024 * 1024;
+        if (!flightRecorder.Start(flightOptions, &gPMConsumer->mMetadata, &gSession.mStartQpc, gSession.mClock)) {
+            gSession.Stop();
+            return 1;
+        }
+        gSession.mFlightRecorder = &flightRecorder;
+        gPMConsumer->mFlightRecorder = &flightRecorder;
+    }
+
+    if (etlPath == nullptr) {
+        auto result = RunRealtime(fp, intervalMs, bufferCapMB, adaptive);
+        if (eventRingMB != 0) {
+            PrintEventRingStats(eventRing);
+        }
+        if (gPMConsumer->mProcessFilter != nullptr) {
+            PrintProcessFilterStats(processFilter);
+        }
+        if (profile) {
+            handlerProfile.Print(stderr);
+        }
+        if (indexPath != nullptr) {
+            index.SetTimeBase(gSession.mStartQpc.QuadPart, gSession.mQpcFrequency.QuadPart);
+            index.Save(indexPath);
+        }
+        if (journalPath != nullptr) {
+            journal.Write(journalPath);
+        }
+        if (timelineFile != nullptr) {
+            timeline.Stop();
+            fclose(timelineFile);
+        }
+        if (flightRecorderMB != 0) {
+            flightRecorder.Stop();
+            flightRecorder.PrintStats(stderr);
+        }
+        if (queueDepth) {
+            queueDepthTracker.PrintSummary(stderr);
+        }
+        if (queueDepthFile != nullptr) {
+            fclose(queueDepthFile);
+        }
+        if (gpuBusy) {
+            gpuBusyTracker.PrintSummary(stderr);
+        }
+        if (gpuBusyFile != nullptr) {
+            fclose(gpuBusyFile);
+        }
+        if (gpuFrameFile != nullptr) {
+            fclose(gpuFrameFile);
+        }
+        if (stageLatency) {
+            stageLatencyHistograms.PrintSummary(stderr);
+        }
+        if (fp != stdout) {
+            fclose(fp);
+        }
+        return result;
+    }
+
+    LARGE_INTEGER processStart = {};
+    LARGE_INTEGER processEnd = {};
+    QueryPerformanceCounter(&processStart);
     ProcessTrace(&gSession.mTraceHandle, 1, NULL, NULL);
+    gSession.WaitForEventRing();
+    QueryPerformanceCounter(&processEnd);
+
+    // Report the processing time so that the cost of options like
+    // -process_name can be compared on the same capture.
+    LARGE_INTEGER processFreq = {};
+    QueryPerformanceFrequency(&processFreq);
+    fprintf(stderr, "processed trace in %.3f s\n", (double) (processEnd.QuadPart - processStart.QuadPart) / processFreq.QuadPart);
+    if (eventRingMB != 0) {
+        PrintEventRingStats(eventRing);
+    }
+    if (gPMConsumer->mProcessFilter != nullptr) {
+        PrintProcessFilterStats(processFilter);
+    }
+    if (profile) {
+        handlerProfile.Print(stderr);
+    }
+
+    if (indexPath != nullptr) {
+        index.SetTimeBase(gSession.mStartQpc.QuadPart, gSession.mQpcFrequency.QuadPart);
+        index.Save(indexPath);
+    }
+    if (journalPath != nullptr) {
+        journal.Write(journalPath);
+    }
+    if (timelineFile != nullptr) {
+        timeline.Stop();
+        fclose(timelineFile);
+    }
+    if (flightRecorderMB != 0) {
+        flightRecorder.Stop();
+        flightRecorder.PrintStats(stderr);
+    }
+    if (queueDepth) {
+        queueDepthTracker.PrintSummary(stderr);
+    }
+    if (queueDepthFile != nullptr) {
+        fclose(queueDepthFile);
+    }
+    if (gpuBusy) {
+        gpuBusyTracker.PrintSummary(stderr);
+    }
+    if (gpuBusyFile != nullptr) {
+        fclose(gpuBusyFile);
+    }
+    if (gpuFrameFile != nullptr) {
+        fclose(gpuFrameFile);
+    }
+    if (stageLatency) {
+        stageLatencyHistograms.PrintSummary(stderr);
+    }
     /*for (auto p : gPMConsumer->mCompletedPresents) {
         std::cout << p->ThreadId << " " << p->QueueSubmitSequence << " "  << p->ReadyTime - gSession.mStartQpc.QuadPart << "\n";
     }*/
+
+    // Rows are formatted here and written out by the CsvOutput writer thread.
+    CsvOutput csv;
+    csv.Start(fp, columns, gSession.mStartQpc.QuadPart, gSession.mClock);
     int late_frames = 0;
-    for (auto f : gPMConsumer->mFrames) {
-        if (f.present) {
-            auto p = f.present;
-            auto start_time = f.StartTime - gSession.mStartQpc.QuadPart;
-            auto combined_time = QpcDeltaToMilliSeconds(p->ReadyTime - f.StartTime);
-            auto renderer_time = QpcDeltaToMilliSeconds(p->QpcTime - f.StartTime);
-            auto gpu_time = QpcDeltaToMilliSeconds(p->ReadyTime - p->QpcTime);
-            auto screen_time = QpcDeltaToMilliSeconds(p->ScreenTime - f.StartTime);
-            if (screen_time > 33.) {
-                late_frames++;
-            }
-            std::cout << start_time << "," << renderer_time << ", " << gpu_time << ", " << combined_time << ", " << screen_time << "\n";
+    for (auto const& f : gPMConsumer->mFrames) {
+        // When stopping early, frames whose present is still in flight are
+        // left to the run that resumes from a checkpoint at the stop time.
+        if (gSession.mStopTime > 0. && f.present && !f.present->Completed) {
+            continue;
         }
+        if (f.present && f.present->FinalState != PresentResult::Lost) {
+            if (f.present->FinalState == PresentResult::Presented) {
+                auto screen_time = gSession.mClock.ToMilliseconds((int64_t) (f.present->ScreenTime - f.StartTime));
+                if (screen_time > 33.) {
+                    late_frames++;
+                }
+            }
+            csv.WriteFrame(f);
+        }
+    }
+    csv.Stop();
+    if (fp != stdout) {
+        fclose(fp);
     }
     std::cout << "late_frames: " << late_frames;
 }
\ No newline at end of file
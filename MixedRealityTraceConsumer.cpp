@@ -28,6 +28,7 @@ SOFTWARE.
 #include <tdh.h>
 
 #include "MixedRealityTraceConsumer.hpp"
+#include "HandlerProfile.hpp"
 #include "TraceConsumer.hpp"
 #include "DxgkrnlEventStructs.hpp"
 
@@ -218,6 +219,7 @@ void MRTraceConsumer::HolographicFrameStop(std::shared_ptr<HolographicFrame> p)
 
 void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::DHDEvent);
     auto const& hdr = pEventRecord->EventHeader;
     const std::wstring taskName = GetEventTaskNameFromTdh(pEventRecord);
 
@@ -406,6 +408,7 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
 
 void MRTraceConsumer::HandleSpectrumContinuousEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::SpectrumContinuousEvent);
     auto const& hdr = pEventRecord->EventHeader;
     const std::wstring taskName = GetEventTaskNameFromTdh(pEventRecord);
 
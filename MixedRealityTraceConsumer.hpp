@@ -257,6 +257,10 @@ struct MRTraceConsumer
     std::map<uint32_t, std::shared_ptr<HolographicFrame>> mHolographicFramesByPresentId;
 
     std::shared_ptr<LateStageReprojectionEvent> mActiveLSR;
+
+    // If non-null, handler costs are accumulated here.
+    HandlerProfile* mProfile = nullptr;
+
     bool DequeueLSRs(std::vector<std::shared_ptr<LateStageReprojectionEvent>>& outLSRs)
     {
         if (mCompletedLSRs.size()) {
@@ -0,0 +1,328 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "OccupancyGauges.hpp"
+#include "PresentMonTraceConsumer.hpp"
+#include "MixedRealityTraceConsumer.hpp"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace {
+
+// Approximate per-entry overhead of a std::map node (left/right/parent
+// pointers plus color and sentinel flags, padded) and of a shared_ptr
+// control block allocated by make_shared.
+size_t const MAP_NODE_OVERHEAD = 4 * sizeof(void*);
+size_t const SHARED_PTR_CONTROL_OVERHEAD = 2 * sizeof(void*);
+
+char const* const GAUGE_NAMES[] = {
+    "mPresentsByProcess",
+    "mPresentsByProcessAndSwapChain",
+    "mPresentByThreadId",
+    "mPresentsBySubmitSequence",
+    "mWin32KPresentHistoryTokens",
+    "mDxgKrnlPresentHistoryTokens",
+    "mBltsByDxgContext",
+    "mLastWindowPresent",
+    "mPresentsWaitingForDWM",
+    "mPresentsByLegacyBlitToken",
+    "mCompletedPresents",
+    "mFrames",
+    "mCurrentFramesByThreadId",
+    "MR mPresentationSourceByPtr",
+    "MR mHolographicFramesByFrameId",
+    "MR mHolographicFramesByPresentId",
+};
+static_assert(_countof(GAUGE_NAMES) == (size_t) OccupancyGauge::Count, "GAUGE_NAMES must match OccupancyGauge");
+
+void UpdateOldest(OccupancySnapshot::Gauge* gauge, uint64_t qpc)
+{
+    if (qpc != 0 && (gauge->mOldestQpc == 0 || qpc < gauge->mOldestQpc)) {
+        gauge->mOldestQpc = qpc;
+    }
+}
+
+// Measure a std::map whose values are shared_ptrs to objects with a start
+// time given by getTime().  Unless scanEntries is set, only the first
+// entry's time is read.
+template<typename Map, typename GetTime>
+void MeasureMap(Map const& map, GetTime getTime, bool scanEntries, OccupancySnapshot::Gauge* gauge)
+{
+    gauge->mCount = map.size();
+    gauge->mBytes = map.size() * (sizeof(typename Map::value_type) + MAP_NODE_OVERHEAD);
+    for (auto const& pair : map) {
+        UpdateOldest(gauge, getTime(pair.second));
+        if (!scanEntries) {
+            break;
+        }
+    }
+}
+
+template<typename Map>
+void MeasurePresentMap(Map const& map, bool scanEntries, OccupancySnapshot::Gauge* gauge)
+{
+    MeasureMap(map, [](std::shared_ptr<PresentEvent> const& p) { return p->QpcTime; }, scanEntries, gauge);
+}
+
+template<typename Container>
+void MeasurePresentSequence(Container const& presents, size_t capacity, bool scanEntries, OccupancySnapshot::Gauge* gauge)
+{
+    gauge->mCount = presents.size();
+    gauge->mBytes = capacity * sizeof(typename Container::value_type);
+    for (auto const& p : presents) {
+        UpdateOldest(gauge, p->QpcTime);
+        if (!scanEntries) {
+            break;
+        }
+    }
+}
+
+// Measure every map (see OccupancyGauges::Sample() and Publish()).
+void MeasureMaps(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, bool scanEntries, OccupancySnapshot* snapshot)
+{
+    auto gauge = [snapshot](OccupancyGauge g) { return &snapshot->mGauges[(size_t) g]; };
+
+    // mPresentsByProcess is keyed by QpcTime, so each process's oldest
+    // present is its first entry.
+    {
+        auto g = gauge(OccupancyGauge::PresentsByProcess);
+        for (auto const& pair : pmConsumer->mPresentsByProcess) {
+            auto const& presents = pair.second;
+            g->mCount += presents.size();
+            g->mBytes += sizeof(pair) + MAP_NODE_OVERHEAD +
+                         presents.size() * (sizeof(*presents.begin()) + MAP_NODE_OVERHEAD);
+            if (!presents.empty()) {
+                UpdateOldest(g, presents.begin()->first);
+            }
+        }
+    }
+
+    // Each swap chain's deque is in submission order.
+    {
+        auto g = gauge(OccupancyGauge::PresentsByProcessAndSwapChain);
+        for (auto const& pair : pmConsumer->mPresentsByProcessAndSwapChain) {
+            auto const& presents = pair.second;
+            g->mCount += presents.size();
+            g->mBytes += sizeof(pair) + MAP_NODE_OVERHEAD +
+                         presents.size() * sizeof(presents[0]);
+            if (!presents.empty()) {
+                UpdateOldest(g, presents.front()->QpcTime);
+            }
+        }
+    }
+
+    MeasurePresentMap(pmConsumer->mPresentByThreadId,           scanEntries, gauge(OccupancyGauge::PresentByThreadId));
+    MeasurePresentMap(pmConsumer->mPresentsBySubmitSequence,    scanEntries, gauge(OccupancyGauge::PresentsBySubmitSequence));
+    MeasurePresentMap(pmConsumer->mWin32KPresentHistoryTokens,  scanEntries, gauge(OccupancyGauge::Win32KPresentHistoryTokens));
+    MeasurePresentMap(pmConsumer->mDxgKrnlPresentHistoryTokens, scanEntries, gauge(OccupancyGauge::DxgKrnlPresentHistoryTokens));
+    MeasurePresentMap(pmConsumer->mBltsByDxgContext,            scanEntries, gauge(OccupancyGauge::BltsByDxgContext));
+    MeasurePresentMap(pmConsumer->mLastWindowPresent,           scanEntries, gauge(OccupancyGauge::LastWindowPresent));
+    MeasurePresentMap(pmConsumer->mPresentsByLegacyBlitToken,   scanEntries, gauge(OccupancyGauge::PresentsByLegacyBlitToken));
+    MeasurePresentSequence(pmConsumer->mPresentsWaitingForDWM, pmConsumer->mPresentsWaitingForDWM.size(), scanEntries, gauge(OccupancyGauge::PresentsWaitingForDWM));
+
+    MeasureMap(pmConsumer->mCurrentFramesByThreadId, [](Frame const& f) { return f.StartTime; }, scanEntries, gauge(OccupancyGauge::CurrentFramesByThreadId));
+
+    // mCompletedPresents and mFrames are shared with the consumer thread.
+    {
+        auto lock = scoped_lock(pmConsumer->mMutex);
+
+        MeasurePresentSequence(pmConsumer->mCompletedPresents, pmConsumer->mCompletedPresents.capacity(), scanEntries, gauge(OccupancyGauge::CompletedPresents));
+
+        auto g = gauge(OccupancyGauge::Frames);
+        g->mCount = pmConsumer->mFrames.size();
+        g->mBytes = pmConsumer->mFrames.capacity() * sizeof(Frame);
+        for (auto const& f : pmConsumer->mFrames) {
+            UpdateOldest(g, f.StartTime);
+            if (!scanEntries) {
+                break;
+            }
+        }
+    }
+
+    if (mrConsumer != nullptr) {
+        MeasureMap(mrConsumer->mPresentationSourceByPtr,
+                   [](std::shared_ptr<PresentationSource> const& s) { return s->AcquireForRenderingTime; },
+                   scanEntries, gauge(OccupancyGauge::MRPresentationSourceByPtr));
+        MeasureMap(mrConsumer->mHolographicFramesByFrameId,
+                   [](std::shared_ptr<HolographicFrame> const& f) { return f->StartTime; },
+                   scanEntries, gauge(OccupancyGauge::MRHolographicFramesByFrameId));
+        MeasureMap(mrConsumer->mHolographicFramesByPresentId,
+                   [](std::shared_ptr<HolographicFrame> const& f) { return f->StartTime; },
+                   scanEntries, gauge(OccupancyGauge::MRHolographicFramesByPresentId));
+    }
+}
+
+}
+
+char const* OccupancyGaugeName(OccupancyGauge gauge)
+{
+    assert(gauge < OccupancyGauge::Count);
+    return GAUGE_NAMES[(size_t) gauge];
+}
+
+void OccupancyGauges::Start(FILE* fp, double intervalMs, bool polled)
+{
+    assert(intervalMs > 0.);
+
+    mFile = fp;
+    mIntervalMs = intervalMs;
+    mIntervalQpc = 0;
+    mNextSampleQpc = 0;
+    for (auto& h : mHighWater) {
+        h = 0;
+    }
+
+    mPolled = polled;
+    mSnapshotRequested = false;
+    mSnapshotPublished = false;
+}
+
+// The interval is converted once the trace's clock is known, and the first
+// snapshot is taken one interval after the first event (or poll).
+void OccupancyGauges::InitializeClock(uint64_t qpc, uint64_t startQpc, QpcClock const& clock)
+{
+    if (clock.mFrequency == 0) {
+        LARGE_INTEGER frequency = {};
+        QueryPerformanceFrequency(&frequency);
+        mClock.Initialize(frequency.QuadPart);
+    } else {
+        mClock = clock;
+    }
+    mStartQpc = startQpc == 0 ? qpc : startQpc;
+    mIntervalQpc = std::max<uint64_t>(1, (uint64_t) mClock.FromSeconds(mIntervalMs / 1000.));
+    mNextSampleQpc = qpc + mIntervalQpc;
+}
+
+void OccupancyGauges::Update(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t qpc, uint64_t startQpc, QpcClock const& clock)
+{
+    if (mNextSampleQpc == 0) {
+        InitializeClock(qpc, startQpc, clock);
+        return;
+    }
+
+    Sample(pmConsumer, mrConsumer, qpc, &mLastSnapshot);
+    if (mFile != nullptr) {
+        Print(mFile, mLastSnapshot);
+    }
+
+    // Intervals without any events are skipped rather than reported late.
+    mNextSampleQpc = qpc + mIntervalQpc;
+}
+
+void OccupancyGauges::Poll(uint64_t startQpc, QpcClock const& clock)
+{
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+    if (mNextSampleQpc == 0) {
+        InitializeClock(now.QuadPart, startQpc, clock);
+        return;
+    }
+
+    // Report the snapshot published since the last request, if any.
+    auto published = false;
+    {
+        auto lock = scoped_lock(mMutex);
+        if (mSnapshotPublished) {
+            mLastSnapshot = mPublishedSnapshot;
+            mSnapshotPublished = false;
+            published = true;
+        }
+    }
+    if (published) {
+        Finish(&mLastSnapshot);
+        if (mFile != nullptr) {
+            Print(mFile, mLastSnapshot);
+        }
+    }
+
+    // If no events arrive, the request stays pending and that interval is
+    // skipped.
+    if ((uint64_t) now.QuadPart >= mNextSampleQpc) {
+        mSnapshotRequested.store(true, std::memory_order_relaxed);
+        mNextSampleQpc = now.QuadPart + mIntervalQpc;
+    }
+}
+
+// Only each map's size and first entry are read, so that the handling thread
+// doesn't pause for a scan of every entry (see OccupancyGauges.hpp).
+void OccupancyGauges::Publish(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t qpc)
+{
+    mSnapshotRequested.store(false, std::memory_order_relaxed);
+
+    OccupancySnapshot snapshot;
+    snapshot.mQpc = qpc;
+    MeasureMaps(pmConsumer, mrConsumer, false, &snapshot);
+
+    auto lock = scoped_lock(mMutex);
+    mPublishedSnapshot = snapshot;
+    mSnapshotPublished = true;
+}
+
+void OccupancyGauges::Sample(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t qpc, OccupancySnapshot* snapshot)
+{
+    *snapshot = OccupancySnapshot();
+    snapshot->mQpc = qpc;
+    MeasureMaps(pmConsumer, mrConsumer, true, snapshot);
+    Finish(snapshot);
+}
+
+// Fill in the high-water marks and live PresentEvent counts of a measured
+// snapshot.
+void OccupancyGauges::Finish(OccupancySnapshot* snapshot)
+{
+    for (size_t i = 0; i < (size_t) OccupancyGauge::Count; ++i) {
+        auto g = &snapshot->mGauges[i];
+        mHighWater[i] = std::max(mHighWater[i], g->mCount);
+        g->mHighWater = mHighWater[i];
+    }
+
+    snapshot->mLivePresentCount = gLivePresentEventCount.load(std::memory_order_relaxed);
+    snapshot->mLivePresentBytes = snapshot->mLivePresentCount * (sizeof(PresentEvent) + SHARED_PTR_CONTROL_OVERHEAD);
+}
+
+void OccupancyGauges::Print(FILE* fp, OccupancySnapshot const& snapshot) const
+{
+    auto totalBytes = snapshot.mLivePresentBytes;
+    for (auto const& g : snapshot.mGauges) {
+        totalBytes += g.mBytes;
+    }
+
+    fprintf(fp, "Occupancy at %.3fs: %llu live presents (%.1f KB), %.1f KB total\n",
+        mClock.ToSeconds((int64_t) (snapshot.mQpc - mStartQpc)),
+        snapshot.mLivePresentCount,
+        snapshot.mLivePresentBytes / 1024.,
+        totalBytes / 1024.);
+    fprintf(fp, "    %-32s %10s %10s %10s %12s\n", "Map", "Entries", "KB", "HighWater", "OldestMs");
+    for (size_t i = 0; i < (size_t) OccupancyGauge::Count; ++i) {
+        auto const& g = snapshot.mGauges[i];
+        if (g.mHighWater == 0) {
+            continue;
+        }
+        if (g.mOldestQpc == 0) {
+            fprintf(fp, "    %-32s %10llu %10.1f %10llu %12s\n", GAUGE_NAMES[i], g.mCount, g.mBytes / 1024., g.mHighWater, "-");
+        } else {
+            fprintf(fp, "    %-32s %10llu %10.1f %10llu %12.1f\n", GAUGE_NAMES[i], g.mCount, g.mBytes / 1024., g.mHighWater,
+                snapshot.mQpc > g.mOldestQpc ? mClock.ToMilliseconds((int64_t) (snapshot.mQpc - g.mOldestQpc)) : 0.);
+        }
+    }
+}
@@ -0,0 +1,143 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "QpcClock.hpp"
+
+struct PMTraceConsumer;
+struct MRTraceConsumer;
+
+// The tracking structures reported by OccupancyGauges.  Names match the
+// consumer members they measure (see GAUGE_NAMES in OccupancyGauges.cpp).
+enum class OccupancyGauge : uint32_t {
+    PresentsByProcess,
+    PresentsByProcessAndSwapChain,
+    PresentByThreadId,
+    PresentsBySubmitSequence,
+    Win32KPresentHistoryTokens,
+    DxgKrnlPresentHistoryTokens,
+    BltsByDxgContext,
+    LastWindowPresent,
+    PresentsWaitingForDWM,
+    PresentsByLegacyBlitToken,
+    CompletedPresents,
+    Frames,
+    CurrentFramesByThreadId,
+    MRPresentationSourceByPtr,
+    MRHolographicFramesByFrameId,
+    MRHolographicFramesByPresentId,
+    Count
+};
+
+char const* OccupancyGaugeName(OccupancyGauge gauge);
+
+struct OccupancySnapshot {
+    struct Gauge {
+        uint64_t mCount = 0;        // Number of entries
+        uint64_t mBytes = 0;        // Approximate heap footprint of the container's own nodes/storage
+        uint64_t mHighWater = 0;    // Largest mCount seen by any snapshot so far
+        uint64_t mOldestQpc = 0;    // Start time of the oldest entry, or 0 if empty
+    };
+
+    uint64_t mQpc = 0;
+    Gauge mGauges[(size_t) OccupancyGauge::Count];
+    uint64_t mLivePresentCount = 0; // PresentEvents allocated and not yet destroyed, on any thread
+    uint64_t mLivePresentBytes = 0;
+};
+
+// OccupancyGauges periodically measures how many entries each of the
+// PMTraceConsumer and MRTraceConsumer tracking maps holds, approximately how
+// much memory they use, and how old their oldest entry is.  Leaks show up as
+// a count or age that keeps growing while the trace runs, and the high-water
+// marks bound how much a long session has needed.
+//
+// Sampling is enabled by pointing TraceSession::mOccupancyGauges at an
+// OccupancyGauges.  The maps are only modified by the event handling thread,
+// so they are measured there, between events, without any locking (other
+// than mMutex for the containers shared with the consumer thread):
+//
+// - When reading a log file, which is consumed at the handling thread's
+//   pace, DispatchEvent() calls Update() before the first event at or after
+//   mNextSampleQpc, and every entry of every map is scanned.
+//
+// - In a realtime session, the handling thread must not stall, so a polling
+//   thread calls Poll() instead.  Once an interval has passed, Poll()
+//   requests a snapshot, DispatchEvent() answers it before the next event
+//   with Publish(), which only reads each map's size and first entry, and
+//   the following Poll() reports it.  Ages therefore come from each map's
+//   first entry, which is its oldest for the maps ordered by time, submit
+//   sequence, or token, but not necessarily for those keyed by thread,
+//   window, context, or pointer.
+//
+// High-water marks are sampled maxima, not exact ones.
+//
+// Byte counts are estimates from the element sizes plus a per-node overhead
+// typical of the standard library containers; they do not include the
+// PresentEvents themselves, which are shared between maps and reported once
+// via mLivePresentCount/mLivePresentBytes.
+struct OccupancyGauges {
+    FILE* mFile = nullptr;          // Where each snapshot is printed, if non-null
+    double mIntervalMs = 1000.;
+    uint64_t mIntervalQpc = 0;
+    uint64_t mStartQpc = 0;
+    QpcClock mClock;
+    uint64_t mNextSampleQpc = 0;    // 0 until the first event (or Poll()) is seen
+    uint64_t mHighWater[(size_t) OccupancyGauge::Count] = {};
+    OccupancySnapshot mLastSnapshot;
+
+    // Realtime sampling state (see Poll() and Publish()).
+    bool mPolled = false;
+    std::atomic<bool> mSnapshotRequested = false;
+    std::mutex mMutex;
+    bool mSnapshotPublished = false;        // Guarded by mMutex
+    OccupancySnapshot mPublishedSnapshot;   // Guarded by mMutex
+
+    // If polled is true, snapshots are taken through Poll() and Publish()
+    // rather than Update().
+    void Start(FILE* fp, double intervalMs, bool polled);
+
+    // Called by DispatchEvent() with each event's timestamp once it reaches
+    // mNextSampleQpc, when not polled.
+    void Update(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t qpc, uint64_t startQpc, QpcClock const& clock);
+
+    // Called periodically by the polling thread to report the last published
+    // snapshot and request the next one.
+    void Poll(uint64_t startQpc, QpcClock const& clock);
+
+    // Called by DispatchEvent() on the event handling thread, with the
+    // event's timestamp, while mSnapshotRequested is set.
+    void Publish(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t qpc);
+
+    // Scan every entry of every map and fill in the high-water marks and live
+    // PresentEvent counts.  Must be called on the event handling thread.
+    void Sample(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t qpc, OccupancySnapshot* snapshot);
+    void Finish(OccupancySnapshot* snapshot);
+    void Print(FILE* fp, OccupancySnapshot const& snapshot) const;
+
+    void InitializeClock(uint64_t qpc, uint64_t startQpc, QpcClock const& clock);
+};
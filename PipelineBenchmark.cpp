@@ -0,0 +1,248 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PipelineBenchmark.hpp"
+#include "EventRing.hpp"
+#include "PresentMonTraceConsumer.hpp"
+#include "SyntheticTrace.hpp"
+#include "TraceSession.hpp"
+
+#include <algorithm>
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+namespace {
+
+uint64_t const RING_CAPACITY = 64ull * 1024 * 1024;
+uint64_t const DEQUEUE_INTERVAL = 0x10000;  // Events between DequeuePresents() calls
+uint32_t const LATENCY_CHUNK = 1024;        // Events per latency sample
+uint32_t const SCALING_PRESENT_COUNT = 256 * 1024;
+uint32_t const SCALING_MIN_PRESENTS_PER_THREAD = 32;
+
+struct {
+    char const* mName;
+    PresentMode mPresentMode;
+} const PRESENT_MODES[] = {
+    { "Hardware_Legacy_Flip",                 PresentMode::Hardware_Legacy_Flip },
+    { "Hardware_Legacy_Copy_To_Front_Buffer", PresentMode::Hardware_Legacy_Copy_To_Front_Buffer },
+    { "Hardware_Independent_Flip",            PresentMode::Hardware_Independent_Flip },
+    { "Composed_Flip",                        PresentMode::Composed_Flip },
+    { "Hardware_Composed_Independent_Flip",   PresentMode::Hardware_Composed_Independent_Flip },
+    { "Composed_Copy_GPU_GDI",                PresentMode::Composed_Copy_GPU_GDI },
+    { "Composed_Copy_CPU_GDI",                PresentMode::Composed_Copy_CPU_GDI },
+    { "Composed_Composition_Atlas",           PresentMode::Composed_Composition_Atlas },
+};
+
+uint64_t GetPrivateBytes()
+{
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    counters.cb = sizeof(counters);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*) &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PrivateUsage;
+}
+
+struct PipelineResult {
+    uint64_t mEventCount;
+    uint64_t mPresentCount;         // Presents started by the application threads
+    uint64_t mCompletedCount;       // Completed application presents
+    uint64_t mExpectedModeCount;    // ... of which had the generated PresentMode
+    uint64_t mPeakBytes;
+    double mSeconds;
+    double mP99NsPerEvent;          // 99th percentile over LATENCY_CHUNK-event samples
+    double mMaxNsPerEvent;
+};
+
+bool RunPipeline(SyntheticTraceOptions const& options, PipelineResult* result)
+{
+    *result = {};
+
+    EventRing ring;
+    if (!ring.Initialize(RING_CAPACITY)) {
+        fprintf(stderr, "error: failed to allocate the event ring.\n");
+        return false;
+    }
+
+    PMTraceConsumer consumer(false, false);
+    TraceSession session;
+    session.InitializeDispatch(&consumer, nullptr);
+
+    SyntheticTrace trace;
+    trace.Initialize(options);
+    trace.AddMetadata(&consumer.mMetadata);
+
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    auto dequeuePresents = [&]() {
+        if (consumer.DequeuePresents(presents)) {
+            for (auto const& p : presents) {
+                if (p->ProcessId != SyntheticTrace::DWM_PROCESS_ID) {
+                    result->mCompletedCount += 1;
+                    result->mExpectedModeCount += p->PresentMode == options.mPresentMode ? 1 : 0;
+                }
+            }
+            presents.clear();
+        }
+    };
+
+    LARGE_INTEGER freq = {};
+    QueryPerformanceFrequency(&freq);
+
+    // Alternate between filling half the ring (not timed) and handling
+    // everything in it (timed in chunks, so that the latency distribution can
+    // show stalls such as rehashing that the average hides).
+    std::vector<double> chunkNs;
+    uint64_t baseBytes = 0;
+    uint64_t ticks = 0;
+    uint64_t nextDequeue = DEQUEUE_INTERVAL;
+    for (auto more = true; more; ) {
+        EVENT_RECORD eventRecord;
+        while (ring.GetOccupancy() < RING_CAPACITY / 2) {
+            more = trace.Next(&eventRecord);
+            if (!more) {
+                break;
+            }
+            ring.Push(&eventRecord);
+        }
+
+        // Take the baseline once the ring has been written to, so that its
+        // pages aren't counted as tracking state.
+        if (baseBytes == 0) {
+            baseBytes = GetPrivateBytes();
+        }
+
+        for (;;) {
+            LARGE_INTEGER start = {};
+            LARGE_INTEGER end = {};
+            uint32_t count = 0;
+            QueryPerformanceCounter(&start);
+            for (auto pEventRecord = ring.Peek(); pEventRecord != nullptr && count < LATENCY_CHUNK; pEventRecord = ring.Peek()) {
+                pEventRecord->UserContext = &session;
+                session.mDispatchEvent(&session, pEventRecord);
+                ring.Pop();
+                count += 1;
+            }
+            QueryPerformanceCounter(&end);
+            if (count == 0) {
+                break;
+            }
+
+            ticks += end.QuadPart - start.QuadPart;
+            chunkNs.push_back((double) (end.QuadPart - start.QuadPart) * 1e9 / freq.QuadPart / count);
+
+            result->mEventCount += count;
+            if (result->mEventCount >= nextDequeue) {
+                dequeuePresents();
+                auto bytes = GetPrivateBytes();
+                if (bytes > baseBytes) {
+                    result->mPeakBytes = std::max(result->mPeakBytes, bytes - baseBytes);
+                }
+                nextDequeue += DEQUEUE_INTERVAL;
+            }
+        }
+    }
+    dequeuePresents();
+
+    if (!chunkNs.empty()) {
+        auto p99 = chunkNs.begin() + chunkNs.size() * 99 / 100;
+        std::nth_element(chunkNs.begin(), p99, chunkNs.end());
+        result->mP99NsPerEvent = *p99;
+        result->mMaxNsPerEvent = *std::max_element(chunkNs.begin(), chunkNs.end());
+    }
+
+    result->mPresentCount = trace.mPresentCount;
+    result->mSeconds = (double) ticks / freq.QuadPart;
+    return result->mEventCount == trace.mEventCount;
+}
+
+}
+
+bool RunPipelineBenchmark()
+{
+    printf("PresentMode, Events, Presents, EventsPerSec, PresentsPerSec, PeakMB, Expected%%\n");
+
+    for (auto const& mode : PRESENT_MODES) {
+        SyntheticTraceOptions options;
+        options.mPresentMode = mode.mPresentMode;
+
+        PipelineResult result;
+        if (!RunPipeline(options, &result)) {
+            fprintf(stderr, "error: pipeline benchmark for %s did not complete.\n", mode.mName);
+            return false;
+        }
+
+        auto seconds = std::max(result.mSeconds, 1e-9);
+        printf("%s, %llu, %llu, %.0f, %.0f, %.1f, %.1f\n",
+            mode.mName,
+            result.mEventCount,
+            result.mPresentCount,
+            result.mEventCount / seconds,
+            result.mPresentCount / seconds,
+            result.mPeakBytes / (1024. * 1024.),
+            result.mCompletedCount == 0 ? 0. : 100. * result.mExpectedModeCount / result.mCompletedCount);
+    }
+
+    return true;
+}
+
+bool RunScalingBenchmark()
+{
+    printf("Processes, SwapChainsPerProcess, QueueDepth, Events, NsPerEvent, P99NsPerEvent, MaxNsPerEvent, PeakMB, Expected%%\n");
+
+    for (uint32_t queueDepth : { 1, 3 }) {
+        for (uint32_t swapChainsPerProcess : { 1, 4 }) {
+            for (uint32_t processCount = 1; processCount <= 1024; processCount *= 4) {
+                // Keep the number of presents roughly constant so that each
+                // point takes about as long to run.
+                auto swapChainCount = processCount * swapChainsPerProcess;
+
+                SyntheticTraceOptions options;
+                options.mPresentMode = PresentMode::Composed_Flip;
+                options.mProcessCount = processCount;
+                options.mThreadsPerProcess = swapChainsPerProcess;
+                options.mPresentsPerThread = std::max(SCALING_PRESENT_COUNT / swapChainCount, SCALING_MIN_PRESENTS_PER_THREAD);
+                options.mQueueDepth = queueDepth;
+
+                PipelineResult result;
+                if (!RunPipeline(options, &result)) {
+                    fprintf(stderr, "error: scaling benchmark for %u processes did not complete.\n", processCount);
+                    return false;
+                }
+
+                printf("%u, %u, %u, %llu, %.1f, %.1f, %.1f, %.1f, %.1f\n",
+                    processCount,
+                    swapChainsPerProcess,
+                    queueDepth,
+                    result.mEventCount,
+                    result.mEventCount == 0 ? 0. : result.mSeconds * 1e9 / result.mEventCount,
+                    result.mP99NsPerEvent,
+                    result.mMaxNsPerEvent,
+                    result.mPeakBytes / (1024. * 1024.),
+                    result.mCompletedCount == 0 ? 0. : 100. * result.mExpectedModeCount / result.mCompletedCount);
+            }
+        }
+    }
+
+    return true;
+}
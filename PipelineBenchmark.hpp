@@ -0,0 +1,46 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+// Measure PMTraceConsumer end to end on synthetic traces (see
+// SyntheticTrace.hpp), one per PresentMode.
+//
+// Events are generated into an EventRing ahead of time and then dispatched
+// from it through the same handler path as a realtime session, so only the
+// ring read and the handlers are timed.  Completed presents are dequeued as
+// they would be by the output thread, and the process's private bytes are
+// sampled to report the peak growth while tracking.
+//
+// The table is printed to stdout as CSV, one row per mode, including the
+// percentage of application presents that were classified with the mode the
+// trace was generated for.  Returns false if any run didn't complete.
+bool RunPipelineBenchmark();
+
+// Sweep the number of presenting processes, swap chains per process, and
+// presents in flight per swap chain (Composed_Flip traces) to find where
+// PMTraceConsumer's per-process and per-swap-chain tracking stops scaling.
+//
+// Each row reports the mean handling cost per event, the 99th percentile and
+// maximum over 1024-event samples, and the peak private bytes growth.
+bool RunScalingBenchmark();
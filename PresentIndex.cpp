@@ -0,0 +1,243 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PresentIndex.hpp"
+#include "PresentMonTraceConsumer.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+char const INDEX_FILE_MAGIC[4] = { 'P', 'M', 'I', 'X' };
+uint32_t const INDEX_FILE_VERSION = 1;
+
+// Records are written to disk as-is, so make sure the layout has no padding.
+static_assert(sizeof(PresentRecord) == 48, "unexpected PresentRecord layout");
+
+template<typename T>
+bool WriteValue(FILE* fp, T const& value)
+{
+    return fwrite(&value, sizeof(T), 1, fp) == 1;
+}
+
+template<typename T>
+bool ReadValue(FILE* fp, T* value)
+{
+    return fread(value, sizeof(T), 1, fp) == 1;
+}
+
+}
+
+void PresentIndex::SetTimeBase(uint64_t startQpc, uint64_t qpcFrequency)
+{
+    mStartQpc = startQpc;
+    mQpcFrequency = qpcFrequency;
+}
+
+void PresentIndex::Add(PresentEvent const& p)
+{
+    PresentRecord r;
+    r.QpcTime      = p.QpcTime;
+    r.TimeTaken    = p.TimeTaken;
+    r.ReadyTime    = p.ReadyTime;
+    r.ScreenTime   = p.ScreenTime;
+    r.ThreadId     = p.ThreadId;
+    r.SyncInterval = p.SyncInterval;
+    r.PresentFlags = p.PresentFlags;
+    r.Runtime      = (uint8_t) p.Runtime;
+    r.PresentMode  = (uint8_t) p.PresentMode;
+    r.FinalState   = (uint8_t) p.FinalState;
+    r.Flags        = (p.SupportsTearing ? PRESENT_RECORD_FLAG_SUPPORTS_TEARING : 0) |
+                     (p.MMIO            ? PRESENT_RECORD_FLAG_MMIO             : 0) |
+                     (p.WasBatched      ? PRESENT_RECORD_FLAG_WAS_BATCHED      : 0) |
+                     (p.DwmNotified     ? PRESENT_RECORD_FLAG_DWM_NOTIFIED     : 0);
+
+    auto lock = scoped_lock(mMutex);
+    auto& swapChain = mSwapChains[std::make_tuple(p.ProcessId, p.SwapChainAddress)];
+    auto& records = swapChain.mRecords;
+
+    // Common case: completed in time order.
+    if (records.empty() || records.back().QpcTime <= r.QpcTime) {
+        records.push_back(r);
+        if ((records.size() - 1) % BLOCK_SIZE == 0) {
+            swapChain.mBlockStartTimes.push_back(r.QpcTime);
+        }
+        return;
+    }
+
+    auto ii = std::upper_bound(records.begin(), records.end(), r.QpcTime,
+        [](uint64_t t, PresentRecord const& rec) { return t < rec.QpcTime; });
+    ii = records.insert(ii, r);
+    UpdateBlockIndex(&swapChain, ii - records.begin());
+}
+
+void PresentIndex::UpdateBlockIndex(SwapChain* swapChain, size_t firstChangedRecord)
+{
+    auto const& records = swapChain->mRecords;
+    auto& blocks = swapChain->mBlockStartTimes;
+
+    auto firstBlock = firstChangedRecord / BLOCK_SIZE;
+    blocks.resize((records.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (auto i = firstBlock, n = blocks.size(); i < n; ++i) {
+        blocks[i] = records[i * BLOCK_SIZE].QpcTime;
+    }
+}
+
+size_t PresentIndex::Query(uint32_t processId, uint64_t swapChainAddress, uint64_t t0, uint64_t t1, std::vector<PresentRecord>* out)
+{
+    auto lock = scoped_lock(mMutex);
+    auto ii = mSwapChains.find(std::make_tuple(processId, swapChainAddress));
+    if (ii == mSwapChains.end()) {
+        return 0;
+    }
+
+    auto const& records = ii->second.mRecords;
+    auto const& blocks = ii->second.mBlockStartTimes;
+
+    // Find the first block that starts at or after t0; any earlier records at
+    // or after t0 can only be in the block before it.  Many records (and so
+    // several blocks) can share a QpcTime, so rather than scanning from the
+    // block start, binary search the records from there for the first one at
+    // or after t0.
+    auto block = (size_t) (std::lower_bound(blocks.begin(), blocks.end(), t0) - blocks.begin());
+    auto first = block > 0 ? (block - 1) * BLOCK_SIZE : 0;
+    auto ri = std::lower_bound(records.begin() + first, records.end(), t0,
+                               [](PresentRecord const& r, uint64_t t) { return r.QpcTime < t; });
+
+    auto count = out->size();
+    for (auto re = records.end(); ri != re && ri->QpcTime <= t1; ++ri) {
+        out->push_back(*ri);
+    }
+    return out->size() - count;
+}
+
+void PresentIndex::GetSwapChains(std::vector<std::pair<ProcessAndSwapChainKey, size_t>>* out)
+{
+    auto lock = scoped_lock(mMutex);
+    out->clear();
+    out->reserve(mSwapChains.size());
+    for (auto const& pr : mSwapChains) {
+        out->emplace_back(pr.first, pr.second.mRecords.size());
+    }
+}
+
+// File layout:
+//     char[4]  "PMIX"
+//     uint32_t version
+//     uint64_t start QPC
+//     uint64_t QPC frequency
+//     uint32_t swap chain count
+//     for each swap chain:
+//         uint32_t       process id
+//         uint64_t       swap chain address
+//         uint64_t       record count
+//         PresentRecord  records[record count]
+//
+// The sparse block index is rebuilt on load.
+bool PresentIndex::Save(char const* path)
+{
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path, "wb") != 0) {
+        fprintf(stderr, "error: failed to open index file for writing: %s\n", path);
+        return false;
+    }
+
+    auto lock = scoped_lock(mMutex);
+    auto ok =
+        fwrite(INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC), 1, fp) == 1 &&
+        WriteValue(fp, INDEX_FILE_VERSION) &&
+        WriteValue(fp, mStartQpc) &&
+        WriteValue(fp, mQpcFrequency) &&
+        WriteValue(fp, (uint32_t) mSwapChains.size());
+    for (auto ii = mSwapChains.begin(), ie = mSwapChains.end(); ok && ii != ie; ++ii) {
+        auto const& records = ii->second.mRecords;
+        ok =
+            WriteValue(fp, std::get<0>(ii->first)) &&
+            WriteValue(fp, std::get<1>(ii->first)) &&
+            WriteValue(fp, (uint64_t) records.size()) &&
+            fwrite(records.data(), sizeof(PresentRecord), records.size(), fp) == records.size();
+    }
+
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "error: failed to write index file: %s\n", path);
+    }
+    return ok;
+}
+
+bool PresentIndex::Load(char const* path)
+{
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path, "rb") != 0) {
+        fprintf(stderr, "error: failed to open index file: %s\n", path);
+        return false;
+    }
+
+    // Record counts are checked against the file size before allocating, so
+    // that a corrupt count fails to load instead of exhausting memory.
+    _fseeki64(fp, 0, SEEK_END);
+    auto fileSize = _ftelli64(fp);
+    _fseeki64(fp, 0, SEEK_SET);
+
+    char magic[4] = {};
+    uint32_t version = 0;
+    uint32_t swapChainCount = 0;
+
+    auto lock = scoped_lock(mMutex);
+    mSwapChains.clear();
+
+    auto ok =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, INDEX_FILE_MAGIC, sizeof(magic)) == 0 &&
+        ReadValue(fp, &version) &&
+        version == INDEX_FILE_VERSION &&
+        ReadValue(fp, &mStartQpc) &&
+        ReadValue(fp, &mQpcFrequency) &&
+        ReadValue(fp, &swapChainCount);
+    for (uint32_t i = 0; ok && i < swapChainCount; ++i) {
+        uint32_t processId = 0;
+        uint64_t swapChainAddress = 0;
+        uint64_t recordCount = 0;
+        ok =
+            ReadValue(fp, &processId) &&
+            ReadValue(fp, &swapChainAddress) &&
+            ReadValue(fp, &recordCount) &&
+            recordCount <= (uint64_t) (fileSize - _ftelli64(fp)) / sizeof(PresentRecord);
+        if (ok) {
+            auto& swapChain = mSwapChains[std::make_tuple(processId, swapChainAddress)];
+            swapChain.mRecords.resize((size_t) recordCount);
+            ok = fread(swapChain.mRecords.data(), sizeof(PresentRecord), (size_t) recordCount, fp) == recordCount;
+            UpdateBlockIndex(&swapChain, 0);
+        }
+    }
+
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "error: invalid or corrupt index file: %s\n", path);
+        mSwapChains.clear();
+    }
+    return ok;
+}
@@ -0,0 +1,104 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+
+struct PresentEvent;
+
+// Compact copy of a completed PresentEvent, kept by PresentIndex.
+struct PresentRecord {
+    uint64_t QpcTime;
+    uint64_t TimeTaken;
+    uint64_t ReadyTime;
+    uint64_t ScreenTime;
+    uint32_t ThreadId;
+    int32_t SyncInterval;
+    uint32_t PresentFlags;
+    uint8_t Runtime;        // ::Runtime
+    uint8_t PresentMode;    // ::PresentMode
+    uint8_t FinalState;     // ::PresentResult
+    uint8_t Flags;          // PRESENT_RECORD_FLAG_*
+};
+
+enum {
+    PRESENT_RECORD_FLAG_SUPPORTS_TEARING = 1 << 0,
+    PRESENT_RECORD_FLAG_MMIO             = 1 << 1,
+    PRESENT_RECORD_FLAG_WAS_BATCHED      = 1 << 2,
+    PRESENT_RECORD_FLAG_DWM_NOTIFIED     = 1 << 3,
+};
+
+// PresentIndex keeps every completed present, grouped by (ProcessId,
+// SwapChainAddress), so that time-range queries can be answered after (or
+// during) a run without re-parsing the trace.
+//
+// Each swap chain has a QpcTime-sorted array of PresentRecords and a sparse
+// index holding the QpcTime of the first record of every BLOCK_SIZE-record
+// block.  A query binary searches the sparse index for the block containing
+// the start time, then the records from there for the first one in range,
+// and then scans the records sequentially.
+//
+// Presents on a swap chain are completed in submission order, so records are
+// normally appended; an out-of-order record is inserted in place and the
+// sparse index is rebuilt from that block onward.
+struct PresentIndex {
+    static size_t const BLOCK_SIZE = 64;
+
+    typedef std::tuple<uint32_t, uint64_t> ProcessAndSwapChainKey;
+
+    struct SwapChain {
+        std::vector<PresentRecord> mRecords;
+        std::vector<uint64_t> mBlockStartTimes;
+    };
+
+    // Time base of the indexed trace, saved with the index so that queries
+    // can be expressed relative to the start of the trace.
+    uint64_t mStartQpc = 0;
+    uint64_t mQpcFrequency = 0;
+
+    std::mutex mMutex;
+    std::map<ProcessAndSwapChainKey, SwapChain> mSwapChains;
+
+    void SetTimeBase(uint64_t startQpc, uint64_t qpcFrequency);
+
+    // Called by PMTraceConsumer for each present as it is completed.
+    void Add(PresentEvent const& p);
+
+    // Append all records for the swap chain with t0 <= QpcTime <= t1 to
+    // *out.  Returns the number of records appended.
+    size_t Query(uint32_t processId, uint64_t swapChainAddress, uint64_t t0, uint64_t t1, std::vector<PresentRecord>* out);
+
+    // List the indexed swap chains and their record counts.
+    void GetSwapChains(std::vector<std::pair<ProcessAndSwapChainKey, size_t>>* out);
+
+    bool Save(char const* path);
+    bool Load(char const* path);
+
+private:
+    static void UpdateBlockIndex(SwapChain* swapChain, size_t firstChangedRecord);
+};
@@ -21,6 +21,15 @@ SOFTWARE.
 */
 
 #include "PresentMonTraceConsumer.hpp"
+#include "FlightRecorder.hpp"
+#include "GpuBusy.hpp"
+#include "HandlerProfile.hpp"
+#include "PresentIndex.hpp"
+#include "ProcessFilter.hpp"
+#include "QueueDepth.hpp"
+#include "SimpleTraceConsumer.hpp"
+#include "StageLatency.hpp"
+#include "TimelineOutput.hpp"
 
 #include "D3d9EventStructs.hpp"
 #include "D3d11EventStructs.hpp"
@@ -28,6 +37,8 @@ SOFTWARE.
 #include "DxgiEventStructs.hpp"
 #include "DxgkrnlEventStructs.hpp"
 #include "EventMetadataEventStructs.hpp"
+#include "KernelProcessEventStructs.hpp"
+#include "LostEventStructs.hpp"
 #include "Win32kEventStructs.hpp"
 
 
@@ -37,6 +48,8 @@ SOFTWARE.
 #include <d3d9.h>
 #include <dxgi.h>
 
+std::atomic<uint64_t> gLivePresentEventCount = 0;
+
 PresentEvent::PresentEvent(EVENT_HEADER const& hdr, ::Runtime runtime)
     : QpcTime(*(uint64_t*) &hdr.TimeStamp)
     , ProcessId(hdr.ProcessId)
@@ -63,12 +76,17 @@ PresentEvent::PresentEvent(EVENT_HEADER const& hdr, ::Runtime runtime)
     , WasBatched(false)
     , DwmNotified(false)
     , Completed(false)
+    , RuntimeOnly(false)
+    , Win32KPresentCount(0)
+    , Win32KBindId(0)
+    , DxgContext(0)
+    , LegacyBlitTokenData(0)
+    , Id(DebugNextPresentId())
 {
-#if DEBUG_VERBOSE
-    static uint64_t presentCount = 0;
-    presentCount += 1;
-    Id = presentCount;
-#endif
+    for (auto& stageTime : StageTimes) {
+        stageTime = STAGE_NOT_REACHED;
+    }
+    gLivePresentEventCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 #ifndef NDEBUG
@@ -78,6 +96,7 @@ static bool gPresentMonTraceConsumer_Exiting = false;
 PresentEvent::~PresentEvent()
 {
     assert(Completed || gPresentMonTraceConsumer_Exiting);
+    gLivePresentEventCount.fetch_sub(1, std::memory_order_relaxed);
 }
 
 PMTraceConsumer::~PMTraceConsumer()
@@ -89,6 +108,7 @@ PMTraceConsumer::~PMTraceConsumer()
 
 void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::DXGIEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto const& hdr = pEventRecord->EventHeader;
@@ -142,6 +162,9 @@ void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
 void PMTraceConsumer::HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool redirectedPresent)
 {
     auto eventIter = FindOrCreatePresent(hdr);
+    if (eventIter == mPresentByThreadId.end()) {
+        return;
+    }
 
     // Check if we might have retrieved a 'stuck' present from a previous
     // frame.  If the present mode isn't unknown at this point, we've already
@@ -150,13 +173,14 @@ void PMTraceConsumer::HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool
     // TODO: do we really want to just throw it away?  Should we complete with
     // unknown completion status or something?  Does this happen?
     if (eventIter->second->PresentMode != PresentMode::Unknown) {
-        mPresentByThreadId.erase(eventIter);
+        RemoveStuckPresent(eventIter, hdr.TimeStamp.QuadPart);
         eventIter = FindOrCreatePresent(hdr);
     }
 
     // This could be one of several types of presents. Further events will clarify.
     // For now, assume that this is a blt straight into a surface which is already on-screen.
     eventIter->second->Hwnd = hwnd;
+    eventIter->second->SetStageTime(PresentStage::FlipOrBlit, hdr.TimeStamp.QuadPart);
     if (redirectedPresent) {
         eventIter->second->PresentMode = PresentMode::Composed_Copy_CPU_GDI;
         eventIter->second->SupportsTearing = false;
@@ -172,12 +196,15 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
     // Afterwards, expect an MMIOFlip packet on the same thread, used
     // to trace the flip to screen.
     auto eventIter = FindOrCreatePresent(hdr);
+    if (eventIter == mPresentByThreadId.end()) {
+        return;
+    }
 
     // Check if we might have retrieved a 'stuck' present from a previous frame.
     // The only events that we can expect before a Flip/FlipMPO are a runtime present start, or a previous FlipMPO.
     if (eventIter->second->QueueSubmitSequence != 0 || eventIter->second->SeenDxgkPresent) {
         // It's already progressed further but didn't complete, ignore it and create a new one.
-        mPresentByThreadId.erase(eventIter);
+        RemoveStuckPresent(eventIter, hdr.TimeStamp.QuadPart);
         eventIter = FindOrCreatePresent(hdr);
     }
 
@@ -188,6 +215,7 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
 
     eventIter->second->MMIO = mmio;
     eventIter->second->PresentMode = PresentMode::Hardware_Legacy_Flip;
+    eventIter->second->SetStageTime(PresentStage::FlipOrBlit, hdr.TimeStamp.QuadPart);
 
     if (eventIter->second->SyncInterval == -1) {
         eventIter->second->SyncInterval = flipInterval;
@@ -218,14 +246,15 @@ void PMTraceConsumer::HandleDxgkQueueSubmit(
     if (!supportsDxgkPresentEvent) {
         auto eventIter = mBltsByDxgContext.find(context);
         if (eventIter != mBltsByDxgContext.end()) {
-            if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
-                DebugModifyPresent(*eventIter->second);
-                eventIter->second->SeenDxgkPresent = true;
-                if (eventIter->second->ScreenTime != 0) {
-                    CompletePresent(eventIter->second);
+            auto pEvent = eventIter->second;
+            mBltsByDxgContext.erase(eventIter);
+            if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
+                DebugModifyPresent(*pEvent);
+                pEvent->SeenDxgkPresent = true;
+                if (pEvent->ScreenTime != 0) {
+                    CompletePresent(pEvent, hdr.TimeStamp.QuadPart);
                 }
             }
-            mBltsByDxgContext.erase(eventIter);
         }
     }
 
@@ -242,10 +271,12 @@ void PMTraceConsumer::HandleDxgkQueueSubmit(
         DebugModifyPresent(*eventIter->second);
 
         eventIter->second->QueueSubmitSequence = submitSequence;
+        eventIter->second->SetStageTime(PresentStage::QueueSubmit, hdr.TimeStamp.QuadPart);
         mPresentsBySubmitSequence.emplace(submitSequence, eventIter->second);
 
         if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer && !supportsDxgkPresentEvent) {
             mBltsByDxgContext[context] = eventIter->second;
+            eventIter->second->DxgContext = context;
         }
     }
 }
@@ -267,7 +298,7 @@ void PMTraceConsumer::HandleDxgkQueueComplete(EVENT_HEADER const& hdr, uint32_t
         // In this case, for blit presents, we have no way to differentiate between fullscreen and windowed blits
         // So, defer the completion of this present until we know all events have been fired
         if (pEvent->SeenDxgkPresent || pEvent->PresentMode != PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
-            CompletePresent(pEvent);
+            CompletePresent(pEvent, hdr.TimeStamp.QuadPart);
         }
     }
 }
@@ -285,6 +316,7 @@ void PMTraceConsumer::HandleDxgkMMIOFlip(EVENT_HEADER const& hdr, uint32_t flipS
     }
 
     pEvent->ReadyTime = hdr.TimeStamp.QuadPart;
+    pEvent->SetStageTime(PresentStage::MMIOFlip, hdr.TimeStamp.QuadPart);
 
     if (pEvent->PresentMode == PresentMode::Composed_Flip) {
         pEvent->PresentMode = PresentMode::Hardware_Independent_Flip;
@@ -295,7 +327,7 @@ void PMTraceConsumer::HandleDxgkMMIOFlip(EVENT_HEADER const& hdr, uint32_t flipS
         pEvent->ScreenTime = hdr.TimeStamp.QuadPart;
         pEvent->SupportsTearing = true;
         if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip) {
-            CompletePresent(pEvent);
+            CompletePresent(pEvent, hdr.TimeStamp.QuadPart);
         }
     }
 }
@@ -311,6 +343,7 @@ void PMTraceConsumer::HandleDxgkMMIOFlipMPO(EVENT_HEADER const& hdr, uint32_t fl
     if (pEvent->ReadyTime == 0) {
         pEvent->ReadyTime = hdr.TimeStamp.QuadPart;
     }
+    pEvent->SetStageTime(PresentStage::MMIOFlip, hdr.TimeStamp.QuadPart);
 
     if (pEvent->PresentMode == PresentMode::Hardware_Independent_Flip ||
         pEvent->PresentMode == PresentMode::Composed_Flip) {
@@ -339,7 +372,7 @@ void PMTraceConsumer::HandleDxgkMMIOFlipMPO(EVENT_HEADER const& hdr, uint32_t fl
         pEvent->ScreenTime = hdr.TimeStamp.QuadPart;
     }
     if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip) {
-        CompletePresent(pEvent);
+        CompletePresent(pEvent, hdr.TimeStamp.QuadPart);
     }
 }
 
@@ -354,8 +387,9 @@ void PMTraceConsumer::HandleDxgkSyncDPC(EVENT_HEADER const& hdr, uint32_t flipSu
 
     pEvent->ScreenTime = hdr.TimeStamp.QuadPart;
     pEvent->FinalState = PresentResult::Presented;
+    pEvent->SetStageTime(PresentStage::SyncDPC, hdr.TimeStamp.QuadPart);
     if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip) {
-        CompletePresent(pEvent);
+        CompletePresent(pEvent, hdr.TimeStamp.QuadPart);
     }
 }
 
@@ -368,11 +402,14 @@ void PMTraceConsumer::HandleDxgkSubmitPresentHistoryEventArgs(
     // These events are emitted during submission of all types of windowed presents while DWM is on.
     // It gives us up to two different types of keys to correlate further.
     auto eventIter = FindOrCreatePresent(hdr);
+    if (eventIter == mPresentByThreadId.end()) {
+        return;
+    }
 
     // Check if we might have retrieved a 'stuck' present from a previous frame.
     if (eventIter->second->TokenPtr != 0) {
         // It's already progressed further but didn't complete, ignore it and create a new one.
-        mPresentByThreadId.erase(eventIter);
+        RemoveStuckPresent(eventIter, hdr.TimeStamp.QuadPart);
         eventIter = FindOrCreatePresent(hdr);
     }
 
@@ -381,6 +418,7 @@ void PMTraceConsumer::HandleDxgkSubmitPresentHistoryEventArgs(
     eventIter->second->SupportsTearing = false;
     eventIter->second->FinalState = PresentResult::Unknown;
     eventIter->second->TokenPtr = token;
+    eventIter->second->SetStageTime(PresentStage::PresentHistory, hdr.TimeStamp.QuadPart);
 
     if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
         eventIter->second->PresentMode = PresentMode::Composed_Copy_GPU_GDI;
@@ -403,6 +441,7 @@ void PMTraceConsumer::HandleDxgkSubmitPresentHistoryEventArgs(
             mPresentsWaitingForDWM.emplace_back(eventIter->second);
         } else {
             mPresentsByLegacyBlitToken[tokenData] = eventIter->second;
+            eventIter->second->LegacyBlitTokenData = tokenData;
         }
     }
     mDxgKrnlPresentHistoryTokens[token] = eventIter->second;
@@ -421,6 +460,7 @@ void PMTraceConsumer::HandleDxgkPropagatePresentHistoryEventArgs(EVENT_HEADER co
     eventIter->second->ReadyTime = eventIter->second->ReadyTime == 0
         ? hdr.TimeStamp.QuadPart
         : std::min(eventIter->second->ReadyTime, (uint64_t) hdr.TimeStamp.QuadPart);
+    eventIter->second->SetStageTime(PresentStage::PropagatePresentHistory, hdr.TimeStamp.QuadPart);
 
     if (eventIter->second->PresentMode == PresentMode::Composed_Composition_Atlas ||
         (eventIter->second->PresentMode == PresentMode::Composed_Flip && !eventIter->second->SeenWin32KEvents)) {
@@ -430,7 +470,7 @@ void PMTraceConsumer::HandleDxgkPropagatePresentHistoryEventArgs(EVENT_HEADER co
     if (eventIter->second->PresentMode == PresentMode::Composed_Copy_GPU_GDI) {
         // Manipulate the map here
         // When DWM is ready to present, we'll query for the most recent blt targeting this window and take it out of the map
-        mLastWindowPresent[eventIter->second->Hwnd] = eventIter->second;
+        SetLastWindowPresent(eventIter->second->Hwnd, eventIter->second, hdr.TimeStamp.QuadPart);
     }
 
     mDxgKrnlPresentHistoryTokens.erase(eventIter);
@@ -438,6 +478,7 @@ void PMTraceConsumer::HandleDxgkPropagatePresentHistoryEventArgs(EVENT_HEADER co
 
 void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::DXGKEvent, pEventRecord->EventHeader.EventDescriptor.Id);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto const& hdr = pEventRecord->EventHeader;
@@ -472,11 +513,28 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         auto hContext       = desc[2].GetData<uint64_t>();
         auto bPresent       = desc[3].GetData<BOOL>() != 0;
 
+        if (mGpuBusy != nullptr) {
+            mGpuBusy->SubmitPacket(hdr.TimeStamp.QuadPart, hdr.ProcessId, hContext, SubmitSequence);
+        }
         HandleDxgkQueueSubmit(hdr, PacketType, SubmitSequence, hContext, bPresent, true);
         break;
     }
     case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:
-        HandleDxgkQueueComplete(hdr, mMetadata.GetEventData<uint32_t>(pEventRecord, L"SubmitSequence"));
+        // The context is only needed to track GPU busy time.
+        if (mGpuBusy != nullptr) {
+            EventDataDesc desc[] = {
+                { L"SubmitSequence" },
+                { L"hContext" },
+            };
+            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
+            auto SubmitSequence = desc[0].GetData<uint32_t>();
+            auto hContext       = desc[1].GetData<uint64_t>();
+
+            mGpuBusy->CompletePacket(hdr.TimeStamp.QuadPart, hContext, SubmitSequence);
+            HandleDxgkQueueComplete(hdr, SubmitSequence);
+        } else {
+            HandleDxgkQueueComplete(hdr, mMetadata.GetEventData<uint32_t>(pEventRecord, L"SubmitSequence"));
+        }
         break;
     case Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id:
     {
@@ -549,7 +607,7 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
             eventIter->second->ScreenTime != 0) {
             // This is a fullscreen or DWM-off blit where all work associated was already done, so it's on-screen
             // It was deferred to here because there was no way to be sure it was really fullscreen until now
-            CompletePresent(eventIter->second);
+            CompletePresent(eventIter->second, hdr.TimeStamp.QuadPart);
         }
 
         if (eventIter->second->ThreadId != hdr.ThreadId) {
@@ -715,6 +773,7 @@ typedef struct _DXGKETW_SCHEDULER_MMIO_FLIP_64 {
 
 void PMTraceConsumer::HandleWin7DxgkBlt(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win7DxgkEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto pBltEvent = reinterpret_cast<Win7::DXGKETW_BLTEVENT*>(pEventRecord->UserData);
@@ -726,6 +785,7 @@ void PMTraceConsumer::HandleWin7DxgkBlt(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleWin7DxgkFlip(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win7DxgkEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto pFlipEvent = reinterpret_cast<Win7::DXGKETW_FLIPEVENT*>(pEventRecord->UserData);
@@ -737,6 +797,7 @@ void PMTraceConsumer::HandleWin7DxgkFlip(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleWin7DxgkPresentHistory(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win7DxgkEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto pPresentHistoryEvent = reinterpret_cast<Win7::DXGKETW_PRESENTHISTORYEVENT*>(pEventRecord->UserData);
@@ -753,10 +814,14 @@ void PMTraceConsumer::HandleWin7DxgkPresentHistory(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleWin7DxgkQueuePacket(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win7DxgkEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     if (pEventRecord->EventHeader.EventDescriptor.Opcode == EVENT_TRACE_TYPE_START) {
         auto pSubmitEvent = reinterpret_cast<Win7::DXGKETW_QUEUESUBMITEVENT*>(pEventRecord->UserData);
+        if (mGpuBusy != nullptr) {
+            mGpuBusy->SubmitPacket(pEventRecord->EventHeader.TimeStamp.QuadPart, pEventRecord->EventHeader.ProcessId, pSubmitEvent->hContext, pSubmitEvent->SubmitSequence);
+        }
         HandleDxgkQueueSubmit(
             pEventRecord->EventHeader,
             pSubmitEvent->PacketType,
@@ -766,12 +831,16 @@ void PMTraceConsumer::HandleWin7DxgkQueuePacket(EVENT_RECORD* pEventRecord)
             false);
     } else if (pEventRecord->EventHeader.EventDescriptor.Opcode == EVENT_TRACE_TYPE_STOP) {
         auto pCompleteEvent = reinterpret_cast<Win7::DXGKETW_QUEUECOMPLETEEVENT*>(pEventRecord->UserData);
+        if (mGpuBusy != nullptr) {
+            mGpuBusy->CompletePacket(pEventRecord->EventHeader.TimeStamp.QuadPart, pCompleteEvent->hContext, pCompleteEvent->SubmitSequence);
+        }
         HandleDxgkQueueComplete(pEventRecord->EventHeader, pCompleteEvent->SubmitSequence);
     }
 }
 
 void PMTraceConsumer::HandleWin7DxgkVSyncDPC(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win7DxgkEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto pVSyncDPCEvent = reinterpret_cast<Win7::DXGKETW_SCHEDULER_VSYNC_DPC*>(pEventRecord->UserData);
@@ -780,6 +849,7 @@ void PMTraceConsumer::HandleWin7DxgkVSyncDPC(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleWin7DxgkMMIOFlip(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win7DxgkEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     if (pEventRecord->EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER)
@@ -802,6 +872,7 @@ void PMTraceConsumer::HandleWin7DxgkMMIOFlip(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::Win32kEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto const& hdr = pEventRecord->EventHeader;
@@ -823,10 +894,13 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
         auto DestHeight             = desc[4].GetData<uint32_t>();
 
         auto eventIter = FindOrCreatePresent(hdr);
+        if (eventIter == mPresentByThreadId.end()) {
+            return;
+        }
 
         // Check if we might have retrieved a 'stuck' present from a previous frame.
         if (eventIter->second->SeenWin32KEvents) {
-            mPresentByThreadId.erase(eventIter);
+            RemoveStuckPresent(eventIter, hdr.TimeStamp.QuadPart);
             eventIter = FindOrCreatePresent(hdr);
         }
 
@@ -834,6 +908,8 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
         eventIter->second->DestWidth = DestWidth;
         eventIter->second->DestHeight = DestHeight;
         eventIter->second->CompositionSurfaceLuid = CompositionSurfaceLuid;
+        eventIter->second->Win32KPresentCount = PresentCount;
+        eventIter->second->Win32KBindId = BindId;
         eventIter->second->SeenWin32KEvents = true;
 
         PMTraceConsumer::Win32KPresentHistoryTokenKey key(CompositionSurfaceLuid, PresentCount, BindId);
@@ -867,6 +943,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
         switch (NewState) {
         case (uint32_t) Microsoft_Windows_Win32k::TokenState::InFrame: // Composition is starting
         {
+            event.SetStageTime(PresentStage::TokenInFrame, hdr.TimeStamp.QuadPart);
             if (event.Hwnd) {
                 auto hWndIter = mLastWindowPresent.find(event.Hwnd);
                 if (hWndIter == mLastWindowPresent.end()) {
@@ -887,6 +964,8 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
         }
 
         case (uint32_t) Microsoft_Windows_Win32k::TokenState::Confirmed: // Present has been submitted
+            event.SetStageTime(PresentStage::TokenConfirmed, hdr.TimeStamp.QuadPart);
+
             // If we haven't already decided we're going to discard a token,
             // now's a good time to indicate it'll make it to screen
             if (event.FinalState == PresentResult::Unknown) {
@@ -905,6 +984,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
 
         case (uint32_t) Microsoft_Windows_Win32k::TokenState::Retired: // Present has been completed, token's buffer is now displayed
             event.ScreenTime = hdr.TimeStamp.QuadPart;
+            event.SetStageTime(PresentStage::TokenRetired, hdr.TimeStamp.QuadPart);
             break;
 
         case (uint32_t) Microsoft_Windows_Win32k::TokenState::Discarded: // Present has been discarded
@@ -916,7 +996,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
                 event.FinalState = PresentResult::Discarded;
             }
 
-            CompletePresent(sharedPtr);
+            CompletePresent(sharedPtr, hdr.TimeStamp.QuadPart);
             break;
         }
         }
@@ -930,6 +1010,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::DWMEvent);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto const& hdr = pEventRecord->EventHeader;
@@ -974,16 +1055,17 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
         // The 64-bit token data from the PHT submission is actually two 32-bit
         // data chunks, corresponding to a "flip chain" id and present id
         auto token = ((uint64_t) ulFlipChain << 32ull) | ulSerialNumber;
-        auto flipIter = mDxgKrnlPresentHistoryTokens.find(token);
-        if (flipIter == mDxgKrnlPresentHistoryTokens.end()) {
+        auto flipIter = mPresentsByLegacyBlitToken.find(token);
+        if (flipIter == mPresentsByLegacyBlitToken.end()) {
             return;
         }
 
         DebugModifyPresent(*flipIter->second);
 
-        // Watch for multiple legacy blits completing against the same window		
-        mLastWindowPresent[hwnd] = flipIter->second;
+        // Watch for multiple legacy blits completing against the same window
+        SetLastWindowPresent(hwnd, flipIter->second, hdr.TimeStamp.QuadPart);
         flipIter->second->DwmNotified = true;
+        flipIter->second->SetStageTime(PresentStage::DwmFlipChain, hdr.TimeStamp.QuadPart);
         mPresentsByLegacyBlitToken.erase(flipIter);
         break;
     }
@@ -1016,6 +1098,7 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::D3D9Event);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto const& hdr = pEventRecord->EventHeader;
@@ -1063,6 +1146,7 @@ void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
 
 void PMTraceConsumer::HandleD3D11Event(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::D3D11Event);
     DebugEvent(pEventRecord, &mMetadata);
 
     auto const& hdr = pEventRecord->EventHeader;
@@ -1072,27 +1156,33 @@ void PMTraceConsumer::HandleD3D11Event(EVENT_RECORD* pEventRecord)
 
         auto message = mMetadata.GetEventData<std::wstring>(pEventRecord, L"Label");
         if (message.find(L"BeginFrame") == 0) {
-            auto frame = mCurrentFramesByThreadId.find(hdr.ThreadId);
-            if (frame == mCurrentFramesByThreadId.end()) {
-                Frame f;
-                f.StartTime = hdr.TimeStamp.QuadPart;
-                mCurrentFramesByThreadId.emplace(hdr.ThreadId, f);
-            }
-            else {
-                assert(false);
+            // A frame that is still open lost its EndFrame (e.g., to an event
+            // gap), so it is restarted.
+            Frame f;
+            f.StartTime = hdr.TimeStamp.QuadPart;
+            mCurrentFramesByThreadId[hdr.ThreadId] = f;
+
+            auto& threads = mFrameThreadsByProcess[hdr.ProcessId];
+            if (std::find(threads.begin(), threads.end(), hdr.ThreadId) == threads.end()) {
+                threads.push_back(hdr.ThreadId);
             }
         } else if (message.find(L"EndFrame") == 0) {
+            // An EndFrame without a BeginFrame (lost, or from before the
+            // trace started) is dropped.
             auto frame = mCurrentFramesByThreadId.find(hdr.ThreadId);
-            if (frame == mCurrentFramesByThreadId.end()) {
-                assert(false);
-            }
-            else {
+            if (frame != mCurrentFramesByThreadId.end()) {
                 frame->second.EndTime = hdr.TimeStamp.QuadPart;
                 auto present = mPresentByThreadId.find(hdr.ThreadId);
                 if (present != mPresentByThreadId.end()) {
                     frame->second.present = present->second;
                 }
-                mFrames.push_back(frame->second);
+                if (mTimeline != nullptr) {
+                    mTimeline->AddFrame(hdr.ProcessId, hdr.ThreadId, frame->second);
+                }
+                {
+                    auto lock = scoped_lock(mMutex);
+                    mFrames.push_back(frame->second);
+                }
                 mCurrentFramesByThreadId.erase(frame);
             }
         }
@@ -1104,8 +1194,9 @@ void PMTraceConsumer::HandleD3D11Event(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t recurseDepth)
+void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint64_t completeQpc, uint32_t recurseDepth)
 {
+    ProfileScope profileScope(recurseDepth == 0 ? mProfile : nullptr, ProfileCounter::CompletePresent);
     DebugCompletePresent(*p, recurseDepth);
 
     if (p->Completed)
@@ -1116,10 +1207,18 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t
 
     // Complete all other presents that were riding along with this one (i.e. this one came from DWM)
     for (auto& p2 : p->DependentPresents) {
+        // Skip presents already completed when their process exited (see
+        // PurgeProcess()).
+        if (p2->Completed) {
+            continue;
+        }
         DebugModifyPresent(*p2);
         p2->ScreenTime = p->ScreenTime;
         p2->FinalState = PresentResult::Presented;
-        CompletePresent(p2, recurseDepth + 1);
+        if (mTimeline != nullptr) {
+            mTimeline->AddDependentPresent(*p, *p2);
+        }
+        CompletePresent(p2, completeQpc, recurseDepth + 1);
     }
     p->DependentPresents.clear();
 
@@ -1139,27 +1238,79 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t
             mDxgKrnlPresentHistoryTokens.erase(iter);
         }
     }
-    auto& processMap = mPresentsByProcess[p->ProcessId];
 
-    auto& presentDeque = mPresentsByProcessAndSwapChain[std::make_tuple(p->ProcessId, p->SwapChainAddress)];
-    processMap.erase(p->QpcTime);
-    auto presentIter = presentDeque.begin();
-    assert(!presentIter->get()->Completed); // It wouldn't be here anymore if it was
+    // A present can be completed before the events that would remove it from
+    // these maps (e.g., behind a later present on the same swap chain), and
+    // if those events are lost it would otherwise stay in them forever.
+    if (p->SeenWin32KEvents) {
+        auto iter = mWin32KPresentHistoryTokens.find(std::make_tuple(p->CompositionSurfaceLuid, p->Win32KPresentCount, p->Win32KBindId));
+        if (iter != mWin32KPresentHistoryTokens.end() && iter->second == p) {
+            mWin32KPresentHistoryTokens.erase(iter);
+        }
+    }
+    if (p->DxgContext != 0) {
+        auto iter = mBltsByDxgContext.find(p->DxgContext);
+        if (iter != mBltsByDxgContext.end() && iter->second == p) {
+            mBltsByDxgContext.erase(iter);
+        }
+    }
+    if (p->LegacyBlitTokenData != 0) {
+        auto iter = mPresentsByLegacyBlitToken.find(p->LegacyBlitTokenData);
+        if (iter != mPresentsByLegacyBlitToken.end() && iter->second == p) {
+            mPresentsByLegacyBlitToken.erase(iter);
+        }
+    }
 
-    if (p->FinalState == PresentResult::Presented) {
-        while (*presentIter != p) {
-            CompletePresent(*presentIter, recurseDepth + 1);
-            presentIter = presentDeque.begin();
+    // Look the per-process nodes up rather than recreating them, since
+    // PurgeProcess() and DrainPresentsBefore() erase the ones they empty.
+    auto processIter = mPresentsByProcess.find(p->ProcessId);
+    if (processIter != mPresentsByProcess.end()) {
+        processIter->second.erase(p->QpcTime);
+    }
+
+    auto swapChainIter = mPresentsByProcessAndSwapChain.find(std::make_tuple(p->ProcessId, p->SwapChainAddress));
+    auto presentDeque = swapChainIter == mPresentsByProcessAndSwapChain.end() || swapChainIter->second.empty()
+        ? nullptr
+        : &swapChainIter->second;
+    if (presentDeque != nullptr) {
+        assert(!presentDeque->front()->Completed); // It wouldn't be here anymore if it was
+
+        if (p->FinalState == PresentResult::Presented) {
+            while (!presentDeque->empty() && presentDeque->front() != p) {
+                CompletePresent(presentDeque->front(), completeQpc, recurseDepth + 1);
+            }
         }
     }
 
     p->Completed = true;
-    if (*presentIter == p) {
+    if (mTimeline != nullptr) {
+        mTimeline->AddPresent(*p);
+    }
+    if (mFlightRecorder != nullptr) {
+        mFlightRecorder->CheckPresent(*p);
+    }
+    if (mQueueDepth != nullptr) {
+        mQueueDepth->CompletePresent(*p, completeQpc);
+    }
+    if (mStageLatency != nullptr) {
+        mStageLatency->AddPresent(*p);
+    }
+    // A present that isn't queued on its swap chain has nothing to wait
+    // behind, so it is handed to the consumer directly.
+    if (presentDeque == nullptr) {
         auto lock = scoped_lock(mMutex);
-        while (presentIter != presentDeque.end() && presentIter->get()->Completed) {
-            mCompletedPresents.push_back(*presentIter);
-            presentDeque.pop_front();
-            presentIter = presentDeque.begin();
+        if (mPresentIndex != nullptr) {
+            mPresentIndex->Add(*p);
+        }
+        mCompletedPresents.push_back(p);
+    } else if (!presentDeque->empty() && presentDeque->front() == p) {
+        auto lock = scoped_lock(mMutex);
+        while (!presentDeque->empty() && presentDeque->front()->Completed) {
+            if (mPresentIndex != nullptr) {
+                mPresentIndex->Add(*presentDeque->front());
+            }
+            mCompletedPresents.push_back(presentDeque->front());
+            presentDeque->pop_front();
         }
     }
 }
@@ -1192,6 +1343,15 @@ decltype(PMTraceConsumer::mPresentByThreadId.begin()) PMTraceConsumer::FindOrCre
 
             // This likely didn't originate from a runtime whose events we're tracking (DXGI/D3D9)
             // Could be composition buffers, or maybe another runtime (e.g. GL)
+            //
+            // Runtime events from filtered-out processes were dropped, so
+            // don't start tracking their presents from the kernel side
+            // either.  DWM's presents are still needed for the presents
+            // waiting on it.
+            if (mProcessFilter != nullptr && hdr.ThreadId != DwmPresentThreadId &&
+                !mProcessFilter->IsTrackedProcess(hdr.ProcessId)) {
+                return mPresentByThreadId.end();
+            }
             auto newEvent = std::make_shared<PresentEvent>(hdr, Runtime::Other);
             eventIter = CreatePresent(newEvent, processMap);
         }
@@ -1209,6 +1369,12 @@ decltype(PMTraceConsumer::mPresentByThreadId.begin()) PMTraceConsumer::CreatePre
 
     processMap.emplace(newEvent->QpcTime, newEvent);
     mPresentsByProcessAndSwapChain[std::make_tuple(newEvent->ProcessId, newEvent->SwapChainAddress)].emplace_back(newEvent);
+    if (mQueueDepth != nullptr) {
+        mQueueDepth->AddPresent(*newEvent);
+    }
+    if (mGpuBusy != nullptr) {
+        mGpuBusy->Present(newEvent->ProcessId, newEvent->QpcTime);
+    }
 
     auto p = mPresentByThreadId.emplace(newEvent->ThreadId, newEvent);
     assert(p.second);
@@ -1217,17 +1383,64 @@ decltype(PMTraceConsumer::mPresentByThreadId.begin()) PMTraceConsumer::CreatePre
 
 void PMTraceConsumer::CreatePresent(std::shared_ptr<PresentEvent> present)
 {
-    // TODO: This version of CreatePresent() will overwrite any in-progress
-    // present from this thread with the new one.  Does this ever happen?  If
-    // so, should we really be just throwing away the old one?  If not, we can
-    // just call the other CreatePresent() without this check.
+    // This version of CreatePresent() will overwrite any in-progress present
+    // from this thread with the new one.  This happens when the previous
+    // present's later events were lost (e.g., its runtime Present_Stop).
     auto iter = mPresentByThreadId.find(present->ThreadId);
     if (iter != mPresentByThreadId.end()) {
-        mPresentByThreadId.erase(iter);
+        RemoveStuckPresent(iter, present->QpcTime);
     }
     CreatePresent(present, mPresentsByProcess[present->ProcessId]);
 }
 
+void PMTraceConsumer::RemoveStuckPresent(decltype(mPresentByThreadId.begin()) eventIter, uint64_t qpc)
+{
+    auto p = eventIter->second;
+    mPresentByThreadId.erase(eventIter);
+
+    // The present can still progress if a later event can find it through
+    // another lookup map.  Otherwise it would stay in mPresentsByProcess and
+    // mPresentsByProcessAndSwapChain forever (e.g., a lone DxgKrnl Flip
+    // whose QueueSubmit was lost), so complete it as lost.  It can't be
+    // picked up as a batched present: it is still on its thread, so its
+    // runtime Present_Stop was never seen.
+    auto isTracked = [&p](auto const& map, auto const& key) {
+        auto ii = map.find(key);
+        return ii != map.end() && ii->second == p;
+    };
+    if (p->Completed ||
+        isTracked(mPresentsBySubmitSequence, p->QueueSubmitSequence) ||
+        isTracked(mDxgKrnlPresentHistoryTokens, p->TokenPtr) ||
+        isTracked(mWin32KPresentHistoryTokens, std::make_tuple(p->CompositionSurfaceLuid, p->Win32KPresentCount, p->Win32KBindId)) ||
+        isTracked(mBltsByDxgContext, p->DxgContext) ||
+        isTracked(mPresentsByLegacyBlitToken, p->LegacyBlitTokenData) ||
+        isTracked(mLastWindowPresent, p->Hwnd) ||
+        std::find(mPresentsWaitingForDWM.begin(), mPresentsWaitingForDWM.end(), p) != mPresentsWaitingForDWM.end()) {
+        return;
+    }
+
+    DebugModifyPresent(*p);
+    p->FinalState = PresentResult::Lost;
+    CompletePresent(p, qpc);
+}
+
+void PMTraceConsumer::SetLastWindowPresent(uint64_t hwnd, std::shared_ptr<PresentEvent> const& present, uint64_t qpc)
+{
+    auto hWndIter = mLastWindowPresent.find(hwnd);
+    if (hWndIter == mLastWindowPresent.end()) {
+        mLastWindowPresent.emplace(hwnd, present);
+        return;
+    }
+
+    auto replaced = hWndIter->second;
+    hWndIter->second = present;
+    if (replaced != present && !replaced->Completed) {
+        DebugModifyPresent(*replaced);
+        replaced->FinalState = PresentResult::Discarded;
+        CompletePresent(replaced, qpc);
+    }
+}
+
 void PMTraceConsumer::RuntimePresentStop(EVENT_HEADER const& hdr, bool AllowPresentBatching)
 {
     auto eventIter = mPresentByThreadId.find(hdr.ThreadId);
@@ -1236,35 +1449,97 @@ void PMTraceConsumer::RuntimePresentStop(EVENT_HEADER const& hdr, bool AllowPres
     }
     auto &event = *eventIter->second;
 
+    // The thread's present may not be this runtime's: its Present_Start may
+    // have been lost, and a kernel event created a Runtime::Other present on
+    // the thread instead, or this Present_Stop may have arrived ahead of the
+    // present's start.  Leave that present to progress through its own
+    // events; dropping it from mPresentByThreadId here would leave it
+    // unreachable.
+    if (event.Runtime == Runtime::Other || event.QpcTime > *(uint64_t*) &hdr.TimeStamp) {
+        return;
+    }
+
     DebugModifyPresent(event);
 
-    assert(event.QpcTime <= *(uint64_t*) &hdr.TimeStamp);
     event.TimeTaken = *(uint64_t*) &hdr.TimeStamp - event.QpcTime;
 
     if (!AllowPresentBatching || mSimpleMode) {
         event.FinalState = AllowPresentBatching ? PresentResult::Presented : PresentResult::Discarded;
-        CompletePresent(eventIter->second);
+        CompletePresent(eventIter->second, hdr.TimeStamp.QuadPart);
     }
 
     mPresentByThreadId.erase(eventIter);
 }
 
+NTProcessEventType PMTraceConsumer::DecodeNTProcessEvent(EVENT_RECORD* pEventRecord, NTProcessEvent* event)
+{
+    event->QpcTime = pEventRecord->EventHeader.TimeStamp.QuadPart;
+
+    if (pEventRecord->EventHeader.ProviderId == Microsoft_Windows_Kernel_Process::GUID) {
+        switch (pEventRecord->EventHeader.EventDescriptor.Id) {
+        case Microsoft_Windows_Kernel_Process::ProcessStart_Start::Id:
+        {
+            event->ProcessId = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessID");
+
+            // ImageName is a full path, but the NT kernel logger provides only
+            // the file name.
+            auto imageName = mMetadata.GetEventData<std::wstring>(pEventRecord, L"ImageName");
+            for (auto i = imageName.find_last_of(L'\\') + 1, n = imageName.size(); i < n; ++i) {
+                event->ImageFileName.push_back((char) imageName[i]);
+            }
+            return NTProcessEventType::Start;
+        }
+        case Microsoft_Windows_Kernel_Process::ProcessStop_Stop::Id:
+            event->ProcessId = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessID");
+            return NTProcessEventType::Exit;
+        }
+    } else {
+        switch (pEventRecord->EventHeader.EventDescriptor.Opcode) {
+        case EVENT_TRACE_TYPE_START:
+        case EVENT_TRACE_TYPE_DC_START:
+            event->ProcessId     = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessId");
+            event->ImageFileName = mMetadata.GetEventData<std::string>(pEventRecord, L"ImageFileName");
+            return NTProcessEventType::Start;
+
+        // DC_END is the rundown of processes still running when the trace
+        // stopped, not an exit.
+        case EVENT_TRACE_TYPE_END:
+            event->ProcessId = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessId");
+            return NTProcessEventType::Exit;
+        case EVENT_TRACE_TYPE_DC_END:
+            event->ProcessId = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessId");
+            return NTProcessEventType::End;
+        }
+    }
+
+    return NTProcessEventType::None;
+}
+
+NTProcessEventType PMTraceConsumer::UpdateProcessFilter(EVENT_RECORD* pEventRecord, NTProcessEvent* event)
+{
+    auto type = DecodeNTProcessEvent(pEventRecord, event);
+    if (mProcessFilter != nullptr) {
+        switch (type) {
+        case NTProcessEventType::Start: mProcessFilter->OnProcessStart(event->ProcessId, event->ImageFileName); break;
+        case NTProcessEventType::End:
+        case NTProcessEventType::Exit:  mProcessFilter->OnProcessEnd(event->ProcessId); break;
+        default: break;
+        }
+    }
+    return type;
+}
+
 void PMTraceConsumer::HandleNTProcessEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::NTProcessEvent);
     NTProcessEvent event;
-    event.QpcTime = pEventRecord->EventHeader.TimeStamp.QuadPart;
-
-    switch (pEventRecord->EventHeader.EventDescriptor.Opcode) {
-    case EVENT_TRACE_TYPE_START:
-    case EVENT_TRACE_TYPE_DC_START:
-        event.ProcessId     = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessId");
-        event.ImageFileName = mMetadata.GetEventData<std::string>(pEventRecord, L"ImageFileName");
-        break;
+    auto type = UpdateProcessFilter(pEventRecord, &event);
+    if (type == NTProcessEventType::None) {
+        return;
+    }
 
-    case EVENT_TRACE_TYPE_END:
-    case EVENT_TRACE_TYPE_DC_END:
-        event.ProcessId = mMetadata.GetEventData<uint32_t>(pEventRecord, L"ProcessId");
-        break;
+    if (type == NTProcessEventType::Exit) {
+        PurgeProcess(event.ProcessId, event.QpcTime);
     }
 
     {
@@ -1273,8 +1548,221 @@ void PMTraceConsumer::HandleNTProcessEvent(EVENT_RECORD* pEventRecord)
     }
 }
 
+void PMTraceConsumer::PurgeProcess(uint32_t processId, uint64_t exitQpc)
+{
+    // Every in-flight present is in mPresentsByProcessAndSwapChain until it
+    // is completed, and the process's swap chains are adjacent in that map.
+    auto swapChainBegin = mPresentsByProcessAndSwapChain.lower_bound(std::make_tuple(processId, (uint64_t) 0));
+    auto swapChainEnd = swapChainBegin;
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    for (; swapChainEnd != mPresentsByProcessAndSwapChain.end() && std::get<0>(swapChainEnd->first) == processId; ++swapChainEnd) {
+        for (auto const& p : swapChainEnd->second) {
+            if (!p->Completed && p->QpcTime < exitQpc) {
+                presents.push_back(p);
+            }
+        }
+    }
+
+    // Remove each present from mPresentByThreadId, which CompletePresent()
+    // doesn't clean up, then complete them in start order so that the
+    // consumer still sees each swap chain's presents in order.
+    auto erasePresent = [](auto* map, auto const& key, std::shared_ptr<PresentEvent> const& p) {
+        auto ii = map->find(key);
+        if (ii != map->end() && ii->second == p) {
+            map->erase(ii);
+        }
+    };
+    std::sort(presents.begin(), presents.end(), [](auto const& a, auto const& b) { return a->QpcTime < b->QpcTime; });
+    for (auto const& p : presents) {
+        erasePresent(&mPresentByThreadId, p->ThreadId, p);
+
+        if (!p->Completed) {
+            DebugModifyPresent(*p);
+            if (p->FinalState == PresentResult::Unknown) {
+                p->FinalState = PresentResult::Discarded;
+            }
+            CompletePresent(p, exitQpc);
+        }
+    }
+
+    // Presents handed off to DWM may be keyed by a different window than
+    // their own, but these only hold the presents of DWM's next frame.
+    auto isPurged = [=](std::shared_ptr<PresentEvent> const& p) { return p->ProcessId == processId && p->QpcTime < exitQpc; };
+    for (auto ii = mLastWindowPresent.begin(); ii != mLastWindowPresent.end(); ) {
+        if (isPurged(ii->second)) {
+            ii = mLastWindowPresent.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+    mPresentsWaitingForDWM.erase(
+        std::remove_if(mPresentsWaitingForDWM.begin(), mPresentsWaitingForDWM.end(), isPurged),
+        mPresentsWaitingForDWM.end());
+
+    // CompletePresent() leaves the per-process nodes, which are now empty
+    // unless the process id has already been reused.
+    auto processIter = mPresentsByProcess.find(processId);
+    if (processIter != mPresentsByProcess.end() && processIter->second.empty()) {
+        mPresentsByProcess.erase(processIter);
+    }
+    for (auto ii = mPresentsByProcessAndSwapChain.lower_bound(std::make_tuple(processId, (uint64_t) 0));
+         ii != mPresentsByProcessAndSwapChain.end() && std::get<0>(ii->first) == processId; ) {
+        if (ii->second.empty()) {
+            ii = mPresentsByProcessAndSwapChain.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+
+    // Frames that never saw their EndFrame.
+    auto threads = mFrameThreadsByProcess.find(processId);
+    if (threads != mFrameThreadsByProcess.end()) {
+        for (auto threadId : threads->second) {
+            auto frame = mCurrentFramesByThreadId.find(threadId);
+            if (frame != mCurrentFramesByThreadId.end() && frame->second.StartTime < exitQpc) {
+                mCurrentFramesByThreadId.erase(frame);
+            }
+        }
+        mFrameThreadsByProcess.erase(threads);
+    }
+
+    if (mTimeline != nullptr) {
+        mTimeline->RemoveProcess(processId);
+    }
+    if (mGpuBusy != nullptr) {
+        mGpuBusy->RemoveProcess(processId);
+    }
+    if (mFlightRecorder != nullptr) {
+        mFlightRecorder->RemoveProcess(processId);
+    }
+    if (mSimpleConsumer != nullptr) {
+        mSimpleConsumer->PurgeProcess(processId, exitQpc);
+    }
+}
+
+void PMTraceConsumer::HandleLostEvent(EVENT_RECORD* pEventRecord)
+{
+    ProfileScope profileScope(mProfile, ProfileCounter::LostEvent);
+    DebugEvent(pEventRecord, &mMetadata);
+
+    auto const& hdr = pEventRecord->EventHeader;
+    switch (hdr.EventDescriptor.Opcode) {
+    case RT_LostEvent::LostEvent:
+    case RT_LostEvent::LostBuffer:
+        // This event is delivered in order, so the gap can be applied now.
+        FlushPresentsBefore(hdr.TimeStamp.QuadPart);
+        break;
+    }
+}
+
+void PMTraceConsumer::ReportEventGap(uint64_t gapQpc)
+{
+    // Keep the latest reported gap; flushing up to it covers earlier ones.
+    auto pending = mPendingEventGapQpc.load();
+    while (pending < gapQpc && !mPendingEventGapQpc.compare_exchange_weak(pending, gapQpc)) {
+    }
+}
+
+void PMTraceConsumer::ApplyPendingEventGap()
+{
+    auto gapQpc = mPendingEventGapQpc.exchange(0);
+    if (gapQpc != 0) {
+        FlushPresentsBefore(gapQpc);
+    }
+}
+
+void PMTraceConsumer::FlushPresentsBefore(uint64_t gapQpc)
+{
+    mEventGapCount += 1;
+    mLostPresentCount += DrainPresentsBefore(gapQpc);
+}
+
+size_t PMTraceConsumer::DrainPresentsBefore(uint64_t gapQpc)
+{
+    // Every in-flight present is in mPresentsByProcessAndSwapChain until it
+    // is completed, so collect the ones that started before the gap from
+    // there.  Presents riding along with a lost present are lost too.
+    std::vector<std::shared_ptr<PresentEvent>> lostPresents;
+    for (auto const& pr : mPresentsByProcessAndSwapChain) {
+        for (auto const& p : pr.second) {
+            if (!p->Completed && p->QpcTime < gapQpc) {
+                lostPresents.push_back(p);
+            }
+        }
+    }
+    for (size_t i = 0; i < lostPresents.size(); ++i) {
+        auto p = lostPresents[i];
+        for (auto const& p2 : p->DependentPresents) {
+            if (!p2->Completed && std::find(lostPresents.begin(), lostPresents.end(), p2) == lostPresents.end()) {
+                lostPresents.push_back(p2);
+            }
+        }
+        p->DependentPresents.clear();
+    }
+
+    // Complete them in start order, so that the consumer still sees each
+    // swap chain's presents in order.
+    std::sort(lostPresents.begin(), lostPresents.end(), [](auto const& a, auto const& b) { return a->QpcTime < b->QpcTime; });
+    size_t lostCount = 0;
+    for (auto const& p : lostPresents) {
+        if (!p->Completed) {
+            DebugModifyPresent(*p);
+            p->FinalState = PresentResult::Lost;
+            CompletePresent(p, gapQpc);
+            lostCount += 1;
+        }
+    }
+
+    // CompletePresent() doesn't remove presents from every lookup map, so
+    // compact the remaining maps now.
+    auto isCompleted = [](std::shared_ptr<PresentEvent> const& p) { return p->Completed; };
+    auto eraseCompleted = [&](auto* map) {
+        for (auto ii = map->begin(); ii != map->end(); ) {
+            if (isCompleted(ii->second)) {
+                ii = map->erase(ii);
+            } else {
+                ++ii;
+            }
+        }
+    };
+    eraseCompleted(&mPresentByThreadId);
+    eraseCompleted(&mPresentsBySubmitSequence);
+    eraseCompleted(&mWin32KPresentHistoryTokens);
+    eraseCompleted(&mDxgKrnlPresentHistoryTokens);
+    eraseCompleted(&mBltsByDxgContext);
+    eraseCompleted(&mLastWindowPresent);
+    eraseCompleted(&mPresentsByLegacyBlitToken);
+    mPresentsWaitingForDWM.erase(
+        std::remove_if(mPresentsWaitingForDWM.begin(), mPresentsWaitingForDWM.end(), isCompleted),
+        mPresentsWaitingForDWM.end());
+
+    for (auto ii = mPresentsByProcess.begin(); ii != mPresentsByProcess.end(); ) {
+        eraseCompleted(&ii->second);
+        if (ii->second.empty()) {
+            ii = mPresentsByProcess.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+    for (auto ii = mPresentsByProcessAndSwapChain.begin(); ii != mPresentsByProcessAndSwapChain.end(); ) {
+        if (ii->second.empty()) {
+            ii = mPresentsByProcessAndSwapChain.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+
+    // Open frames are kept: their EndFrame may still arrive, and if it was
+    // lost the thread's next BeginFrame restarts the frame.
+    if (mSimpleConsumer != nullptr) {
+        lostCount += mSimpleConsumer->FlushPresentsBefore(gapQpc);
+    }
+    return lostCount;
+}
+
 void PMTraceConsumer::HandleMetadataEvent(EVENT_RECORD* pEventRecord)
 {
+    ProfileScope profileScope(mProfile, ProfileCounter::MetadataEvent);
     mMetadata.AddMetadata(pEventRecord);
 }
 
@@ -24,6 +24,7 @@ SOFTWARE.
 
 #define NOMINMAX
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
@@ -38,11 +39,29 @@ SOFTWARE.
 #include "Debug.hpp"
 #include "TraceConsumer.hpp"
 
+struct FlightRecorder;
+struct GpuBusyTracker;
+struct HandlerProfile;
+struct PresentIndex;
+struct ProcessFilter;
+struct QueueDepthTracker;
+struct SimpleTraceConsumer;
+struct StageLatencyHistograms;
+struct TimelineOutput;
+
 template <typename mutex_t> std::unique_lock<mutex_t> scoped_lock(mutex_t &m)
 {
     return std::unique_lock<mutex_t>(m);
 }
 
+// Erase every entry of processId from a std::map keyed by (ProcessId,
+// SwapChainAddress), whose entries for a process are adjacent.
+template <typename map_t> void EraseProcessSwapChains(map_t* map, uint32_t processId)
+{
+    map->erase(map->lower_bound(std::make_tuple(processId, (uint64_t) 0)),
+               map->upper_bound(std::make_tuple(processId, UINT64_MAX)));
+}
+
 enum class PresentMode
 {
     Unknown,
@@ -61,7 +80,7 @@ enum class PresentMode
 
 enum class PresentResult
 {
-    Unknown, Presented, Discarded, Error
+    Unknown, Presented, Discarded, Error, Lost
 };
 
 enum class Runtime
@@ -69,12 +88,37 @@ enum class Runtime
     DXGI, D3D9, Other
 };
 
+// The milestones that the handlers see a present pass through after its
+// runtime present start, roughly in pipeline order.  Which ones a present
+// reaches depends on its PresentMode (see the sequences described below).
+enum class PresentStage
+{
+    FlipOrBlit,                 // DxgKrnl Flip, FlipMultiPlaneOverlay or Blit
+    QueueSubmit,                // DxgKrnl QueuePacket_Start of the present packet
+    MMIOFlip,                   // DxgKrnl MMIOFlip or MMIOFlipMultiPlaneOverlay
+    PresentHistory,             // DxgKrnl PresentHistory(Detailed)_Start
+    PropagatePresentHistory,    // DxgKrnl PresentHistory_Info
+    DwmFlipChain,               // DWM FlipChain_Pending, _Complete or _Dirty
+    TokenInFrame,               // Win32K TokenStateChanged to InFrame
+    TokenConfirmed,             // Win32K TokenStateChanged to Confirmed
+    TokenRetired,               // Win32K TokenStateChanged to Retired
+    SyncDPC,                    // DxgKrnl VSyncDPC or HSyncDPC
+    Count
+};
+
 struct NTProcessEvent {
     std::string ImageFileName;  // If ImageFileName.empty(), then event is that process ending
     uint64_t QpcTime;
     uint32_t ProcessId;
 };
 
+enum class NTProcessEventType {
+    None,   // Not a process start or end
+    Start,  // Process start, or rundown of a process running when the trace started
+    End,    // Rundown of a process still running when the trace stopped
+    Exit,   // Process exit
+};
+
 struct PresentEvent {
     // Initial event information (might be a kernel event if not presented
     // through DXGI or D3D9)
@@ -109,21 +153,46 @@ struct PresentEvent {
     bool WasBatched;
     bool DwmNotified;
     bool Completed;
+    bool RuntimeOnly;               // Tracked by SimpleTraceConsumer, so there is no ready or screen time
+
+    // Keys of the lookup maps this present was added to, other than the ones
+    // above, so that it can be removed from them directly (see PurgeProcess()).
+    uint64_t Win32KPresentCount;    // mWin32KPresentHistoryTokens (with CompositionSurfaceLuid)
+    uint64_t Win32KBindId;
+    uint64_t DxgContext;            // mBltsByDxgContext
+    uint64_t LegacyBlitTokenData;   // mPresentsByLegacyBlitToken
 
     // Additional transient state
     std::deque<std::shared_ptr<PresentEvent>> DependentPresents;
 
-#if DEBUG_VERBOSE
-    uint64_t Id;
-#endif
+    uint64_t Id;                    // Non-zero only when gDebugJournal is set
+
+    // The time each PresentStage was first reached, as a QPC offset from
+    // QpcTime (saturated to 32 bits), or STAGE_NOT_REACHED.
+    static uint32_t const STAGE_NOT_REACHED = UINT32_MAX;
+    uint32_t StageTimes[(size_t) PresentStage::Count];
 
     PresentEvent(EVENT_HEADER const& hdr, ::Runtime runtime);
     ~PresentEvent();
 
+    void SetStageTime(PresentStage stage, uint64_t qpc)
+    {
+        auto& stageTime = StageTimes[(size_t) stage];
+        if (stageTime == STAGE_NOT_REACHED) {
+            auto offset = qpc < QpcTime ? 0 : qpc - QpcTime;
+            stageTime = offset < STAGE_NOT_REACHED ? (uint32_t) offset : STAGE_NOT_REACHED - 1;
+        }
+    }
+
 private:
     PresentEvent(PresentEvent const& copy); // dne
 };
 
+// The number of PresentEvents currently allocated, whether they are still
+// being tracked or have been handed to the consumer thread (see
+// OccupancyGauges).
+extern std::atomic<uint64_t> gLivePresentEventCount;
+
 struct Frame {
     // Initial event information (might be a kernel event if not presented
     // through DXGI or D3D9)
@@ -193,6 +262,43 @@ struct PMTraceConsumer
     // These will be handed off to the consumer thread.
     std::vector<std::shared_ptr<PresentEvent>> mCompletedPresents;
 
+    // If non-null, every completed present is also added to this index.
+    PresentIndex* mPresentIndex = nullptr;
+
+    // If non-null, every completed present and frame is also written to this
+    // timeline.
+    TimelineOutput* mTimeline = nullptr;
+
+    // If non-null, every completed present is checked for a hitch, which
+    // makes the recorder write out the events around it.
+    FlightRecorder* mFlightRecorder = nullptr;
+
+    // If non-null, every present is added to this tracker when it is
+    // created and removed when it is completed.
+    QueueDepthTracker* mQueueDepth = nullptr;
+
+    // If non-null, every DMA packet is added to this tracker when it is
+    // queued and completed, and every present starts a new frame.
+    GpuBusyTracker* mGpuBusy = nullptr;
+
+    // If non-null, every completed present's stage times are added to
+    // these histograms.
+    StageLatencyHistograms* mStageLatency = nullptr;
+
+    // In simple mode, the runtime events are handled by mSimpleConsumer
+    // instead (see TraceSession.cpp DispatchEvent()), which completes presents
+    // into mCompletedPresents and mFrames without using any of the tracking
+    // maps below.  It is required when mSimpleMode is set.
+    SimpleTraceConsumer* mSimpleConsumer = nullptr;
+
+    // If non-null, runtime events are only handled for the processes it
+    // tracks (see TraceSession.cpp DispatchEvent()).  HandleNTProcessEvent()
+    // keeps it up to date as processes start and end.
+    ProcessFilter* mProcessFilter = nullptr;
+
+    // If non-null, handler and CompletePresent() costs are accumulated here.
+    HandlerProfile* mProfile = nullptr;
+
     // For each process, stores each in-progress present in order. Used for present batching
     std::map<uint32_t, std::map<uint64_t, std::shared_ptr<PresentEvent>>> mPresentsByProcess;
 
@@ -269,17 +375,39 @@ struct PMTraceConsumer
     std::mutex mNTProcessEventMutex;
     std::vector<NTProcessEvent> mNTProcessEvents;
 
+    // Frames delimited by D3D11 BeginFrame/EndFrame markers.  mFrames is
+    // guarded by mMutex, so that a consumer thread that dequeues frames
+    // before presents will always see a frame before its present completes.
     std::vector<Frame> mFrames;
     std::map<uint32_t, Frame> mCurrentFramesByThreadId;
 
+    // The threads of each process that have started a frame, used to find
+    // the process's entries in mCurrentFramesByThreadId when it exits.
+    std::map<uint32_t, std::vector<uint32_t>> mFrameThreadsByProcess;
+
+    // Lost event handling.  When ETW reports lost events, any present that
+    // was in flight at the time may never see the events it is waiting for.
+    // ReportEventGap() may be called from any thread; the gap is applied on
+    // the event handling thread once it reaches an event at or after the gap
+    // (see ApplyPendingEventGap()), at which point every in-flight present
+    // that started before the gap is completed with PresentResult::Lost and
+    // the tracking maps are compacted.
+    std::atomic<uint64_t> mPendingEventGapQpc = 0;
+    uint64_t mEventGapCount = 0;
+    uint64_t mLostPresentCount = 0;
+
+    // Presents in flight when tracking switched between full and simple
+    // mode, which were completed with PresentResult::Lost as well.
+    uint64_t mDrainedPresentCount = 0;
+
 
     bool DequeueProcessEvents(std::vector<NTProcessEvent>& outProcessEvents)
     {
+        auto lock = scoped_lock(mNTProcessEventMutex);
         if (mNTProcessEvents.empty()) {
             return false;
         }
 
-        auto lock = scoped_lock(mNTProcessEventMutex);
         outProcessEvents.swap(mNTProcessEvents);
         return true;
     }
@@ -295,6 +423,27 @@ struct PMTraceConsumer
         return true;
     }
 
+    bool DequeueFrames(std::vector<Frame>& outFrames)
+    {
+        auto lock = scoped_lock(mMutex);
+        if (mFrames.empty()) {
+            return false;
+        }
+
+        outFrames.swap(mFrames);
+        return true;
+    }
+
+    // Dequeue the frames and completed presents together, so that a frame
+    // is never seen after its present (a frame is queued before its present
+    // can complete, but both could be queued between two separate dequeues).
+    void DequeueFramesAndPresents(std::vector<Frame>& outFrames, std::vector<std::shared_ptr<PresentEvent>>& outPresents)
+    {
+        auto lock = scoped_lock(mMutex);
+        outFrames.swap(mFrames);
+        outPresents.swap(mCompletedPresents);
+    }
+
     void HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool redirectedPresent);
     void HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterval, bool mmio);
     void HandleDxgkQueueSubmit(EVENT_HEADER const& hdr, uint32_t packetType, uint32_t submitSequence, uint64_t context, bool present, bool supportsDxgkPresentEvent);
@@ -305,14 +454,57 @@ struct PMTraceConsumer
     void HandleDxgkSubmitPresentHistoryEventArgs(EVENT_HEADER const& hdr, uint64_t token, uint64_t tokenData, PresentMode knownPresentMode);
     void HandleDxgkPropagatePresentHistoryEventArgs(EVENT_HEADER const& hdr, uint64_t token);
 
-    void CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t recurseDepth=0);
+    // completeQpc is the time of the event (or process exit, or event gap)
+    // that completes the present.
+    void CompletePresent(std::shared_ptr<PresentEvent> p, uint64_t completeQpc, uint32_t recurseDepth=0);
     std::shared_ptr<PresentEvent> FindBySubmitSequence(uint32_t submitSequence);
+    // Returns mPresentByThreadId.end() instead of creating a present for a
+    // process that mProcessFilter doesn't track.
     decltype(mPresentByThreadId.begin()) FindOrCreatePresent(EVENT_HEADER const& hdr);
     decltype(mPresentByThreadId.begin()) CreatePresent(std::shared_ptr<PresentEvent> present, decltype(mPresentsByProcess.begin()->second)& processMap);
     void CreatePresent(std::shared_ptr<PresentEvent> present);
+
+    // Remove a 'stuck' present (one that a newer present on the same thread
+    // is replacing) from mPresentByThreadId, completing it as lost if no
+    // other tracking map can find it.
+    void RemoveStuckPresent(decltype(mPresentByThreadId.begin()) eventIter, uint64_t qpc);
+
+    // Make present the most recent one DWM will pick up for hwnd.  A
+    // different present it replaces will never be picked up, and no other
+    // lookup map finds it anymore, so it is completed as discarded.
+    void SetLastWindowPresent(uint64_t hwnd, std::shared_ptr<PresentEvent> const& present, uint64_t qpc);
+
     void RuntimePresentStop(EVENT_HEADER const& hdr, bool AllowPresentBatching);
 
+    // Complete (as discarded, unless already presented) the in-flight
+    // presents that an exited process started before exitQpc, drop its
+    // unfinished frames, and remove its entries from every lookup map.  The
+    // work is proportional to the process's own entries.
+    void PurgeProcess(uint32_t processId, uint64_t exitQpc);
+
+    void ReportEventGap(uint64_t gapQpc);
+    void ApplyPendingEventGap();
+    void FlushPresentsBefore(uint64_t gapQpc);
+
+    // Complete (as lost) every in-flight present that started before gapQpc,
+    // including SimpleTraceConsumer's, and compact the tracking maps.
+    // FlushPresentsBefore() counts these as lost to an event gap; this is
+    // also used when switching between full and simple tracking (see
+    // TraceSession::SetSimpleMode()).  Returns the number of presents
+    // completed.
+    size_t DrainPresentsBefore(uint64_t gapQpc);
+
+    // Decode a process start or end from either process provider.  Returns
+    // NTProcessEventType::None for any other event.
+    NTProcessEventType DecodeNTProcessEvent(EVENT_RECORD* pEventRecord, NTProcessEvent* event);
+
+    // Decode a process event and apply it to mProcessFilter only; tracking
+    // state is not purged and nothing is queued.  Used directly when
+    // skipping events to resume from a checkpoint (see TraceSession.cpp).
+    NTProcessEventType UpdateProcessFilter(EVENT_RECORD* pEventRecord, NTProcessEvent* event);
+
     void HandleNTProcessEvent(EVENT_RECORD* pEventRecord);
+    void HandleLostEvent(EVENT_RECORD* pEventRecord);
     void HandleDXGIEvent(EVENT_RECORD* pEventRecord);
     void HandleD3D9Event(EVENT_RECORD* pEventRecord);
     void HandleD3D11Event(EVENT_RECORD* pEventRecord);
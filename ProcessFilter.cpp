@@ -0,0 +1,79 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <windows.h>
+
+#include "ProcessFilter.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+bool ProcessFilter::IsTrackedImageName(char const* imageFileName) const
+{
+    // Compare the file name only, in case a full path was provided.
+    auto slash = strrchr(imageFileName, '\\');
+    if (slash != nullptr) {
+        imageFileName = slash + 1;
+    }
+
+    for (auto const& name : mImageNames) {
+        if (_stricmp(name.c_str(), imageFileName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decide whether a process id that hasn't been seen yet is tracked.
+bool ProcessFilter::AddProcess(uint32_t processId)
+{
+    auto tracked = std::find(mProcessIds.begin(), mProcessIds.end(), processId) != mProcessIds.end();
+
+    if (!tracked && mQueryProcesses && !mImageNames.empty()) {
+        auto h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+        if (h != nullptr) {
+            char path[MAX_PATH] = {};
+            DWORD size = MAX_PATH;
+            if (QueryFullProcessImageNameA(h, 0, path, &size)) {
+                tracked = IsTrackedImageName(path);
+            }
+            CloseHandle(h);
+        }
+    }
+
+    mIsTracked.emplace(processId, tracked);
+    return tracked;
+}
+
+void ProcessFilter::OnProcessStart(uint32_t processId, std::string const& imageFileName)
+{
+    mIsTracked[processId] =
+        std::find(mProcessIds.begin(), mProcessIds.end(), processId) != mProcessIds.end() ||
+        IsTrackedImageName(imageFileName.c_str());
+}
+
+// Forget the decision, in case the process id is reused.
+void ProcessFilter::OnProcessEnd(uint32_t processId)
+{
+    mIsTracked.erase(processId);
+}
@@ -0,0 +1,85 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ProcessFilter limits runtime (DXGI, D3D9, D3D11) event handling to a set of
+// processes, given by process id and/or image file name (e.g., "game.exe",
+// compared case-insensitively).  Runtime events from other processes are
+// dropped in DispatchEvent() before any of their properties are decoded.
+// Kernel, Win32k, and DWM events are never filtered since they are needed to
+// correlate the tracked processes' presents, but they don't start tracking a
+// present (e.g., a GDI blit) for a process that isn't tracked.
+//
+// Image names are resolved from process start and rundown events as
+// PMTraceConsumer::HandleNTProcessEvent() sees them.  Realtime sessions get
+// Kernel-Process start events but no rundown of the processes that were
+// already running when the session started; set mQueryProcesses to look up
+// those processes' image names with OpenProcess() when their process ids are
+// first seen.
+//
+// All methods must be called on the event handling thread.
+struct ProcessFilter {
+    std::vector<uint32_t> mProcessIds;
+    std::vector<std::string> mImageNames;
+    bool mQueryProcesses = false;
+
+    // Decision for each process id seen so far.
+    std::unordered_map<uint32_t, bool> mIsTracked;
+
+    // Statistics
+    uint64_t mRuntimeEventCount = 0;    // runtime events checked against the filter
+    uint64_t mFilteredEventCount = 0;   // runtime events dropped
+
+    bool IsEmpty() const { return mProcessIds.empty() && mImageNames.empty(); }
+
+    bool IsTracked(uint32_t processId)
+    {
+        mRuntimeEventCount += 1;
+        auto tracked = IsTrackedProcess(processId);
+        if (!tracked) {
+            mFilteredEventCount += 1;
+        }
+        return tracked;
+    }
+
+    // As IsTracked(), but not counted as a runtime event (e.g., for a kernel
+    // event that would start tracking a present).
+    bool IsTrackedProcess(uint32_t processId)
+    {
+        auto ii = mIsTracked.find(processId);
+        return ii == mIsTracked.end() ? AddProcess(processId) : ii->second;
+    }
+
+    void OnProcessStart(uint32_t processId, std::string const& imageFileName);
+    void OnProcessEnd(uint32_t processId);
+
+private:
+    bool AddProcess(uint32_t processId);
+    bool IsTrackedImageName(char const* imageFileName) const;
+};
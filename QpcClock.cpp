@@ -0,0 +1,100 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "QpcClock.hpp"
+
+#include <assert.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define QPC_CLOCK_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Returns (numerator << 64) / denominator, for numerator < denominator (so
+// that the result fits in 64 bits), by long division.
+uint64_t DivideShifted(uint64_t numerator, uint64_t denominator)
+{
+    assert(numerator < denominator);
+
+    uint64_t quotient = 0;
+    uint64_t remainder = numerator;
+    for (int i = 0; i < 64; ++i) {
+        auto carry = remainder >> 63;
+        remainder <<= 1;
+        quotient <<= 1;
+        if (carry != 0 || remainder >= denominator) {
+            remainder -= denominator;
+            quotient |= 1;
+        }
+    }
+    return quotient;
+}
+
+QpcClock::FixedPoint GetUnitsPerTick(uint64_t unitsPerSecond, uint64_t frequency)
+{
+    QpcClock::FixedPoint f;
+    f.mInteger = unitsPerSecond / frequency;
+    f.mFraction = DivideShifted(unitsPerSecond % frequency, frequency);
+    return f;
+}
+
+}
+
+void QpcClock::Initialize(uint64_t frequency)
+{
+    assert(frequency != 0);
+
+    mFrequency = frequency;
+    mNsPerTick = GetUnitsPerTick(1000000000ull, frequency);
+    mUsPerTick = GetUnitsPerTick(1000000ull, frequency);
+    mMsPerTick = GetUnitsPerTick(1000ull, frequency);
+    mSecondsPerTick = 1. / frequency;
+    mMillisecondsPerTick = 1000. / frequency;
+    mMicrosecondsPerTick = 1000000. / frequency;
+}
+
+void QpcClock::ToMilliseconds(int64_t const* ticks, double* milliseconds, size_t count) const
+{
+    size_t i = 0;
+
+#if QPC_CLOCK_USE_SSE2
+    // SSE2 has no 64-bit integer to double conversion, but adding an integer
+    // within +/-2^51 to the bits of 1.5 * 2^52 gives the bits of 1.5 * 2^52
+    // plus the integer, so subtracting 1.5 * 2^52 converts it exactly.
+    auto const magic = _mm_set1_pd(6755399441055744.); // 1.5 * 2^52
+    auto const magicBits = _mm_castpd_si128(magic);
+    auto const scale = _mm_set1_pd(mMillisecondsPerTick);
+    for (; i + 2 <= count; i += 2) {
+        assert(ticks[i]     >= -(1ll << 51) && ticks[i]     <= (1ll << 51));
+        assert(ticks[i + 1] >= -(1ll << 51) && ticks[i + 1] <= (1ll << 51));
+        auto t = _mm_loadu_si128((__m128i const*) (ticks + i));
+        auto d = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(t, magicBits)), magic);
+        _mm_storeu_pd(milliseconds + i, _mm_mul_pd(d, scale));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        milliseconds[i] = ToMilliseconds(ticks[i]);
+    }
+}
@@ -0,0 +1,98 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+// QpcClock converts QPC tick counts into time for one QPC frequency.  The
+// TraceSession initializes one once the frequency of the trace is known,
+// and every output converts its timestamps with it so that they all report
+// identical values for identical ticks.
+//
+// The integer conversions (ToNs(), ToUs(), ToMs()) multiply by the number of
+// units per tick, precomputed as 64.64 fixed point, so they need no division
+// and only overflow if the result itself doesn't fit in 64 bits (unlike
+// 1000000000 * ticks / frequency, which overflows after about half an hour
+// at 10MHz).  They round down, and are at most one unit less than exact.
+//
+// The floating point conversions multiply by a precomputed units-per-tick
+// double.  ToMilliseconds() has a batch version for converting a whole
+// column of times, which uses SSE2 where available and gives the same
+// results as the scalar version.
+struct QpcClock {
+    struct FixedPoint {
+        uint64_t mInteger;
+        uint64_t mFraction;     // In units of 2^-64
+    };
+
+    uint64_t mFrequency = 0;
+    FixedPoint mNsPerTick = {};
+    FixedPoint mUsPerTick = {};
+    FixedPoint mMsPerTick = {};
+    double mSecondsPerTick = 0.;
+    double mMillisecondsPerTick = 0.;
+    double mMicrosecondsPerTick = 0.;
+
+    void Initialize(uint64_t frequency);
+
+    uint64_t ToNs(uint64_t ticks) const { return Multiply(ticks, mNsPerTick); }
+    uint64_t ToUs(uint64_t ticks) const { return Multiply(ticks, mUsPerTick); }
+    uint64_t ToMs(uint64_t ticks) const { return Multiply(ticks, mMsPerTick); }
+
+    double ToSeconds(int64_t ticks) const { return (double) ticks * mSecondsPerTick; }
+    double ToMilliseconds(int64_t ticks) const { return (double) ticks * mMillisecondsPerTick; }
+    double ToMicroseconds(int64_t ticks) const { return (double) ticks * mMicrosecondsPerTick; }
+
+    // Each of ticks[0..count) must be within +/-2^51.
+    void ToMilliseconds(int64_t const* ticks, double* milliseconds, size_t count) const;
+
+    int64_t FromSeconds(double seconds) const { return (int64_t) (seconds * mFrequency); }
+
+private:
+    static uint64_t MultiplyHigh(uint64_t a, uint64_t b)
+    {
+#if defined(_M_X64) || defined(_M_ARM64)
+        return __umulh(a, b);
+#else
+        auto aLo = a & 0xffffffffull;
+        auto aHi = a >> 32;
+        auto bLo = b & 0xffffffffull;
+        auto bHi = b >> 32;
+        auto lolo = aLo * bLo;
+        auto hilo = aHi * bLo;
+        auto lohi = aLo * bHi;
+        auto middle = (lolo >> 32) + (hilo & 0xffffffffull) + (lohi & 0xffffffffull);
+        return aHi * bHi + (hilo >> 32) + (lohi >> 32) + (middle >> 32);
+#endif
+    }
+
+    static uint64_t Multiply(uint64_t ticks, FixedPoint const& unitsPerTick)
+    {
+        return ticks * unitsPerTick.mInteger + MultiplyHigh(ticks, unitsPerTick.mFraction);
+    }
+};
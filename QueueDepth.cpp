@@ -0,0 +1,118 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMonTraceConsumer.hpp"
+#include "QueueDepth.hpp"
+
+#include <algorithm>
+#include <assert.h>
+
+void QueueDepthTracker::Start(FILE* fp, LARGE_INTEGER const* startQpc, QpcClock const& clock)
+{
+    assert(clock.mFrequency != 0);
+
+    mFile = fp;
+    mStartQpc = startQpc;
+    mClock = clock;
+    mSwapChains.clear();
+
+    if (mFile != nullptr) {
+        fprintf(mFile, "Time, ProcessId, SwapChainAddress, QueueDepth\n");
+    }
+}
+
+void QueueDepthTracker::AddPresent(PresentEvent const& p)
+{
+    Update(p, p.QpcTime, true);
+}
+
+void QueueDepthTracker::CompletePresent(PresentEvent const& p, uint64_t completeQpc)
+{
+    auto displayed = p.FinalState == PresentResult::Presented && p.ScreenTime != 0;
+    Update(p, displayed ? p.ScreenTime : completeQpc, false);
+}
+
+void QueueDepthTracker::Update(PresentEvent const& p, uint64_t qpc, bool enqueue)
+{
+    auto& swapChain = mSwapChains[std::make_tuple(p.ProcessId, p.SwapChainAddress)];
+    if (!enqueue && swapChain.mDepth == 0) {
+        return;
+    }
+
+    // Keep each swap chain's changes in time order; a present can be
+    // completed with a ScreenTime slightly before the last change.
+    if (swapChain.mPresentCount == 0) {
+        swapChain.mLastChangeQpc = qpc;
+    }
+    qpc = std::max(qpc, swapChain.mLastChangeQpc);
+
+    swapChain.mDepthTicks[std::min(swapChain.mDepth, MAX_DEPTH)] += qpc - swapChain.mLastChangeQpc;
+    swapChain.mLastChangeQpc = qpc;
+    if (enqueue) {
+        swapChain.mDepth += 1;
+        swapChain.mMaxDepth = std::max(swapChain.mMaxDepth, swapChain.mDepth);
+        swapChain.mPresentCount += 1;
+    } else {
+        swapChain.mDepth -= 1;
+    }
+
+    if (mFile != nullptr) {
+        fprintf(mFile, "%.6f, %u, %llx, %u\n",
+            mClock.ToSeconds((int64_t) (qpc - mStartQpc->QuadPart)),
+            p.ProcessId,
+            p.SwapChainAddress,
+            swapChain.mDepth);
+    }
+}
+
+void QueueDepthTracker::PrintSummary(FILE* fp) const
+{
+    fprintf(fp, "%-10s %-16s %10s %8s %8s  %% of time at depth 0..%u+\n", "ProcessId", "SwapChain", "Presents", "MaxDepth", "Mean", MAX_DEPTH);
+    for (auto const& pair : mSwapChains) {
+        auto const& swapChain = pair.second;
+        if (swapChain.mPresentCount == 0) {
+            continue;
+        }
+
+        uint64_t totalTicks = 0;
+        uint64_t weightedTicks = 0;
+        uint32_t lastDepth = 0;
+        for (uint32_t depth = 0; depth <= MAX_DEPTH; ++depth) {
+            totalTicks += swapChain.mDepthTicks[depth];
+            weightedTicks += depth * swapChain.mDepthTicks[depth];
+            if (swapChain.mDepthTicks[depth] != 0) {
+                lastDepth = depth;
+            }
+        }
+
+        fprintf(fp, "%-10u %-16llx %10llu %8u %8.2f ",
+            std::get<0>(pair.first),
+            std::get<1>(pair.first),
+            swapChain.mPresentCount,
+            swapChain.mMaxDepth,
+            totalTicks == 0 ? 0. : (double) weightedTicks / totalTicks);
+        for (uint32_t depth = 0; depth <= lastDepth; ++depth) {
+            fprintf(fp, " %5.1f", totalTicks == 0 ? 0. : 100. * swapChain.mDepthTicks[depth] / totalTicks);
+        }
+        fprintf(fp, "\n");
+    }
+}
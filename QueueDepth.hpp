@@ -0,0 +1,79 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <tuple>
+#include <windows.h>
+
+#include "QpcClock.hpp"
+
+struct PresentEvent;
+
+// QueueDepthTracker follows how many presents each swap chain has in flight
+// (started but not yet displayed or discarded) as PMTraceConsumer creates
+// and completes them, which is the queue an input has to wait behind.
+//
+// A present enters the queue at its QpcTime and leaves it at its ScreenTime,
+// or, if it isn't displayed, at the time of the event that completed it (or
+// of the process exit or event gap that did).  Each change is optionally
+// written to mFile as a row of (time, process, swap chain, depth), and is
+// accumulated into the swap chain's max, time-weighted mean, and histogram
+// of time spent at each depth; an update is one map lookup.
+//
+// Presents that are completed without having been seen to start (e.g., ones
+// restored from a checkpoint) don't take the depth below zero.
+//
+// All functions are called from the event handling thread.
+struct QueueDepthTracker {
+    static uint32_t const MAX_DEPTH = 16;   // The last histogram bucket counts this depth or more
+
+    typedef std::tuple<uint32_t, uint64_t> ProcessAndSwapChainKey;
+
+    struct SwapChain {
+        uint32_t mDepth = 0;
+        uint32_t mMaxDepth = 0;
+        uint64_t mPresentCount = 0;
+        uint64_t mLastChangeQpc = 0;
+        uint64_t mDepthTicks[MAX_DEPTH + 1] = {};   // QPC ticks spent at each depth
+    };
+
+    FILE* mFile = nullptr;                  // If non-null, each change is written here
+    LARGE_INTEGER const* mStartQpc = nullptr;  // Set by the session once the first event is seen
+    QpcClock mClock;
+    std::map<ProcessAndSwapChainKey, SwapChain> mSwapChains;
+
+    void Start(FILE* fp, LARGE_INTEGER const* startQpc, QpcClock const& clock);
+
+    // Called by PMTraceConsumer as presents are created and completed.
+    void AddPresent(PresentEvent const& p);
+    void CompletePresent(PresentEvent const& p, uint64_t completeQpc);
+
+    // Print each swap chain's max, mean and histogram of queue depth.
+    void PrintSummary(FILE* fp) const;
+
+private:
+    void Update(PresentEvent const& p, uint64_t qpc, bool enqueue);
+};
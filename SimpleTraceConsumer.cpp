@@ -0,0 +1,333 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMonTraceConsumer.hpp"
+#include "SimpleTraceConsumer.hpp"
+#include "FlightRecorder.hpp"
+#include "HandlerProfile.hpp"
+#include "PresentIndex.hpp"
+#include "QueueDepth.hpp"
+#include "TimelineOutput.hpp"
+
+#include "D3d9EventStructs.hpp"
+#include "D3d11EventStructs.hpp"
+#include "DxgiEventStructs.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <d3d9.h>
+#include <dxgi.h>
+#include <vector>
+
+void SimpleTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
+{
+    ProfileScope profileScope(mOutput->mProfile, ProfileCounter::DXGIEvent);
+    DebugEvent(pEventRecord, &mOutput->mMetadata);
+
+    auto const& hdr = pEventRecord->EventHeader;
+    switch (hdr.EventDescriptor.Id) {
+    case Microsoft_Windows_DXGI::Present_Start::Id:
+    case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Start::Id:
+    {
+        EventDataDesc desc[] = {
+            { L"pIDXGISwapChain" },
+            { L"Flags" },
+            { L"SyncInterval" },
+        };
+        mOutput->mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
+        auto pIDXGISwapChain = desc[0].GetData<uint64_t>();
+        auto Flags           = desc[1].GetData<uint32_t>();
+        auto SyncInterval    = desc[2].GetData<int32_t>();
+
+        // Ignore PRESENT_TEST: it's just to check if you're still fullscreen
+        if ((Flags & DXGI_PRESENT_TEST) != 0) {
+            break;
+        }
+
+        auto present = std::make_shared<PresentEvent>(hdr, Runtime::DXGI);
+        present->SwapChainAddress = pIDXGISwapChain;
+        present->PresentFlags     = Flags;
+        present->SyncInterval     = SyncInterval;
+
+        PresentStart(present);
+        break;
+    }
+    case Microsoft_Windows_DXGI::Present_Stop::Id:
+    case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Stop::Id:
+    {
+        auto result = mOutput->mMetadata.GetEventData<uint32_t>(pEventRecord, L"Result");
+
+        bool presented =
+            SUCCEEDED(result) &&
+            result != DXGI_STATUS_OCCLUDED &&
+            result != DXGI_STATUS_MODE_CHANGE_IN_PROGRESS &&
+            result != DXGI_STATUS_NO_DESKTOP_ACCESS;
+
+        PresentStop(hdr, presented);
+        break;
+    }
+    default:
+        assert(!mOutput->mFilteredEvents); // Assert that filtering is working if expected
+        break;
+    }
+}
+
+void SimpleTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
+{
+    ProfileScope profileScope(mOutput->mProfile, ProfileCounter::D3D9Event);
+    DebugEvent(pEventRecord, &mOutput->mMetadata);
+
+    auto const& hdr = pEventRecord->EventHeader;
+    switch (hdr.EventDescriptor.Id) {
+    case Microsoft_Windows_D3D9::Present_Start::Id:
+    {
+        EventDataDesc desc[] = {
+            { L"pSwapchain" },
+            { L"Flags" },
+        };
+        mOutput->mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
+        auto pSwapchain = desc[0].GetData<uint64_t>();
+        auto Flags      = desc[1].GetData<uint32_t>();
+
+        auto present = std::make_shared<PresentEvent>(hdr, Runtime::D3D9);
+        present->SwapChainAddress = pSwapchain;
+        present->PresentFlags =
+            ((Flags & D3DPRESENT_DONOTFLIP) ? DXGI_PRESENT_DO_NOT_SEQUENCE : 0) |
+            ((Flags & D3DPRESENT_DONOTWAIT) ? DXGI_PRESENT_DO_NOT_WAIT : 0) |
+            ((Flags & D3DPRESENT_FLIPRESTART) ? DXGI_PRESENT_RESTART : 0);
+        if ((Flags & D3DPRESENT_FORCEIMMEDIATE) != 0) {
+            present->SyncInterval = 0;
+        }
+
+        PresentStart(present);
+        break;
+    }
+    case Microsoft_Windows_D3D9::Present_Stop::Id:
+    {
+        auto result = mOutput->mMetadata.GetEventData<uint32_t>(pEventRecord, L"Result");
+
+        bool presented =
+            SUCCEEDED(result) &&
+            result != S_PRESENT_OCCLUDED;
+
+        PresentStop(hdr, presented);
+        break;
+    }
+    default:
+        assert(!mOutput->mFilteredEvents); // Assert that filtering is working if expected
+        break;
+    }
+}
+
+void SimpleTraceConsumer::HandleD3D11Event(EVENT_RECORD* pEventRecord)
+{
+    ProfileScope profileScope(mOutput->mProfile, ProfileCounter::D3D11Event);
+    DebugEvent(pEventRecord, &mOutput->mMetadata);
+
+    auto const& hdr = pEventRecord->EventHeader;
+    switch (hdr.EventDescriptor.Id) {
+    case Microsoft_Windows_D3D11::Marker::Id:
+    {
+        auto message = mOutput->mMetadata.GetEventData<std::wstring>(pEventRecord, L"Label");
+        if (message.find(L"BeginFrame") == 0) {
+            // A frame that is still open lost its EndFrame (e.g., to an event
+            // gap), so it is restarted.
+            auto& thread = mThreads[hdr.ThreadId];
+            thread.mFrame = {};
+            thread.mFrame.StartTime = hdr.TimeStamp.QuadPart;
+            thread.mInFrame = true;
+            thread.mProcessId = hdr.ProcessId;
+        } else if (message.find(L"EndFrame") == 0) {
+            // An EndFrame without a BeginFrame (lost, or from before the
+            // trace started) is dropped.
+            auto ii = mThreads.find(hdr.ThreadId);
+            if (ii == mThreads.end() || !ii->second.mInFrame) {
+                break;
+            }
+
+            auto& thread = ii->second;
+            thread.mFrame.EndTime = hdr.TimeStamp.QuadPart;
+            thread.mFrame.present = thread.mPresent;
+            if (mOutput->mTimeline != nullptr) {
+                mOutput->mTimeline->AddFrame(hdr.ProcessId, hdr.ThreadId, thread.mFrame);
+            }
+            {
+                auto lock = scoped_lock(mOutput->mMutex);
+                mOutput->mFrames.push_back(std::move(thread.mFrame));
+            }
+            thread.mInFrame = false;
+            if (thread.mPresent == nullptr) {
+                mThreads.erase(ii);
+            }
+        }
+        break;
+    }
+    default:
+        assert(!mOutput->mFilteredEvents); // Assert that filtering is working if expected
+        break;
+    }
+}
+
+void SimpleTraceConsumer::PresentStart(std::shared_ptr<PresentEvent> present)
+{
+    present->RuntimeOnly = true;
+    DebugCreatePresent(*present);
+
+    if (mOutput->mQueueDepth != nullptr) {
+        mOutput->mQueueDepth->AddPresent(*present);
+    }
+
+    // A thread can only be in one present at a time, so a present that is
+    // still in progress never saw its Present_Stop.
+    auto& thread = mThreads[present->ThreadId];
+    if (thread.mPresent != nullptr) {
+        DebugModifyPresent(*thread.mPresent);
+        thread.mPresent->FinalState = PresentResult::Discarded;
+        CompletePresent(std::move(thread.mPresent), present->QpcTime);
+    }
+    thread.mPresent = std::move(present);
+    thread.mProcessId = thread.mPresent->ProcessId;
+}
+
+void SimpleTraceConsumer::PresentStop(EVENT_HEADER const& hdr, bool presented)
+{
+    auto ii = mThreads.find(hdr.ThreadId);
+    if (ii == mThreads.end() || ii->second.mPresent == nullptr) {
+        return;
+    }
+
+    auto& thread = ii->second;
+    auto& present = *thread.mPresent;
+    DebugModifyPresent(present);
+
+    assert(present.QpcTime <= (uint64_t) hdr.TimeStamp.QuadPart);
+    present.TimeTaken = hdr.TimeStamp.QuadPart - present.QpcTime;
+    present.FinalState = presented ? PresentResult::Presented : PresentResult::Discarded;
+    CompletePresent(std::move(thread.mPresent), hdr.TimeStamp.QuadPart);
+
+    if (!thread.mInFrame) {
+        mThreads.erase(ii);
+    }
+}
+
+void SimpleTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint64_t completeQpc)
+{
+    ProfileScope profileScope(mOutput->mProfile, ProfileCounter::CompletePresent);
+    DebugCompletePresent(*p, 0);
+
+    p->Completed = true;
+    if (mOutput->mTimeline != nullptr) {
+        mOutput->mTimeline->AddPresent(*p);
+    }
+    if (mOutput->mFlightRecorder != nullptr) {
+        mOutput->mFlightRecorder->CheckPresent(*p);
+    }
+    if (mOutput->mQueueDepth != nullptr) {
+        mOutput->mQueueDepth->CompletePresent(*p, completeQpc);
+    }
+
+    auto lock = scoped_lock(mOutput->mMutex);
+    if (mOutput->mPresentIndex != nullptr) {
+        mOutput->mPresentIndex->Add(*p);
+    }
+    mOutput->mCompletedPresents.push_back(std::move(p));
+}
+
+template<typename ProcessPredicate>
+size_t SimpleTraceConsumer::FlushThreads(uint64_t beforeQpc, PresentResult result, bool dropFrames, ProcessPredicate isProcessFlushed)
+{
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    for (auto ii = mThreads.begin(); ii != mThreads.end(); ) {
+        auto& thread = ii->second;
+        if (isProcessFlushed(thread.mProcessId)) {
+            if (thread.mPresent != nullptr && thread.mPresent->QpcTime < beforeQpc) {
+                presents.push_back(std::move(thread.mPresent));
+                thread.mPresent = nullptr;
+            }
+            if (dropFrames && thread.mInFrame && thread.mFrame.StartTime < beforeQpc) {
+                thread.mInFrame = false;
+            }
+        }
+        if (thread.mPresent == nullptr && !thread.mInFrame) {
+            ii = mThreads.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+
+    // Complete them in start order, like PMTraceConsumer does.
+    std::sort(presents.begin(), presents.end(), [](auto const& a, auto const& b) { return a->QpcTime < b->QpcTime; });
+    for (auto& p : presents) {
+        DebugModifyPresent(*p);
+        p->FinalState = result;
+        CompletePresent(std::move(p), beforeQpc);
+    }
+    return presents.size();
+}
+
+void SimpleTraceConsumer::PurgeProcess(uint32_t processId, uint64_t exitQpc)
+{
+    FlushThreads(exitQpc, PresentResult::Discarded, true, [=](uint32_t id) { return id == processId; });
+}
+
+size_t SimpleTraceConsumer::FlushPresentsBefore(uint64_t gapQpc)
+{
+    // Open frames are kept, as in PMTraceConsumer::FlushPresentsBefore().
+    return FlushThreads(gapQpc, PresentResult::Lost, false, [](uint32_t) { return true; });
+}
+
+void SimpleTraceConsumer::TakeOpenFrames()
+{
+    for (auto const& pr : mOutput->mFrameThreadsByProcess) {
+        for (auto threadId : pr.second) {
+            auto frame = mOutput->mCurrentFramesByThreadId.find(threadId);
+            if (frame != mOutput->mCurrentFramesByThreadId.end()) {
+                auto& thread = mThreads[threadId];
+                thread.mFrame = frame->second;
+                thread.mInFrame = true;
+                thread.mProcessId = pr.first;
+            }
+        }
+    }
+    mOutput->mCurrentFramesByThreadId.clear();
+    mOutput->mFrameThreadsByProcess.clear();
+}
+
+void SimpleTraceConsumer::ReturnOpenFrames()
+{
+    for (auto ii = mThreads.begin(); ii != mThreads.end(); ) {
+        auto& thread = ii->second;
+        if (thread.mInFrame) {
+            mOutput->mCurrentFramesByThreadId[ii->first] = thread.mFrame;
+            auto& threads = mOutput->mFrameThreadsByProcess[thread.mProcessId];
+            if (std::find(threads.begin(), threads.end(), ii->first) == threads.end()) {
+                threads.push_back(ii->first);
+            }
+            thread.mInFrame = false;
+        }
+        if (thread.mPresent == nullptr) {
+            ii = mThreads.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+}
@@ -0,0 +1,93 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <unordered_map>
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+
+#include "PresentMonTraceConsumer.hpp"
+
+// SimpleTraceConsumer handles the runtime events (DXGI and D3D9 present
+// start/stop, and D3D11 BeginFrame/EndFrame markers) when PMTraceConsumer is
+// in simple mode, for when only the application side of frame pacing is
+// needed.  DispatchEvent<SIMPLE=true> routes those events here instead of to
+// PMTraceConsumer, so none of the kernel tracking maps are touched.
+//
+// The only state is the present and frame that each thread is in the middle
+// of, and a thread's entry is removed as soon as it has neither.  A present
+// is complete at its Present_Stop (presented, or discarded if the runtime
+// reported an error or occlusion) and goes straight into mOutput's completed
+// present queue; there is no ready or screen time, and presents on the same
+// swap chain from different threads are queued in the order they stop.
+//
+// mOutput still owns the metadata, the output queues, process tracking, and
+// the optional components (timeline, flight recorder, queue depth, present
+// index, profile).  It calls PurgeProcess() and FlushPresentsBefore() from
+// its own versions, so process exits and event gaps apply here as well.
+//
+// All functions are called from the event handling thread.
+struct SimpleTraceConsumer {
+    struct Thread {
+        std::shared_ptr<PresentEvent> mPresent; // Between Present_Start and Present_Stop
+        Frame mFrame = {};                      // Between BeginFrame and EndFrame
+        bool mInFrame = false;
+        uint32_t mProcessId = 0;
+    };
+
+    explicit SimpleTraceConsumer(PMTraceConsumer* output) : mOutput(output) { }
+
+    PMTraceConsumer* mOutput;
+    std::unordered_map<uint32_t, Thread> mThreads;
+
+    void HandleDXGIEvent(EVENT_RECORD* pEventRecord);
+    void HandleD3D9Event(EVENT_RECORD* pEventRecord);
+    void HandleD3D11Event(EVENT_RECORD* pEventRecord);
+
+    // Complete (as discarded) the presents that an exited process started
+    // before exitQpc, and drop its unfinished frames.
+    void PurgeProcess(uint32_t processId, uint64_t exitQpc);
+
+    // Complete (as lost) the presents started before gapQpc.  Open frames are
+    // kept, since their EndFrame may still arrive.  Returns the number of
+    // presents completed.
+    size_t FlushPresentsBefore(uint64_t gapQpc);
+
+    // Move the open D3D11 frames from mOutput's tracking into this consumer,
+    // or back, when switching between full and simple tracking.
+    void TakeOpenFrames();
+    void ReturnOpenFrames();
+
+private:
+    void PresentStart(std::shared_ptr<PresentEvent> present);
+    void PresentStop(EVENT_HEADER const& hdr, bool presented);
+    void CompletePresent(std::shared_ptr<PresentEvent> p, uint64_t completeQpc);
+
+    // Complete the presents, and drop the frames if dropFrames is set, that
+    // started before beforeQpc on the threads whose process matches.  Returns
+    // the number of presents completed.
+    template<typename ProcessPredicate>
+    size_t FlushThreads(uint64_t beforeQpc, PresentResult result, bool dropFrames, ProcessPredicate isProcessFlushed);
+};
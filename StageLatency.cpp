@@ -0,0 +1,136 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "StageLatency.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+char const* const STAGE_NAMES[] = {
+    "FlipOrBlit",
+    "QueueSubmit",
+    "MMIOFlip",
+    "PresentHistory",
+    "PropagatePresentHistory",
+    "DwmFlipChain",
+    "TokenInFrame",
+    "TokenConfirmed",
+    "TokenRetired",
+    "SyncDPC",
+    "PresentStart",
+};
+static_assert(_countof(STAGE_NAMES) == StageLatencyHistograms::STAGE_COUNT + 1, "STAGE_NAMES must match PresentStage");
+
+// The upper bound of the bucket that holds the given fraction of the
+// histogram's samples (but no more than its max), in milliseconds.
+double GetPercentileMs(StageLatencyHistograms::Histogram const& h, double fraction, QpcClock const& clock)
+{
+    auto maxMs = clock.ToMilliseconds((int64_t) h.mMaxTicks);
+    auto target = (uint64_t) (fraction * h.mCount);
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < StageLatencyHistograms::BUCKET_COUNT - 1; ++i) {
+        count += h.mBuckets[i];
+        if (count > target) {
+            return std::min((1ull << i) / 1000.0, maxMs);
+        }
+    }
+    return maxMs;
+}
+
+}
+
+void StageLatencyHistograms::Start(QpcClock const& clock)
+{
+    assert(clock.mFrequency != 0);
+
+    mClock = clock;
+    mPresentCount = 0;
+    memset(mHistograms, 0, sizeof(mHistograms));
+}
+
+void StageLatencyHistograms::AddPresent(PresentEvent const& p)
+{
+    // Order the reached stages by time, keeping pipeline order for ties.
+    uint32_t stages[STAGE_COUNT];
+    uint32_t count = 0;
+    for (uint32_t stage = 0; stage < STAGE_COUNT; ++stage) {
+        auto offset = p.StageTimes[stage];
+        if (offset == PresentEvent::STAGE_NOT_REACHED) {
+            continue;
+        }
+
+        auto i = count++;
+        for (; i > 0 && p.StageTimes[stages[i - 1]] > offset; --i) {
+            stages[i] = stages[i - 1];
+        }
+        stages[i] = stage;
+    }
+
+    uint32_t from = PRESENT_START;
+    uint32_t fromOffset = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        auto to = stages[i];
+        auto ticks = (uint64_t) (p.StageTimes[to] - fromOffset);
+        auto us = mClock.ToUs(ticks);
+
+        uint32_t bucket = 0;
+        for (; us != 0 && bucket < BUCKET_COUNT - 1; us >>= 1) {
+            bucket += 1;
+        }
+
+        auto& h = mHistograms[from][to];
+        h.mCount += 1;
+        h.mTotalTicks += ticks;
+        h.mMaxTicks = std::max(h.mMaxTicks, ticks);
+        h.mBuckets[bucket] += 1;
+
+        from = to;
+        fromOffset = p.StageTimes[to];
+    }
+
+    mPresentCount += 1;
+}
+
+void StageLatencyHistograms::PrintSummary(FILE* fp) const
+{
+    fprintf(fp, "%-24s %-24s %10s %10s %10s %10s %10s\n", "From", "To", "Count", "Mean (ms)", "p50<= (ms)", "p99<= (ms)", "Max (ms)");
+    for (uint32_t from = 0; from <= STAGE_COUNT; ++from) {
+        for (uint32_t to = 0; to < STAGE_COUNT; ++to) {
+            auto const& h = mHistograms[from][to];
+            if (h.mCount == 0) {
+                continue;
+            }
+            fprintf(fp, "%-24s %-24s %10llu %10.3f %10.3f %10.3f %10.3f\n",
+                STAGE_NAMES[from],
+                STAGE_NAMES[to],
+                h.mCount,
+                mClock.ToMilliseconds((int64_t) h.mTotalTicks) / h.mCount,
+                GetPercentileMs(h, 0.5, mClock),
+                GetPercentileMs(h, 0.99, mClock),
+                mClock.ToMilliseconds((int64_t) h.mMaxTicks));
+        }
+    }
+    fprintf(fp, "%llu presents\n", mPresentCount);
+}
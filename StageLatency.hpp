@@ -0,0 +1,68 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "PresentMonTraceConsumer.hpp"
+#include "QpcClock.hpp"
+
+// StageLatencyHistograms breaks each completed present's latency down by the
+// PresentStages it reached (see PresentEvent::StageTimes).  The stages are
+// ordered by the time they were reached, and the time between each
+// consecutive pair (starting from the runtime present start) is added to the
+// histogram for that transition, so a path such as PresentHistory ->
+// PropagatePresentHistory -> TokenInFrame -> TokenRetired shows how long a
+// present waited on each step.
+//
+// Histogram buckets are powers of two of microseconds: bucket 0 counts
+// times under 1us, and bucket i counts times in [2^(i-1), 2^i) us, with the
+// last bucket also counting anything longer.
+//
+// All functions are called from the event handling thread.
+struct StageLatencyHistograms {
+    static uint32_t const STAGE_COUNT = (uint32_t) PresentStage::Count;
+    static uint32_t const PRESENT_START = STAGE_COUNT;     // The 'from' index of the runtime present start
+    static uint32_t const BUCKET_COUNT = 24;
+
+    struct Histogram {
+        uint64_t mCount;
+        uint64_t mTotalTicks;
+        uint64_t mMaxTicks;
+        uint64_t mBuckets[BUCKET_COUNT];
+    };
+
+    QpcClock mClock;
+    uint64_t mPresentCount = 0;
+    Histogram mHistograms[STAGE_COUNT + 1][STAGE_COUNT] = {};   // [from][to]
+
+    void Start(QpcClock const& clock);
+
+    // Called by PMTraceConsumer as presents are completed.
+    void AddPresent(PresentEvent const& p);
+
+    // Print the count, mean, median, 99th percentile and max of each
+    // transition that was seen.
+    void PrintSummary(FILE* fp) const;
+};
@@ -0,0 +1,556 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "StressTest.hpp"
+#include "OccupancyGauges.hpp"
+#include "PresentMonTraceConsumer.hpp"
+#include "SyntheticTrace.hpp"
+#include "TraceSession.hpp"
+
+#include "DwmEventStructs.hpp"
+#include "DxgiEventStructs.hpp"
+#include "DxgkrnlEventStructs.hpp"
+#include "Win32kEventStructs.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <string.h>
+
+namespace {
+
+uint32_t const CHECK_INTERVAL = 4096;           // Events handled between bound checks
+uint32_t const MAX_GAP_EVENTS = 256;            // Longest run of events dropped for an event gap
+uint32_t const MINIMIZE_REPLAY_BUDGET = 2000;   // Replays allowed while minimizing
+
+uint32_t const SEGMENT_PROCESS_COUNT = 8;
+uint32_t const SEGMENT_THREADS_PER_PROCESS = 2;
+uint32_t const SEGMENT_PRESENTS_PER_THREAD = 600;
+uint32_t const SEGMENT_MAX_QUEUE_DEPTH = 3;
+uint64_t const SEGMENT_SPACING = SyntheticTrace::QPC_FREQUENCY / 100;  // From one segment's last event to the next's first
+
+PresentMode const SEGMENT_MODES[] = {
+    PresentMode::Hardware_Legacy_Flip,
+    PresentMode::Composed_Flip,
+    PresentMode::Hardware_Legacy_Copy_To_Front_Buffer,
+    PresentMode::Composed_Copy_GPU_GDI,
+    PresentMode::Hardware_Independent_Flip,
+    PresentMode::Composed_Copy_CPU_GDI,
+    PresentMode::Hardware_Composed_Independent_Flip,
+    PresentMode::Composed_Composition_Atlas,
+};
+
+struct StressEvent {
+    EVENT_HEADER mHeader;
+    std::vector<uint8_t> mUserData;
+    bool mGap;          // Report an event gap at mHeader.TimeStamp instead of handling an event
+};
+
+enum class StressBound {
+    MapEntries,
+    MapAge,
+    LivePresents,
+    EventTime,
+};
+
+struct StressFailure {
+    StressBound mBound;
+    OccupancyGauge mGauge;      // For MapEntries and MapAge
+    uint64_t mQpc;              // Trace time of the check that failed
+    double mValue;
+};
+
+struct StressMeasurement {
+    OccupancySnapshot mSnapshot;
+    uint64_t mLivePresents;
+};
+
+// StressStream generates the mutated event stream described in
+// StressTest.hpp.
+struct StressStream {
+    StressTestOptions mOptions;
+    SyntheticTrace mTrace;
+    uint32_t mRandom = 0;
+    uint32_t mSegment = 0;
+    bool mSegmentStarted = false;
+    uint64_t mTimeOffset = 0;
+    uint64_t mLastTime = 0;
+    uint32_t mGapEventsRemaining = 0;
+    bool mHaveHeld = false;
+    StressEvent mHeld;
+
+    uint64_t mPresentCount = 0;
+    uint64_t mDroppedCount = 0;
+    uint64_t mDuplicatedCount = 0;
+    uint64_t mReorderedCount = 0;
+    uint64_t mGapCount = 0;
+
+    void Initialize(StressTestOptions const& options)
+    {
+        mOptions = options;
+        mRandom = options.mSeed == 0 ? 1 : options.mSeed;
+        StartSegment();
+    }
+
+    // xorshift32
+    uint32_t Random()
+    {
+        mRandom ^= mRandom << 13;
+        mRandom ^= mRandom >> 17;
+        mRandom ^= mRandom << 5;
+        return mRandom;
+    }
+
+    bool Chance(uint32_t ppm)
+    {
+        return ppm != 0 && Random() % 1000000 < ppm;
+    }
+
+    void StartSegment()
+    {
+        mPresentCount += mTrace.mPresentCount;
+
+        SyntheticTraceOptions options;
+        options.mPresentMode = SEGMENT_MODES[mSegment % _countof(SEGMENT_MODES)];
+        options.mProcessCount = SEGMENT_PROCESS_COUNT;
+        options.mThreadsPerProcess = SEGMENT_THREADS_PER_PROCESS;
+        options.mPresentsPerThread = SEGMENT_PRESENTS_PER_THREAD;
+        options.mQueueDepth = 1 + mSegment % SEGMENT_MAX_QUEUE_DEPTH;
+        options.mSeed = Random();
+
+        mTrace = SyntheticTrace();
+        mTrace.Initialize(options);
+        mSegment += 1;
+        mSegmentStarted = false;
+    }
+
+    // Every segment starts at the same time, so later segments are shifted
+    // to follow the previous one.
+    void NextCleanEvent(StressEvent* e)
+    {
+        EVENT_RECORD eventRecord;
+        while (!mTrace.Next(&eventRecord)) {
+            StartSegment();
+        }
+
+        auto time = (uint64_t) eventRecord.EventHeader.TimeStamp.QuadPart;
+        if (!mSegmentStarted) {
+            mTimeOffset = mLastTime == 0 ? 0 : mLastTime + SEGMENT_SPACING - time;
+            mSegmentStarted = true;
+        }
+
+        e->mHeader = eventRecord.EventHeader;
+        e->mHeader.TimeStamp.QuadPart = (LONGLONG) (time + mTimeOffset);
+        e->mUserData.assign((uint8_t const*) eventRecord.UserData, (uint8_t const*) eventRecord.UserData + eventRecord.UserDataLength);
+        e->mGap = false;
+        mLastTime = std::max(mLastTime, time + mTimeOffset);
+    }
+
+    void Generate(std::deque<StressEvent>* out, uint32_t count)
+    {
+        for (uint32_t emitted = 0; emitted < count; ) {
+            StressEvent e;
+            NextCleanEvent(&e);
+
+            if (mGapEventsRemaining > 0) {
+                mGapEventsRemaining -= 1;
+                mDroppedCount += 1;
+                continue;
+            }
+
+            if (Chance(mOptions.mGapPpm)) {
+                e.mUserData.clear();
+                e.mGap = true;
+                out->emplace_back(std::move(e));
+                emitted += 1;
+                mGapEventsRemaining = Random() % MAX_GAP_EVENTS;
+                mDroppedCount += 1;
+                mGapCount += 1;
+                continue;
+            }
+
+            auto isStop = e.mHeader.EventDescriptor.Opcode == EVENT_TRACE_TYPE_STOP;
+            if (Chance(mOptions.mDropPpm) || (isStop && Chance(mOptions.mDropStopPpm))) {
+                mDroppedCount += 1;
+                continue;
+            }
+
+            if (mHaveHeld) {
+                out->emplace_back(std::move(e));
+                out->emplace_back(std::move(mHeld));
+                emitted += 2;
+                mHaveHeld = false;
+                continue;
+            }
+
+            if (Chance(mOptions.mReorderPpm)) {
+                mHeld = std::move(e);
+                mHaveHeld = true;
+                mReorderedCount += 1;
+                continue;
+            }
+
+            if (Chance(mOptions.mDuplicatePpm)) {
+                out->push_back(e);
+                emitted += 1;
+                mDuplicatedCount += 1;
+            }
+            out->emplace_back(std::move(e));
+            emitted += 1;
+        }
+    }
+};
+
+void Dispatch(TraceSession* session, StressEvent const& e)
+{
+    if (e.mGap) {
+        session->mPMConsumer->ReportEventGap(e.mHeader.TimeStamp.QuadPart);
+        return;
+    }
+
+    EVENT_RECORD eventRecord;
+    memset(&eventRecord, 0, sizeof(eventRecord));
+    eventRecord.EventHeader = e.mHeader;
+    eventRecord.UserDataLength = (USHORT) e.mUserData.size();
+    eventRecord.UserData = (void*) e.mUserData.data();
+    eventRecord.UserContext = session;
+    session->mDispatchEvent(session, &eventRecord);
+}
+
+// Dequeue completed presents as the output thread would, then measure what
+// is still being tracked.
+void Measure(PMTraceConsumer* consumer, OccupancyGauges* gauges, uint64_t qpc, uint64_t liveBase, StressMeasurement* m)
+{
+    std::vector<std::shared_ptr<PresentEvent>> presents;
+    std::vector<Frame> frames;
+    consumer->DequeueFramesAndPresents(frames, presents);
+    presents.clear();
+    frames.clear();
+
+    gauges->Sample(consumer, nullptr, qpc, &m->mSnapshot);
+
+    auto live = gLivePresentEventCount.load(std::memory_order_relaxed);
+    m->mLivePresents = live > liveBase ? live - liveBase : 0;
+}
+
+bool Exceeds(StressTestOptions const& options, StressMeasurement const& m, StressBound bound, OccupancyGauge gauge, double* value)
+{
+    auto const& g = m.mSnapshot.mGauges[(size_t) gauge];
+    switch (bound) {
+    case StressBound::MapEntries:
+        *value = (double) g.mCount;
+        return g.mCount > options.mMaxMapEntries;
+    case StressBound::MapAge:
+        *value = g.mOldestQpc == 0 || g.mOldestQpc >= m.mSnapshot.mQpc ? 0.
+            : (double) (m.mSnapshot.mQpc - g.mOldestQpc) * 1000. / SyntheticTrace::QPC_FREQUENCY;
+        return *value > options.mMaxAgeMs;
+    case StressBound::LivePresents:
+        *value = (double) m.mLivePresents;
+        return m.mLivePresents > options.mMaxLivePresents;
+    case StressBound::EventTime:
+        break;
+    }
+    *value = 0.;
+    return false;
+}
+
+bool FindFailure(StressTestOptions const& options, StressMeasurement const& m, StressFailure* failure)
+{
+    for (auto bound : { StressBound::MapEntries, StressBound::MapAge }) {
+        for (uint32_t i = 0; i < (uint32_t) OccupancyGauge::Count; ++i) {
+            if (Exceeds(options, m, bound, (OccupancyGauge) i, &failure->mValue)) {
+                failure->mBound = bound;
+                failure->mGauge = (OccupancyGauge) i;
+                failure->mQpc = m.mSnapshot.mQpc;
+                return true;
+            }
+        }
+    }
+    if (Exceeds(options, m, StressBound::LivePresents, OccupancyGauge::Count, &failure->mValue)) {
+        failure->mBound = StressBound::LivePresents;
+        failure->mGauge = OccupancyGauge::Count;
+        failure->mQpc = m.mSnapshot.mQpc;
+        return true;
+    }
+    return false;
+}
+
+// Handle events with a fresh consumer and check whether the failure's bound
+// is exceeded at the failure's time.
+bool Reproduces(StressTestOptions const& options, std::vector<StressEvent const*> const& events, StressFailure const& failure)
+{
+    auto liveBase = gLivePresentEventCount.load(std::memory_order_relaxed);
+
+    PMTraceConsumer consumer(false, false);
+    TraceSession session;
+    session.InitializeDispatch(&consumer, nullptr);
+    SyntheticTrace::AddMetadata(&consumer.mMetadata);
+
+    for (auto e : events) {
+        Dispatch(&session, *e);
+    }
+
+    OccupancyGauges gauges;
+    StressMeasurement m;
+    Measure(&consumer, &gauges, failure.mQpc, liveBase, &m);
+
+    double value = 0.;
+    return Exceeds(options, m, failure.mBound, failure.mGauge, &value);
+}
+
+// Reduce the recent events to a small sequence that still reproduces the
+// failure: first drop the longest unneeded prefix (by bisection), then
+// remove ever smaller runs of events (delta debugging) until no single
+// event can be removed or the replay budget runs out.  Returns an empty
+// sequence if the recent events don't reproduce the failure on their own.
+std::vector<StressEvent const*> Minimize(StressTestOptions const& options, std::deque<StressEvent> const& history,
+                                          StressFailure const& failure, uint32_t* replayCount)
+{
+    std::vector<StressEvent const*> events;
+    for (auto const& e : history) {
+        events.push_back(&e);
+    }
+
+    *replayCount = 1;
+    if (!Reproduces(options, events, failure)) {
+        events.clear();
+        return events;
+    }
+
+    size_t lo = 0;
+    size_t hi = events.size();
+    while (hi - lo > 1) {
+        auto mid = lo + (hi - lo) / 2;
+        std::vector<StressEvent const*> suffix(events.begin() + mid, events.end());
+        *replayCount += 1;
+        if (Reproduces(options, suffix, failure)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    events.erase(events.begin(), events.begin() + lo);
+
+    size_t granularity = 2;
+    while (events.size() > 1 && *replayCount < MINIMIZE_REPLAY_BUDGET) {
+        auto chunk = (events.size() + granularity - 1) / granularity;
+        auto reduced = false;
+        for (size_t start = 0; start < events.size() && *replayCount < MINIMIZE_REPLAY_BUDGET; start += chunk) {
+            std::vector<StressEvent const*> candidate(events.begin(), events.begin() + start);
+            candidate.insert(candidate.end(), events.begin() + std::min(start + chunk, events.size()), events.end());
+            *replayCount += 1;
+            if (Reproduces(options, candidate, failure)) {
+                events.swap(candidate);
+                granularity = std::max<size_t>(granularity - 1, 2);
+                reduced = true;
+                break;
+            }
+        }
+        if (!reduced) {
+            if (chunk == 1) {
+                break;
+            }
+            granularity = std::min(granularity * 2, events.size());
+        }
+    }
+
+    return events;
+}
+
+char const* ProviderName(GUID const& providerId)
+{
+    if (providerId == Microsoft_Windows_DXGI::GUID)     return "DXGI";
+    if (providerId == Microsoft_Windows_DxgKrnl::GUID)  return "DxgKrnl";
+    if (providerId == Microsoft_Windows_Win32k::GUID)   return "Win32k";
+    if (providerId == Microsoft_Windows_Dwm_Core::GUID) return "Dwm";
+    return "?";
+}
+
+void PrintEvent(StressEvent const& e)
+{
+    auto const& hdr = e.mHeader;
+    if (e.mGap) {
+        printf("    %llu event gap\n", hdr.TimeStamp.QuadPart);
+        return;
+    }
+
+    printf("    %llu %s id=%u opcode=%u version=%u pid=%u tid=%u data=",
+        hdr.TimeStamp.QuadPart,
+        ProviderName(hdr.ProviderId),
+        hdr.EventDescriptor.Id,
+        hdr.EventDescriptor.Opcode,
+        hdr.EventDescriptor.Version,
+        hdr.ProcessId,
+        hdr.ThreadId);
+    for (auto b : e.mUserData) {
+        printf("%02x", b);
+    }
+    printf("\n");
+}
+
+void PrintFailure(StressTestOptions const& options, StressFailure const& failure)
+{
+    switch (failure.mBound) {
+    case StressBound::MapEntries:
+        fprintf(stderr, "error: %s has %.0f entries (bound %llu) at qpc %llu.\n",
+            OccupancyGaugeName(failure.mGauge), failure.mValue, options.mMaxMapEntries, failure.mQpc);
+        break;
+    case StressBound::MapAge:
+        fprintf(stderr, "error: %s has an entry %.1f ms old (bound %.1f ms) at qpc %llu.\n",
+            OccupancyGaugeName(failure.mGauge), failure.mValue, options.mMaxAgeMs, failure.mQpc);
+        break;
+    case StressBound::LivePresents:
+        fprintf(stderr, "error: %.0f PresentEvents are live (bound %llu) at qpc %llu.\n",
+            failure.mValue, options.mMaxLivePresents, failure.mQpc);
+        break;
+    case StressBound::EventTime:
+        fprintf(stderr, "error: events took %.0f ns each (bound %.0f ns) in the chunk ending at qpc %llu.\n",
+            failure.mValue, options.mMaxNsPerEvent, failure.mQpc);
+        break;
+    }
+}
+
+bool RunStressPass(StressTestOptions const& options)
+{
+    auto liveBase = gLivePresentEventCount.load(std::memory_order_relaxed);
+
+    PMTraceConsumer consumer(false, false);
+    TraceSession session;
+    session.InitializeDispatch(&consumer, nullptr);
+    SyntheticTrace::AddMetadata(&consumer.mMetadata);
+
+    StressStream stream;
+    stream.Initialize(options);
+
+    OccupancyGauges gauges;
+    std::deque<StressEvent> history;
+
+    LARGE_INTEGER freq = {};
+    QueryPerformanceFrequency(&freq);
+
+    uint64_t eventCount = 0;
+    uint64_t maxMapEntries = 0;
+    uint64_t maxLivePresents = 0;
+    double maxAgeMs = 0.;
+    double maxNsPerEvent = 0.;
+    auto failed = false;
+    StressFailure failure = {};
+    while (eventCount < options.mEventCount && !failed) {
+        auto first = history.size();
+        stream.Generate(&history, CHECK_INTERVAL);
+
+        LARGE_INTEGER start = {};
+        LARGE_INTEGER end = {};
+        QueryPerformanceCounter(&start);
+        for (auto i = first, n = history.size(); i < n; ++i) {
+            Dispatch(&session, history[i]);
+        }
+        QueryPerformanceCounter(&end);
+
+        auto count = history.size() - first;
+        auto nsPerEvent = (double) (end.QuadPart - start.QuadPart) * 1e9 / freq.QuadPart / count;
+        eventCount += count;
+
+        StressMeasurement m;
+        Measure(&consumer, &gauges, stream.mLastTime, liveBase, &m);
+        for (uint32_t i = 0; i < (uint32_t) OccupancyGauge::Count; ++i) {
+            double ageMs = 0.;
+            Exceeds(options, m, StressBound::MapAge, (OccupancyGauge) i, &ageMs);
+            maxMapEntries = std::max(maxMapEntries, m.mSnapshot.mGauges[i].mCount);
+            maxAgeMs = std::max(maxAgeMs, ageMs);
+        }
+        maxLivePresents = std::max(maxLivePresents, m.mLivePresents);
+        maxNsPerEvent = std::max(maxNsPerEvent, nsPerEvent);
+
+        if (FindFailure(options, m, &failure)) {
+            failed = true;
+        } else if (nsPerEvent > options.mMaxNsPerEvent) {
+            failure.mBound = StressBound::EventTime;
+            failure.mGauge = OccupancyGauge::Count;
+            failure.mQpc = stream.mLastTime;
+            failure.mValue = nsPerEvent;
+            failed = true;
+        }
+
+        // Keep the events from twice the age bound, so that the start of any
+        // present that exceeds it is still available for minimization.
+        auto historyQpc = (uint64_t) (2. * options.mMaxAgeMs * SyntheticTrace::QPC_FREQUENCY / 1000.);
+        while (!history.empty() && (uint64_t) history.front().mHeader.TimeStamp.QuadPart + historyQpc < stream.mLastTime) {
+            history.pop_front();
+        }
+    }
+
+    printf("%u, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %.1f, %.1f, %s\n",
+        options.mSeed,
+        eventCount,
+        stream.mPresentCount + stream.mTrace.mPresentCount,
+        stream.mDroppedCount,
+        stream.mDuplicatedCount,
+        stream.mReorderedCount,
+        stream.mGapCount,
+        maxMapEntries,
+        maxLivePresents,
+        maxAgeMs,
+        maxNsPerEvent,
+        failed ? "FAILED" : "passed");
+
+    if (!failed) {
+        return true;
+    }
+
+    PrintFailure(options, failure);
+    if (failure.mBound == StressBound::EventTime) {
+        return false;
+    }
+
+    uint32_t replayCount = 0;
+    auto repro = Minimize(options, history, failure, &replayCount);
+    if (repro.empty()) {
+        fprintf(stderr, "error: the last %zu events do not reproduce the failure on their own.\n", history.size());
+        return false;
+    }
+
+    printf("Repro (%zu events, minimized from %zu with %u replays):\n", repro.size(), history.size(), replayCount);
+    for (auto e : repro) {
+        PrintEvent(*e);
+    }
+    return false;
+}
+
+}
+
+bool RunStressTest(StressTestOptions const& options)
+{
+    printf("Seed, Events, Presents, Dropped, Duplicated, Reordered, Gaps, MaxMapEntries, MaxLivePresents, MaxAgeMs, MaxNsPerEvent, Result\n");
+
+    // Event gaps flush everything that started before them, which would also
+    // clean up presents leaked by other mutations, so run the seed without
+    // gaps first.
+    if (options.mGapPpm != 0) {
+        auto gapFreeOptions = options;
+        gapFreeOptions.mGapPpm = 0;
+        if (!RunStressPass(gapFreeOptions)) {
+            return false;
+        }
+    }
+
+    return RunStressPass(options);
+}
@@ -0,0 +1,68 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+struct StressTestOptions {
+    uint32_t mSeed = 1;
+    uint64_t mEventCount = 4000000;     // Events to handle (approximately; checks are per chunk)
+
+    // Mutation rates, in events per million.
+    uint32_t mDropPpm = 500;            // Drop any event
+    uint32_t mDropStopPpm = 2000;       // Drop a Stop event (DXGI Present_Stop, QueuePacket_Stop, ...)
+    uint32_t mDuplicatePpm = 500;       // Handle an event twice
+    uint32_t mReorderPpm = 1000;        // Swap an event with the next one
+    uint32_t mGapPpm = 100;             // Drop a run of events and report an event gap, as ETW does for lost events
+
+    // Bounds asserted after every chunk of events.
+    uint64_t mMaxMapEntries = 1024;     // Entries in any one tracking map
+    uint64_t mMaxLivePresents = 4096;   // PresentEvents still allocated once completed presents are dequeued
+    double mMaxAgeMs = 20000.;          // Trace time since the oldest tracked present started
+    double mMaxNsPerEvent = 20000.;     // Mean handling time over a chunk
+};
+
+// Stress PMTraceConsumer with adversarial event streams, to catch the
+// tracking state leaks and slowdowns that damaged real traces can cause.
+//
+// The stream is a sequence of SyntheticTrace segments that cycle through the
+// present modes and queue depths.  Every segment reuses the same process,
+// thread, swap chain and submit sequence values without any process stop
+// events, and events are randomly dropped (Stop events more often),
+// duplicated, swapped out of order, or dropped in runs reported as event
+// gaps.  Everything is derived from mSeed, so a failing seed always fails.
+// Since an event gap flushes everything that started before it, which would
+// hide presents leaked by the other mutations, the seed is also run without
+// gaps first.
+//
+// Completed presents are dequeued as the output thread would before each
+// check.  If a map size, present age, or live present bound is exceeded, the
+// recent stream is replayed into a fresh consumer and reduced to a minimal
+// sequence of events that still exceeds the same bound at the same time,
+// which is printed to stdout along with the failure.  Handling time bounds
+// depend on the machine, so they are reported but not minimized.
+//
+// Dropped, duplicated and reordered events are valid input for the
+// consumer, so this runs on debug builds too.  Returns false if any bound was
+// exceeded.
+bool RunStressTest(StressTestOptions const& options);
@@ -0,0 +1,72 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "SyntheticEventInfo.hpp"
+
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+
+std::vector<uint8_t> BuildTraceEventInfo(GUID const& providerId, EVENT_DESCRIPTOR const& descriptor,
+                                         SyntheticProperty const* properties, uint32_t propertyCount,
+                                         uint32_t topLevelPropertyCount)
+{
+    auto nameOffset = (uint32_t) (offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) + propertyCount * sizeof(EVENT_PROPERTY_INFO));
+
+    auto size = nameOffset;
+    for (uint32_t i = 0; i < propertyCount; ++i) {
+        size += (uint32_t) ((wcslen(properties[i].mName) + 1) * sizeof(wchar_t));
+    }
+
+    std::vector<uint8_t> blob(size, 0);
+    auto tei = (TRACE_EVENT_INFO*) blob.data();
+    tei->ProviderGuid = providerId;
+    tei->EventDescriptor = descriptor;
+    tei->DecodingSource = DecodingSourceXMLFile;
+    tei->PropertyCount = propertyCount;
+    tei->TopLevelPropertyCount = topLevelPropertyCount;
+
+    for (uint32_t i = 0; i < propertyCount; ++i) {
+        auto const& p = properties[i];
+        auto& epi = tei->EventPropertyInfoArray[i];
+        epi.Flags = (PROPERTY_FLAGS) p.mFlags;
+        epi.NameOffset = nameOffset;
+        if (p.mFlags & PropertyStruct) {
+            epi.structType.StructStartIndex = p.mStructStartIndex;
+            epi.structType.NumOfStructMembers = p.mStructMemberCount;
+        } else {
+            epi.nonStructType.InType = p.mInType;
+        }
+        if (p.mFlags & PropertyParamCount) {
+            epi.countPropertyIndex = p.mCount;
+        } else {
+            epi.count = p.mCount;
+        }
+        epi.length = p.mLength;
+
+        auto nameSize = (uint32_t) ((wcslen(p.mName) + 1) * sizeof(wchar_t));
+        memcpy(blob.data() + nameOffset, p.mName, nameSize);
+        nameOffset += nameSize;
+    }
+
+    return blob;
+}
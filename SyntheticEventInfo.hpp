@@ -0,0 +1,46 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <windows.h>
+#include <tdh.h> // Must include after windows.h
+
+// A property in a synthetic event's metadata.  Struct members are listed
+// after the top-level properties, as TDH does.
+struct SyntheticProperty {
+    wchar_t const* mName;
+    USHORT mInType;             // TDH_INTYPE_*, unused for structs
+    USHORT mFlags;              // PROPERTY_FLAGS
+    USHORT mLength;             // Element size in bytes, 0 for strings and structs
+    USHORT mCount;              // Element count, or the count property's index if PropertyParamCount
+    USHORT mStructStartIndex;   // First member if PropertyStruct
+    USHORT mStructMemberCount;
+};
+
+// Lay out a TRACE_EVENT_INFO the way TDH does: the fixed header, the
+// EVENT_PROPERTY_INFO array, then the property names.
+std::vector<uint8_t> BuildTraceEventInfo(GUID const& providerId, EVENT_DESCRIPTOR const& descriptor,
+                                         SyntheticProperty const* properties, uint32_t propertyCount,
+                                         uint32_t topLevelPropertyCount);
@@ -0,0 +1,640 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "SyntheticTrace.hpp"
+
+#include "DwmEventStructs.hpp"
+#include "DxgiEventStructs.hpp"
+#include "DxgkrnlEventStructs.hpp"
+#include "Win32kEventStructs.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+enum class SyntheticEventType : uint32_t {
+    DxgiPresentStart,
+    DxgiPresentStop,
+    DxgkBlit,
+    DxgkFlip,
+    DxgkMMIOFlip,
+    DxgkMMIOFlipMPO,
+    DxgkPresent,
+    DxgkPresentHistoryDetailedStart,
+    DxgkPresentHistory,
+    DxgkQueuePacketStart,
+    DxgkQueuePacketStop,
+    DxgkVSyncDPC,
+    Win32kTokenCompositionSurfaceObject,
+    Win32kTokenStateChanged,
+    DwmGetPresentHistory,
+    DwmSchedulePresentStart,
+    DwmScheduleSurfaceUpdate,
+    DwmFlipChainPending,
+    Count
+};
+
+namespace {
+
+uint64_t const START_QPC = 0x100000000ull;
+uint64_t const VSYNC_PERIOD = SyntheticTrace::QPC_FREQUENCY / 60;
+uint64_t const COMPOSE_LEAD = SyntheticTrace::QPC_FREQUENCY * 15 / 10000;   // DWM composes 1.5ms before vsync
+
+uint64_t const DXG_ADAPTER = 0xffffc00100a00000ull;
+uint64_t const DWM_CONTEXT = 0xffffc00100b00000ull;
+int32_t const WIDTH = 1920;
+int32_t const HEIGHT = 1080;
+
+struct EventSchema {
+    GUID mProviderId;
+    EVENT_DESCRIPTOR mDescriptor;
+    std::vector<SyntheticProperty> mProperties;     // Top-level properties followed by struct members
+    uint32_t mTopLevelPropertyCount;
+};
+
+template<typename T>
+EVENT_DESCRIPTOR Descriptor()
+{
+    EVENT_DESCRIPTOR desc = {};
+    desc.Id      = T::Id;
+    desc.Version = T::Version;
+    desc.Channel = T::Channel;
+    desc.Level   = T::Level;
+    desc.Opcode  = T::Opcode;
+    desc.Task    = T::Task;
+    desc.Keyword = (ULONGLONG) T::Keyword;
+    return desc;
+}
+
+SyntheticProperty Pointer(wchar_t const* name) { return SyntheticProperty{ name, TDH_INTYPE_POINTER, 0, 8, 1, 0, 0 }; }
+SyntheticProperty UInt32 (wchar_t const* name) { return SyntheticProperty{ name, TDH_INTYPE_UINT32,  0, 4, 1, 0, 0 }; }
+SyntheticProperty Int32  (wchar_t const* name) { return SyntheticProperty{ name, TDH_INTYPE_INT32,   0, 4, 1, 0, 0 }; }
+SyntheticProperty UInt64 (wchar_t const* name) { return SyntheticProperty{ name, TDH_INTYPE_UINT64,  0, 8, 1, 0, 0 }; }
+SyntheticProperty Int64  (wchar_t const* name) { return SyntheticProperty{ name, TDH_INTYPE_INT64,   0, 8, 1, 0, 0 }; }
+
+SyntheticProperty Int32Array(wchar_t const* name, USHORT countPropertyIndex)
+{
+    return SyntheticProperty{ name, TDH_INTYPE_INT32, PropertyParamCount, 4, countPropertyIndex, 0, 0 };
+}
+
+SyntheticProperty Struct(wchar_t const* name, USHORT count, USHORT structStartIndex, USHORT structMemberCount)
+{
+    return SyntheticProperty{ name, 0, PropertyStruct, 0, count, structStartIndex, structMemberCount };
+}
+
+EventSchema Schema(GUID const& providerId, EVENT_DESCRIPTOR const& descriptor, std::vector<SyntheticProperty> const& properties, uint32_t topLevelPropertyCount = 0)
+{
+    return EventSchema{ providerId, descriptor, properties, topLevelPropertyCount == 0 ? (uint32_t) properties.size() : topLevelPropertyCount };
+}
+
+// The layouts follow the *_Struct definitions in *EventStructs.hpp, plus the
+// Win32k properties the consumer reads that those predate.  Listed in
+// SyntheticEventType order.
+std::vector<EventSchema> CreateEventSchemas()
+{
+    namespace Dxgi = Microsoft_Windows_DXGI;
+    namespace Dxgk = Microsoft_Windows_DxgKrnl;
+    namespace Win32k = Microsoft_Windows_Win32k;
+    namespace Dwm = Microsoft_Windows_Dwm_Core;
+
+    EVENT_DESCRIPTOR flipChainPending = {};
+    flipChainPending.Id = Dwm::FlipChain_Pending::Id;
+
+    std::vector<EventSchema> schemas = {
+        Schema(Dxgi::GUID, Descriptor<Dxgi::Present_Start>(), {
+            Pointer(L"pIDXGISwapChain"), UInt32(L"Flags"), Int32(L"SyncInterval"), UInt32(L"DirtyRects"), UInt32(L"ScrollRects"),
+        }),
+        Schema(Dxgi::GUID, Descriptor<Dxgi::Present_Stop>(), {
+            UInt32(L"Result"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::Blit_Info>(), {
+            Pointer(L"hwnd"), Pointer(L"pDmaBuffer"), UInt64(L"PresentHistoryToken"), Pointer(L"hSourceAllocation"),
+            Pointer(L"hDestAllocation"), UInt32(L"bSubmit"), UInt32(L"bRedirectedPresent"), UInt32(L"Flags"),
+            Int32(L"Source_Left"), Int32(L"Source_Right"), Int32(L"Source_Top"), Int32(L"Source_Bottom"),
+            Int32(L"Dest_Left"), Int32(L"Dest_Right"), Int32(L"Dest_Top"), Int32(L"Dest_Bottom"),
+            UInt32(L"SubRectCount"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::Flip_Info>(), {
+            Pointer(L"pDmaBuffer"), UInt32(L"VidPnSourceId"), Pointer(L"FlipToAllocation"), UInt32(L"FlipInterval"),
+            UInt32(L"FlipWithNoWait"), UInt32(L"MMIOFlip"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::MMIOFlip_Info>(), {
+            Pointer(L"pDxgAdapter"), UInt32(L"VidPnSourceId"), UInt32(L"FlipSubmitSequence"), Pointer(L"FlipToDriverAllocation"),
+            UInt64(L"FlipToPhysicalAddress"), UInt32(L"FlipToSegmentId"), UInt32(L"FlipPresentId"), UInt32(L"FlipPhysicalAdapterMask"),
+            UInt32(L"Flags"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::MMIOFlipMultiPlaneOverlay_Info>(), {
+            Pointer(L"pDxgAdapter"), UInt32(L"VidPnSourceId"), UInt32(L"LayerIndex"), UInt64(L"FlipSubmitSequence"),
+            Pointer(L"FlipToDriverAllocation"), UInt64(L"FlipToPhysicalAddress"), UInt32(L"FlipToSegmentId"), UInt32(L"FlipPresentId"),
+            UInt32(L"FlipPhysicalAdapterMask"),
+            Int32(L"SrcRect_left"), Int32(L"SrcRect_right"), Int32(L"SrcRect_top"), Int32(L"SrcRect_bottom"),
+            Int32(L"DstRect_left"), Int32(L"DstRect_right"), Int32(L"DstRect_top"), Int32(L"DstRect_bottom"),
+            Int32(L"ClipRect_left"), Int32(L"ClipRect_right"), Int32(L"ClipRect_top"), Int32(L"ClipRect_bottom"),
+            UInt32(L"ColorSpace"), UInt32(L"FlipEntryStatusAfterFlip"), UInt32(L"Enabled"), UInt32(L"SDRWhiteLevel"),
+            UInt32(L"DirtyRectCount"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::Present_Info>(), {
+            UInt32(L"hContext"), Pointer(L"hWindow"), UInt32(L"VidPnSourceId"), UInt32(L"Flags"), UInt32(L"ReturnStatus"),
+            Pointer(L"hSrcAllocHandle"), Pointer(L"hDstAllocHandle"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::PresentHistoryDetailed_Start>(), {
+            Pointer(L"hAdapter"), Pointer(L"Token"), UInt32(L"Model"), UInt32(L"TokenSize"), UInt64(L"TokenData"),
+            UInt32(L"ScrollRect_left"), UInt32(L"ScrollRect_right"), UInt32(L"ScrollRect_top"), UInt32(L"ScrollRect_bottom"),
+            UInt32(L"ScrollOffset_X"), UInt32(L"ScrollOffset_Y"), UInt32(L"DirtyRectCount"),
+            Int32Array(L"Left", 11), Int32Array(L"Right", 11), Int32Array(L"Top", 11), Int32Array(L"Bottom", 11),
+            UInt32(L"SourceRect_left"), UInt32(L"SourceRect_right"), UInt32(L"SourceRect_top"), UInt32(L"SourceRect_bottom"),
+            UInt32(L"DestWidth"), UInt32(L"DestHeight"),
+            UInt32(L"TargetRect_left"), UInt32(L"TargetRect_right"), UInt32(L"TargetRect_top"), UInt32(L"TargetRect_bottom"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::PresentHistory_Info>(), {
+            Pointer(L"hAdapter"), Pointer(L"Token"), UInt32(L"Model"), UInt32(L"TokenSize"), UInt64(L"TokenData"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::QueuePacket_Start>(), {
+            Pointer(L"hContext"), UInt32(L"PacketType"), UInt32(L"SubmitSequence"), UInt64(L"DmaBufferSize"),
+            UInt32(L"AllocationListSize"), UInt32(L"PatchLocationListSize"), UInt32(L"bPresent"), Pointer(L"hDmaBuffer"),
+            Pointer(L"pQueuePacket"), UInt64(L"ProgressFenceValue"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::QueuePacket_Stop>(), {
+            Pointer(L"hContext"), UInt32(L"PacketType"), UInt32(L"SubmitSequence"), UInt32(L"bPreempted"),
+            UInt32(L"bTimeouted"), Pointer(L"pQueuePacket"),
+        }),
+        Schema(Dxgk::GUID, Descriptor<Dxgk::VSyncDPC_Info>(), {
+            Pointer(L"pDxgAdapter"), UInt32(L"VidPnTargetId"), UInt64(L"ScannedPhysicalAddress"), UInt32(L"VidPnSourceId"),
+            UInt32(L"FrameNumber"), Int64(L"FrameQPCTime"), Pointer(L"hFlipDevice"), UInt32(L"FlipType"), UInt64(L"FlipFenceId"),
+        }),
+        Schema(Win32k::GUID, Descriptor<Win32k::TokenCompositionSurfaceObject_Info>(), {
+            Pointer(L"pToken"), Pointer(L"pCompositionSurfaceObject"), UInt32(L"SwapChainIndex"), UInt64(L"PresentCount"),
+            UInt64(L"CompositionSurfaceLuid"), UInt64(L"BindId"), UInt32(L"DestWidth"), UInt32(L"DestHeight"),
+        }),
+        Schema(Win32k::GUID, Descriptor<Win32k::TokenStateChanged_Info>(), {
+            Pointer(L"pCompositionSurfaceObject"), UInt32(L"SwapChainIndex"), UInt32(L"PresentCount"), UInt64(L"FenceValue"),
+            UInt32(L"NewState"), UInt32(L"IndependentFlip"), UInt32(L"SkipIndependentFlip"), UInt64(L"CompositionSurfaceLuid"),
+            UInt64(L"BindId"),
+        }),
+        Schema(Dwm::GUID, Descriptor<Dwm::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info>(), {
+            UInt32(L"hr"), UInt32(L"cTokenCount"),
+        }),
+        Schema(Dwm::GUID, Descriptor<Dwm::SCHEDULE_PRESENT_Start>(), {
+            UInt64(L"tCurrent"), UInt64(L"tPresent"), UInt64(L"cRefreshCurrent"), UInt64(L"cRefreshPresent"), UInt32(L"fForce"),
+        }),
+        Schema(Dwm::GUID, Descriptor<Dwm::SCHEDULE_SURFACEUPDATE_Info>(), {
+            Struct(L"luidSurface", 1, 16, 2), UInt64(L"bindId"), UInt64(L"PresentCount"), UInt64(L"fenceValue"),
+            UInt32(L"bDirectFlip"), UInt32(L"DXGI_ALPHA_MODE"), UInt64(L"hmonAssociation"), UInt32(L"bStereoPreferRight"),
+            UInt32(L"bTemporaryMono"), UInt32(L"bSwapPool"), UInt32(L"BufferContentType"), UInt32(L"bIndependentFlip"),
+            UInt32(L"uPesentDuration"), UInt32(L"BufferRealizationType"), UInt32(L"uRealizationIndex"), UInt64(L"hDxSurface"),
+            UInt32(L"lowpart"), UInt32(L"highpart"),
+        }, 16),
+        Schema(Dwm::GUID, flipChainPending, {
+            UInt32(L"ulFlipChain"), UInt32(L"ulSerialNumber"), Pointer(L"hwnd"),
+        }),
+    };
+
+    assert(schemas.size() == (size_t) SyntheticEventType::Count);
+    return schemas;
+}
+
+std::vector<EventSchema> const& GetEventSchemas()
+{
+    static std::vector<EventSchema> const schemas = CreateEventSchemas();
+    return schemas;
+}
+
+void AppendValue(std::vector<uint8_t>* data, USHORT size, uint64_t value)
+{
+    assert(size <= sizeof(value));
+    auto p = (uint8_t const*) &value;
+    data->insert(data->end(), p, p + size);
+}
+
+}
+
+bool SyntheticTrace::PendingEvent::operator<(PendingEvent const& rhs) const
+{
+    return mTime != rhs.mTime ? mTime > rhs.mTime : mOrder > rhs.mOrder;
+}
+
+void SyntheticTrace::Initialize(SyntheticTraceOptions const& options)
+{
+    mOptions = options;
+    mSwapChains.clear();
+    mSwapChainStarts = decltype(mSwapChainStarts)();
+    mPending = decltype(mPending)();
+    mNextDwmVSync = START_QPC + VSYNC_PERIOD;
+    mLastAppEventTime = 0;
+    mNextOrder = 0;
+    mNextSubmitSequence = 1;
+    mNextToken = 0xffffc00200000000ull;
+    mRandom = options.mSeed == 0 ? 1 : options.mSeed;
+    assert(options.mQueueDepth > 0);
+    mEventCount = 0;
+    mPresentCount = 0;
+
+    switch (options.mPresentMode) {
+    case PresentMode::Hardware_Legacy_Flip:
+    case PresentMode::Hardware_Legacy_Copy_To_Front_Buffer:
+        mDwmComposes = false;
+        break;
+    default:
+        mDwmComposes = true;
+        break;
+    }
+
+    // Threads start at random points within the first refresh so that their
+    // presents interleave.
+    for (uint32_t process = 0; process < options.mProcessCount; ++process) {
+        for (uint32_t thread = 0; thread < options.mThreadsPerProcess; ++thread) {
+            auto index = (uint32_t) mSwapChains.size();
+
+            SwapChain swapChain = {};
+            swapChain.mProcessId = 1000 + process * 4;
+            swapChain.mThreadId = 10000 + index * 4;
+            swapChain.mAddress = 0x000001d200000000ull + index * 0x10000ull;
+            swapChain.mHwnd = 0x10000ull + index * 0x10ull;
+            swapChain.mContext = 0xffffc00300000000ull + index * 0x1000ull;
+            swapChain.mCompositionSurfaceLuid = 0x100000000ull + index;
+            swapChain.mBindId = index + 1;
+            swapChain.mPresentCount = 0;
+            swapChain.mPresentsRemaining = options.mPresentsPerThread;
+            mSwapChains.push_back(swapChain);
+
+            if (swapChain.mPresentsRemaining > 0) {
+                mSwapChainStarts.emplace(START_QPC + Random((uint32_t) VSYNC_PERIOD), index);
+            }
+        }
+    }
+}
+
+void SyntheticTrace::AddMetadata(EventMetadata* metadata)
+{
+    for (auto const& schema : GetEventSchemas()) {
+        EventMetadataKey key;
+        memset(&key, 0, sizeof(key));
+        key.guid_ = schema.mProviderId;
+        key.desc_ = schema.mDescriptor;
+        metadata->metadata_[key] = BuildTraceEventInfo(schema.mProviderId, schema.mDescriptor, schema.mProperties.data(),
+                                                        (uint32_t) schema.mProperties.size(), schema.mTopLevelPropertyCount);
+    }
+}
+
+bool SyntheticTrace::Next(EVENT_RECORD* eventRecord)
+{
+    // Start sources until the earliest pending event can't be preceded by
+    // anything a later source would schedule.
+    for (;;) {
+        auto sourceTime = NextSourceTime();
+        if (!mPending.empty() && mPending.top().mTime <= sourceTime) {
+            break;
+        }
+        if (sourceTime == UINT64_MAX) {
+            return false;
+        }
+        StartNextSource();
+    }
+
+    auto const& e = mPending.top();
+    auto const& schema = GetEventSchemas()[(size_t) e.mType];
+
+    // Values are consumed in layout order: struct properties take one value
+    // per member per element, and PropertyParamCount arrays use the value of
+    // their count property.
+    uint64_t topLevelValues[PendingEvent::MAX_VALUE_COUNT] = {};
+    uint32_t valueIndex = 0;
+    mUserData.clear();
+    for (uint32_t i = 0; i < schema.mTopLevelPropertyCount; ++i) {
+        auto const& p = schema.mProperties[i];
+        auto count = (p.mFlags & PropertyParamCount) ? (uint32_t) topLevelValues[p.mCount] : p.mCount;
+        for (uint32_t j = 0; j < count; ++j) {
+            if (p.mFlags & PropertyStruct) {
+                for (USHORT k = 0; k < p.mStructMemberCount; ++k) {
+                    assert(valueIndex < e.mValueCount);
+                    AppendValue(&mUserData, schema.mProperties[p.mStructStartIndex + k].mLength, e.mValues[valueIndex++]);
+                }
+            } else {
+                assert(valueIndex < e.mValueCount);
+                topLevelValues[i] = e.mValues[valueIndex];
+                AppendValue(&mUserData, p.mLength, e.mValues[valueIndex++]);
+            }
+        }
+    }
+    assert(valueIndex == e.mValueCount);
+
+    memset(eventRecord, 0, sizeof(*eventRecord));
+    auto& hdr = eventRecord->EventHeader;
+    hdr.Size = sizeof(EVENT_HEADER);
+    hdr.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    hdr.ThreadId = e.mThreadId;
+    hdr.ProcessId = e.mProcessId;
+    hdr.TimeStamp.QuadPart = (LONGLONG) e.mTime;
+    hdr.ProviderId = schema.mProviderId;
+    hdr.EventDescriptor = schema.mDescriptor;
+    eventRecord->UserDataLength = (USHORT) mUserData.size();
+    eventRecord->UserData = mUserData.data();
+
+    mPending.pop();
+    mEventCount += 1;
+    return true;
+}
+
+// xorshift32
+uint32_t SyntheticTrace::Random(uint32_t range)
+{
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 17;
+    mRandom ^= mRandom << 5;
+    return mRandom % range;
+}
+
+// The first vsync at or after time.
+uint64_t SyntheticTrace::NextVSync(uint64_t time) const
+{
+    return START_QPC + (time - START_QPC + VSYNC_PERIOD - 1) / VSYNC_PERIOD * VSYNC_PERIOD;
+}
+
+uint64_t SyntheticTrace::NextSourceTime() const
+{
+    auto time = mSwapChainStarts.empty() ? UINT64_MAX : mSwapChainStarts.top().first;
+
+    // DWM keeps composing until everything the applications handed off to it
+    // has been flipped.
+    if (mDwmComposes && (!mSwapChainStarts.empty() || mNextDwmVSync <= mLastAppEventTime)) {
+        time = std::min(time, mNextDwmVSync - COMPOSE_LEAD);
+    }
+
+    return time;
+}
+
+void SyntheticTrace::StartNextSource()
+{
+    if (mSwapChainStarts.empty() || mSwapChainStarts.top().first > NextSourceTime()) {
+        ScheduleDwmComposition(mNextDwmVSync);
+        mNextDwmVSync += VSYNC_PERIOD;
+        return;
+    }
+
+    auto start = mSwapChainStarts.top();
+    mSwapChainStarts.pop();
+
+    auto swapChain = &mSwapChains[start.second];
+    SchedulePresent(swapChain, start.first);
+
+    // Present again roughly once per refresh.
+    swapChain->mPresentsRemaining -= 1;
+    if (swapChain->mPresentsRemaining > 0) {
+        auto period = (uint32_t) VSYNC_PERIOD;
+        mSwapChainStarts.emplace(start.first + period - period / 20 + Random(period / 10), start.second);
+    }
+}
+
+// Schedule every event for one present, following the sequences described in
+// PresentMonTraceConsumer.hpp for mOptions.mPresentMode.
+void SyntheticTrace::SchedulePresent(SwapChain* swapChain, uint64_t time)
+{
+    auto const& sc = *swapChain;
+    auto pid = sc.mProcessId;
+    auto tid = sc.mThreadId;
+
+    swapChain->mPresentCount += 1;
+    mPresentCount += 1;
+
+    // Runtime present call, then the GPU work that it submitted.
+    auto runtimeTime = 1000 + Random(2000);
+    auto tKernel1 = time + runtimeTime / 4;
+    auto tKernel2 = time + runtimeTime / 2;
+    auto tKernel3 = time + runtimeTime * 3 / 4;
+    auto tStop    = time + runtimeTime;
+    auto tReady   = tStop + (mOptions.mQueueDepth - 1) * VSYNC_PERIOD + 10000 + Random(40000);
+
+    // The refresh DWM composes this present for (composed modes) or that it
+    // flips at (fullscreen).
+    auto vsync = NextVSync(tReady + COMPOSE_LEAD + 1);
+    auto tCompose = vsync - COMPOSE_LEAD;
+
+    auto submitSequence = mNextSubmitSequence++;
+    auto token = mNextToken;
+    mNextToken += 0x100;
+
+    Schedule(time, SyntheticEventType::DxgiPresentStart, pid, tid, {
+        sc.mAddress, 0, 1, 0, 0,    // pIDXGISwapChain, Flags, SyncInterval, DirtyRects, ScrollRects
+    });
+
+    auto stopTime = tStop;
+    auto lastTime = tReady;
+    switch (mOptions.mPresentMode) {
+    case PresentMode::Hardware_Legacy_Flip:
+        Schedule(tKernel1, SyntheticEventType::DxgkFlip, pid, tid, { sc.mContext, 0, sc.mAddress, 1, 0, 1 });
+        ScheduleQueuePacket(tKernel2, tReady, pid, tid, sc.mContext, DXGKETW_MMIOFLIP_COMMAND_BUFFER, submitSequence);
+        Schedule(tReady, SyntheticEventType::DxgkMMIOFlip, 0, 0, {
+            DXG_ADAPTER, 0, submitSequence, sc.mAddress, 0, 0, 0, 1, (uint64_t) Microsoft_Windows_DxgKrnl::MMIOFlip::OnNextVSync,
+        });
+        Schedule(vsync, SyntheticEventType::DxgkVSyncDPC, 0, 0, {
+            DXG_ADAPTER, 0, 0, 0, 0, vsync, 0, 0, (uint64_t) submitSequence << 32,
+        });
+        lastTime = vsync;
+        break;
+
+    case PresentMode::Hardware_Legacy_Copy_To_Front_Buffer:
+        Schedule(tKernel1, SyntheticEventType::DxgkBlit, pid, tid, {
+            sc.mHwnd, 0, 0, sc.mAddress, 0, 1, 0, 0, 0, WIDTH, 0, HEIGHT, 0, WIDTH, 0, HEIGHT, 0,
+        });
+        ScheduleQueuePacket(tKernel2, tReady, pid, tid, sc.mContext, DXGKETW_RENDER_COMMAND_BUFFER, submitSequence);
+        Schedule(tKernel3, SyntheticEventType::DxgkPresent, pid, tid, { (uint32_t) sc.mContext, sc.mHwnd, 0, 0, 0, 0, 0 });
+        break;
+
+    case PresentMode::Hardware_Independent_Flip:
+    case PresentMode::Composed_Flip:
+    case PresentMode::Hardware_Composed_Independent_Flip:
+    {
+        auto independentFlip = mOptions.mPresentMode != PresentMode::Composed_Flip;
+        Schedule(tKernel1, SyntheticEventType::Win32kTokenCompositionSurfaceObject, pid, tid, {
+            token, sc.mAddress, 0, sc.mPresentCount, sc.mCompositionSurfaceLuid, sc.mBindId, WIDTH, HEIGHT,
+        });
+        Schedule(tKernel2, SyntheticEventType::DxgkPresentHistoryDetailedStart, pid, tid, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_FLIP, 0, 0,
+            0, 0, 0, 0, 0, 0,
+            1, 0, WIDTH, 0, HEIGHT,     // DirtyRectCount, Left[], Right[], Top[], Bottom[]
+            0, WIDTH, 0, HEIGHT, WIDTH, HEIGHT, 0, WIDTH, 0, HEIGHT,
+        });
+        ScheduleQueuePacket(tKernel3, tReady, pid, tid, sc.mContext, DXGKETW_RENDER_COMMAND_BUFFER, submitSequence);
+        Schedule(tReady, SyntheticEventType::DxgkPresentHistory, DWM_PROCESS_ID, DWM_THREAD_ID, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_FLIP, 0, 0,
+        });
+
+        // DWM picks the token up at the next composition; independent flips
+        // are then flipped by the system rather than composed.
+        Schedule(tCompose, SyntheticEventType::DwmScheduleSurfaceUpdate, DWM_PROCESS_ID, DWM_THREAD_ID, {
+            sc.mCompositionSurfaceLuid & 0xffffffff, sc.mCompositionSurfaceLuid >> 32, sc.mBindId, sc.mPresentCount, 0,
+            independentFlip ? 1u : 0u, 0, 0, 0, 0, 0, 0, independentFlip ? 1u : 0u, 0, 0, 0, 0,
+        });
+        ScheduleTokenStateChanged(tCompose, sc, sc.mPresentCount, (uint32_t) Microsoft_Windows_Win32k::TokenState::InFrame,
+                                  mOptions.mPresentMode == PresentMode::Hardware_Independent_Flip);
+        ScheduleTokenStateChanged(tCompose, sc, sc.mPresentCount, (uint32_t) Microsoft_Windows_Win32k::TokenState::Confirmed, false);
+        if (mOptions.mPresentMode == PresentMode::Hardware_Independent_Flip) {
+            Schedule(tCompose + 3, SyntheticEventType::DxgkMMIOFlip, 0, 0, {
+                DXG_ADAPTER, 0, submitSequence, sc.mAddress, 0, 0, 0, 1, (uint64_t) Microsoft_Windows_DxgKrnl::MMIOFlip::OnNextVSync,
+            });
+        }
+        if (mOptions.mPresentMode == PresentMode::Hardware_Composed_Independent_Flip) {
+            Schedule(tCompose + 3, SyntheticEventType::DxgkMMIOFlipMPO, 0, 0, {
+                DXG_ADAPTER, 0, 0, (uint64_t) submitSequence << 32, sc.mAddress, 0, 0, 0, 1,
+                0, WIDTH, 0, HEIGHT, 0, WIDTH, 0, HEIGHT, 0, WIDTH, 0, HEIGHT,
+                0, (uint64_t) Microsoft_Windows_DxgKrnl::FlipEntryStatus::FlipWaitVSync, 1, 0, 0,
+            });
+        }
+        if (independentFlip) {
+            Schedule(vsync, SyntheticEventType::DxgkVSyncDPC, 0, 0, {
+                DXG_ADAPTER, 0, 0, 0, 0, vsync, 0, 0, (uint64_t) submitSequence << 32,
+            });
+        }
+        ScheduleTokenStateChanged(vsync + 1, sc, sc.mPresentCount, (uint32_t) Microsoft_Windows_Win32k::TokenState::Retired, false);
+        ScheduleTokenStateChanged(vsync + VSYNC_PERIOD, sc, sc.mPresentCount, (uint32_t) Microsoft_Windows_Win32k::TokenState::Discarded, false);
+        lastTime = vsync + VSYNC_PERIOD;
+        break;
+    }
+
+    case PresentMode::Composed_Copy_GPU_GDI:
+        Schedule(tKernel1, SyntheticEventType::DxgkBlit, pid, tid, {
+            sc.mHwnd, 0, 0, sc.mAddress, 0, 1, 0, 0, 0, WIDTH, 0, HEIGHT, 0, WIDTH, 0, HEIGHT, 0,
+        });
+        Schedule(tKernel2, SyntheticEventType::DxgkPresentHistoryDetailedStart, pid, tid, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_BLT, 0, 0,
+            0, 0, 0, 0, 0, 0,
+            1, 0, WIDTH, 0, HEIGHT,
+            0, WIDTH, 0, HEIGHT, WIDTH, HEIGHT, 0, WIDTH, 0, HEIGHT,
+        });
+        ScheduleQueuePacket(tKernel2 + 1, tReady, pid, tid, sc.mContext, DXGKETW_RENDER_COMMAND_BUFFER, submitSequence);
+        Schedule(tKernel3, SyntheticEventType::DxgkPresent, pid, tid, { (uint32_t) sc.mContext, sc.mHwnd, 0, 0, 0, 0, 0 });
+        Schedule(tReady, SyntheticEventType::DxgkPresentHistory, DWM_PROCESS_ID, DWM_THREAD_ID, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_BLT, 0, 0,
+        });
+        lastTime = vsync;
+        break;
+
+    case PresentMode::Composed_Copy_CPU_GDI:
+    {
+        // The token data identifies the flip chain and serial number that DWM
+        // reports when it picks up the blit.
+        auto tokenData = ((uint64_t) (sc.mBindId & 0xffffffff) << 32) | sc.mPresentCount;
+        Schedule(tKernel1, SyntheticEventType::DxgkBlit, pid, tid, {
+            sc.mHwnd, 0, 0, sc.mAddress, 0, 1, 1, 0, 0, WIDTH, 0, HEIGHT, 0, WIDTH, 0, HEIGHT, 0,
+        });
+        Schedule(tKernel2, SyntheticEventType::DxgkPresentHistoryDetailedStart, pid, tid, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_VISTABLT, 8, tokenData,
+            0, 0, 0, 0, 0, 0,
+            1, 0, WIDTH, 0, HEIGHT,
+            0, WIDTH, 0, HEIGHT, WIDTH, HEIGHT, 0, WIDTH, 0, HEIGHT,
+        });
+        Schedule(tKernel3, SyntheticEventType::DxgkPresent, pid, tid, { (uint32_t) sc.mContext, sc.mHwnd, 0, 0, 0, 0, 0 });
+        Schedule(tReady, SyntheticEventType::DxgkPresentHistory, DWM_PROCESS_ID, DWM_THREAD_ID, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_VISTABLT, 8, tokenData,
+        });
+        Schedule(tCompose - 1, SyntheticEventType::DwmFlipChainPending, DWM_PROCESS_ID, DWM_THREAD_ID, {
+            tokenData >> 32, tokenData & 0xffffffff, sc.mHwnd,
+        });
+        lastTime = vsync;
+        break;
+    }
+
+    case PresentMode::Composed_Composition_Atlas:
+        Schedule(tKernel1, SyntheticEventType::DxgkPresentHistoryDetailedStart, pid, tid, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_COMPOSITION, 0, 0,
+            0, 0, 0, 0, 0, 0,
+            1, 0, WIDTH, 0, HEIGHT,
+            0, WIDTH, 0, HEIGHT, WIDTH, HEIGHT, 0, WIDTH, 0, HEIGHT,
+        });
+        ScheduleQueuePacket(tKernel2, tReady, pid, tid, sc.mContext, DXGKETW_RENDER_COMMAND_BUFFER, submitSequence);
+        Schedule(tReady, SyntheticEventType::DxgkPresentHistory, DWM_PROCESS_ID, DWM_THREAD_ID, {
+            DXG_ADAPTER, token, D3DKMT_PM_REDIRECTED_COMPOSITION, 0, 0,
+        });
+        lastTime = vsync;
+        break;
+
+    default:
+        assert(false);
+        break;
+    }
+
+    Schedule(stopTime, SyntheticEventType::DxgiPresentStop, pid, tid, { 0 });
+
+    mLastAppEventTime = std::max(mLastAppEventTime, lastTime);
+}
+
+// DWM picks up the handed-off presents, then flips its own composed frame
+// like a fullscreen application.
+void SyntheticTrace::ScheduleDwmComposition(uint64_t vsync)
+{
+    auto tCompose = vsync - COMPOSE_LEAD;
+    auto submitSequence = mNextSubmitSequence++;
+
+    Schedule(tCompose, SyntheticEventType::DwmGetPresentHistory, DWM_PROCESS_ID, DWM_THREAD_ID, { 0, 1 });
+    Schedule(tCompose + 1, SyntheticEventType::DwmSchedulePresentStart, DWM_PROCESS_ID, DWM_THREAD_ID, {
+        tCompose, vsync, (vsync - START_QPC) / VSYNC_PERIOD - 1, (vsync - START_QPC) / VSYNC_PERIOD, 0,
+    });
+    Schedule(tCompose + 2, SyntheticEventType::DxgkFlip, DWM_PROCESS_ID, DWM_THREAD_ID, { DWM_CONTEXT, 0, DWM_CONTEXT, 1, 0, 1 });
+    ScheduleQueuePacket(tCompose + 3, tCompose + COMPOSE_LEAD / 2 + 1, DWM_PROCESS_ID, DWM_THREAD_ID, DWM_CONTEXT,
+                        DXGKETW_MMIOFLIP_COMMAND_BUFFER, submitSequence);
+    Schedule(tCompose + COMPOSE_LEAD / 2, SyntheticEventType::DxgkMMIOFlip, 0, 0, {
+        DXG_ADAPTER, 0, submitSequence, DWM_CONTEXT, 0, 0, 0, 1, (uint64_t) Microsoft_Windows_DxgKrnl::MMIOFlip::OnNextVSync,
+    });
+    Schedule(vsync, SyntheticEventType::DxgkVSyncDPC, 0, 0, {
+        DXG_ADAPTER, 0, 0, 0, 0, vsync, 0, 0, (uint64_t) submitSequence << 32,
+    });
+}
+
+void SyntheticTrace::Schedule(uint64_t time, SyntheticEventType type, uint32_t processId, uint32_t threadId, std::initializer_list<uint64_t> values)
+{
+    assert(values.size() <= PendingEvent::MAX_VALUE_COUNT);
+
+    PendingEvent e;
+    e.mTime = time;
+    e.mOrder = mNextOrder++;
+    e.mType = type;
+    e.mProcessId = processId;
+    e.mThreadId = threadId;
+    e.mValueCount = 0;
+    for (auto value : values) {
+        e.mValues[e.mValueCount++] = value;
+    }
+    mPending.push(e);
+}
+
+// The packet is queued from the presenting thread and completes on the
+// system thread.
+void SyntheticTrace::ScheduleQueuePacket(uint64_t submitTime, uint64_t completeTime, uint32_t processId, uint32_t threadId,
+                                         uint64_t context, uint32_t packetType, uint32_t submitSequence)
+{
+    auto packet = context + 0x800 + (submitSequence & 0x7f) * 8;
+    Schedule(submitTime, SyntheticEventType::DxgkQueuePacketStart, processId, threadId, {
+        context, packetType, submitSequence, 0x1000, 0, 0, 1, 0, packet, submitSequence,
+    });
+    Schedule(completeTime, SyntheticEventType::DxgkQueuePacketStop, 0, 0, {
+        context, packetType, submitSequence, 0, 0, packet,
+    });
+}
+
+void SyntheticTrace::ScheduleTokenStateChanged(uint64_t time, SwapChain const& swapChain, uint32_t presentCount, uint32_t newState, bool independentFlip)
+{
+    Schedule(time, SyntheticEventType::Win32kTokenStateChanged, DWM_PROCESS_ID, DWM_THREAD_ID, {
+        swapChain.mAddress, 0, presentCount, 0, newState, independentFlip ? 1u : 0u, 0,
+        swapChain.mCompositionSurfaceLuid, swapChain.mBindId,
+    });
+}
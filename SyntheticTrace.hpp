@@ -0,0 +1,131 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include <queue>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+
+#include "PresentMonTraceConsumer.hpp"
+#include "SyntheticEventInfo.hpp"
+
+struct SyntheticTraceOptions {
+    PresentMode mPresentMode = PresentMode::Composed_Flip;
+    uint32_t mProcessCount = 16;
+    uint32_t mThreadsPerProcess = 2;    // Each presenting thread has its own swap chain and window
+    uint32_t mPresentsPerThread = 2000;
+    uint32_t mQueueDepth = 1;           // Refreshes each present waits for the GPU, i.e. presents in flight per swap chain
+    uint32_t mSeed = 1;
+};
+
+enum class SyntheticEventType : uint32_t;
+
+// SyntheticTrace generates the event sequences described at the top of
+// PresentMonTraceConsumer.hpp for one PresentMode, as if they had been
+// recorded from many presenting processes at once: each thread presents once
+// per refresh (with jitter), GPU and display events follow on the system and
+// DWM threads, and all events are returned in timestamp order.  For the
+// windowed modes DWM also composes every refresh, picking up the presents
+// handed off to it and flipping them to the screen as the real DWM does.
+//
+// The output depends only on the options, so runs are reproducible.  Call
+// AddMetadata() on the consumer's EventMetadata before handling the events;
+// event layouts follow *EventStructs.hpp with 64-bit pointers.
+struct SyntheticTrace {
+    static uint64_t const QPC_FREQUENCY = 10000000;
+    static uint32_t const DWM_PROCESS_ID = 900;
+    static uint32_t const DWM_THREAD_ID = 904;
+
+    void Initialize(SyntheticTraceOptions const& options);
+    static void AddMetadata(EventMetadata* metadata);
+
+    // Fill in the next event, or return false once the trace is finished.
+    // eventRecord->UserData is valid until the next call.
+    bool Next(EVENT_RECORD* eventRecord);
+
+    uint64_t mEventCount = 0;
+    uint64_t mPresentCount = 0;     // Presents started by the application threads
+
+private:
+    struct PendingEvent {
+        static uint32_t const MAX_VALUE_COUNT = 32;
+
+        uint64_t mTime;
+        uint64_t mOrder;            // Keeps events with the same time in the order they were scheduled
+        SyntheticEventType mType;
+        uint32_t mProcessId;
+        uint32_t mThreadId;
+        uint32_t mValueCount;
+        uint64_t mValues[MAX_VALUE_COUNT];  // Property values in layout order (see Next())
+
+        bool operator<(PendingEvent const& rhs) const;  // Later events have lower priority
+    };
+
+    struct SwapChain {
+        uint32_t mProcessId;
+        uint32_t mThreadId;
+        uint64_t mAddress;
+        uint64_t mHwnd;
+        uint64_t mContext;
+        uint64_t mCompositionSurfaceLuid;
+        uint64_t mBindId;
+        uint32_t mPresentCount;
+        uint32_t mPresentsRemaining;
+    };
+
+    // Each source (a swap chain's next present, or DWM's next composition)
+    // schedules all of its events when it starts, so a pending event can be
+    // returned once no source starts before it.
+    typedef std::pair<uint64_t, uint32_t> SourceStart;    // (time, swap chain index)
+
+    SyntheticTraceOptions mOptions;
+    std::vector<SwapChain> mSwapChains;
+    std::priority_queue<SourceStart, std::vector<SourceStart>, std::greater<SourceStart>> mSwapChainStarts;
+    std::priority_queue<PendingEvent> mPending;
+    bool mDwmComposes = false;
+    uint64_t mNextDwmVSync = 0;
+    uint64_t mLastAppEventTime = 0;
+    uint64_t mNextOrder = 0;
+    uint32_t mNextSubmitSequence = 1;
+    uint64_t mNextToken = 0;
+    uint32_t mRandom = 0;
+    std::vector<uint8_t> mUserData;
+
+    uint32_t Random(uint32_t range);
+    uint64_t NextVSync(uint64_t time) const;
+    uint64_t NextSourceTime() const;
+    void StartNextSource();
+    void SchedulePresent(SwapChain* swapChain, uint64_t time);
+    void ScheduleDwmComposition(uint64_t vsync);
+
+    void Schedule(uint64_t time, SyntheticEventType type, uint32_t processId, uint32_t threadId, std::initializer_list<uint64_t> values);
+    void ScheduleQueuePacket(uint64_t submitTime, uint64_t completeTime, uint32_t processId, uint32_t threadId,
+                             uint64_t context, uint32_t packetType, uint32_t submitSequence);
+    void ScheduleTokenStateChanged(uint64_t time, SwapChain const& swapChain, uint32_t presentCount, uint32_t newState, bool independentFlip);
+};
@@ -0,0 +1,251 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMonTraceConsumer.hpp"
+#include "TimelineOutput.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <stdarg.h>
+#include <string.h>
+
+namespace {
+
+char const* GetRuntimeName(Runtime runtime)
+{
+    switch (runtime) {
+    case Runtime::DXGI:  return "DXGI";
+    case Runtime::D3D9:  return "D3D9";
+    case Runtime::Other: return "Other";
+    }
+    return "Unknown";
+}
+
+char const* GetPresentModeName(PresentMode mode)
+{
+    switch (mode) {
+    case PresentMode::Hardware_Legacy_Flip:                 return "Hardware_Legacy_Flip";
+    case PresentMode::Hardware_Legacy_Copy_To_Front_Buffer: return "Hardware_Legacy_Copy_To_Front_Buffer";
+    case PresentMode::Hardware_Independent_Flip:            return "Hardware_Independent_Flip";
+    case PresentMode::Composed_Flip:                        return "Composed_Flip";
+    case PresentMode::Composed_Copy_GPU_GDI:                return "Composed_Copy_GPU_GDI";
+    case PresentMode::Composed_Copy_CPU_GDI:                return "Composed_Copy_CPU_GDI";
+    case PresentMode::Composed_Composition_Atlas:           return "Composed_Composition_Atlas";
+    case PresentMode::Hardware_Composed_Independent_Flip:   return "Hardware_Composed_Independent_Flip";
+    }
+    return "Unknown";
+}
+
+char const* GetPresentResultName(PresentResult result)
+{
+    switch (result) {
+    case PresentResult::Presented: return "Presented";
+    case PresentResult::Discarded: return "Discarded";
+    case PresentResult::Error:     return "Error";
+    case PresentResult::Lost:      return "Lost";
+    }
+    return "Unknown";
+}
+
+}
+
+bool TimelineOutput::Start(FILE* fp, LARGE_INTEGER const* startQpc, QpcClock const& clock)
+{
+    assert(mFile == nullptr);
+    assert(clock.mFrequency != 0);
+
+    mFile = fp;
+    mStartQpc = startQpc;
+    mClock = clock;
+    mBuffer.resize(BUFFER_SIZE);
+    mBufferSize = 0;
+    mEventCount = 0;
+    mWriteFailed = false;
+
+    auto header = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    mBufferSize = strlen(header);
+    memcpy(mBuffer.data(), header, mBufferSize);
+    return true;
+}
+
+void TimelineOutput::Stop()
+{
+    if (mFile == nullptr) {
+        return;
+    }
+
+    auto footer = "\n]}\n";
+    if (mBufferSize + strlen(footer) > BUFFER_SIZE) {
+        Flush();
+    }
+    memcpy(mBuffer.data() + mBufferSize, footer, strlen(footer));
+    mBufferSize += strlen(footer);
+    Flush();
+
+    fflush(mFile);
+    mFile = nullptr;
+    mSwapChainTracks.clear();
+    mTrackCountByProcess.clear();
+    mPendingFlows.clear();
+}
+
+void TimelineOutput::AddPresent(PresentEvent const& p)
+{
+    auto runtimeEnd = p.QpcTime + p.TimeTaken;
+    auto readyTime  = p.ReadyTime  == 0 ? runtimeEnd : std::max(p.ReadyTime, runtimeEnd);
+    auto screenTime = p.ScreenTime == 0 ? readyTime  : std::max(p.ScreenTime, readyTime);
+    auto pid = p.ProcessId;
+    auto tid = GetLaneThreadId(p, screenTime);
+
+    AppendEvent("{\"name\":\"Present\",\"cat\":\"present\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"Runtime\":\"%s\",\"PresentMode\":\"%s\",\"FinalState\":\"%s\",\"SyncInterval\":%d,"
+                "\"PresentFlags\":%u,\"QueueSubmitSequence\":%u,\"ThreadId\":%u}}",
+                pid, tid, QpcToMicroseconds(p.QpcTime), QpcToMicroseconds(runtimeEnd) - QpcToMicroseconds(p.QpcTime),
+                GetRuntimeName(p.Runtime), GetPresentModeName(p.PresentMode), GetPresentResultName(p.FinalState),
+                p.SyncInterval, p.PresentFlags, p.QueueSubmitSequence, p.ThreadId);
+    if (p.ReadyTime != 0) {
+        AppendEvent("{\"name\":\"GPU\",\"cat\":\"present\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    pid, tid, QpcToMicroseconds(runtimeEnd), QpcToMicroseconds(readyTime) - QpcToMicroseconds(runtimeEnd));
+    }
+    if (p.ScreenTime != 0) {
+        AppendEvent("{\"name\":\"Display\",\"cat\":\"present\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    pid, tid, QpcToMicroseconds(readyTime), QpcToMicroseconds(screenTime) - QpcToMicroseconds(readyTime));
+    }
+
+    // Flow arrows start inside the dependent present's last slice, and end
+    // at the start of the DWM present (see AddDependentPresent()).
+    for (auto ii = mPendingFlows.begin(); ii != mPendingFlows.end(); ) {
+        if (ii->mSource == &p) {
+            AppendEvent("{\"name\":\"DWM\",\"cat\":\"dwm\",\"ph\":\"s\",\"id\":%llu,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+                        ii->mId, pid, tid, QpcToMicroseconds(p.ScreenTime != 0 ? readyTime : p.QpcTime));
+            ii->mSource = nullptr;
+        }
+        if (ii->mTarget == &p) {
+            AppendEvent("{\"name\":\"DWM\",\"cat\":\"dwm\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%llu,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+                        ii->mId, pid, tid, QpcToMicroseconds(p.QpcTime));
+            ii = mPendingFlows.erase(ii);
+        } else {
+            ++ii;
+        }
+    }
+}
+
+void TimelineOutput::AddDependentPresent(PresentEvent const& dwmPresent, PresentEvent const& p)
+{
+    PendingFlow flow;
+    flow.mSource = &p;
+    flow.mTarget = &dwmPresent;
+    flow.mId = mNextFlowId++;
+    mPendingFlows.push_back(flow);
+}
+
+void TimelineOutput::AddFrame(uint32_t processId, uint32_t threadId, Frame const& f)
+{
+    AppendEvent("{\"name\":\"Frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                processId, threadId, QpcToMicroseconds(f.StartTime), QpcToMicroseconds(f.EndTime) - QpcToMicroseconds(f.StartTime));
+}
+
+void TimelineOutput::RemoveProcess(uint32_t processId)
+{
+    EraseProcessSwapChains(&mSwapChainTracks, processId);
+    mTrackCountByProcess.erase(processId);
+}
+
+double TimelineOutput::QpcToMicroseconds(uint64_t qpc) const
+{
+    return mClock.ToMicroseconds((int64_t) (qpc - mStartQpc->QuadPart));
+}
+
+// Use the swap chain's first lane that is free by the time the present
+// starts, adding a lane if none are.  Presents usually complete in start
+// order, so a lane is free if its last present ended first.
+uint32_t TimelineOutput::GetLaneThreadId(PresentEvent const& p, uint64_t endTime)
+{
+    auto key = std::make_tuple(p.ProcessId, p.SwapChainAddress);
+    auto ii = mSwapChainTracks.find(key);
+    if (ii == mSwapChainTracks.end()) {
+        SwapChainTrack track = {};
+        track.mTrackIndex = mTrackCountByProcess[p.ProcessId]++;
+        ii = mSwapChainTracks.emplace(key, track).first;
+    }
+    auto track = &ii->second;
+
+    uint32_t lane = 0;
+    for (; lane < track->mLaneCount && track->mLaneEndTimes[lane] > p.QpcTime; ++lane) {
+    }
+
+    // Out of lanes, overlap on the one that ends first.
+    if (lane == MAX_LANES) {
+        lane = 0;
+        for (uint32_t i = 1; i < MAX_LANES; ++i) {
+            if (track->mLaneEndTimes[i] < track->mLaneEndTimes[lane]) {
+                lane = i;
+            }
+        }
+    }
+
+    auto tid = 1 + 2 * (track->mTrackIndex * MAX_LANES + lane);
+    if (lane == track->mLaneCount) {
+        track->mLaneCount += 1;
+        if (lane == 0) {
+            AppendEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"SwapChain %llx\"}}",
+                        p.ProcessId, tid, p.SwapChainAddress);
+        } else {
+            AppendEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"SwapChain %llx (%u)\"}}",
+                        p.ProcessId, tid, p.SwapChainAddress, lane + 1);
+        }
+    }
+
+    track->mLaneEndTimes[lane] = endTime;
+    return tid;
+}
+
+void TimelineOutput::AppendEvent(char const* format, ...)
+{
+    if (mBufferSize + MAX_EVENT_SIZE > BUFFER_SIZE) {
+        Flush();
+    }
+
+    auto p = mBuffer.data() + mBufferSize;
+    if (mEventCount > 0) {
+        *p++ = ',';
+        *p++ = '\n';
+    }
+
+    va_list args;
+    va_start(args, format);
+    auto r = vsnprintf(p, MAX_EVENT_SIZE - 2, format, args);
+    va_end(args);
+    assert(r > 0 && (size_t) r < MAX_EVENT_SIZE - 2);
+
+    mBufferSize = (p - mBuffer.data()) + r;
+    mEventCount += 1;
+}
+
+void TimelineOutput::Flush()
+{
+    if (mBufferSize > 0 && !mWriteFailed && fwrite(mBuffer.data(), 1, mBufferSize, mFile) != mBufferSize) {
+        fprintf(stderr, "error: failed to write timeline; the rest of the timeline is dropped.\n");
+        mWriteFailed = true;
+    }
+    mBufferSize = 0;
+}
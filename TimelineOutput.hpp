@@ -0,0 +1,108 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+
+#include "QpcClock.hpp"
+
+struct Frame;
+struct PresentEvent;
+
+// TimelineOutput streams completed presents and CPU frames to a file in the
+// JSON Trace Event Format, which chrome://tracing and Perfetto can open.
+// Events are written as they are completed, into a fixed-size buffer that is
+// written out whenever it fills, so memory use doesn't depend on the length
+// of the capture.
+//
+// Each swap chain has its own track in its process, on which each present
+// shows as consecutive "Present" (runtime start to stop), "GPU" (to ready)
+// and "Display" (to screen) slices.  When presents overlap (queue depth > 1)
+// the swap chain gets additional lanes, one track each, up to MAX_LANES.
+// Swap chain tracks use odd thread ids, which can't collide with the
+// application threads (Windows thread ids are multiples of 4) that CPU frames
+// are shown on.
+//
+// Presents composed by a DWM present (PresentEvent::DependentPresents) get a
+// flow arrow from their "Display" slice to the DWM present.  The dependents
+// are completed inside the DWM present's CompletePresent() before it is
+// completed itself, so each arrow is resolved within that call.
+//
+// All functions are called from the event handling thread.
+struct TimelineOutput {
+    static size_t const BUFFER_SIZE = 1024 * 1024;
+    static size_t const MAX_EVENT_SIZE = 512;
+    static uint32_t const MAX_LANES = 8;
+
+    typedef std::tuple<uint32_t, uint64_t> ProcessAndSwapChainKey;
+
+    struct SwapChainTrack {
+        uint32_t mTrackIndex;               // Per-process index, used to form the lanes' thread ids
+        uint32_t mLaneCount;
+        uint64_t mLaneEndTimes[MAX_LANES];  // QPC time each lane's last present ended
+    };
+
+    struct PendingFlow {
+        PresentEvent const* mSource;
+        PresentEvent const* mTarget;
+        uint64_t mId;
+    };
+
+    FILE* mFile = nullptr;
+    LARGE_INTEGER const* mStartQpc = nullptr;   // Set by the session once the first event is seen
+    QpcClock mClock;
+
+    std::vector<char> mBuffer;
+    size_t mBufferSize = 0;
+    uint64_t mEventCount = 0;
+    uint64_t mNextFlowId = 1;
+    bool mWriteFailed = false;
+
+    std::map<ProcessAndSwapChainKey, SwapChainTrack> mSwapChainTracks;
+    std::unordered_map<uint32_t, uint32_t> mTrackCountByProcess;
+    std::vector<PendingFlow> mPendingFlows;
+
+    bool Start(FILE* fp, LARGE_INTEGER const* startQpc, QpcClock const& clock);
+    void Stop();
+
+    // Called by PMTraceConsumer as presents and frames are completed.
+    void AddPresent(PresentEvent const& p);
+    void AddDependentPresent(PresentEvent const& dwmPresent, PresentEvent const& p);
+    void AddFrame(uint32_t processId, uint32_t threadId, Frame const& f);
+
+    // Forget the process's swap chain tracks and track count once it has
+    // exited.
+    void RemoveProcess(uint32_t processId);
+
+private:
+    double QpcToMicroseconds(uint64_t qpc) const;
+    uint32_t GetLaneThreadId(PresentEvent const& p, uint64_t endTime);
+    void AppendEvent(char const* format, ...);
+    void Flush();
+};
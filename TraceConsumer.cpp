@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include "TraceConsumer.hpp"
+#include "HandlerProfile.hpp"
 #include "EventMetadataEventStructs.hpp"
 
 namespace {
@@ -61,9 +62,9 @@ uint32_t GetStringPropertySize(TRACE_EVENT_INFO const& tei, EVENT_RECORD const&
     }
 
     for (uint32_t size = 0;; size += sizeof(T)) {
-        if (offset + size > eventRecord.UserDataLength) {
+        if (offset + size + sizeof(T) > eventRecord.UserDataLength) {
             // string ends at end of block, possibly ok (see note above)
-            return size - sizeof(T);
+            return size;
         }
         if (*(T const*) ((uintptr_t) eventRecord.UserData + offset + size) == (T) 0) {
             *propStatus |= PROP_STATUS_NULL_TERMINATED;
@@ -223,6 +224,8 @@ void EventMetadata::AddMetadata(EVENT_RECORD* eventRecord)
 // property in the metadata to obtain it's data pointer and size.
 void EventMetadata::GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount /*=0*/)
 {
+    ProfileScope profileScope(profile_, ProfileCounter::GetEventData);
+
     // Look up metadata
     auto tei = GetTraceEventInfo(this, eventRecord);
 
@@ -270,8 +273,8 @@ T GetEventString(EventMetadata* metadata, EVENT_RECORD* eventRecord, wchar_t con
 
     // Don't include null termination character
     if (desc.status_ & PROP_STATUS_NULL_TERMINATED) {
-        assert(desc.size_ >= sizeof(T::value_type));
-        desc.size_ -= sizeof(T::value_type);
+        assert(desc.size_ >= sizeof(typename T::value_type));
+        desc.size_ -= sizeof(typename T::value_type);
     }
 
     auto start = (typename T::value_type*) desc.data_;
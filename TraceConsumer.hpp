@@ -29,6 +29,8 @@ SOFTWARE.
 #include <windows.h>
 #include <tdh.h> // Must include after windows.h
 
+struct HandlerProfile;
+
 struct EventMetadataKey {
     GUID guid_;
     EVENT_DESCRIPTOR desc_;
@@ -77,15 +79,7 @@ struct EventDataDesc {
 
             // This is allowed and expected.  e.g., sometimes we want a
             // uint32_t promoted into uint64_t (for example to simplify pointer
-            // handling).  It may also be a mistake though so we keep a warning
-            // in DEBUG_VERBOSE.
-#if DEBUG_VERBOSE
-            static bool first = true;
-            if (first) {
-                fprintf(stderr, "warning: event's %ls property had unexpected size (%u < %zu).\n", name_, size_, sizeof(T));
-                first = false;
-            }
-#endif
+            // handling).
             T t {};
             memcpy(&t, data_, size_);
             return t;
@@ -106,6 +100,7 @@ struct EventDataDesc {
 
 struct EventMetadata {
     std::unordered_map<EventMetadataKey, std::vector<uint8_t>, EventMetadataKeyHash, EventMetadataKeyEqual> metadata_;
+    HandlerProfile* profile_ = nullptr;  // If non-null, GetEventData() costs are accumulated here
 
     void AddMetadata(EVENT_RECORD* eventRecord);
     void GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount=0);
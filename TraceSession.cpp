@@ -24,14 +24,21 @@ SOFTWARE.
 #define VC_EXTRALEAN
 #include <assert.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <windows.h>
 #include <evntcons.h> // must include after windows.h
 
 #include "TraceSession.hpp"
 
+#include "Checkpoint.hpp"
 #include "Debug.hpp"
+#include "EventRing.hpp"
+#include "FlightRecorder.hpp"
+#include "OccupancyGauges.hpp"
 #include "PresentMonTraceConsumer.hpp"
 #include "MixedRealityTraceConsumer.hpp"
+#include "ProcessFilter.hpp"
+#include "SimpleTraceConsumer.hpp"
 
 #include "D3d9EventStructs.hpp"
 #include "D3d11EventStructs.hpp"
@@ -39,6 +46,8 @@ SOFTWARE.
 #include "DxgiEventStructs.hpp"
 #include "DxgkrnlEventStructs.hpp"
 #include "EventMetadataEventStructs.hpp"
+#include "KernelProcessEventStructs.hpp"
+#include "LostEventStructs.hpp"
 #include "NTProcessEventStructs.hpp"
 #include "Win32kEventStructs.hpp"
 
@@ -88,6 +97,88 @@ ULONG EnableFilteredProvider(
     return status;
 }
 
+// The providers that are only used for full (non-simple) tracking.  They
+// can be enabled and disabled on a running session (see
+// TraceSession::SetSimpleMode()).
+ULONG EnableKernelProviders(
+    TRACEHANDLE sessionHandle,
+    GUID const& sessionGuid)
+{
+    // DxgKrnl
+    auto keywordMask =
+        (uint64_t) Microsoft_Windows_DxgKrnl::Keyword::Microsoft_Windows_DxgKrnl_Performance |
+        (uint64_t) Microsoft_Windows_DxgKrnl::Keyword::Base;
+    auto status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_DxgKrnl::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
+        Microsoft_Windows_DxgKrnl::Blit_Info::Id,
+        Microsoft_Windows_DxgKrnl::Flip_Info::Id,
+        Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id,
+        Microsoft_Windows_DxgKrnl::HSyncDPCMultiPlane_Info::Id,
+        Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id,
+        Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id,
+        Microsoft_Windows_DxgKrnl::Present_Info::Id,
+        Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id,
+        Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id,
+        Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id,
+        Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id,
+        Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id,
+        Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id,
+    });
+    if (status != ERROR_SUCCESS) return status;
+
+    status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_DxgKrnl::Win7::GUID, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+                            TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, 0, nullptr);
+    if (status != ERROR_SUCCESS) return status;
+
+    // Win32k
+    keywordMask =
+        (uint64_t) Microsoft_Windows_Win32k::Keyword::Updates |
+        (uint64_t) Microsoft_Windows_Win32k::Keyword::Visualization |
+        (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing;
+    status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Win32k::GUID, TRACE_LEVEL_INFORMATION, keywordMask,
+        (uint64_t) Microsoft_Windows_Win32k::Keyword::Updates |
+        (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing, {
+        Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info::Id,
+        Microsoft_Windows_Win32k::TokenStateChanged_Info::Id,
+    });
+    if (status != ERROR_SUCCESS) return status;
+
+    // Dwm_Core
+    status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Dwm_Core::GUID, TRACE_LEVEL_VERBOSE, 0, 0, {
+        Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id,
+        Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start::Id,
+        Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id,
+        Microsoft_Windows_Dwm_Core::FlipChain_Pending::Id,
+        Microsoft_Windows_Dwm_Core::FlipChain_Complete::Id,
+        Microsoft_Windows_Dwm_Core::FlipChain_Dirty::Id,
+    });
+    if (status != ERROR_SUCCESS) return status;
+
+    status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Dwm_Core::Win7::GUID, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+                            TRACE_LEVEL_VERBOSE, 0, 0, 0, nullptr);
+    if (status != ERROR_SUCCESS) return status;
+
+    return ERROR_SUCCESS;
+}
+
+ULONG DisableKernelProviders(TRACEHANDLE sessionHandle)
+{
+    GUID const* guids[] = {
+        &Microsoft_Windows_DxgKrnl::GUID,
+        &Microsoft_Windows_DxgKrnl::Win7::GUID,
+        &Microsoft_Windows_Win32k::GUID,
+        &Microsoft_Windows_Dwm_Core::GUID,
+        &Microsoft_Windows_Dwm_Core::Win7::GUID,
+    };
+    ULONG result = ERROR_SUCCESS;
+    for (auto guid : guids) {
+        auto status = EnableTraceEx2(sessionHandle, guid, EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
+        if (status != ERROR_SUCCESS && result == ERROR_SUCCESS) {
+            result = status;
+        }
+    }
+    return result;
+}
+
 ULONG EnableProviders(
     TRACEHANDLE sessionHandle,
     GUID const& sessionGuid,
@@ -116,58 +207,24 @@ ULONG EnableProviders(
     });
     if (status != ERROR_SUCCESS) return status;
 
-    if (!simple) {
-        // DxgKrnl
-        keywordMask =
-            (uint64_t) Microsoft_Windows_DxgKrnl::Keyword::Microsoft_Windows_DxgKrnl_Performance |
-            (uint64_t) Microsoft_Windows_DxgKrnl::Keyword::Base;
-        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_DxgKrnl::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
-                Microsoft_Windows_DxgKrnl::Blit_Info::Id,
-                Microsoft_Windows_DxgKrnl::Flip_Info::Id,
-                Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id,
-                Microsoft_Windows_DxgKrnl::HSyncDPCMultiPlane_Info::Id,
-                Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id,
-                Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id,
-                Microsoft_Windows_DxgKrnl::Present_Info::Id,
-                Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id,
-                Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id,
-                Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id,
-                Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id,
-                Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id,
-                Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id,
-            });
-        if (status != ERROR_SUCCESS) return status;
-
-        status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_DxgKrnl::Win7::GUID, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
-                                TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, 0, nullptr);
-        if (status != ERROR_SUCCESS) return status;
-
-        // Win32k
-        keywordMask =
-            (uint64_t) Microsoft_Windows_Win32k::Keyword::Updates |
-            (uint64_t) Microsoft_Windows_Win32k::Keyword::Visualization |
-            (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing;
-        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Win32k::GUID, TRACE_LEVEL_INFORMATION, keywordMask,
-            (uint64_t) Microsoft_Windows_Win32k::Keyword::Updates |
-            (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing, {
-            Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info::Id,
-            Microsoft_Windows_Win32k::TokenStateChanged_Info::Id,
-        });
-        if (status != ERROR_SUCCESS) return status;
+    // D3D11 (BeginFrame/EndFrame markers)
+    keywordMask = (uint64_t) Microsoft_Windows_D3D11::Marker::Keyword;
+    status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_D3D11::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
+        Microsoft_Windows_D3D11::Marker::Id,
+    });
+    if (status != ERROR_SUCCESS) return status;
 
-        // Dwm_Core
-        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Dwm_Core::GUID, TRACE_LEVEL_VERBOSE, 0, 0, {
-            Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id,
-            Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start::Id,
-            Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id,
-            Microsoft_Windows_Dwm_Core::FlipChain_Pending::Id,
-            Microsoft_Windows_Dwm_Core::FlipChain_Complete::Id,
-            Microsoft_Windows_Dwm_Core::FlipChain_Dirty::Id,
-        });
-        if (status != ERROR_SUCCESS) return status;
+    // Kernel-Process (process start/stop, used to purge exited processes'
+    // state and to resolve ProcessFilter image names)
+    keywordMask = (uint64_t) Microsoft_Windows_Kernel_Process::Keyword::WINEVENT_KEYWORD_PROCESS;
+    status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Kernel_Process::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
+        Microsoft_Windows_Kernel_Process::ProcessStart_Start::Id,
+        Microsoft_Windows_Kernel_Process::ProcessStop_Stop::Id,
+    });
+    if (status != ERROR_SUCCESS) return status;
 
-        status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Dwm_Core::Win7::GUID, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
-                                TRACE_LEVEL_VERBOSE, 0, 0, 0, nullptr);
+    if (!simple) {
+        status = EnableKernelProviders(sessionHandle, sessionGuid);
         if (status != ERROR_SUCCESS) return status;
     }
 
@@ -193,6 +250,8 @@ void DisableProviders(TRACEHANDLE sessionHandle)
     ULONG status = 0;
     status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_DXGI::GUID,           EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
     status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_D3D9::GUID,           EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
+    status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_D3D11::GUID,          EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
+    status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Kernel_Process::GUID, EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
     status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_DxgKrnl::GUID,        EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
     status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Win32k::GUID,         EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
     status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Dwm_Core::GUID,       EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
@@ -202,6 +261,149 @@ void DisableProviders(TRACEHANDLE sessionHandle)
     status = EnableTraceEx2(sessionHandle, &SPECTRUMCONTINUOUS_PROVIDER_GUID,       EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
 }
 
+void ApplyPendingTrackingMode(TraceSession* session);
+
+template<
+    bool SIMPLE,
+    bool WMR>
+void DispatchEvent(TraceSession* session, EVENT_RECORD* pEventRecord)
+{
+    auto const& hdr = pEventRecord->EventHeader;
+
+#pragma warning(push)
+#pragma warning(disable: 4127) // constant conditional expressions
+
+    // Switch between full and simple tracking once events from after
+    // SetSimpleMode() changed the providers are being handled, and handle
+    // this event with the new mode's dispatch.
+    auto modeQpc = session->mPendingModeQpc.load(std::memory_order_acquire);
+    if (modeQpc != 0 && (uint64_t) hdr.TimeStamp.QuadPart >= modeQpc) {
+        ApplyPendingTrackingMode(session);
+        if (session->mDispatchEvent != &DispatchEvent<SIMPLE, WMR>) {
+            session->mDispatchEvent(session, pEventRecord);
+            return;
+        }
+    }
+
+    // Only this thread writes these, so the count it doesn't need a locked add.
+    session->mDispatchedEventCount.store(session->mDispatchedEventCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    session->mLastEventQpc.store(hdr.TimeStamp.QuadPart, std::memory_order_relaxed);
+
+    // Apply an event gap reported from another thread (e.g., from polling
+    // CheckLostReports()) once events from after the gap are being handled.
+    auto gapQpc = session->mPMConsumer->mPendingEventGapQpc.load(std::memory_order_relaxed);
+    if (gapQpc != 0 && (uint64_t) hdr.TimeStamp.QuadPart >= gapQpc) {
+        session->mPMConsumer->ApplyPendingEventGap();
+    }
+
+    // Measure tracking map occupancy between events, so that the maps are
+    // not being modified while they are measured.  When polled, the snapshot
+    // is reported by the polling thread (see OccupancyGauges.hpp).
+    auto gauges = session->mOccupancyGauges;
+    if (gauges != nullptr) {
+        if (gauges->mPolled) {
+            if (gauges->mSnapshotRequested.load(std::memory_order_relaxed)) {
+                gauges->Publish(session->mPMConsumer, session->mMRConsumer, hdr.TimeStamp.QuadPart);
+            }
+        } else if ((uint64_t) hdr.TimeStamp.QuadPart >= gauges->mNextSampleQpc) {
+            gauges->Update(session->mPMConsumer, session->mMRConsumer, hdr.TimeStamp.QuadPart, session->mStartQpc.QuadPart, session->mClock);
+        }
+    }
+
+    // Drop runtime events from untracked processes before decoding any of
+    // their properties.  The runtime providers log from the presenting
+    // process, so hdr.ProcessId is authoritative for them.
+    auto filter = session->mPMConsumer->mProcessFilter;
+    if (filter != nullptr &&
+        (hdr.ProviderId == Microsoft_Windows_DXGI::GUID ||
+         hdr.ProviderId == Microsoft_Windows_D3D9::GUID ||
+         hdr.ProviderId == Microsoft_Windows_D3D11::GUID) &&
+        !filter->IsTracked(hdr.ProcessId)) {
+        return;
+    }
+
+    if (session->mFlightRecorder != nullptr) {
+        session->mFlightRecorder->Record(pEventRecord);
+    }
+
+    // Simple mode only handles the runtime events, with a consumer that
+    // keeps no kernel tracking state (see SimpleTraceConsumer.hpp).
+    if (SIMPLE) {
+        auto simple = session->mPMConsumer->mSimpleConsumer;
+             if (hdr.ProviderId == Microsoft_Windows_DXGI::GUID)            simple->HandleDXGIEvent                    (pEventRecord);
+        else if (hdr.ProviderId == Microsoft_Windows_D3D9::GUID)            simple->HandleD3D9Event                    (pEventRecord);
+        else if (hdr.ProviderId == Microsoft_Windows_D3D11::GUID)           simple->HandleD3D11Event                   (pEventRecord);
+        else if (hdr.ProviderId == NTProcessProvider::GUID)                 session->mPMConsumer->HandleNTProcessEvent (pEventRecord);
+        else if (hdr.ProviderId == Microsoft_Windows_Kernel_Process::GUID)  session->mPMConsumer->HandleNTProcessEvent (pEventRecord);
+        else if (hdr.ProviderId == Microsoft_Windows_EventMetadata::GUID)   session->mPMConsumer->HandleMetadataEvent  (pEventRecord);
+        else if (hdr.ProviderId == RT_LostEvent::GUID)                      session->mPMConsumer->HandleLostEvent      (pEventRecord);
+        else if (WMR && hdr.ProviderId == DHD_PROVIDER_GUID)                session->mMRConsumer->HandleDHDEvent       (pEventRecord);
+        return;
+    }
+
+    // TODO: specialize realtime callback to exclude NTProcessEvent?
+
+         if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::GUID)                      session->mPMConsumer->HandleDXGKEvent              (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_Win32k::GUID)                       session->mPMConsumer->HandleWin32kEvent            (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_Dwm_Core::GUID)                     session->mPMConsumer->HandleDWMEvent               (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DXGI::GUID)                         session->mPMConsumer->HandleDXGIEvent              (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_D3D9::GUID)                         session->mPMConsumer->HandleD3D9Event              (pEventRecord);
+    else if (hdr.ProviderId == NTProcessProvider::GUID)                              session->mPMConsumer->HandleNTProcessEvent         (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_Kernel_Process::GUID)               session->mPMConsumer->HandleNTProcessEvent         (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_Dwm_Core::Win7::GUID)               session->mPMConsumer->HandleDWMEvent               (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::BLT_GUID)            session->mPMConsumer->HandleWin7DxgkBlt            (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID)           session->mPMConsumer->HandleWin7DxgkFlip           (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID) session->mPMConsumer->HandleWin7DxgkPresentHistory (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID)    session->mPMConsumer->HandleWin7DxgkQueuePacket    (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID)       session->mPMConsumer->HandleWin7DxgkVSyncDPC       (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID)       session->mPMConsumer->HandleWin7DxgkMMIOFlip       (pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_EventMetadata::GUID)                session->mPMConsumer->HandleMetadataEvent          (pEventRecord);
+    else if (hdr.ProviderId == RT_LostEvent::GUID)                                   session->mPMConsumer->HandleLostEvent              (pEventRecord);
+    else if (WMR && hdr.ProviderId == DHD_PROVIDER_GUID)                             session->mMRConsumer->HandleDHDEvent               (pEventRecord);
+    else if (WMR && hdr.ProviderId == SPECTRUMCONTINUOUS_PROVIDER_GUID)              session->mMRConsumer->HandleSpectrumContinuousEvent(pEventRecord);
+    else if (hdr.ProviderId == Microsoft_Windows_D3D11::GUID)                        session->mPMConsumer->HandleD3D11Event             (pEventRecord);
+
+#pragma warning(pop)
+}
+
+typedef decltype(TraceSession::mDispatchEvent) DispatchEventFn;
+
+DispatchEventFn GetDispatchEvent(bool simple, bool includeWinMR)
+{
+    switch ((simple ? 2 : 0) | (includeWinMR ? 1 : 0)) {
+    case 0:  return &DispatchEvent<false, false>;
+    case 1:  return &DispatchEvent<false, true>;
+    case 2:  return &DispatchEvent<true, false>;
+    default: return &DispatchEvent<true, true>;
+    }
+}
+
+// Called on the event handling thread.  The presents that were in flight in
+// the previous mode won't see the rest of their events (the kernel providers
+// were just disabled, or the runtime-only state doesn't carry over into full
+// tracking), so they are completed as lost.  Open D3D11 frames only depend on
+// runtime events, so they are handed over to the new mode's consumer.
+void ApplyPendingTrackingMode(TraceSession* session)
+{
+    auto modeQpc = session->mPendingModeQpc.exchange(0);
+    auto simple = session->mPendingSimpleMode.load();
+    auto pmConsumer = session->mPMConsumer;
+    if (modeQpc == 0 || simple == pmConsumer->mSimpleMode) {
+        return;
+    }
+
+    auto simpleConsumer = pmConsumer->mSimpleConsumer;
+    if (simple) {
+        pmConsumer->mDrainedPresentCount += pmConsumer->DrainPresentsBefore(modeQpc);
+        simpleConsumer->TakeOpenFrames();
+    } else {
+        simpleConsumer->ReturnOpenFrames();
+        pmConsumer->mDrainedPresentCount += simpleConsumer->FlushPresentsBefore(modeQpc);
+    }
+    pmConsumer->mSimpleMode = simple;
+    session->mDispatchEvent = GetDispatchEvent(simple, session->mMRConsumer != nullptr);
+}
+
 template<
     bool SAVE_FIRST_TIMESTAMP,
     bool SIMPLE,
@@ -209,36 +411,169 @@ template<
 void CALLBACK EventRecordCallback(EVENT_RECORD* pEventRecord)
 {
     auto session = (TraceSession*) pEventRecord->UserContext;
-    auto const& hdr = pEventRecord->EventHeader;
 
 #pragma warning(push)
 #pragma warning(disable: 4127) // constant conditional expressions
 
     if (SAVE_FIRST_TIMESTAMP && session->mStartQpc.QuadPart == 0) {
-        session->mStartQpc = hdr.TimeStamp;
+        session->mStartQpc = pEventRecord->EventHeader.TimeStamp;
     }
 
-    // TODO: specialize realtime callback to exclude NTProcessEvent?
+#pragma warning(pop)
 
-         if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::GUID)                      session->mPMConsumer->HandleDXGKEvent              (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_Win32k::GUID)                       session->mPMConsumer->HandleWin32kEvent            (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_Dwm_Core::GUID)                     session->mPMConsumer->HandleDWMEvent               (pEventRecord);
-    else if (           hdr.ProviderId == Microsoft_Windows_DXGI::GUID)                         session->mPMConsumer->HandleDXGIEvent              (pEventRecord);
-    else if (           hdr.ProviderId == Microsoft_Windows_D3D9::GUID)                         session->mPMConsumer->HandleD3D9Event              (pEventRecord);
-    else if (           hdr.ProviderId == NTProcessProvider::GUID)                              session->mPMConsumer->HandleNTProcessEvent         (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_Dwm_Core::Win7::GUID)               session->mPMConsumer->HandleDWMEvent               (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::BLT_GUID)            session->mPMConsumer->HandleWin7DxgkBlt            (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID)           session->mPMConsumer->HandleWin7DxgkFlip           (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID) session->mPMConsumer->HandleWin7DxgkPresentHistory (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID)    session->mPMConsumer->HandleWin7DxgkQueuePacket    (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID)       session->mPMConsumer->HandleWin7DxgkVSyncDPC       (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID)       session->mPMConsumer->HandleWin7DxgkMMIOFlip       (pEventRecord);
-    else if (           hdr.ProviderId == Microsoft_Windows_EventMetadata::GUID)                session->mPMConsumer->HandleMetadataEvent          (pEventRecord);
-    else if (           WMR && hdr.ProviderId == DHD_PROVIDER_GUID)                             session->mMRConsumer->HandleDHDEvent               (pEventRecord);
-    else if (!SIMPLE && WMR && hdr.ProviderId == SPECTRUMCONTINUOUS_PROVIDER_GUID)              session->mMRConsumer->HandleSpectrumContinuousEvent(pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_D3D11::GUID)              session->mPMConsumer->HandleD3D11Event(pEventRecord);
+    DispatchEvent<SIMPLE, WMR>(session, pEventRecord);
+}
+
+// Used instead of EventRecordCallback when TraceSession::mAdaptiveTracking is
+// set, since SetSimpleMode() changes mDispatchEvent while the trace runs.
+template<bool SAVE_FIRST_TIMESTAMP>
+void CALLBACK EventDispatchCallback(EVENT_RECORD* pEventRecord)
+{
+    auto session = (TraceSession*) pEventRecord->UserContext;
+
+#pragma warning(push)
+#pragma warning(disable: 4127) // constant conditional expressions
+
+    if (SAVE_FIRST_TIMESTAMP && session->mStartQpc.QuadPart == 0) {
+        session->mStartQpc = pEventRecord->EventHeader.TimeStamp;
+    }
 
 #pragma warning(pop)
+
+    session->mDispatchEvent(session, pEventRecord);
+}
+
+// When using an EventRing, the ETW callback only copies the event into the
+// ring; EventRingThread() dispatches it.
+template<bool SAVE_FIRST_TIMESTAMP>
+void CALLBACK EventRingCallback(EVENT_RECORD* pEventRecord)
+{
+    auto session = (TraceSession*) pEventRecord->UserContext;
+
+#pragma warning(push)
+#pragma warning(disable: 4127) // constant conditional expressions
+
+    if (SAVE_FIRST_TIMESTAMP && session->mStartQpc.QuadPart == 0) {
+        session->mStartQpc = pEventRecord->EventHeader.TimeStamp;
+    }
+
+#pragma warning(pop)
+
+    session->mEventRing->Push(pEventRecord);
+}
+
+uint64_t SecondsToQpc(TraceSession const* session, double seconds)
+{
+    return session->mStartQpc.QuadPart + (uint64_t) session->mClock.FromSeconds(seconds);
+}
+
+void UpdateNextCheckpointQpc(TraceSession* session)
+{
+    session->mNextCheckpointQpc = session->mNextCheckpoint < session->mCheckpoints.size()
+        ? SecondsToQpc(session, session->mCheckpoints[session->mNextCheckpoint].mTime)
+        : UINT64_MAX;
+}
+
+// Used instead of EventRecordCallback when checkpointing, resuming from a
+// checkpoint, or stopping at a given time (see TraceSession::mCheckpoints).
+template<bool SAVE_FIRST_TIMESTAMP>
+void CALLBACK EventControlCallback(EVENT_RECORD* pEventRecord)
+{
+    auto session = (TraceSession*) pEventRecord->UserContext;
+    auto timestamp = (uint64_t) pEventRecord->EventHeader.TimeStamp.QuadPart;
+    auto eventIndex = session->mEventIndex++;
+
+    if (eventIndex < session->mResumeEventIndex) {
+        // The checkpoint's start time is the first event's time, so a
+        // mismatch means the checkpoint came from a different file.
+        if (eventIndex == 0 && timestamp != (uint64_t) session->mStartQpc.QuadPart) {
+            fprintf(stderr, "error: checkpoint does not match the trace being processed.\n");
+            session->mResumeEventIndex = UINT64_MAX;
+            session->mContinueProcessingBuffers = FALSE;
+            return;
+        }
+
+        // Process lifetimes still need to be followed while skipping, so
+        // that a ProcessFilter can resolve image names.  Only the filter is
+        // updated: the restored tracking state already reflects these events,
+        // and a reused process id must not purge it.
+        if (session->mPMConsumer->mProcessFilter != nullptr &&
+            (pEventRecord->EventHeader.ProviderId == NTProcessProvider::GUID ||
+             pEventRecord->EventHeader.ProviderId == Microsoft_Windows_Kernel_Process::GUID)) {
+            NTProcessEvent processEvent;
+            session->mPMConsumer->UpdateProcessFilter(pEventRecord, &processEvent);
+        }
+        return;
+    }
+
+#pragma warning(push)
+#pragma warning(disable: 4127) // constant conditional expressions
+
+    if (SAVE_FIRST_TIMESTAMP && session->mStartQpc.QuadPart == 0) {
+        session->mStartQpc = pEventRecord->EventHeader.TimeStamp;
+    }
+
+#pragma warning(pop)
+
+    // Times can only be converted once mStartQpc is known.
+    if (eventIndex == session->mResumeEventIndex) {
+        session->mStopQpc = session->mStopTime > 0. ? SecondsToQpc(session, session->mStopTime) : UINT64_MAX;
+        UpdateNextCheckpointQpc(session);
+    }
+
+    // ProcessTrace() only returns at the end of a buffer, so also ignore
+    // the events after mStopQpc until then.
+    if (timestamp >= session->mStopQpc) {
+        session->mContinueProcessingBuffers = FALSE;
+        return;
+    }
+
+    while (timestamp >= session->mNextCheckpointQpc) {
+        CheckpointInfo info;
+        info.mEventIndex = eventIndex;
+        info.mTimestamp = timestamp;
+        info.mStartQpc = session->mStartQpc.QuadPart;
+        info.mQpcFrequency = session->mQpcFrequency.QuadPart;
+        WriteCheckpoint(session->mCheckpoints[session->mNextCheckpoint].mPath.c_str(), info, session->mPMConsumer, session->mMRConsumer);
+
+        session->mNextCheckpoint += 1;
+        UpdateNextCheckpointQpc(session);
+    }
+
+    session->mDispatchEvent(session, pEventRecord);
+}
+
+void EventRingThread(TraceSession* session)
+{
+    auto ring = session->mEventRing;
+    uint32_t idleCount = 0;
+    for (;;) {
+        // Check for completion before looking at the ring, so that no events
+        // pushed before WaitForEventRing() was called are missed.
+        auto done = session->mEventRingDone.load();
+
+        auto pEventRecord = ring->Peek();
+        if (pEventRecord == nullptr) {
+            if (done) {
+                break;
+            }
+
+            // Spin briefly before sleeping, since events tend to arrive in
+            // bursts as ETW delivers each buffer.
+            idleCount += 1;
+            if (idleCount < 1000) {
+                YieldProcessor();
+            } else {
+                Sleep(1);
+            }
+            continue;
+        }
+
+        idleCount = 0;
+        pEventRecord->UserContext = session;
+        session->mDispatchEvent(session, pEventRecord);
+        ring->Pop();
+    }
 }
 
 ULONG CALLBACK BufferCallback(EVENT_TRACE_LOGFILEA* pLogFile)
@@ -249,6 +584,16 @@ ULONG CALLBACK BufferCallback(EVENT_TRACE_LOGFILEA* pLogFile)
 
 }
 
+void TraceSession::InitializeDispatch(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer)
+{
+    mPMConsumer = pmConsumer;
+    mMRConsumer = mrConsumer;
+
+    auto simple = pmConsumer->mSimpleMode;
+    assert(!simple || pmConsumer->mSimpleConsumer != nullptr);
+    mDispatchEvent = GetDispatchEvent(simple, mrConsumer != nullptr);
+}
+
 ULONG TraceSession::Start(
     PMTraceConsumer* pmConsumer,
     MRTraceConsumer* mrConsumer,
@@ -261,6 +606,7 @@ ULONG TraceSession::Start(
     mPMConsumer = pmConsumer;
     mMRConsumer = mrConsumer;
     mContinueProcessingBuffers = TRUE;
+    mSessionName = sessionName;
 
     // -------------------------------------------------------------------------
     // Configure session properties
@@ -270,14 +616,14 @@ ULONG TraceSession::Start(
     sessionProps.LogFileMode = EVENT_TRACE_REAL_TIME_MODE;    // We have a realtime consumer, not writing to a log file
     sessionProps.LogFileNameOffset = 0;                       // 0 means no output log file
     sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);  // Location of session name; will be written by StartTrace()
+    sessionProps.BufferSize = mBufferSizeKB;                  // See TraceSession::mBufferSizeKB etc.
+    sessionProps.MinimumBuffers = mMinimumBuffers;
+    sessionProps.MaximumBuffers = mMaximumBuffers;
+    sessionProps.FlushTimer = mFlushTimer;
     /* Not used:
     sessionProps.Wnode.Guid               // Only needed for private or kernel sessions, otherwise it's an output
-    sessionProps.FlushTimer               // How often in seconds buffers are flushed; 0=min (1 second)
     sessionProps.EnableFlags              // Which kernel providers to include in trace
     sessionProps.AgeLimit                 // n/a
-    sessionProps.BufferSize = 0;          // Size of each tracing buffer in kB (max 1MB)
-    sessionProps.MinimumBuffers = 200;    // Min tracing buffer pool size; must be at least 2 per processor
-    sessionProps.MaximumBuffers = 0;      // Max tracing buffer pool size; min+20 by default
     sessionProps.MaximumFileSize = 0;     // Max file size in MB
     */
     /* The following members are output variables, set by StartTrace() and/or ControlTrace()
@@ -312,13 +658,13 @@ ULONG TraceSession::Start(
 
     // Redirect to a specialized event handler: <SAVE_FIRST_TIMESTAMP, FULL, WMR>
     auto saveFirstTimestamp = etlPath != nullptr;
-    auto simple             = pmConsumer->mSimpleMode;
+    auto simple             = mAdaptiveTracking ? mPendingSimpleMode.load() : pmConsumer->mSimpleMode;
     auto includeWinMR       = mrConsumer != nullptr;
 
     UINT callbackFlags =
-        saveFirstTimestamp ? 4 : 0 |
-        simple             ? 2 : 0 |
-        includeWinMR       ? 1 : 0;
+        (saveFirstTimestamp ? 4 : 0) |
+        (simple             ? 2 : 0) |
+        (includeWinMR       ? 1 : 0);
     switch (callbackFlags) {
     case 0: traceProps.EventRecordCallback = &EventRecordCallback<false, false, false>; break;
     case 1: traceProps.EventRecordCallback = &EventRecordCallback<false, false, true>; break;
@@ -330,6 +676,40 @@ ULONG TraceSession::Start(
     case 7: traceProps.EventRecordCallback = &EventRecordCallback<true, true, true>; break;
     }
 
+    // With adaptive tracking, the handling thread owns mPMConsumer's mode and
+    // mDispatchEvent once they are set (an EventRing's handling thread keeps
+    // running during Restart()), so providers are enabled for the latest
+    // requested mode and the dispatch is left to catch up with it.
+    if (!mAdaptiveTracking || mDispatchEvent == nullptr) {
+        InitializeDispatch(pmConsumer, mrConsumer);
+    }
+
+    // Checkpoints are written on the handling thread, so they can't be used
+    // with an EventRing.
+    mEventIndex = 0;
+    mNextCheckpoint = 0;
+    if (!mCheckpoints.empty() || mResumeEventIndex != 0 || mStopTime > 0.) {
+        assert(etlPath != nullptr);
+        assert(mEventRing == nullptr);
+        traceProps.EventRecordCallback = saveFirstTimestamp
+            ? &EventControlCallback<true>
+            : &EventControlCallback<false>;
+    }
+
+    if (mAdaptiveTracking) {
+        assert(etlPath == nullptr);
+        assert(pmConsumer->mSimpleConsumer != nullptr);
+        traceProps.EventRecordCallback = saveFirstTimestamp
+            ? &EventDispatchCallback<true>
+            : &EventDispatchCallback<false>;
+    }
+
+    if (mEventRing != nullptr) {
+        traceProps.EventRecordCallback = saveFirstTimestamp
+            ? &EventRingCallback<true>
+            : &EventRingCallback<false>;
+    }
+
     // When processing log files, we need to use the buffer callback in case
     // the user wants to stop processing before the entire log has been parsed.
     if (traceProps.LogFileName != nullptr) {
@@ -343,19 +723,22 @@ ULONG TraceSession::Start(
     }
 
     // -------------------------------------------------------------------------
-    // Start the session
-    /*auto status = StartTraceA(&mHandle, sessionName, &sessionProps);
-    if (status != ERROR_SUCCESS) {
-        mHandle = 0;
-        return status;
-    }
+    // Start the session (realtime only; log files are opened directly)
+    if (etlPath == nullptr) {
+        auto status = StartTraceA(&mHandle, sessionName, &sessionProps);
+        if (status != ERROR_SUCCESS) {
+            mHandle = 0;
+            return status;
+        }
 
-    // Enable desired providers
-    status = EnableProviders(mHandle, sessionProps.Wnode.Guid, simple, includeWinMR);
-    if (status != ERROR_SUCCESS) {
-        Stop();
-        return status;
-    }*/
+        // Enable desired providers
+        mSessionGuid = sessionProps.Wnode.Guid;
+        status = EnableProviders(mHandle, mSessionGuid, simple, includeWinMR);
+        if (status != ERROR_SUCCESS) {
+            Stop();
+            return status;
+        }
+    }
 
     // -------------------------------------------------------------------------
     // Open the trace
@@ -369,6 +752,7 @@ ULONG TraceSession::Start(
     // -------------------------------------------------------------------------
     // Store trace properties
     mQpcFrequency = traceProps.LogfileHeader.PerfFreq;
+    mClock.Initialize(mQpcFrequency.QuadPart);
 
     // Use current time as start for realtime traces (instead of the first event time)
     if (!saveFirstTimestamp) {
@@ -377,9 +761,22 @@ ULONG TraceSession::Start(
 
     DebugInitialize(&mStartQpc, mQpcFrequency);
 
+    if (mEventRing != nullptr) {
+        mEventRingDone = false;
+        mEventRingThread = std::thread(EventRingThread, this);
+    }
+
     return ERROR_SUCCESS;
 }
 
+void TraceSession::WaitForEventRing()
+{
+    if (mEventRingThread.joinable()) {
+        mEventRingDone = true;
+        mEventRingThread.join();
+    }
+}
+
 void TraceSession::Stop()
 {
     ULONG status = 0;
@@ -397,13 +794,57 @@ void TraceSession::Stop()
     status = CloseTrace(mTraceHandle);
     mTraceHandle = INVALID_PROCESSTRACE_HANDLE;
 
-    DisableProviders(mHandle);
+    // There is no session to stop when processing a log file.
+    if (mHandle != 0) {
+        DisableProviders(mHandle);
 
+        TraceProperties sessionProps = {};
+        sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
+        sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);
+        status = ControlTraceW(mHandle, nullptr, &sessionProps, EVENT_TRACE_CONTROL_STOP);
+        mHandle = 0;
+    }
+}
+
+ULONG TraceSession::SetSimpleMode(bool simple)
+{
+    assert(mHandle != 0);
+    assert(mPMConsumer->mSimpleConsumer != nullptr);
+
+    auto status = simple
+        ? DisableKernelProviders(mHandle)
+        : EnableKernelProviders(mHandle, mSessionGuid);
+    if (status != ERROR_SUCCESS) {
+        return status;
+    }
+
+    // Events from before now were logged with the previous providers.
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+    mPendingSimpleMode = simple;
+    mPendingModeQpc.store(now.QuadPart, std::memory_order_release);
+    return ERROR_SUCCESS;
+}
+
+ULONG TraceSession::Restart()
+{
+    assert(mSessionName != nullptr);
+
+    auto startQpc = mStartQpc;
+    auto status = Start(mPMConsumer, mMRConsumer, nullptr, mSessionName);
+    mStartQpc = startQpc;
+    return status;
+}
+
+ULONG TraceSession::UpdateBuffers()
+{
     TraceProperties sessionProps = {};
     sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
     sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);
-    status = ControlTraceW(mHandle, nullptr, &sessionProps, EVENT_TRACE_CONTROL_STOP);
-    mHandle = 0;
+    sessionProps.LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+    sessionProps.MaximumBuffers = mMaximumBuffers;
+    sessionProps.FlushTimer = mFlushTimer;
+    return ControlTraceW(mHandle, nullptr, &sessionProps, EVENT_TRACE_CONTROL_UPDATE);
 }
 
 ULONG TraceSession::StopNamedSession(char const* sessionName)
@@ -427,3 +868,17 @@ ULONG TraceSession::CheckLostReports(ULONG* eventsLost, ULONG* buffersLost) cons
     return status;
 }
 
+ULONG TraceSession::QueryBuffers(ULONG* bufferSizeKB, ULONG* minimumBuffers, ULONG* maximumBuffers, ULONG* numberOfBuffers, ULONG* freeBuffers) const
+{
+    TraceProperties sessionProps = {};
+    sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
+    sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);
+
+    auto status = ControlTraceW(mHandle, nullptr, &sessionProps, EVENT_TRACE_CONTROL_QUERY);
+    *bufferSizeKB = sessionProps.BufferSize;
+    *minimumBuffers = sessionProps.MinimumBuffers;
+    *maximumBuffers = sessionProps.MaximumBuffers;
+    *numberOfBuffers = sessionProps.NumberOfBuffers;
+    *freeBuffers = sessionProps.FreeBuffers;
+    return status;
+}
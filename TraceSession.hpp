@@ -20,17 +20,96 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Checkpoint.hpp"
+#include "QpcClock.hpp"
+
 struct PMTraceConsumer;
 struct MRTraceConsumer;
+struct EventRing;
+struct OccupancyGauges;
+struct FlightRecorder;
 
 struct TraceSession {
     LARGE_INTEGER mStartQpc = {};
     LARGE_INTEGER mQpcFrequency = {};
+    QpcClock mClock;                                        // Initialized from mQpcFrequency by Start()
     PMTraceConsumer* mPMConsumer = nullptr;
     MRTraceConsumer* mMRConsumer = nullptr;
     TRACEHANDLE mHandle = 0;                                // invalid session handles are 0
+    GUID mSessionGuid = {};                                 // realtime session GUID, set by Start()
     TRACEHANDLE mTraceHandle = INVALID_PROCESSTRACE_HANDLE; // invalid trace handles are INVALID_PROCESSTRACE_HANDLE
     ULONG mContinueProcessingBuffers = TRUE;
+    char const* mSessionName = nullptr;                     // realtime session name, as passed to Start()
+
+    // ETW buffer configuration used by Start() for realtime sessions.  Zero
+    // means use the ETW default.  mMaximumBuffers and mFlushTimer can also be
+    // changed on a running session with UpdateBuffers().
+    ULONG mBufferSizeKB = 0;    // Size of each tracing buffer in kB (max 1MB)
+    ULONG mMinimumBuffers = 0;  // Min tracing buffer pool size; must be at least 2 per processor
+    ULONG mMaximumBuffers = 0;  // Max tracing buffer pool size; min+20 by default
+    ULONG mFlushTimer = 0;      // How often in seconds buffers are flushed; 0=min (1 second)
+
+    // If mEventRing is set before Start(), the ETW callback only copies each
+    // event into the ring and the handlers run on mEventRingThread.  Call
+    // WaitForEventRing() once ProcessTrace() has returned to handle the
+    // remaining events and stop the thread.
+    EventRing* mEventRing = nullptr;
+    std::thread mEventRingThread;
+    std::atomic<bool> mEventRingDone = false;
+
+    // Checkpoint/resume control for log files (see Checkpoint.hpp).  If any
+    // of these are set before Start(), events are routed through a callback
+    // that counts them in mEventIndex, skips the first mResumeEventIndex
+    // events, writes each of mCheckpoints (sorted by time) before handling the
+    // first event at or after its time, and stops processing at mStopTime.
+    // Times are in seconds from mStartQpc.
+    std::vector<CheckpointRequest> mCheckpoints;
+    uint64_t mResumeEventIndex = 0;
+    double mStopTime = 0.;
+    uint64_t mEventIndex = 0;
+    size_t mNextCheckpoint = 0;
+    uint64_t mNextCheckpointQpc = 0;
+    uint64_t mStopQpc = 0;
+
+    // If non-null, tracking map occupancy is measured on the event handling
+    // thread every mOccupancyGauges->mIntervalMs, or when requested by
+    // OccupancyGauges::Poll() if it is polled.
+    OccupancyGauges* mOccupancyGauges = nullptr;
+
+    // If non-null, every event that is handled is also recorded by
+    // mFlightRecorder, on the event handling thread.
+    FlightRecorder* mFlightRecorder = nullptr;
+
+    // Handler dispatch specialized for the consumers' configuration.
+    void (*mDispatchEvent)(TraceSession* session, EVENT_RECORD* pEventRecord) = nullptr;
+
+    // Adaptive tracking for realtime sessions (see TrackingController.hpp).
+    // If mAdaptiveTracking is set before Start(), events are always handled
+    // through mDispatchEvent, and SetSimpleMode() can switch the running
+    // session between full and simple tracking: it enables or disables the
+    // kernel providers, then records the time in mPendingModeQpc.  The event
+    // handling thread switches mPMConsumer's mode and mDispatchEvent once it
+    // reaches an event from after that time (requires
+    // mPMConsumer->mSimpleConsumer).
+    //
+    // mDispatchedEventCount is the number of events handled so far, and
+    // mLastEventQpc the timestamp of the latest one (e.g., the time to report
+    // an event gap at, since events up to it were seen).
+    bool mAdaptiveTracking = false;
+    std::atomic<uint64_t> mPendingModeQpc = 0;
+    std::atomic<bool> mPendingSimpleMode = false;
+    std::atomic<uint64_t> mDispatchedEventCount = 0;
+    std::atomic<uint64_t> mLastEventQpc = 0;
+
+    // Set the consumers and mDispatchEvent without starting a session, so
+    // that events from another source (e.g., SyntheticTrace) can be handled
+    // with mDispatchEvent(this, eventRecord).  Start() does this itself.
+    void InitializeDispatch(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer);
 
     ULONG Start(
         PMTraceConsumer* pmConsumer, // Required PMTraceConsumer instance
@@ -39,7 +118,17 @@ struct TraceSession {
         char const* sessionName);    // Required session name
 
     void Stop();
+    void WaitForEventRing();
+
+    // Start a realtime session again after Stop() (and after ProcessTrace()
+    // has returned), using the same consumers and the current buffer
+    // configuration.  mStartQpc is kept so that times remain comparable.
+    ULONG Restart();
+
+    ULONG UpdateBuffers();
+    ULONG SetSimpleMode(bool simple);
 
     ULONG CheckLostReports(ULONG* eventsLost, ULONG* buffersLost) const;
+    ULONG QueryBuffers(ULONG* bufferSizeKB, ULONG* minimumBuffers, ULONG* maximumBuffers, ULONG* numberOfBuffers, ULONG* freeBuffers) const;
     static ULONG StopNamedSession(char const* sessionName);
 };
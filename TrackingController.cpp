@@ -0,0 +1,169 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMonTraceConsumer.hpp"
+#include "TrackingController.hpp"
+#include "EventRing.hpp"
+#include "TraceSession.hpp"
+
+#include <algorithm>
+
+void TrackingController::Initialize(TraceSession* session, FILE* output)
+{
+    mSession = session;
+    mOutput = output;
+    mLastEventsLost = 0;
+    mLastBuffersLost = 0;
+    mLastEventCount = session->mDispatchedEventCount.load(std::memory_order_relaxed);
+    mDegraded = false;
+    mPollsInMode = 0;
+    mHoldPolls = MIN_HOLD_POLLS;
+    mIntervals.clear();
+}
+
+void TrackingController::OnRestart()
+{
+    mLastEventsLost = 0;
+    mLastBuffersLost = 0;
+}
+
+void TrackingController::Poll()
+{
+    ULONG eventsLost = 0;
+    ULONG buffersLost = 0;
+    if (mSession->CheckLostReports(&eventsLost, &buffersLost) != ERROR_SUCCESS) {
+        return;
+    }
+
+    auto newEventsLost = eventsLost - mLastEventsLost;
+    auto newBuffersLost = buffersLost - mLastBuffersLost;
+    mLastEventsLost = eventsLost;
+    mLastBuffersLost = buffersLost;
+
+    auto eventCount = mSession->mDispatchedEventCount.load(std::memory_order_relaxed);
+    auto eventRate = eventCount - mLastEventCount;
+    mLastEventCount = eventCount;
+
+    auto ring = mSession->mEventRing;
+    auto backlog = ring != nullptr && ring->GetOccupancy() > ring->mCapacity / 2;
+
+    char const* overload =
+        newBuffersLost > 0 ? "buffers lost" :
+        newEventsLost > 0  ? "events lost" :
+        backlog            ? "event ring backlog" :
+                             nullptr;
+
+    mPollsInMode += 1;
+    if (mDegraded) {
+        mIntervals.back().mBuffersLost += newBuffersLost;
+        if (overload == nullptr && mPollsInMode >= mHoldPolls) {
+            SetMode(false, nullptr, eventRate);
+        }
+        return;
+    }
+
+    if (overload == nullptr) {
+        if (mPollsInMode == PROBATION_POLLS) {
+            mHoldPolls = MIN_HOLD_POLLS;
+        }
+        return;
+    }
+
+    // The load that caused the last degradation is probably still there.
+    if (!mIntervals.empty() && mPollsInMode < PROBATION_POLLS) {
+        mHoldPolls = std::min(mHoldPolls * 2, MAX_HOLD_POLLS);
+    }
+    SetMode(true, overload, eventRate);
+}
+
+bool TrackingController::SetMode(bool simple, char const* reason, uint64_t eventRate)
+{
+    mPollsInMode = 0;
+
+    auto status = mSession->SetSimpleMode(simple);
+    if (status != ERROR_SUCCESS) {
+        fprintf(stderr, "error: failed to %s kernel providers (error=%lu).\n", simple ? "disable" : "enable", status);
+        return false;
+    }
+
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+    auto time = mSession->mClock.ToSeconds((int64_t) (now.QuadPart - mSession->mStartQpc.QuadPart));
+
+    mDegraded = simple;
+    if (simple) {
+        DegradedInterval interval;
+        interval.mStartQpc = now.QuadPart;
+        interval.mReason = reason;
+        mIntervals.push_back(interval);
+
+        fprintf(mOutput, "%.3f: degraded to runtime-only tracking (%s, %llu events/s)\n", time, reason, eventRate);
+    } else {
+        auto& interval = mIntervals.back();
+        interval.mEndQpc = now.QuadPart;
+
+        fprintf(mOutput, "%.3f: resumed full tracking after %.3f s (%llu events/s)\n",
+            time,
+            mSession->mClock.ToSeconds((int64_t) (interval.mEndQpc - interval.mStartQpc)),
+            eventRate);
+    }
+    fflush(mOutput);
+    return true;
+}
+
+void TrackingController::PrintSummary(FILE* fp) const
+{
+    if (mIntervals.empty()) {
+        return;
+    }
+
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+
+    auto const& clock = mSession->mClock;
+    auto startQpc = mSession->mStartQpc.QuadPart;
+    auto degradedSeconds = 0.;
+    for (auto const& interval : mIntervals) {
+        auto endQpc = interval.mEndQpc == 0 ? now.QuadPart : interval.mEndQpc;
+        degradedSeconds += clock.ToSeconds((int64_t) (endQpc - interval.mStartQpc));
+    }
+
+    fprintf(fp, "runtime-only tracking: %zu intervals, %.3f of %.3f s, %llu presents drained on switches\n",
+        mIntervals.size(),
+        degradedSeconds,
+        clock.ToSeconds((int64_t) (now.QuadPart - startQpc)),
+        mSession->mPMConsumer->mDrainedPresentCount);
+    fprintf(fp, "       Start         End    Duration  BuffersLost  Reason\n");
+    for (auto const& interval : mIntervals) {
+        auto endQpc = interval.mEndQpc == 0 ? now.QuadPart : interval.mEndQpc;
+        char end[32] = "-";
+        if (interval.mEndQpc != 0) {
+            sprintf_s(end, "%.3f", clock.ToSeconds((int64_t) (interval.mEndQpc - startQpc)));
+        }
+        fprintf(fp, "  %10.3f  %10s  %10.3f  %11llu  %s\n",
+            clock.ToSeconds((int64_t) (interval.mStartQpc - startQpc)),
+            end,
+            clock.ToSeconds((int64_t) (endQpc - interval.mStartQpc)),
+            interval.mBuffersLost,
+            interval.mReason);
+    }
+}
@@ -0,0 +1,87 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <windows.h>
+
+struct TraceSession;
+
+// TrackingController switches a realtime session between full and simple
+// (runtime-only) tracking as the load changes.  Poll() is called once a
+// second:
+//
+//   - In full tracking, if ETW lost events or buffers since the last poll, or
+//     the EventRing is more than half full (the handling thread is falling
+//     behind the callback), the kernel providers are disabled with
+//     TraceSession::SetSimpleMode(true).  DxgKrnl, Win32k, and DWM make up
+//     nearly all of the event volume.
+//
+//   - In simple tracking, once mHoldPolls polls have passed without any loss
+//     or backlog, full tracking is resumed.  The kernel event rate can't be
+//     seen while its providers are disabled, so resuming is a probe: if the
+//     session degrades again within PROBATION_POLLS, the hold time is
+//     doubled (up to MAX_HOLD_POLLS), and it is reset after PROBATION_POLLS
+//     of full tracking.
+//
+// Every switch is reported to mOutput as it happens, along with the handled
+// event rate, and each degraded interval is kept in mIntervals for
+// PrintSummary().  Presents completed while degraded have
+// PresentEvent::RuntimeOnly set.
+struct TrackingController {
+    static uint32_t const MIN_HOLD_POLLS = 10;
+    static uint32_t const MAX_HOLD_POLLS = 320;
+    static uint32_t const PROBATION_POLLS = 60;
+
+    struct DegradedInterval {
+        uint64_t mStartQpc = 0;
+        uint64_t mEndQpc = 0;           // 0 while still degraded
+        char const* mReason = nullptr;
+        uint64_t mBuffersLost = 0;      // Buffers still lost while degraded
+    };
+
+    TraceSession* mSession = nullptr;
+    FILE* mOutput = nullptr;
+
+    ULONG mLastEventsLost = 0;
+    ULONG mLastBuffersLost = 0;
+    uint64_t mLastEventCount = 0;
+    bool mDegraded = false;
+    uint32_t mPollsInMode = 0;
+    uint32_t mHoldPolls = MIN_HOLD_POLLS;
+    std::vector<DegradedInterval> mIntervals;
+
+    void Initialize(TraceSession* session, FILE* output);
+    void Poll();
+
+    // Call after the session was restarted; ETW's lost counts start over.
+    // Start() enables the providers for the latest mode set by Poll().
+    void OnRestart();
+
+    void PrintSummary(FILE* fp) const;
+
+private:
+    bool SetMode(bool simple, char const* reason, uint64_t eventRate);
+};
@@ -0,0 +1,142 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+// See windows.h.  There is no TDH here: metadata must already be stored in
+// the EventMetadata (as the decode benchmark does before timing), and the
+// Tdh*() functions fail if they are reached.
+
+#include <evntcons.h>
+
+enum _TDH_IN_TYPE {
+    TDH_INTYPE_NULL,
+    TDH_INTYPE_UNICODESTRING,
+    TDH_INTYPE_ANSISTRING,
+    TDH_INTYPE_INT8,
+    TDH_INTYPE_UINT8,
+    TDH_INTYPE_INT16,
+    TDH_INTYPE_UINT16,
+    TDH_INTYPE_INT32,
+    TDH_INTYPE_UINT32,
+    TDH_INTYPE_INT64,
+    TDH_INTYPE_UINT64,
+    TDH_INTYPE_FLOAT,
+    TDH_INTYPE_DOUBLE,
+    TDH_INTYPE_BOOLEAN,
+    TDH_INTYPE_BINARY,
+    TDH_INTYPE_GUID,
+    TDH_INTYPE_POINTER,
+    TDH_INTYPE_FILETIME,
+    TDH_INTYPE_SYSTEMTIME,
+    TDH_INTYPE_SID,
+    TDH_INTYPE_HEXINT32,
+    TDH_INTYPE_HEXINT64,
+    TDH_INTYPE_SIZET = 308,
+    TDH_INTYPE_WBEMSID = 310,
+};
+
+enum PROPERTY_FLAGS {
+    PropertyStruct           = 0x1,
+    PropertyParamLength      = 0x2,
+    PropertyParamCount       = 0x4,
+    PropertyWBEMXmlFragment  = 0x8,
+    PropertyParamFixedLength = 0x10,
+    PropertyParamFixedCount  = 0x20,
+    PropertyHasTags          = 0x40,
+    PropertyHasCustomSchema  = 0x80,
+};
+
+enum DECODING_SOURCE {
+    DecodingSourceXMLFile,
+    DecodingSourceWbem,
+    DecodingSourceWPP,
+    DecodingSourceTlg,
+    DecodingSourceMax,
+};
+
+struct EVENT_PROPERTY_INFO {
+    PROPERTY_FLAGS Flags;
+    ULONG NameOffset;
+    union {
+        struct {
+            USHORT InType;
+            USHORT OutType;
+            ULONG MapNameOffset;
+        } nonStructType;
+        struct {
+            USHORT StructStartIndex;
+            USHORT NumOfStructMembers;
+            ULONG padding;
+        } structType;
+    };
+    union {
+        USHORT count;
+        USHORT countPropertyIndex;
+    };
+    union {
+        USHORT length;
+        USHORT lengthPropertyIndex;
+    };
+    ULONG Reserved;
+};
+
+struct TRACE_EVENT_INFO {
+    GUID ProviderGuid;
+    GUID EventGuid;
+    EVENT_DESCRIPTOR EventDescriptor;
+    DECODING_SOURCE DecodingSource;
+    ULONG ProviderNameOffset;
+    ULONG LevelNameOffset;
+    ULONG ChannelNameOffset;
+    ULONG KeywordsNameOffset;
+    ULONG TaskNameOffset;
+    ULONG OpcodeNameOffset;
+    ULONG EventMessageOffset;
+    ULONG ProviderMessageOffset;
+    ULONG BinaryXMLOffset;
+    ULONG BinaryXMLSize;
+    ULONG ActivityIDNameOffset;
+    ULONG RelatedActivityIDNameOffset;
+    ULONG PropertyCount;
+    ULONG TopLevelPropertyCount;
+    ULONG Flags;
+    EVENT_PROPERTY_INFO EventPropertyInfoArray[ANYSIZE_ARRAY];
+};
+
+#define TEI_PROPERTY_NAME(tei, epi) ((wchar_t*) ((uintptr_t) (tei) + (epi)->NameOffset))
+
+struct PROPERTY_DATA_DESCRIPTOR {
+    ULONGLONG PropertyName;
+    ULONG ArrayIndex;
+    ULONG Reserved;
+};
+
+inline ULONG TdhGetEventInformation(EVENT_RECORD*, ULONG, void*, TRACE_EVENT_INFO*, ULONG*)
+{
+    return ERROR_NOT_SUPPORTED;
+}
+
+inline ULONG TdhGetPropertySize(EVENT_RECORD*, ULONG, void*, ULONG, PROPERTY_DATA_DESCRIPTOR*, ULONG*)
+{
+    return ERROR_NOT_SUPPORTED;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+// Just enough of the Windows SDK for TraceConsumer.cpp and the decode
+// benchmark to build without it (see ../CMakeLists.txt).  Layouts follow the
+// SDK, but only what those files use is declared.
+
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+typedef uint8_t  UCHAR;
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef int64_t  LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uint64_t ULONG64;
+
+#define ANYSIZE_ARRAY 1
+
+#define ERROR_SUCCESS               0L
+#define ERROR_NOT_SUPPORTED         50L
+#define ERROR_INSUFFICIENT_BUFFER   122L
+
+struct GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t  Data4[8];
+};
+
+union LARGE_INTEGER {
+    struct {
+        uint32_t LowPart;
+        int32_t HighPart;
+    } u;
+    LONGLONG QuadPart;
+};
+
+// Provider GUIDs are declared with __declspec(uuid()) in the *EventStructs.hpp
+// files.  The decode path doesn't use them, so they are all zero here.
+#define __declspec(x)
+#define __uuidof(x) (::GUID {})